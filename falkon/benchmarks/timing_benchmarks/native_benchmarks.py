@@ -0,0 +1,102 @@
+"""Native micro-benchmarks of the falkon C++ ops, with regression checks against a baseline.
+
+The timings are taken in C++ (see ``falkon/c_ext/benchmarks.cpp``), so they do not include
+any Python overhead. Results are written as JSON. Passing a previous result file with
+``--baseline`` compares the two runs, and exits with status 1 if any case is slower than its
+baseline by more than ``--tolerance``.
+
+Create a baseline on the reference machine with::
+
+    python native_benchmarks.py --output logs/native_baseline.json
+
+and check a new build with::
+
+    python native_benchmarks.py --output logs/native_new.json --baseline logs/native_baseline.json
+"""
+import argparse
+import json
+import sys
+from typing import Any, Dict, List, Tuple
+
+import torch
+
+from falkon import c_ext
+
+
+def _case_key(res: Dict[str, Any]) -> Tuple:
+    return res["op"], res["device"], res["dtype"], res["layout"], res["size"]
+
+
+def run(ops: List[str], devices: List[str], sizes: List[int], warmup: int, repeats: int, density: float):
+    return json.loads(c_ext.run_benchmarks(ops, devices, sizes, warmup, repeats, density))
+
+
+def compare(results: Dict[str, Any], baseline: Dict[str, Any], tolerance: float) -> List[str]:
+    """The cases of `results` which are more than `tolerance` (relative) slower than in `baseline`."""
+    base = {_case_key(r): r for r in baseline["results"] if "error" not in r}
+    regressions = []
+    for res in results["results"]:
+        ref = base.get(_case_key(res))
+        if ref is None or "error" in res:
+            continue
+        ratio = res["median_ms"] / ref["median_ms"]
+        if ratio > 1 + tolerance:
+            regressions.append(
+                "%s %s %s %s n=%d: %.3fms vs. %.3fms baseline (%.2fx)"
+                % (*_case_key(res), res["median_ms"], ref["median_ms"], ratio)
+            )
+    return regressions
+
+
+def print_results(results: Dict[str, Any]):
+    for peak in results["peaks"]:
+        print(
+            "Peak %-6s %-8s %10.1f GFLOP/s %8.1f GB/s" % (peak["device"], peak["dtype"], peak["gflops"], peak["gbps"])
+        )
+    for res in results["results"]:
+        case = "%-18s %-6s %-8s %-4s %7d" % _case_key(res)
+        if "error" in res:
+            print("%s  skipped: %s" % (case, res["error"].splitlines()[0]))
+        else:
+            print(
+                "%s %10.3fms %8.1f GB/s (%3.0f%%) %9.1f GFLOP/s (%3.0f%%)"
+                % (
+                    case,
+                    res["median_ms"],
+                    res["gbps"],
+                    100 * res["frac_peak_gbps"],
+                    res["gflops"],
+                    100 * res["frac_peak_gflops"],
+                )
+            )
+
+
+if __name__ == "__main__":
+    default_devices = ["cpu"] + (["cuda"] if torch.cuda.is_available() else [])
+    p = argparse.ArgumentParser(description="Falkon native op benchmarks")
+    p.add_argument("--ops", type=str, nargs="*", default=[], help="Ops to run (default: all of them)")
+    p.add_argument("--devices", type=str, nargs="+", default=default_devices)
+    p.add_argument("--sizes", type=int, nargs="+", default=[1024, 4096])
+    p.add_argument("--warmup", type=int, default=2)
+    p.add_argument("--repeats", type=int, default=10)
+    p.add_argument("--density", type=float, default=0.01, help="Density of the sparse matrices")
+    p.add_argument("--output", type=str, default=None, help="JSON file for the results")
+    p.add_argument("--baseline", type=str, default=None, help="JSON results to compare against")
+    p.add_argument("--tolerance", type=float, default=0.1, help="Allowed relative slow-down")
+    args = p.parse_args()
+
+    out = run(args.ops, args.devices, args.sizes, args.warmup, args.repeats, args.density)
+    out["torch_version"] = torch.__version__
+    print_results(out)
+    if args.output is not None:
+        with open(args.output, "w") as fh:
+            json.dump(out, fh, indent=1)
+    if args.baseline is not None:
+        with open(args.baseline, "r") as fh:
+            baseline_res = json.load(fh)
+        slower = compare(out, baseline_res, args.tolerance)
+        for line in slower:
+            print("REGRESSION: %s" % (line,))
+        if len(slower) > 0:
+            sys.exit(1)
+        print("No regressions with respect to %s" % (args.baseline,))
@@ -22,23 +22,42 @@ def _make_lazy_cuda_func(name: str) -> Callable:
 
 # Custom la functions
 parallel_potrf = _make_lazy_cuda_func("parallel_potrf")
+parallel_potrf_resident = _make_lazy_cuda_func("parallel_potrf_resident")
+parallel_lauum = _make_lazy_cuda_func("parallel_lauum")
 lauum_cuda = _make_lazy_cuda_func("lauum")
+lauum = lauum_cuda
 
 # Triangular helpers
 copy_triang = _make_lazy_cuda_func("copy_triang")
 mul_triang = _make_lazy_cuda_func("mul_triang")
 copy_transpose = _make_lazy_cuda_func("copy_transpose")
 vec_mul_triang = _make_lazy_cuda_func("vec_mul_triang")
+triang_affine = _make_lazy_cuda_func("triang_affine")
+trsm = _make_lazy_cuda_func("trsm")
+pc_apply = _make_lazy_cuda_func("pc_apply")
 
 # Sparse matrices
 spspmm = _make_lazy_cuda_func("spspmm")
+spspmm_ws = _make_lazy_cuda_func("spspmm_ws")
 csr2dense = _make_lazy_cuda_func("csr2dense")
 sparse_row_norm_sq = _make_lazy_cuda_func("sparse_square_norm")
 sparse_row_norm = _make_lazy_cuda_func("sparse_norm")
 sparse_bdot = _make_lazy_cuda_func("sparse_bdot")
+sell_csr_dot = _make_lazy_cuda_func("sell_csr_dot")
 
 # Square norm with autograd
 square_norm = _make_lazy_cuda_func("square_norm")
+# Kernel functions
+fused_distance_kernel = _make_lazy_cuda_func("fused_distance_kernel")
+fused_distance_mmv = _make_lazy_cuda_func("fused_distance_mmv")
+
+# Multi-producer single-consumer queue for batched predictions
+def request_queue():
+    from ._backend import _assert_has_ext
+
+    _assert_has_ext()
+    return torch.classes.falkon.RequestQueue()
+
 
 # Wrappers
 cublas_2d_copy_to_dev_async = _make_lazy_cuda_func("cublas_2d_copy_to_dev_async")
@@ -47,6 +66,7 @@ cublas_2d_copy_to_host_async = _make_lazy_cuda_func("cublas_2d_copy_to_host_asyn
 cublas_2d_copy_to_host = _make_lazy_cuda_func("cublas_2d_copy_to_host")
 cuda_2d_copy_async = _make_lazy_cuda_func("cuda_2d_copy_async")
 cuda_2d_copy = _make_lazy_cuda_func("cuda_2d_copy")
+cuda_2d_copy_batch_async = _make_lazy_cuda_func("cuda_2d_copy_batch_async")
 cuda_1d_copy_async = _make_lazy_cuda_func("cuda_1d_copy_async")
 cuda_1d_copy = _make_lazy_cuda_func("cuda_1d_copy")
 mem_get_info = _make_lazy_cuda_func("mem_get_info")
@@ -58,3 +78,11 @@ cublas_trmm = _make_lazy_cuda_func("cublas_trmm")
 cublas_gemm = _make_lazy_cuda_func("cublas_gemm")
 cublas_syrk = _make_lazy_cuda_func("cublas_syrk")
 cuda_version = _make_lazy_cuda_func("_cuda_version")
+
+# Native micro-benchmarks
+run_benchmarks = _make_lazy_cuda_func("_run_benchmarks")
+benchmark_ops = _make_lazy_cuda_func("_benchmark_ops")
+
+# Tracing of the native ops (see falkon.utils.tracing)
+trace_set_enabled = _make_lazy_cuda_func("_trace_set_enabled")
+trace_collect = _make_lazy_cuda_func("_trace_collect")
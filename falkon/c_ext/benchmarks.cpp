@@ -0,0 +1,367 @@
+#include "benchmarks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+#include <ATen/ATen.h>
+#include <torch/library.h>
+
+#ifdef WITH_CUDA
+#include <c10/cuda/CUDAFunctions.h>
+#include <c10/cuda/CUDAGuard.h>
+#endif
+
+#include "ops/copy_transpose.h"
+#include "ops/copy_triang.h"
+#include "ops/csr2dense.h"
+#include "ops/lauum.h"
+#include "ops/mul_triang.h"
+#include "ops/potrf.h"
+#include "ops/sparse_vector_ops.h"
+#include "ops/spspmm.h"
+#include "ops/vec_mul_triang.h"
+
+namespace falkon {
+
+namespace {
+using steady = std::chrono::steady_clock;
+
+const std::vector<std::string> kAllOps = {
+    "potrf", "parallel_potrf", "lauum", "copy_triang", "mul_triang", "vec_mul_triang", "copy_transpose",
+    "csr2dense", "spspmm", "sparse_square_norm", "sparse_norm", "sparse_bdot"};
+
+struct Case {
+    std::string op;
+    std::string device;
+    std::string dtype;
+    std::string layout;  // "C", "F", or "csr"
+    int64_t size;
+    // Work of a single call, used to compute the achieved throughput.
+    double bytes = 0;
+    double flops = 0;
+};
+
+struct Timing {
+    double median_ms;
+    double min_ms;
+};
+
+void synchronize(const at::Device &dev) {
+#ifdef WITH_CUDA
+    if (dev.is_cuda()) {
+        // parallel_potrf runs on all GPUs.
+        for (c10::DeviceIndex d = 0; d < c10::cuda::device_count(); d++) {
+            c10::cuda::CUDAGuard g(d);
+            c10::cuda::device_synchronize();
+        }
+    }
+#endif
+}
+
+// Time `run`, with `setup` (untimed) called before each repetition.
+Timing time_op(
+        const at::Device &dev,
+        int64_t warmup,
+        int64_t repeats,
+        const std::function<void()> &setup,
+        const std::function<void()> &run) {
+    std::vector<double> times;
+    for (int64_t i = 0; i < warmup + repeats; i++) {
+        setup();
+        synchronize(dev);
+        auto t_s = steady::now();
+        run();
+        synchronize(dev);
+        auto t_e = steady::now();
+        if (i >= warmup) {
+            times.push_back(std::chrono::duration<double, std::milli>(t_e - t_s).count());
+        }
+    }
+    std::sort(times.begin(), times.end());
+    // Avoid infinite throughputs for calls faster than the clock resolution.
+    return {std::max(times[times.size() / 2], 1e-6), std::max(times.front(), 1e-6)};
+}
+
+// The dense matrix `t` with the values of `t`, in C or F order.
+at::Tensor with_layout(const at::Tensor &t, const std::string &layout) {
+    if (layout == "F") {
+        return t.t().contiguous().t();
+    }
+    return t.contiguous();
+}
+
+int64_t leading_dim(const at::Tensor &t) {
+    return t.stride(0) == 1 ? t.stride(1) : t.stride(0);
+}
+
+at::Tensor random_spd(int64_t n, const at::TensorOptions &opts) {
+    auto X = at::randn({n, n}, opts) / std::sqrt(static_cast<double>(n));
+    auto A = at::mm(X, X.t());
+    A.diagonal().add_(1.0);
+    return A;
+}
+
+// A random (rows x cols) CSR matrix with about `density * cols` non-zeros per row, on the CPU.
+std::tuple<at::Tensor, at::Tensor, at::Tensor> random_csr(
+        int64_t rows, int64_t cols, double density, at::ScalarType dtype, uint64_t seed) {
+    const int64_t per_row = std::max<int64_t>(1, std::min<int64_t>(cols, std::llround(density * cols)));
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<int64_t> col_dist(0, cols - 1);
+    auto rowptr = at::empty({rows + 1}, at::kLong);
+    std::vector<int64_t> col_vec;
+    col_vec.reserve(rows * per_row);
+    auto rowptr_a = rowptr.accessor<int64_t, 1>();
+    rowptr_a[0] = 0;
+    std::vector<int64_t> row_cols;
+    for (int64_t i = 0; i < rows; i++) {
+        row_cols.clear();
+        for (int64_t k = 0; k < per_row; k++) {
+            row_cols.push_back(col_dist(gen));
+        }
+        std::sort(row_cols.begin(), row_cols.end());
+        row_cols.erase(std::unique(row_cols.begin(), row_cols.end()), row_cols.end());
+        col_vec.insert(col_vec.end(), row_cols.begin(), row_cols.end());
+        rowptr_a[i + 1] = static_cast<int64_t>(col_vec.size());
+    }
+    auto col = at::tensor(col_vec, at::kLong);
+    auto val = at::rand({static_cast<int64_t>(col_vec.size())}, at::TensorOptions().dtype(dtype));
+    return std::make_tuple(rowptr, col, val);
+}
+
+double index_bytes(const at::Tensor &rowptr, const at::Tensor &col) {
+    return static_cast<double>((rowptr.numel() + col.numel()) * rowptr.element_size());
+}
+
+// Number of multiply-adds of the product of the CSR matrices A and B.
+double spspmm_flops(const at::Tensor &colA, const at::Tensor &rowptrB) {
+    auto rp = rowptrB.accessor<int64_t, 1>();
+    auto ca = colA.accessor<int64_t, 1>();
+    double count = 0;
+    for (int64_t k = 0; k < colA.numel(); k++) {
+        count += rp[ca[k] + 1] - rp[ca[k]];
+    }
+    return 2 * count;
+}
+
+std::vector<int64_t> all_cuda_devices() {
+    std::vector<int64_t> devices;
+#ifdef WITH_CUDA
+    for (c10::DeviceIndex d = 0; d < c10::cuda::device_count(); d++) {
+        devices.push_back(d);
+    }
+#endif
+    return devices;
+}
+
+/*
+ * Prepare the inputs of `c` and return the op call. `setup` is set to the untimed preparation
+ * which each repetition needs (e.g. restoring an input which the op overwrites).
+ */
+std::function<void()> make_case(Case &c, const at::Device &dev, at::ScalarType dtype, double density,
+                                std::function<void()> &setup) {
+    const int64_t n = c.size;
+    const double es = static_cast<double>(c10::elementSize(dtype));
+    const double nsq = static_cast<double>(n) * n;
+    const auto opts = at::TensorOptions().dtype(dtype).device(dev);
+    setup = [] {};
+
+    if (c.op == "potrf" || c.op == "parallel_potrf" || c.op == "lauum") {
+        c.flops = nsq * n / 3;
+        c.bytes = nsq * es;
+        if (c.op == "parallel_potrf") {
+            // Out-of-core: the matrix is on the host, and (lower, F-order) tiles are sent to the GPUs.
+            TORCH_CHECK(dev.is_cuda(), "parallel_potrf only runs on CUDA devices.");
+            TORCH_CHECK(c.layout == "F", "parallel_potrf only supports F-ordered matrices.");
+            auto host_opts = at::TensorOptions().dtype(dtype).pinned_memory(true);
+            auto src = with_layout(random_spd(n, at::TensorOptions().dtype(dtype)), "F");
+            auto A = at::empty({n, n}, host_opts).t();
+            auto gpus = all_cuda_devices();
+            const int64_t num_blocks = 4 * static_cast<int64_t>(gpus.size());
+            const int64_t bs = (n + num_blocks - 1) / num_blocks;
+            std::vector<int64_t> starts, ends, sizes, devs, ids;
+            for (int64_t i = 0, start = 0; start < n; i++, start += bs) {
+                starts.push_back(start);
+                ends.push_back(std::min(n, start + bs));
+                sizes.push_back(ends.back() - start);
+                devs.push_back(gpus[i % gpus.size()]);
+                ids.push_back(i);
+            }
+            setup = [A, src]() mutable { A.copy_(src); };
+            return [=]() mutable { ops::parallel_potrf(gpus, starts, ends, sizes, devs, ids, A, false, {}); };
+        }
+        auto src = with_layout(random_spd(n, opts), c.layout);
+        auto A = src.clone();
+        if (c.op == "potrf") {
+            setup = [A, src]() mutable { A.copy_(src); };
+            return [A]() mutable { ops::potrf(A, false, false, true); };
+        }
+        auto L = with_layout(at::tril(src), c.layout);
+        return [L, A, n]() mutable { ops::lauum(n, L, leading_dim(L), A, leading_dim(A), true); };
+    }
+    if (c.op == "copy_triang" || c.op == "mul_triang" || c.op == "vec_mul_triang") {
+        c.bytes = nsq * es;
+        c.flops = c.op == "copy_triang" ? 0 : nsq / 2;
+        auto A = with_layout(at::rand({n, n}, opts), c.layout);
+        if (c.op == "copy_triang") {
+            return [A]() mutable { ops::copy_triang(A, true); };
+        }
+        if (c.op == "mul_triang") {
+            return [A]() mutable { ops::mul_triang(A, 1.0, true, true); };
+        }
+        auto vec = at::ones({n}, opts);
+        return [A, vec]() mutable { ops::vec_mul_triang(A, vec, true, true); };
+    }
+    if (c.op == "copy_transpose") {
+        c.bytes = 2 * nsq * es;
+        auto A = with_layout(at::rand({n, n}, opts), c.layout);
+        auto out = with_layout(at::empty({n, n}, opts), c.layout);
+        return [A, out]() mutable { ops::copy_transpose(A, out); };
+    }
+
+    // Sparse ops: (n x n) CSR matrices with the given density.
+    TORCH_CHECK(c.layout == "csr", "Unknown op ", c.op);
+    at::Tensor rowptr, col, val, rowptr2, col2, val2;
+    std::tie(rowptr, col, val) = random_csr(n, n, density, dtype, 1);
+    std::tie(rowptr2, col2, val2) = random_csr(n, n, density, dtype, 2);
+    const double nnz = static_cast<double>(val.numel());
+    if (c.op == "spspmm") {
+        c.flops = spspmm_flops(col, rowptr2);
+        c.bytes = index_bytes(rowptr, col) + index_bytes(rowptr2, col2) + (nnz + val2.numel()) * es;
+    }
+    rowptr = rowptr.to(dev); col = col.to(dev); val = val.to(dev);
+    rowptr2 = rowptr2.to(dev); col2 = col2.to(dev); val2 = val2.to(dev);
+    if (c.op == "spspmm") {
+        return [=]() { ops::spspmm(rowptr, col, val, rowptr2, col2, val2, n); };
+    }
+    if (c.op == "csr2dense") {
+        c.bytes = index_bytes(rowptr, col) + nnz * es + nsq * es;
+        auto out = at::zeros({n, n}, opts);
+        return [=]() mutable { ops::csr2dense(rowptr, col, val, out); };
+    }
+    auto out = at::empty({n, 1}, opts);
+    if (c.op == "sparse_bdot") {
+        c.flops = 2 * std::min(nnz, static_cast<double>(val2.numel()));
+        c.bytes = index_bytes(rowptr, col) + index_bytes(rowptr2, col2) + (nnz + val2.numel() + n) * es;
+        return [=]() mutable { ops::sparse_bdot(rowptr, col, val, rowptr2, col2, val2, out); };
+    }
+    c.flops = 2 * nnz;
+    c.bytes = rowptr.numel() * rowptr.element_size() + (nnz + n) * es;
+    if (c.op == "sparse_square_norm") {
+        return [=]() mutable { ops::sparse_square_norm(rowptr, val, out); };
+    }
+    TORCH_CHECK(c.op == "sparse_norm", "Unknown op ", c.op);
+    return [=]() mutable { ops::sparse_norm(rowptr, val, out); };
+}
+
+std::vector<std::string> layouts_for(const std::string &op) {
+    if (op == "parallel_potrf") {
+        return {"F"};
+    }
+    if (op == "csr2dense" || op == "spspmm" || op.rfind("sparse_", 0) == 0) {
+        return {"csr"};
+    }
+    return {"C", "F"};
+}
+
+std::string json_str(const std::string &s) {
+    std::ostringstream os;
+    os << '"';
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            os << '\\' << ch;
+        } else if (ch == '\n') {
+            os << "\\n";
+        } else if (static_cast<unsigned char>(ch) >= 0x20) {
+            os << ch;
+        }
+    }
+    os << '"';
+    return os.str();
+}
+
+// Peak GFLOP/s (large GEMM) and GB/s (large copy) attainable on `dev` with data-type `dtype`.
+std::pair<double, double> measure_peaks(const at::Device &dev, at::ScalarType dtype) {
+    const auto opts = at::TensorOptions().dtype(dtype).device(dev);
+    const int64_t n = dev.is_cuda() ? 4096 : 2048;
+    auto A = at::rand({n, n}, opts), B = at::rand({n, n}, opts), C = at::empty({n, n}, opts);
+    Timing t_mm = time_op(dev, 1, 3, [] {}, [&] { at::mm_out(C, A, B); });
+    const int64_t numel = (int64_t{1} << 28) / c10::elementSize(dtype);
+    auto src = at::rand({numel}, opts), dst = at::empty({numel}, opts);
+    Timing t_cp = time_op(dev, 1, 5, [] {}, [&] { dst.copy_(src); });
+    const double flops = 2.0 * n * n * n, bytes = 2.0 * numel * c10::elementSize(dtype);
+    return {flops / t_mm.min_ms / 1e6, bytes / t_cp.min_ms / 1e6};
+}
+} // namespace
+
+std::vector<std::string> benchmark_ops() {
+    return kAllOps;
+}
+
+std::string run_benchmarks(
+        const std::vector<std::string> &ops,
+        const std::vector<std::string> &devices,
+        const std::vector<int64_t> &sizes,
+        int64_t warmup,
+        int64_t repeats,
+        double density) {
+    TORCH_CHECK(repeats > 0, "The number of repetitions must be positive.");
+    const std::vector<std::pair<std::string, at::ScalarType>> dtypes = {
+        {"float32", at::kFloat}, {"float64", at::kDouble}};
+    const auto &op_names = ops.empty() ? kAllOps : ops;
+    for (const auto &op : op_names) {
+        TORCH_CHECK(std::find(kAllOps.begin(), kAllOps.end(), op) != kAllOps.end(), "Unknown op ", op);
+    }
+
+    std::ostringstream peaks, results;
+    peaks << std::setprecision(6);
+    results << std::setprecision(6);
+    bool first_peak = true, first_result = true;
+    for (const auto &dev_name : devices) {
+        const at::Device dev(dev_name);
+        for (const auto &dt : dtypes) {
+            double peak_gflops, peak_gbps;
+            std::tie(peak_gflops, peak_gbps) = measure_peaks(dev, dt.second);
+            peaks << (first_peak ? "" : ",") << "{\"device\":" << json_str(dev_name)
+                  << ",\"dtype\":" << json_str(dt.first) << ",\"gflops\":" << peak_gflops
+                  << ",\"gbps\":" << peak_gbps << "}";
+            first_peak = false;
+            for (const auto &op : op_names) {
+                for (const auto &layout : layouts_for(op)) {
+                    for (int64_t size : sizes) {
+                        Case c{op, dev_name, dt.first, layout, size};
+                        results << (first_result ? "" : ",") << "{\"op\":" << json_str(op)
+                                << ",\"device\":" << json_str(dev_name) << ",\"dtype\":" << json_str(dt.first)
+                                << ",\"layout\":" << json_str(layout) << ",\"size\":" << size;
+                        first_result = false;
+                        try {
+                            std::function<void()> setup;
+                            auto run = make_case(c, dev, dt.second, density, setup);
+                            Timing t = time_op(dev, warmup, repeats, setup, run);
+                            const double gbps = c.bytes / t.min_ms / 1e6, gflops = c.flops / t.min_ms / 1e6;
+                            results << ",\"median_ms\":" << t.median_ms << ",\"min_ms\":" << t.min_ms
+                                    << ",\"gbps\":" << gbps << ",\"gflops\":" << gflops
+                                    << ",\"frac_peak_gbps\":" << gbps / peak_gbps
+                                    << ",\"frac_peak_gflops\":" << gflops / peak_gflops << "}";
+                        } catch (const c10::Error &e) {
+                            results << ",\"error\":" << json_str(e.what_without_backtrace()) << "}";
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return "{\"peaks\":[" + peaks.str() + "],\"results\":[" + results.str() + "]}";
+}
+
+TORCH_LIBRARY_FRAGMENT(falkon, m) {
+    m.def("_run_benchmarks", &run_benchmarks);
+    m.def("_benchmark_ops", &benchmark_ops);
+}
+
+} // namespace falkon
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace falkon {
+
+/*
+ * Native micro-benchmarks of the falkon ops.
+ *
+ * Each op in `ops` is timed on each device in `devices` ("cpu", or "cuda" for the current GPU),
+ * for each size in `sizes`, data-type (float32, float64) and layout (C or F order for the dense
+ * ops). Every repetition prepares fresh inputs, synchronizes the device, and times a single call
+ * of the op through the dispatcher, so that no Python overhead is included. The first `warmup`
+ * repetitions are discarded.
+ *
+ * The achieved GB/s and GFLOP/s are compared with the peak measured on each device (a large
+ * GEMM for GFLOP/s, a large device-to-device copy for GB/s).
+ *
+ * Returns a JSON document: {"peaks": [...], "results": [...]}. Cases which fail (for example
+ * an unsupported layout) are reported with an "error" field instead of their timings.
+ */
+std::string run_benchmarks(
+    const std::vector<std::string> &ops,
+    const std::vector<std::string> &devices,
+    const std::vector<int64_t> &sizes,
+    int64_t warmup,
+    int64_t repeats,
+    double density);
+
+// Names of all ops which can be benchmarked.
+std::vector<std::string> benchmark_ops();
+
+} // namespace falkon
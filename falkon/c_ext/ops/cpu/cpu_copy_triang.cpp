@@ -3,6 +3,7 @@
 #include <ATen/Parallel.h>
 
 #include "../helpers.h"
+#include "cpu_helpers.h"
 
 namespace falkon {
 namespace ops {
@@ -12,7 +13,7 @@ template <class scalar_t>
 void copy_triang_impl(scalar_t *mat, const int n, const int stride1, const int stride2, const bool upper) {
     // assume input is f-contiguous (contiguous columns, stride1 == 1)
     if (upper) {
-        at::parallel_for(0, n, 0, [&](int64_t start, int64_t end) {
+        parallel_for_triang(n, /*growing=*/true, [&](int64_t start, int64_t end) {
             for (int64_t i : c10::irange(start, end)) {
                 for (int64_t j = 0; j < i; j++) {
                     // mat[i, j] = mat[j, i]
@@ -21,7 +22,7 @@ void copy_triang_impl(scalar_t *mat, const int n, const int stride1, const int s
             }
         });
     } else {
-        at::parallel_for(0, n, 0, [&](int64_t start, int64_t end) {
+        parallel_for_triang(n, /*growing=*/false, [&](int64_t start, int64_t end) {
             for (int64_t i : c10::irange(start, end)) {
                 for (int64_t j = i + 1; j < n; j++) {
                     // mat[i, j] = mat[j, i]
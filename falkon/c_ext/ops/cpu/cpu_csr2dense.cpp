@@ -0,0 +1,83 @@
+#include "../helpers.h"
+#include "cpu_helpers.h"
+
+#include <ATen/ATen.h>
+#include <torch/library.h>
+
+namespace falkon {
+namespace ops {
+namespace {
+
+/*
+ * Scatter the non-zeros of a CSR matrix into the (zeroed) dense matrix `out`, which may be
+ * C- or F-contiguous. Rows are split between threads by number of non-zeros.
+ */
+template <typename value_t, typename index_t>
+void run_csr2dense(
+        const index_t *rowptr,
+        const index_t *col,
+        const value_t *val,
+        value_t *out,
+        const int64_t M,
+        const int64_t out_s0,
+        const int64_t out_s1) {
+    const auto cost = [&](int64_t i) { return (int64_t)rowptr[i] + i; };
+    parallel_for_csr_rows(M, cost, [&](int64_t row_start, int64_t row_end) {
+        for (int64_t i = row_start; i < row_end; i++) {
+            value_t *out_row = out + i * out_s0;
+            for (int64_t p = rowptr[i]; p < rowptr[i + 1]; p++) {
+                out_row[(int64_t)col[p] * out_s1] += val[p];
+            }
+        }
+    });
+}
+
+at::Tensor csr2dense_kernel(
+    const at::Tensor &rowptr,
+    const at::Tensor &col,
+    const at::Tensor &val,
+    at::Tensor &out) {
+  CHECK_CPU(rowptr);
+  CHECK_CPU(col);
+  CHECK_CPU(val);
+  CHECK_CPU(out);
+
+  const int64_t M = out.size(0);
+
+  TORCH_CHECK(
+    rowptr.numel() - 1 == M, "Expected output with ", rowptr.numel() - 1, " rows but found ", M);
+  TORCH_CHECK(val.dtype() == out.dtype(), "Expected csr and output matrix with the same dtypes but found ",
+    val.dtype(), " and ", out.dtype());
+  TORCH_CHECK(rowptr.dtype() == col.dtype(), "Expected row-pointers and column indices with the same dtypes but found ",
+    rowptr.dtype(), " and ", col.dtype());
+  TORCH_CHECK(out.dim() == 2 && (out.stride(0) == 1 || out.stride(1) == 1),
+    "Output matrix must be 2D and either C- or F-contiguous");
+  TORCH_CHECK(rowptr.is_contiguous() && col.is_contiguous() && val.is_contiguous(),
+    "Expected contiguous CSR arrays");
+
+  out.zero_();
+  AT_DISPATCH_FLOATING_TYPES(val.scalar_type(), "csr2dense_cpu_value", [&] {
+    AT_DISPATCH_INDEX_TYPES(col.scalar_type(), "csr2dense_cpu_index", [&] {
+      run_csr2dense<scalar_t, index_t>(
+          rowptr.data_ptr<index_t>(),
+          col.data_ptr<index_t>(),
+          val.data_ptr<scalar_t>(),
+          out.data_ptr<scalar_t>(),
+          M,
+          out.stride(0),
+          out.stride(1));
+    });
+  });
+  return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::csr2dense"),
+      TORCH_FN(csr2dense_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
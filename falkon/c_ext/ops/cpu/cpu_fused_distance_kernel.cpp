@@ -0,0 +1,172 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/Parallel.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "../fused_distance_kernel.h"
+
+namespace falkon {
+namespace ops {
+namespace {
+
+template <typename scalar_t>
+inline scalar_t distance_kernel_fn(scalar_t sq_dist, const int64_t kernel_type) {
+    // Same constants as in `falkon.kernels.distance_kernel`
+    constexpr scalar_t sqrt3 = 1.7320508075688772;
+    constexpr scalar_t sqrt5 = 2.23606797749979;
+    sq_dist = std::max(sq_dist, (scalar_t)1e-20);
+    switch (kernel_type) {
+        case kGaussianKernel:
+            return std::exp(-sq_dist / 2);
+        case kLaplacianKernel:
+            return std::exp(-std::sqrt(sq_dist));
+        case kMatern32Kernel: {
+            const scalar_t r = sqrt3 * std::sqrt(sq_dist);
+            return (1 + r) * std::exp(-r);
+        }
+        default: {
+            const scalar_t r = sqrt5 * std::sqrt(sq_dist);
+            return (1 + r + sq_dist * 5 / 3) * std::exp(-r);
+        }
+    }
+}
+
+/*
+ * out[i, j] = f(norm1[i] + norm2[j] - 2 * out[i, j]) where `out` already contains mat1 @ mat2.T.
+ * The loop runs over the contiguous dimension of `out`.
+ */
+template <typename scalar_t>
+void distance_kernel_epilogue(
+        scalar_t *out,
+        const scalar_t *norm1,
+        const scalar_t *norm2,
+        const int64_t n,
+        const int64_t m,
+        const int64_t out_row_stride,
+        const int64_t out_col_stride,
+        const int64_t kernel_type) {
+    const bool rows_contig = out_col_stride == 1;
+    const int64_t num_lines = rows_contig ? n : m;
+    const int64_t line_len = rows_contig ? m : n;
+    const int64_t line_stride = rows_contig ? out_row_stride : out_col_stride;
+    const scalar_t *line_norms = rows_contig ? norm1 : norm2;
+    const scalar_t *elem_norms = rows_contig ? norm2 : norm1;
+    const int64_t grain_size = std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(line_len, 1));
+    at::parallel_for(0, num_lines, grain_size, [&](int64_t start, int64_t end) {
+        for (int64_t l = start; l < end; l++) {
+            scalar_t *line = out + l * line_stride;
+            const scalar_t line_norm = line_norms[l];
+            for (int64_t e = 0; e < line_len; e++) {
+                line[e] = distance_kernel_fn<scalar_t>(line_norm + elem_norms[e] - 2 * line[e], kernel_type);
+            }
+        }
+    });
+}
+
+at::Tensor fused_distance_kernel_kernel(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out) {
+    TORCH_CHECK(mat1.dim() == 2 && mat2.dim() == 2, "mat1 and mat2 must be 2D matrices.");
+    TORCH_CHECK(mat1.size(1) == mat2.size(1), "mat1 and mat2 must have the same number of columns.");
+    const int64_t n = mat1.size(0);
+    const int64_t m = mat2.size(0);
+    TORCH_CHECK(norm1.numel() == n, "norm1 must have as many elements as the rows of mat1.");
+    TORCH_CHECK(norm2.numel() == m, "norm2 must have as many elements as the rows of mat2.");
+    TORCH_CHECK(out.dim() == 2 && out.size(0) == n && out.size(1) == m,
+        "out must be of shape (", n, ", ", m, "). Found shape ", out.sizes());
+    TORCH_CHECK(out.stride(0) == 1 || out.stride(1) == 1, "out must be contiguous in one dimension.");
+    TORCH_CHECK(kernel_type >= kGaussianKernel && kernel_type <= kMatern52Kernel,
+        "Invalid kernel_type ", kernel_type);
+    TORCH_CHECK(mat1.scalar_type() == out.scalar_type() && mat2.scalar_type() == out.scalar_type() &&
+                norm1.scalar_type() == out.scalar_type() && norm2.scalar_type() == out.scalar_type(),
+        "All inputs must have the same data-type.");
+    if (n == 0 || m == 0) {
+        return out;
+    }
+    at::mm_out(out, mat1, mat2.t());
+    const at::Tensor norm1_c = norm1.contiguous();
+    const at::Tensor norm2_c = norm2.contiguous();
+
+    AT_DISPATCH_FLOATING_TYPES(out.scalar_type(), "fused_distance_kernel", [&] {
+        distance_kernel_epilogue<scalar_t>(
+            out.data_ptr<scalar_t>(),
+            norm1_c.data_ptr<scalar_t>(),
+            norm2_c.data_ptr<scalar_t>(),
+            n,
+            m,
+            out.stride(0),
+            out.stride(1),
+            kernel_type);
+    });
+    return out;
+}
+
+// Size of the kernel tiles used by the CPU kernel-vector product.
+constexpr int64_t kMmvTileSize = 1024;
+
+/*
+ * out += k(mat1, mat2) @ vec. Kernel tiles of at most kMmvTileSize x kMmvTileSize entries
+ * are computed into a single work buffer, and immediately multiplied with `vec`.
+ */
+at::Tensor fused_distance_mmv_kernel(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &vec,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out) {
+    TORCH_CHECK(mat1.dim() == 2 && mat2.dim() == 2 && vec.dim() == 2, "mat1, mat2 and vec must be 2D matrices.");
+    TORCH_CHECK(mat1.size(1) == mat2.size(1), "mat1 and mat2 must have the same number of columns.");
+    const int64_t n = mat1.size(0);
+    const int64_t m = mat2.size(0);
+    const int64_t t = vec.size(1);
+    TORCH_CHECK(vec.size(0) == m, "vec must have as many rows as mat2.");
+    TORCH_CHECK(norm1.numel() == n, "norm1 must have as many elements as the rows of mat1.");
+    TORCH_CHECK(norm2.numel() == m, "norm2 must have as many elements as the rows of mat2.");
+    TORCH_CHECK(out.dim() == 2 && out.size(0) == n && out.size(1) == t,
+        "out must be of shape (", n, ", ", t, "). Found shape ", out.sizes());
+    if (n == 0 || m == 0 || t == 0) {
+        return out;
+    }
+    const at::Tensor norm1_c = norm1.reshape({-1});
+    const at::Tensor norm2_c = norm2.reshape({-1});
+    at::Tensor tile = at::empty({std::min(n, kMmvTileSize), std::min(m, kMmvTileSize)}, out.options());
+    for (int64_t i = 0; i < n; i += kMmvTileSize) {
+        const int64_t leni = std::min(kMmvTileSize, n - i);
+        at::Tensor out_i = out.narrow(0, i, leni);
+        for (int64_t j = 0; j < m; j += kMmvTileSize) {
+            const int64_t lenj = std::min(kMmvTileSize, m - j);
+            at::Tensor tile_ij = tile.narrow(0, 0, leni).narrow(1, 0, lenj);
+            fused_distance_kernel_kernel(
+                mat1.narrow(0, i, leni),
+                mat2.narrow(0, j, lenj),
+                norm1_c.narrow(0, i, leni),
+                norm2_c.narrow(0, j, lenj),
+                kernel_type,
+                tile_ij);
+            out_i.addmm_(tile_ij, vec.narrow(0, j, lenj));
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::fused_distance_kernel"),
+      TORCH_FN(fused_distance_kernel_kernel));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::fused_distance_mmv"),
+      TORCH_FN(fused_distance_mmv_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
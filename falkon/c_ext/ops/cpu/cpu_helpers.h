@@ -0,0 +1,103 @@
+#pragma once
+
+#include <ATen/ATen.h>
+#include <ATen/Parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace falkon {
+namespace ops {
+
+/*
+ * Parallel loop over the `n` lines (rows or columns) of a triangular matrix.
+ * If `growing` is true line `i` contains `i + 1` elements, otherwise it contains `n - i`
+ * elements. Lines are split in contiguous ranges such that each range covers roughly the
+ * same area of the triangle (instead of the same number of lines, which would leave the
+ * threads working on the long lines as stragglers).
+ * `f` is called with the range of lines [start, end) to process.
+ */
+template <typename F>
+inline void parallel_for_triang(const int64_t n, const bool growing, const F &f) {
+    if (n <= 0) {
+        return;
+    }
+    const double total = (double)n * (double)(n + 1) / 2;
+    const int64_t num_chunks = std::min<int64_t>(at::get_num_threads(), n);
+    if (num_chunks <= 1 || total < at::internal::GRAIN_SIZE || at::in_parallel_region()) {
+        f(0, n);
+        return;
+    }
+    std::vector<int64_t> bounds(num_chunks + 1);
+    bounds[0] = 0;
+    bounds[num_chunks] = n;
+    for (int64_t t = 1; t < num_chunks; t++) {
+        const double area = total * t / num_chunks;
+        int64_t line;
+        if (growing) {
+            // smallest `line` such that line * (line + 1) / 2 >= area
+            line = (int64_t)std::ceil((std::sqrt(1.0 + 8.0 * area) - 1.0) / 2.0);
+        } else {
+            // the remaining (n - line) lines form a growing triangle of area (total - area)
+            line = n - (int64_t)std::floor((std::sqrt(1.0 + 8.0 * (total - area)) - 1.0) / 2.0);
+        }
+        bounds[t] = std::min(std::max(line, bounds[t - 1]), n);
+    }
+    at::parallel_for(0, num_chunks, 1, [&](int64_t start, int64_t end) {
+        for (int64_t t = start; t < end; t++) {
+            if (bounds[t] < bounds[t + 1]) {
+                f(bounds[t], bounds[t + 1]);
+            }
+        }
+    });
+}
+
+/*
+ * Parallel loop over the `n` rows of one or more CSR matrices, with ranges of rows balanced
+ * by the amount of work instead of by the number of rows. `cost(i)` must be the total work
+ * for rows [0, i), and be increasing in `i` (e.g. `indptr[i] + i`, counting one unit per
+ * non-zero and one per row).
+ * `f` is called with the range of rows [start, end) to process.
+ */
+template <typename C, typename F>
+inline void parallel_for_csr_rows(const int64_t n, const C &cost, const F &f) {
+    if (n <= 0) {
+        return;
+    }
+    const int64_t c0 = cost(0);
+    const int64_t total = cost(n) - c0;
+    const int64_t num_chunks = std::min<int64_t>(
+        std::min<int64_t>(at::get_num_threads() * 4, n), std::max<int64_t>(total / at::internal::GRAIN_SIZE, 1));
+    if (num_chunks <= 1 || at::in_parallel_region()) {
+        f(0, n);
+        return;
+    }
+    std::vector<int64_t> bounds(num_chunks + 1);
+    bounds[0] = 0;
+    bounds[num_chunks] = n;
+    for (int64_t t = 1; t < num_chunks; t++) {
+        // smallest row `i` such that cost(i) - c0 >= total * t / num_chunks
+        const int64_t target = c0 + (int64_t)((double)total * t / num_chunks);
+        int64_t lo = bounds[t - 1], hi = n;
+        while (lo < hi) {
+            const int64_t mid = lo + (hi - lo) / 2;
+            if (cost(mid) < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        bounds[t] = lo;
+    }
+    at::parallel_for(0, num_chunks, 1, [&](int64_t start, int64_t end) {
+        for (int64_t t = start; t < end; t++) {
+            if (bounds[t] < bounds[t + 1]) {
+                f(bounds[t], bounds[t + 1]);
+            }
+        }
+    });
+}
+
+} // namespace ops
+} // namespace falkon
@@ -0,0 +1,213 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/Parallel.h>
+#include <ATen/native/CPUBlas.h>
+
+#include "../helpers.h"
+
+namespace falkon {
+namespace ops {
+namespace {
+
+#define LAUUM_BLOCK_SIZE 256
+// Minimum number of output columns handled by a single thread
+#define LAUUM_GRAIN_SIZE 32
+
+using at::native::TransposeType;
+
+/*
+ * View of a (sub)matrix with generic strides, where one of the two strides must be 1.
+ * BLAS routines only take column-major inputs: a row-major block is passed as its transpose.
+ */
+template <typename scalar_t>
+struct StridedMat {
+    scalar_t *data;
+    int64_t row_stride;
+    int64_t col_stride;
+
+    inline scalar_t *ptr(int64_t i, int64_t j) const {
+        return data + i * row_stride + j * col_stride;
+    }
+    inline scalar_t &at(int64_t i, int64_t j) const {
+        return data[i * row_stride + j * col_stride];
+    }
+    inline int64_t ld() const {
+        return row_stride == 1 ? col_stride : row_stride;
+    }
+    // Transposition needed for a BLAS routine to see the block as-is
+    inline TransposeType trans() const {
+        return row_stride == 1 ? TransposeType::NoTranspose : TransposeType::Transpose;
+    }
+    // Transposition needed for a BLAS routine to see the transpose of the block
+    inline TransposeType trans_t() const {
+        return row_stride == 1 ? TransposeType::Transpose : TransposeType::NoTranspose;
+    }
+};
+
+/*
+ * out[:m, :w] (column-major, ld m) = in[r0:, c0:c0+m].T @ in[r0:, j0:j0+w]
+ * where the inner dimension runs over rows r0 to n. The range may be empty, in which
+ * case the output is zeroed.
+ */
+template <typename scalar_t>
+void lower_panel_product(
+        const StridedMat<scalar_t> &in,
+        const int64_t n,
+        const int64_t r0,
+        const int64_t c0,
+        const int64_t m,
+        const int64_t j0,
+        const int64_t w,
+        scalar_t *out) {
+    const int64_t k = n - r0;
+    if (k <= 0) {
+        std::fill(out, out + m * w, scalar_t(0));
+        return;
+    }
+    at::native::cpublas::gemm(
+        in.trans_t(), in.trans(),
+        m, w, k,
+        scalar_t(1),
+        in.ptr(r0, c0), in.ld(),
+        in.ptr(r0, j0), in.ld(),
+        scalar_t(0),
+        out, m);
+}
+
+/*
+ * Blocked LAUUM on the lower triangle: out = tril(in.T @ in), where `in` is lower triangular.
+ * The strictly upper triangle of `out` is not touched, and `in` and `out` may be the same
+ * matrix (in-place operation).
+ *
+ * The output is processed one block-row at a time, from top to bottom. Block-row I of the
+ * output only depends on block-rows >= I of the input, so writing it in-place never destroys
+ * data needed later. Within a block-row, output columns are split across threads, and each
+ * thread computes its tiles with GEMM calls:
+ *   out[I, J] = in[I+1:, I].T @ in[I+1:, J] + tril(in[I, I]).T @ in[I, J]
+ * The diagonal tile (which would be overwritten while other threads still read it) is
+ * computed first in a separate buffer, and written back at the end of the block-row.
+ */
+template <typename scalar_t>
+void lauum_lower_impl(
+        const StridedMat<scalar_t> &in,
+        const StridedMat<scalar_t> &out,
+        const int64_t n) {
+    const int64_t bs = LAUUM_BLOCK_SIZE;
+    // Column-major copy of tril(in[I, I]) and out[I, I].
+    std::vector<scalar_t> tri_buf(bs * bs);
+    std::vector<scalar_t> diag_buf(bs * bs);
+
+    for (int64_t i0 = 0; i0 < n; i0 += bs) {
+        const int64_t ib = std::min(bs, n - i0);
+        scalar_t *tri = tri_buf.data();
+        scalar_t *diag = diag_buf.data();
+        for (int64_t c = 0; c < ib; c++) {
+            for (int64_t r = 0; r < ib; r++) {
+                tri[r + c * ib] = r >= c ? in.at(i0 + r, i0 + c) : scalar_t(0);
+            }
+        }
+        // Diagonal tile. This runs outside of the parallel region: BLAS may use its own threads.
+        lower_panel_product(in, n, i0 + ib, i0, ib, i0, ib, diag);
+        at::native::cpublas::gemm(
+            TransposeType::Transpose, TransposeType::NoTranspose,
+            ib, ib, ib,
+            scalar_t(1),
+            tri, ib,
+            tri, ib,
+            scalar_t(1),
+            diag, ib);
+
+        // Off-diagonal tiles of block-row I: output columns [0, i0)
+        at::parallel_for(0, i0, LAUUM_GRAIN_SIZE, [&](int64_t start, int64_t end) {
+            std::vector<scalar_t> tile_buf(ib * std::min(bs, end - start));
+            scalar_t *tile = tile_buf.data();
+            for (int64_t j0 = start; j0 < end; j0 += bs) {
+                const int64_t jb = std::min(bs, end - j0);
+                lower_panel_product(in, n, i0 + ib, i0, ib, j0, jb, tile);
+                at::native::cpublas::gemm(
+                    TransposeType::Transpose, in.trans(),
+                    ib, jb, ib,
+                    scalar_t(1),
+                    tri, ib,
+                    in.ptr(i0, j0), in.ld(),
+                    scalar_t(1),
+                    tile, ib);
+                for (int64_t c = 0; c < jb; c++) {
+                    for (int64_t r = 0; r < ib; r++) {
+                        out.at(i0 + r, j0 + c) = tile[r + c * ib];
+                    }
+                }
+            }
+        });
+
+        for (int64_t c = 0; c < ib; c++) {
+            for (int64_t r = c; r < ib; r++) {
+                out.at(i0 + r, i0 + c) = diag[r + c * ib];
+            }
+        }
+    }
+}
+
+at::Tensor lauum_kernel(
+        const int64_t n,
+        const at::Tensor &A,
+        const int64_t lda,
+        at::Tensor &B,
+        const int64_t ldb,
+        const bool lower) {
+    CHECK_CPU(A);
+    CHECK_CPU(B);
+    AT_ASSERTM(A.dim() == 2, "A must be 2D");
+    AT_ASSERTM(B.dim() == 2, "B must be 2D");
+    TORCH_CHECK(
+        (A.size(0) >= n && A.size(1) >= n && B.size(0) >= n && B.size(1) >= n),
+        "LAUUM size n=", n, " is larger than the input (", A.sizes(), ") or output (", B.sizes(), ") matrices.");
+    TORCH_CHECK(
+        (A.scalar_type() == B.scalar_type()),
+        "A and B must have the same data-type. Found ", A.scalar_type(), " and ", B.scalar_type(), ".");
+    TORCH_CHECK(
+        (A.stride(0) == 1 || A.stride(1) == 1),
+        "A must be contiguous in one dimension. Found strides: (", A.stride(0), ", ", A.stride(1), ")");
+    TORCH_CHECK(
+        (B.stride(0) == 1 || B.stride(1) == 1),
+        "B must be contiguous in one dimension. Found strides: (", B.stride(0), ", ", B.stride(1), ")");
+    if (n == 0) {
+        return B;
+    }
+
+    AT_DISPATCH_FLOATING_TYPES(A.scalar_type(), "lauum_cpu", [&] {
+        StridedMat<scalar_t> in;
+        StridedMat<scalar_t> out;
+        in.data = A.data_ptr<scalar_t>();
+        out.data = B.data_ptr<scalar_t>();
+        if (is_fortran_contig(A)) {
+            in.row_stride = 1; in.col_stride = lda;
+        } else {
+            in.row_stride = lda; in.col_stride = 1;
+        }
+        if (is_fortran_contig(B)) {
+            out.row_stride = 1; out.col_stride = ldb;
+        } else {
+            out.row_stride = ldb; out.col_stride = 1;
+        }
+        // upper: triu(U @ U.T) is the same as tril(L.T @ L) where L = U.T, which
+        // only requires swapping the strides of both matrices.
+        if (!lower) {
+            std::swap(in.row_stride, in.col_stride);
+            std::swap(out.row_stride, out.col_stride);
+        }
+        lauum_lower_impl<scalar_t>(in, out, n);
+    });
+    return B;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::lauum"),
+      TORCH_FN(lauum_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
@@ -1,26 +1,34 @@
 #include <ATen/ATen.h>
 #include <torch/library.h>
 #include <ATen/Parallel.h>
+#include <ATen/cpu/vec/functional.h>
+#include <ATen/cpu/vec/vec.h>
+
+#include "cpu_helpers.h"
 
 namespace falkon {
 namespace ops {
 namespace {
 
-// TODO: Parallelize
+/*
+ * Both functions assume that the matrix is stored with contiguous rows (col_stride == 1),
+ * so that the inner loops are contiguous and can be vectorized.
+ */
 template <typename scalar_t>
 void mul_upper_diag(
         scalar_t *data,
         const int64_t size,
         const scalar_t mul,
         const int64_t row_stride,
-        const int64_t col_stride,
         const bool preserve_diag) {
-    const int diagonal_offset = preserve_diag ? 1 : 0;
-    for (int64_t i = 0; i < size; i++) {
-        for (int64_t j = i + diagonal_offset; j < size; j++) {
-            data[i * row_stride + j * col_stride] *= mul;
+    using Vec = at::vec::Vectorized<scalar_t>;
+    const int64_t diagonal_offset = preserve_diag ? 1 : 0;
+    parallel_for_triang(size, /*growing=*/false, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; i++) {
+            scalar_t *row = data + i * row_stride + i + diagonal_offset;
+            at::vec::map([mul](Vec x) { return x * Vec(mul); }, row, row, size - i - diagonal_offset);
         }
-    }
+    });
 }
 
 template <typename scalar_t>
@@ -29,14 +37,15 @@ void mul_lower_diag(
         const int64_t size,
         const scalar_t mul,
         const int64_t row_stride,
-        const int64_t col_stride,
         const bool preserve_diag) {
-    const int diagonal_offset = preserve_diag ? -1 : 0;
-    for (int64_t i = 0; i < size; i++) {
-        for (int64_t j = 0; j <= (i + diagonal_offset); j++) {
-            data[i * row_stride + j * col_stride] *= mul;
+    using Vec = at::vec::Vectorized<scalar_t>;
+    const int64_t diagonal_offset = preserve_diag ? 1 : 0;
+    parallel_for_triang(size, /*growing=*/true, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; i++) {
+            scalar_t *row = data + i * row_stride;
+            at::vec::map([mul](Vec x) { return x * Vec(mul); }, row, row, i + 1 - diagonal_offset);
         }
-    }
+    });
 }
 
 
@@ -65,8 +74,9 @@ at::Tensor mul_triang_kernel(
         col_stride,
         ")");
 
+    // Make rows contiguous: a F-contiguous upper triangle is a C-contiguous lower triangle.
     bool bupper = upper;
-    if (row_stride == 1) {
+    if (row_stride == 1 && col_stride != 1) {
         bupper = !upper;
         int64_t tmp_stride = row_stride;
         row_stride = col_stride;
@@ -81,7 +91,6 @@ at::Tensor mul_triang_kernel(
                 n,
                 mul,
                 row_stride,
-                col_stride,
                 preserve_diag);
         } else {
             mul_lower_diag(
@@ -89,7 +98,6 @@ at::Tensor mul_triang_kernel(
                 n,
                 mul,
                 row_stride,
-                col_stride,
                 preserve_diag);
         }
     });
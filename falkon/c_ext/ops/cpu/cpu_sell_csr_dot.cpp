@@ -0,0 +1,130 @@
+#include "../helpers.h"
+#include "cpu_helpers.h"
+
+#include <ATen/ATen.h>
+#include <ATen/AccumulateType.h>
+#include <torch/library.h>
+
+#include <algorithm>
+
+namespace falkon {
+namespace ops {
+namespace {
+
+/*
+ * Dot-products between all rows of a sliced-ELL matrix A and all rows of a CSR matrix B (with
+ * sorted column indices): out[row_perm[r], j] = <A[r], B[j]>. Slices of A are split between
+ * threads by their padded size, and each non-zero of A is looked up in B with a binary search.
+ */
+template <typename scalar_t, typename index_t>
+void run_sell_csr_dot(
+        const index_t *slice_ptr,
+        const index_t *sell_index,
+        const scalar_t *sell_data,
+        const index_t *row_perm,
+        const int64_t num_slices,
+        const int64_t slice_size,
+        const int64_t N,
+        const index_t *indexptr2,
+        const index_t *indices2,
+        const scalar_t *data2,
+        const int64_t M,
+        scalar_t *out,
+        const int64_t out_s0,
+        const int64_t out_s1) {
+    using acc_t = at::acc_type<scalar_t, false>;
+    const auto cost = [&](int64_t s) { return (int64_t)slice_ptr[s] + s; };
+    parallel_for_csr_rows(num_slices, cost, [&](int64_t slice_start, int64_t slice_end) {
+        for (int64_t s = slice_start; s < slice_end; s++) {
+            const int64_t base = slice_ptr[s];
+            const int64_t width = (slice_ptr[s + 1] - base) / slice_size;
+            for (int64_t l = 0; l < slice_size && s * slice_size + l < N; l++) {
+                scalar_t *out_row = out + (int64_t)row_perm[s * slice_size + l] * out_s0;
+                for (int64_t j = 0; j < M; j++) {
+                    const index_t *b_start = indices2 + indexptr2[j], *b_end = indices2 + indexptr2[j + 1];
+                    acc_t acc = 0;
+                    for (int64_t k = 0; k < width && b_start < b_end; k++) {
+                        const int64_t p = base + k * slice_size + l;
+                        const index_t col = sell_index[p];
+                        if (col < 0) {  // padding is at the end of each row
+                            break;
+                        }
+                        const index_t *found = std::lower_bound(b_start, b_end, col);
+                        if (found != b_end && *found == col) {
+                            acc += static_cast<acc_t>(sell_data[p]) * static_cast<acc_t>(data2[found - indices2]);
+                        }
+                    }
+                    out_row[j * out_s1] = static_cast<scalar_t>(acc);
+                }
+            }
+        }
+    });
+}
+
+at::Tensor sell_csr_dot_kernel(
+        const at::Tensor &slice_ptr,
+        const at::Tensor &sell_index,
+        const at::Tensor &sell_data,
+        const at::Tensor &row_perm,
+        int64_t slice_size,
+        const at::Tensor &indexptr2,
+        const at::Tensor &indices2,
+        const at::Tensor &data2,
+        at::Tensor &out) {
+    CHECK_CPU(slice_ptr);
+    CHECK_CPU(sell_index);
+    CHECK_CPU(sell_data);
+    CHECK_CPU(row_perm);
+    CHECK_CPU(indexptr2);
+    CHECK_CPU(indices2);
+    CHECK_CPU(data2);
+    CHECK_CPU(out);
+    TORCH_CHECK(slice_size > 0, "slice_size must be positive");
+    TORCH_CHECK(slice_ptr.is_contiguous() && sell_index.is_contiguous() && sell_data.is_contiguous() &&
+                row_perm.is_contiguous(), "Sliced-ELL arrays must be contiguous");
+    TORCH_CHECK(indexptr2.is_contiguous() && indices2.is_contiguous() && data2.is_contiguous(),
+                "CSR arrays must be contiguous");
+    TORCH_CHECK(sell_index.scalar_type() == slice_ptr.scalar_type() && row_perm.scalar_type() == slice_ptr.scalar_type() &&
+                indexptr2.scalar_type() == slice_ptr.scalar_type() && indices2.scalar_type() == slice_ptr.scalar_type(),
+                "All index arrays must be of the same type.");
+    TORCH_CHECK(sell_data.scalar_type() == out.scalar_type() && data2.scalar_type() == out.scalar_type(),
+                "Matrices A, B and out must be of the same type.");
+    const int64_t N = row_perm.numel(), M = indexptr2.numel() - 1;
+    const int64_t num_slices = slice_ptr.numel() - 1;
+    TORCH_CHECK(num_slices == (N + slice_size - 1) / slice_size, "Number of slices does not match number of rows");
+    TORCH_CHECK(out.dim() == 2 && out.size(0) == N && out.size(1) == M,
+                "Output must be a ", N, " x ", M, " matrix");
+    TORCH_CHECK(out.stride(0) == 1 || out.stride(1) == 1, "Output matrix must be either C- or F-contiguous");
+
+    AT_DISPATCH_FLOATING_TYPES(sell_data.scalar_type(), "sell_csr_dot_cpu", [&] {
+        AT_DISPATCH_INDEX_TYPES(slice_ptr.scalar_type(), "sell_csr_dot_cpu_index", [&] {
+            run_sell_csr_dot<scalar_t, index_t>(
+                slice_ptr.data_ptr<index_t>(),
+                sell_index.data_ptr<index_t>(),
+                sell_data.data_ptr<scalar_t>(),
+                row_perm.data_ptr<index_t>(),
+                num_slices,
+                slice_size,
+                N,
+                indexptr2.data_ptr<index_t>(),
+                indices2.data_ptr<index_t>(),
+                data2.data_ptr<scalar_t>(),
+                M,
+                out.data_ptr<scalar_t>(),
+                out.stride(0),
+                out.stride(1));
+        });
+    });
+    return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::sell_csr_dot"),
+      TORCH_FN(sell_csr_dot_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
@@ -1,4 +1,5 @@
 #include "../helpers.h"
+#include "cpu_helpers.h"
 
 #include <ATen/ATen.h>
 #include <torch/library.h>
@@ -6,6 +7,8 @@
 #include <ATen/native/cpu/Reduce.h>
 #include <c10/macros/Macros.h>
 
+#include <cmath>
+
 namespace falkon {
 namespace ops {
 namespace {
@@ -13,42 +16,46 @@ namespace {
 #define ASSERT_IS_CPU(x) AT_ASSERTM(x.device().is_cpu(), #x " must be CPU tensor")
 
 
-template <typename scalar_t>
+template <typename scalar_t, typename index_t>
 static inline void sparse_bdot_impl(
         scalar_t* data1,
-        int64_t* indices1,
-        int64_t* indptr1,
+        index_t* indices1,
+        index_t* indptr1,
         scalar_t* data2,
-        int64_t* indices2,
-        int64_t* indptr2,
+        index_t* indices2,
+        index_t* indptr2,
         scalar_t* out_data,
         int64_t N) {
-    // row start and row end for both input matrices
-    int64_t rs1, re1, rs2, re2;
-    // column indices (in the `indices1` and `indices2` arrays)
-    int64_t colidx1, colidx2;
-    int64_t i;
-
-    for (i = 0; i < N; i++) {
-        rs1 = indptr1[i];
-        re1 = indptr1[i + 1];
-        rs2 = indptr2[i];
-        re2 = indptr2[i + 1];
-
-        while (rs1 < re1 && rs2 < re2) {
-            colidx1 = indices1[rs1];
-            colidx2 = indices2[rs2];
-            if (colidx1 < colidx2) {
-                rs1++;
-            } else if (colidx1 > colidx2) {
-                rs2++;
-            } else {
-                out_data[i] += data1[rs1] * data2[rs2];
-                rs1++;
-                rs2++;
+    // Rows are partitioned so that each thread gets roughly the same number of non-zeros.
+    const auto cost = [&](int64_t i) { return (int64_t)indptr1[i] + (int64_t)indptr2[i] + i; };
+    parallel_for_csr_rows(N, cost, [&](int64_t row_start, int64_t row_end) {
+        // row start and row end for both input matrices
+        int64_t rs1, re1, rs2, re2;
+        // column indices (in the `indices1` and `indices2` arrays)
+        index_t colidx1, colidx2;
+        for (int64_t i = row_start; i < row_end; i++) {
+            rs1 = indptr1[i];
+            re1 = indptr1[i + 1];
+            rs2 = indptr2[i];
+            re2 = indptr2[i + 1];
+            scalar_t acc = 0;
+
+            while (rs1 < re1 && rs2 < re2) {
+                colidx1 = indices1[rs1];
+                colidx2 = indices2[rs2];
+                if (colidx1 < colidx2) {
+                    rs1++;
+                } else if (colidx1 > colidx2) {
+                    rs2++;
+                } else {
+                    acc += data1[rs1] * data2[rs2];
+                    rs1++;
+                    rs2++;
+                }
             }
+            out_data[i] = acc;
         }
-    }
+    });
 }
 
 
@@ -80,6 +87,8 @@ at::Tensor sparse_bdot_kernel(
     AT_ASSERTM(data2.dim() == 1, "data must be 1D");
     AT_ASSERTM(data2.stride(0) == 1, "data must be memory-contiguous");
     AT_ASSERTM(indexptr1.size(0) == indexptr2.size(0), "the two sparse matrices must have the same number of rows.");
+    AT_ASSERTM(indexptr1.scalar_type() == indices1.scalar_type() && indexptr1.scalar_type() == indexptr2.scalar_type() &&
+               indexptr1.scalar_type() == indices2.scalar_type(), "All index arrays must be of the same type.");
     AT_ASSERTM(data1.scalar_type() == data2.scalar_type(), "the two sparse matrices must be of the same type.");
     AT_ASSERTM(out.scalar_type() == data1.scalar_type(), "Matrices A, B and out must be of the same type.");
 
@@ -88,45 +97,44 @@ at::Tensor sparse_bdot_kernel(
     if (out.dim() >= 2) {
         AT_ASSERTM(out.size(1) == 1, "Output array must be 1D");
     }
-    out.fill_(0.0);
+    AT_ASSERTM(out.stride(0) == 1 || out.size(0) <= 1, "Output array must be memory-contiguous");
 
     auto scalar_type = data1.scalar_type();
 
     AT_DISPATCH_ALL_TYPES(scalar_type, "sparse_bdot_impl", [&] {
-        sparse_bdot_impl<scalar_t>(
-                data1.data_ptr<scalar_t>(),
-                indices1.data_ptr<int64_t>(),
-                indexptr1.data_ptr<int64_t>(),
-                data2.data_ptr<scalar_t>(),
-                indices2.data_ptr<int64_t>(),
-                indexptr2.data_ptr<int64_t>(),
-                out.data_ptr<scalar_t>(),
-                N);
+        AT_DISPATCH_INDEX_TYPES(indexptr1.scalar_type(), "sparse_bdot_impl", [&] {
+            sparse_bdot_impl<scalar_t, index_t>(
+                    data1.data_ptr<scalar_t>(),
+                    indices1.data_ptr<index_t>(),
+                    indexptr1.data_ptr<index_t>(),
+                    data2.data_ptr<scalar_t>(),
+                    indices2.data_ptr<index_t>(),
+                    indexptr2.data_ptr<index_t>(),
+                    out.data_ptr<scalar_t>(),
+                    N);
+        });
     });
     return out;
 }
 
 
-template <typename scalar_t>
-static inline void sparse_square_norm_impl(
+template <typename scalar_t, typename index_t, bool take_sqrt>
+static inline void sparse_norm_impl(
         scalar_t* data,
-        int64_t* indptr,
+        index_t* indptr,
         scalar_t* out_data,
         int64_t N) {
-    int64_t i;
-    int64_t i_start, i_end;
-    scalar_t val_ij;
-    // Assume squaring is desired, but need to fix this to accept multiple operations eventually
-    for (i = 0; i < N; i++) {
-        i_start = indptr[i];
-        i_end = indptr[i+1];
-        val_ij = 0.0;
-        while (i_start < i_end) {
-            val_ij += data[i_start]*data[i_start];
-            i_start++;
+    // Rows are partitioned so that each thread gets roughly the same number of non-zeros.
+    const auto cost = [&](int64_t i) { return (int64_t)indptr[i] + i; };
+    parallel_for_csr_rows(N, cost, [&](int64_t row_start, int64_t row_end) {
+        for (int64_t i = row_start; i < row_end; i++) {
+            scalar_t val_ij = 0.0;
+            for (int64_t j = indptr[i]; j < indptr[i + 1]; j++) {
+                val_ij += data[j] * data[j];
+            }
+            out_data[i] = take_sqrt ? (scalar_t)std::sqrt(val_ij) : val_ij;
         }
-        out_data[i] = val_ij;
-    }
+    });
 }
 
 at::Tensor sparse_square_norm_kernel(
@@ -148,41 +156,22 @@ at::Tensor sparse_square_norm_kernel(
         AT_ASSERTM(out.size(1) == 1, "Output array must be 1D");
     }
     AT_ASSERTM(out.scalar_type() == data.scalar_type(), "Matrices A, B and out must be of the same type.");
+    AT_ASSERTM(out.stride(0) == 1 || out.size(0) <= 1, "Output array must be memory-contiguous");
 
     auto scalar_type = data.scalar_type();
-    auto indexptr_data = indexptr.data_ptr<int64_t>();
 
     AT_DISPATCH_ALL_TYPES(scalar_type, "sparse_square_norm_impl", [&] {
-        sparse_square_norm_impl<scalar_t>(
-                data.data_ptr<scalar_t>(),
-                indexptr_data,
-                out.data_ptr<scalar_t>(),
-                N);
+        AT_DISPATCH_INDEX_TYPES(indexptr.scalar_type(), "sparse_square_norm_impl", [&] {
+            sparse_norm_impl<scalar_t, index_t, false>(
+                    data.data_ptr<scalar_t>(),
+                    indexptr.data_ptr<index_t>(),
+                    out.data_ptr<scalar_t>(),
+                    N);
+        });
     });
     return out;
 }
 
-template <typename scalar_t>
-static inline void sparse_norm_impl(
-        scalar_t* data,
-        int64_t* indptr,
-        scalar_t* out_data,
-        int64_t N) {
-    int64_t i;
-    int64_t i_start, i_end;
-    scalar_t val_ij;
-    for (i = 0; i < N; i++) {
-        i_start = indptr[i];
-        i_end = indptr[i+1];
-        val_ij = 0.0;
-        while (i_start < i_end) {
-            val_ij += data[i_start]*data[i_start];
-            i_start++;
-        }
-        out_data[i] = sqrt(val_ij);
-    }
-}
-
 at::Tensor sparse_norm_kernel(
         const at::Tensor &indexptr,
         const at::Tensor &data,
@@ -202,16 +191,18 @@ at::Tensor sparse_norm_kernel(
         AT_ASSERTM(out.size(1) == 1, "Output array must be 1D");
     }
     AT_ASSERTM(out.scalar_type() == data.scalar_type(), "Matrices A, B and out must be of the same type.");
+    AT_ASSERTM(out.stride(0) == 1 || out.size(0) <= 1, "Output array must be memory-contiguous");
 
     auto scalar_type = data.scalar_type();
-    auto indexptr_data = indexptr.data_ptr<int64_t>();
 
     AT_DISPATCH_ALL_TYPES(scalar_type, "sparse_norm_impl", [&] {
-        sparse_norm_impl<scalar_t>(
-                data.data_ptr<scalar_t>(),
-                indexptr_data,
-                out.data_ptr<scalar_t>(),
-                N);
+        AT_DISPATCH_INDEX_TYPES(indexptr.scalar_type(), "sparse_norm_impl", [&] {
+            sparse_norm_impl<scalar_t, index_t, true>(
+                    data.data_ptr<scalar_t>(),
+                    indexptr.data_ptr<index_t>(),
+                    out.data_ptr<scalar_t>(),
+                    N);
+        });
     });
     return out;
 }
@@ -0,0 +1,172 @@
+#include "../helpers.h"
+#include "cpu_helpers.h"
+
+#include <ATen/ATen.h>
+#include <torch/library.h>
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+namespace falkon {
+namespace ops {
+namespace {
+
+/*
+ * Row-by-row (Gustavson) sparse matrix product C = A @ B, with A (M x K), B (K x N) and C all
+ * in CSR format. The first pass counts the non-zeros of each row of C, the second pass fills
+ * in the (sorted) column indices and values. Each thread uses dense work arrays of length N.
+ */
+template <typename scalar_t, typename index_t>
+std::tuple<at::Tensor, at::Tensor, at::Tensor>
+run_spspmm_cpu(
+    const at::Tensor &rowptrA,
+    const at::Tensor &colA,
+    const at::Tensor &valA,
+    const at::Tensor &rowptrB,
+    const at::Tensor &colB,
+    const at::Tensor &valB,
+    int64_t N)
+{
+  const int64_t M = rowptrA.numel() - 1;
+  const index_t *rpA = rowptrA.data_ptr<index_t>();
+  const index_t *cA = colA.data_ptr<index_t>();
+  const scalar_t *vA = valA.data_ptr<scalar_t>();
+  const index_t *rpB = rowptrB.data_ptr<index_t>();
+  const index_t *cB = colB.data_ptr<index_t>();
+  const scalar_t *vB = valB.data_ptr<scalar_t>();
+  const auto cost = [&](int64_t i) { return (int64_t)rpA[i] + i; };
+
+  at::Tensor rowptrC = at::empty(M + 1, rowptrA.options());
+  index_t *rpC = rowptrC.data_ptr<index_t>();
+
+  // Pass 1: number of non-zeros in each row of C, stored in rpC[i + 1]
+  rpC[0] = 0;
+  parallel_for_csr_rows(M, cost, [&](int64_t row_start, int64_t row_end) {
+    std::vector<int64_t> marker(N, -1);
+    for (int64_t i = row_start; i < row_end; i++) {
+      int64_t row_nnz = 0;
+      for (int64_t pa = rpA[i]; pa < rpA[i + 1]; pa++) {
+        const int64_t k = cA[pa];
+        for (int64_t pb = rpB[k]; pb < rpB[k + 1]; pb++) {
+          const int64_t j = cB[pb];
+          if (marker[j] != i) {
+            marker[j] = i;
+            row_nnz++;
+          }
+        }
+      }
+      rpC[i + 1] = (index_t)row_nnz;
+    }
+  });
+  for (int64_t i = 0; i < M; i++) {
+    rpC[i + 1] += rpC[i];
+  }
+  const int64_t nnzC = rpC[M];
+  at::Tensor colC = at::empty(nnzC, rowptrA.options());
+  at::Tensor valC = at::empty(nnzC, valA.options());
+  index_t *cC = colC.data_ptr<index_t>();
+  scalar_t *vC = valC.data_ptr<scalar_t>();
+
+  // Pass 2: accumulate the rows of C in a dense work array, then gather them in column order.
+  parallel_for_csr_rows(M, cost, [&](int64_t row_start, int64_t row_end) {
+    std::vector<int64_t> marker(N, -1);
+    std::vector<scalar_t> acc(N);
+    for (int64_t i = row_start; i < row_end; i++) {
+      int64_t pos = rpC[i];
+      for (int64_t pa = rpA[i]; pa < rpA[i + 1]; pa++) {
+        const int64_t k = cA[pa];
+        const scalar_t a = vA[pa];
+        for (int64_t pb = rpB[k]; pb < rpB[k + 1]; pb++) {
+          const int64_t j = cB[pb];
+          if (marker[j] != i) {
+            marker[j] = i;
+            cC[pos++] = (index_t)j;
+            acc[j] = a * vB[pb];
+          } else {
+            acc[j] += a * vB[pb];
+          }
+        }
+      }
+      std::sort(cC + rpC[i], cC + pos);
+      for (int64_t p = rpC[i]; p < pos; p++) {
+        vC[p] = acc[cC[p]];
+      }
+    }
+  });
+  return std::make_tuple(rowptrC, colC, valC);
+}
+
+std::tuple<at::Tensor, at::Tensor, at::Tensor>
+spspmm_cpu(
+    const at::Tensor &rowptrA,
+    const at::Tensor &colA,
+    const at::Tensor &valA,
+    const at::Tensor &rowptrB,
+    const at::Tensor &colB,
+    const at::Tensor &valB,
+    int64_t N
+)
+{
+  CHECK_CPU(rowptrA);
+  CHECK_CPU(colA);
+  CHECK_CPU(valA);
+  CHECK_CPU(rowptrB);
+  CHECK_CPU(colB);
+  CHECK_CPU(valB);
+
+  TORCH_CHECK(rowptrA.dim() == 1 && rowptrA.is_contiguous());
+  TORCH_CHECK(colA.dim() == 1 && colA.is_contiguous());
+  TORCH_CHECK(valA.dim() == 1 && valA.is_contiguous());
+  TORCH_CHECK(valA.size(0) == colA.size(0));
+
+  TORCH_CHECK(rowptrB.dim() == 1 && rowptrB.is_contiguous());
+  TORCH_CHECK(colB.dim() == 1 && colB.is_contiguous());
+  TORCH_CHECK(valB.dim() == 1 && valB.is_contiguous());
+  TORCH_CHECK(valB.size(0) == colB.size(0));
+
+  TORCH_CHECK(valA.dtype() == valB.dtype(), "Expected A, B with equal dtypes but found ",
+    valA.dtype(), ", ", valB.dtype());
+  TORCH_CHECK(rowptrA.dtype() == colA.dtype() && rowptrA.dtype() == rowptrB.dtype() && rowptrA.dtype() == colB.dtype(),
+    "Expected all index arrays to have the same dtype.");
+  TORCH_CHECK(N >= 0, "Expected a non-negative number of columns but found ", N);
+
+  std::tuple<at::Tensor, at::Tensor, at::Tensor> out;
+  AT_DISPATCH_FLOATING_TYPES(valA.scalar_type(), "dispatch_spspmm_cpu", [&] {
+    AT_DISPATCH_INDEX_TYPES(rowptrA.scalar_type(), "dispatch_spspmm_cpu_index", [&] {
+      out = run_spspmm_cpu<scalar_t, index_t>(rowptrA, colA, valA, rowptrB, colB, valB, N);
+    });
+  });
+  return out;
+}
+
+// The CPU kernel only needs small per-thread work arrays, so the workspaces are not used.
+std::tuple<at::Tensor, at::Tensor, at::Tensor>
+spspmm_ws_cpu(
+    const at::Tensor &rowptrA,
+    const at::Tensor &colA,
+    const at::Tensor &valA,
+    const at::Tensor &rowptrB,
+    const at::Tensor &colB,
+    const at::Tensor &valB,
+    int64_t N,
+    at::Tensor &workspace1,
+    at::Tensor &workspace2
+)
+{
+  return spspmm_cpu(rowptrA, colA, valA, rowptrB, colB, valB, N);
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::spspmm"),
+      TORCH_FN(spspmm_cpu));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::spspmm_ws"),
+      TORCH_FN(spspmm_ws_cpu));
+}
+
+} // namespace ops
+} // namespace falkon
@@ -0,0 +1,117 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/Parallel.h>
+#include <ATen/cpu/vec/functional.h>
+#include <ATen/cpu/vec/vec.h>
+
+#include "cpu_helpers.h"
+
+namespace falkon {
+namespace ops {
+namespace {
+
+/*
+ * mat[i, j] = mat[i, j] * multiplier * row_vec[i] * col_vec[j] + (i == j) * diag_add
+ * for all (i, j) in the upper or lower triangle of `mat` (diagonal included).
+ * Rows of `mat` must be contiguous (the column stride is 1). `row_vec` and `col_vec`
+ * may be null, in which case they are treated as vectors of ones.
+ */
+template <typename scalar_t>
+void triang_affine_impl(
+        scalar_t *mat,
+        const scalar_t *row_vec,
+        const scalar_t *col_vec,
+        const int64_t n,
+        const int64_t row_stride,
+        const scalar_t multiplier,
+        const scalar_t diag_add,
+        const bool upper) {
+    using Vec = at::vec::Vectorized<scalar_t>;
+    parallel_for_triang(n, /*growing=*/!upper, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; i++) {
+            const int64_t j_start = upper ? i : 0;
+            const int64_t j_end = upper ? n : i + 1;
+            scalar_t *row = mat + i * row_stride + j_start;
+            const scalar_t mul = row_vec == nullptr ? multiplier : multiplier * row_vec[i];
+            if (col_vec != nullptr) {
+                at::vec::map2(
+                    [mul](Vec x, Vec c) { return x * c * Vec(mul); },
+                    row, row, col_vec + j_start, j_end - j_start);
+            } else {
+                at::vec::map([mul](Vec x) { return x * Vec(mul); }, row, row, j_end - j_start);
+            }
+            mat[i * row_stride + i] += diag_add;
+        }
+    });
+}
+
+at::Tensor triang_affine_kernel(
+        at::Tensor &mat,
+        const c10::optional<at::Tensor> &row_vec,
+        const c10::optional<at::Tensor> &col_vec,
+        const double multiplier,
+        const double diag_add,
+        const bool upper) {
+    AT_ASSERTM(mat.dim() == 2, "mat must be 2D");
+    const int64_t n = mat.size(0);
+    const int64_t m = mat.size(1);
+    TORCH_CHECK(
+        (n == m),
+        "Input matrix must be square. Found shape: (",
+        n,
+        ", ",
+        m,
+        ")");
+    int64_t row_stride = mat.stride(0);
+    int64_t col_stride = mat.stride(1);
+    TORCH_CHECK(
+        (row_stride == 1 || col_stride == 1),
+        "Input must be contiguous in one dimension. Found strides: (",
+        row_stride,
+        ", ",
+        col_stride,
+        ")");
+    at::Tensor row_vec_c, col_vec_c;
+    if (row_vec.has_value()) {
+        TORCH_CHECK(row_vec->numel() == n, "row_vec must be a vector with size matching mat.");
+        TORCH_CHECK(row_vec->scalar_type() == mat.scalar_type(), "row_vec must have the same data-type as mat.");
+        row_vec_c = row_vec->contiguous();
+    }
+    if (col_vec.has_value()) {
+        TORCH_CHECK(col_vec->numel() == n, "col_vec must be a vector with size matching mat.");
+        TORCH_CHECK(col_vec->scalar_type() == mat.scalar_type(), "col_vec must have the same data-type as mat.");
+        col_vec_c = col_vec->contiguous();
+    }
+
+    // Make rows contiguous by operating on the transpose of F-contiguous inputs.
+    bool bupper = upper;
+    if (row_stride == 1 && col_stride != 1) {
+        bupper = !upper;
+        std::swap(row_stride, col_stride);
+        std::swap(row_vec_c, col_vec_c);
+    }
+
+    AT_DISPATCH_FLOATING_TYPES(mat.scalar_type(), "triang_affine", [&] {
+        triang_affine_impl<scalar_t>(
+            mat.data_ptr<scalar_t>(),
+            row_vec_c.defined() ? row_vec_c.data_ptr<scalar_t>() : nullptr,
+            col_vec_c.defined() ? col_vec_c.data_ptr<scalar_t>() : nullptr,
+            n,
+            row_stride,
+            (scalar_t)multiplier,
+            (scalar_t)diag_add,
+            bupper);
+    });
+    return mat;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::triang_affine"),
+      TORCH_FN(triang_affine_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
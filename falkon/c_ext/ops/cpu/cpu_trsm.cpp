@@ -0,0 +1,83 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/native/BatchLinearAlgebra.h>
+
+#include "../helpers.h"
+#include "../trsm.h"
+
+namespace falkon {
+namespace ops {
+namespace {
+
+/*
+ * Triangular solve with BLAS, directly on the memory of the input tensors:
+ * no copy is made for either C or F-contiguous inputs.
+ */
+at::Tensor trsm_kernel(
+        const at::Tensor &A,
+        at::Tensor &B,
+        const double alpha,
+        const bool upper,
+        const bool transpose) {
+    CHECK_CPU(A);
+    CHECK_CPU(B);
+    const TrsmParams p = trsm_params(A, B, upper, transpose);
+    if (p.m == 0 || p.n == 0) {
+        return B;
+    }
+    if (alpha != 1.0) {
+        B.mul_(alpha);
+    }
+    AT_DISPATCH_FLOATING_TYPES(A.scalar_type(), "trsm", [&] {
+        at::native::blasTriangularSolve<scalar_t>(
+            p.left ? 'L' : 'R',
+            p.upper ? 'U' : 'L',
+            p.transpose ? 'T' : 'N',
+            'N',
+            p.m,
+            p.n,
+            const_cast<scalar_t *>(A.data_ptr<scalar_t>()),
+            p.lda,
+            B.data_ptr<scalar_t>(),
+            p.ldb);
+    });
+    return B;
+}
+
+/*
+ * The Falkon preconditioner stores T in upper(fC) and A.T in lower(fC), with their diagonals
+ * in dT and dA. Overwrite `out` with T^-1 A^-1 out, or with A^-T T^-T out if `transpose`.
+ */
+at::Tensor pc_apply_kernel(
+        at::Tensor &fC,
+        const at::Tensor &dT,
+        const at::Tensor &dA,
+        at::Tensor &out,
+        const bool transpose) {
+    if (!transpose) {
+        fC.diagonal().copy_(dA);
+        trsm_kernel(fC, out, 1.0, /*upper=*/false, /*transpose=*/true);
+        fC.diagonal().copy_(dT);
+        trsm_kernel(fC, out, 1.0, /*upper=*/true, /*transpose=*/false);
+    } else {
+        fC.diagonal().copy_(dT);
+        trsm_kernel(fC, out, 1.0, /*upper=*/true, /*transpose=*/true);
+        fC.diagonal().copy_(dA);
+        trsm_kernel(fC, out, 1.0, /*upper=*/false, /*transpose=*/false);
+    }
+    return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::trsm"),
+      TORCH_FN(trsm_kernel));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::pc_apply"),
+      TORCH_FN(pc_apply_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
@@ -1,6 +1,10 @@
 #include <ATen/ATen.h>
 #include <torch/library.h>
 #include <ATen/Parallel.h>
+#include <ATen/cpu/vec/functional.h>
+#include <ATen/cpu/vec/vec.h>
+
+#include "cpu_helpers.h"
 
 namespace falkon {
 namespace ops {
@@ -21,53 +25,35 @@ void vec_mul_triang_impl(
     * if side == true: multiplier is a row vector
     * if side == false: multiplier is a column vector
     */
+    using Vec = at::vec::Vectorized<scalar_t>;
+    const auto vec_mul = [](Vec x, Vec m) { return x * m; };
     if (col_stride == 1) {
         // C-contiguous (rows are stored as contiguous blocks, stride is (?, 1))
-        at::parallel_for(0, n, 0, [&](int64_t start, int64_t end) {  // rows
-            scalar_t mul;
-            for (int64_t i : c10::irange(start, end)) {
-                if (!side) {
-                    mul = multiplier_vector[i];
-                }
-                if (upper) {
-                    for (int64_t j = i; j < n; j++) {  // cols
-                        if (side) {
-                            mul = multiplier_vector[j];
-                        }
-                        mat[i * row_stride + j] = mat[i * row_stride + j] * mul;
-                    }
+        parallel_for_triang(n, /*growing=*/!upper, [&](int64_t start, int64_t end) {  // rows
+            for (int64_t i = start; i < end; i++) {
+                const int64_t j_start = upper ? i : 0;
+                const int64_t j_end = upper ? n : i + 1;
+                scalar_t *row = mat + i * row_stride + j_start;
+                if (side) {
+                    at::vec::map2(vec_mul, row, row, multiplier_vector + j_start, j_end - j_start);
                 } else {
-                    for (int64_t j = 0; j <= i; j++) { // cols
-                        if (side) {
-                            mul = multiplier_vector[j];
-                        }
-                        mat[i * row_stride + j] = mat[i * row_stride + j] * mul;
-                    }
+                    const scalar_t mul = multiplier_vector[i];
+                    at::vec::map([mul](Vec x) { return x * Vec(mul); }, row, row, j_end - j_start);
                 }
             }
         });
     } else {
         // F-contiguous (columns are stored as contiguous blocks, stride is (1, ?))
-        at::parallel_for(0, n, 0, [&](int64_t start, int64_t end) {  // columns
-            scalar_t mul;
-            for (int64_t i : c10::irange(start, end)) {
+        parallel_for_triang(n, /*growing=*/upper, [&](int64_t start, int64_t end) {  // columns
+            for (int64_t i = start; i < end; i++) {
+                const int64_t j_start = upper ? 0 : i;
+                const int64_t j_end = upper ? i + 1 : n;
+                scalar_t *col = mat + i * col_stride + j_start;
                 if (side) {
-                    mul = multiplier_vector[i];
-                }
-                if (upper) {
-                    for (int64_t j = 0; j <= i; j++) { // rows
-                        if (!side) {
-                            mul = multiplier_vector[j];
-                        }
-                        mat[j + i * col_stride] = mat[j + i * col_stride] * mul;
-                    }
+                    const scalar_t mul = multiplier_vector[i];
+                    at::vec::map([mul](Vec x) { return x * Vec(mul); }, col, col, j_end - j_start);
                 } else {
-                    for (int64_t j = i; j < n; j++) { // rows
-                        if (!side) {
-                            mul = multiplier_vector[j];
-                        }
-                        mat[j + i * col_stride] = mat[j + i * col_stride] * mul;
-                    }
+                    at::vec::map2(vec_mul, col, col, multiplier_vector + j_start, j_end - j_start);
                 }
             }
         });
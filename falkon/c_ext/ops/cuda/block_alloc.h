@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include <c10/util/ArrayRef.h>
+#include <c10/util/irange.h>
+
+namespace falkon {
+namespace ops {
+
+/* Subdivision of a square matrix in blocks, shared by the out-of-core multi-GPU runners */
+struct blockAlloc {
+    int start;
+    int end;
+    int size;
+    int device;
+    int id;
+};
+
+inline std::vector<blockAlloc> make_block_allocs(
+        c10::IntArrayRef block_starts,
+        c10::IntArrayRef block_ends,
+        c10::IntArrayRef block_sizes,
+        c10::IntArrayRef block_devices,
+        c10::IntArrayRef block_ids) {
+    std::vector<blockAlloc> out_allocs;
+    for (const int i : c10::irange(block_starts.size())) {
+        blockAlloc ba = {
+            .start = (int)block_starts[i],
+            .end   = (int)block_ends[i],
+            .size  = (int)block_sizes[i],
+            .device= (int)block_devices[i],
+            .id    = (int)block_ids[i]
+        };
+        out_allocs.push_back(ba);
+    }
+    return out_allocs;
+}
+
+} // namespace ops
+} // namespace falkon
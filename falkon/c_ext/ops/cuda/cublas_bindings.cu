@@ -387,6 +387,20 @@ void cublas_gemm(
     cublasOperation_t transa_op = transa ? CUBLAS_OP_T : CUBLAS_OP_N;
     cublasOperation_t transb_op = transb ? CUBLAS_OP_T : CUBLAS_OP_N;
 
+    if ((A.scalar_type() == at::kHalf || A.scalar_type() == at::kBFloat16) && C.scalar_type() == at::kFloat) {
+        // Reduced precision inputs (on the tensor cores), with single precision accumulation and output.
+        TORCH_CHECK(B.scalar_type() == A.scalar_type(), "A and B must have the same data-type. Found ",
+                    A.scalar_type(), " and ", B.scalar_type(), ".");
+        const cudaDataType_t ab_type = A.scalar_type() == at::kHalf ? CUDA_R_16F : CUDA_R_16BF;
+        auto handle = at::cuda::getCurrentCUDABlasHandle();
+        const float cast_alpha = alpha.to<float>();
+        const float cast_beta = beta.to<float>();
+        FLK_CUDABLAS_CHECK(cublasGemmEx(
+            handle, transa_op, transb_op, m, n, k, &cast_alpha, A.data_ptr(), ab_type, lda, B.data_ptr(), ab_type,
+            ldb, &cast_beta, C.data_ptr(), CUDA_R_32F, ldc, CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+        return;
+    }
+
     AT_DISPATCH_FLOATING_TYPES(A.scalar_type(), "cublas_gemm", [&]{
         auto handle = at::cuda::getCurrentCUDABlasHandle();
         auto A_data = A.data_ptr<scalar_t>();
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <ATen/ATen.h>
 #include <ATen/cuda/CUDAContext.h>
 #include <c10/cuda/CUDAStream.h>
@@ -61,6 +63,136 @@ void cuda_2d_copy(
     ));
 }
 
+/*
+ * Batched 2D copies. Copies between two buffers of the current device are gathered in one kernel
+ * launch (per `kMaxBatchCopies` copies), which moves the widest words allowed by the alignment of
+ * all pointers, pitches and widths. The other copies (to and from the host, or between devices)
+ * are submitted back-to-back with `cudaMemcpy2DAsync`. The copies of a batch must not overlap,
+ * since they may run in any order.
+ */
+constexpr int kMaxBatchCopies = 32;
+constexpr int kBatchCopyThreads = 256;
+constexpr int64_t kBatchCopyMaxBlocks = 1024;
+
+struct Copy2D {
+    const char *src;
+    char *dst;
+    int64_t src_pitch;
+    int64_t dst_pitch;
+    int64_t width;
+    int64_t height;
+};
+
+// Passed by value as a kernel parameter, so no descriptor needs to be copied to the device.
+struct Copy2DBatch {
+    Copy2D copies[kMaxBatchCopies];
+};
+
+template <typename word_t>
+__global__ void batch_2d_copy_kernel(const Copy2DBatch batch) {
+    const Copy2D c = batch.copies[blockIdx.y];
+    const int64_t row_words = c.width / sizeof(word_t);
+    const int64_t total = row_words * c.height;
+    for (int64_t idx = blockIdx.x * blockDim.x + threadIdx.x; idx < total; idx += gridDim.x * blockDim.x) {
+        const int64_t row = idx / row_words;
+        const int64_t col = idx - row * row_words;
+        reinterpret_cast<word_t *>(c.dst + row * c.dst_pitch)[col] =
+            reinterpret_cast<const word_t *>(c.src + row * c.src_pitch)[col];
+    }
+}
+
+void launch_batch_2d_copy(const Copy2DBatch &batch, const int count, cudaStream_t stream) {
+    uint64_t align_bits = 16;
+    int64_t max_bytes = 0;
+    for (int i = 0; i < count; i++) {
+        const Copy2D &c = batch.copies[i];
+        align_bits |= reinterpret_cast<uint64_t>(c.src) | reinterpret_cast<uint64_t>(c.dst) |
+                      static_cast<uint64_t>(c.src_pitch) | static_cast<uint64_t>(c.dst_pitch) |
+                      static_cast<uint64_t>(c.width);
+        max_bytes = std::max(max_bytes, c.width * c.height);
+    }
+    const uint64_t word_size = align_bits & (~align_bits + 1);  // Lowest set bit, at most 16
+    const int64_t max_words = max_bytes / static_cast<int64_t>(word_size);
+    const int64_t blocks_x = std::min(
+        kBatchCopyMaxBlocks, std::max<int64_t>(1, (max_words + kBatchCopyThreads - 1) / kBatchCopyThreads));
+    const dim3 grid(blocks_x, count);
+    switch (word_size) {
+        case 16:
+            batch_2d_copy_kernel<int4><<<grid, kBatchCopyThreads, 0, stream>>>(batch);
+            break;
+        case 8:
+            batch_2d_copy_kernel<int2><<<grid, kBatchCopyThreads, 0, stream>>>(batch);
+            break;
+        case 4:
+            batch_2d_copy_kernel<int32_t><<<grid, kBatchCopyThreads, 0, stream>>>(batch);
+            break;
+        case 2:
+            batch_2d_copy_kernel<int16_t><<<grid, kBatchCopyThreads, 0, stream>>>(batch);
+            break;
+        default:
+            batch_2d_copy_kernel<int8_t><<<grid, kBatchCopyThreads, 0, stream>>>(batch);
+    }
+    C10_CUDA_KERNEL_LAUNCH_CHECK();
+}
+
+void cuda_2d_copy_batch_async(
+        at::TensorList dest_tensors,
+        at::IntArrayRef dest_pitches,
+        at::TensorList src_tensors,
+        at::IntArrayRef src_pitches,
+        at::IntArrayRef widths,
+        at::IntArrayRef heights) {
+    const int64_t num_copies = dest_tensors.size();
+    TORCH_CHECK(src_tensors.size() == num_copies && dest_pitches.size() == num_copies &&
+                src_pitches.size() == num_copies && widths.size() == num_copies && heights.size() == num_copies,
+                "All arguments of the batched copy must have the same length (", num_copies, ").");
+    const int64_t device = at::cuda::current_device();
+    cudaStream_t stream = at::cuda::getCurrentCUDAStream(device).stream();
+
+    Copy2DBatch batch;
+    int count = 0;
+    for (int64_t i = 0; i < num_copies; i++) {
+        TORCH_CHECK(widths[i] <= src_pitches[i] && widths[i] <= dest_pitches[i],
+                    "Copy ", i, ": width (", widths[i], ") must not be larger than the pitches (",
+                    src_pitches[i], ", ", dest_pitches[i], ").");
+        if (widths[i] == 0 || heights[i] == 0) {
+            continue;
+        }
+        const at::Tensor &dst = dest_tensors[i];
+        const at::Tensor &src = src_tensors[i];
+        const bool on_device = dst.is_cuda() && src.is_cuda() &&
+                               dst.device().index() == device && src.device().index() == device;
+        if (!on_device) {
+            C10_CUDA_CHECK(cudaMemcpy2DAsync(
+                dst.data_ptr(),
+                dest_pitches[i],
+                src.data_ptr(),
+                src_pitches[i],
+                widths[i],
+                heights[i],
+                cudaMemcpyDefault,
+                stream
+            ));
+            continue;
+        }
+        batch.copies[count++] = Copy2D{
+            static_cast<const char *>(src.data_ptr()),
+            static_cast<char *>(dst.data_ptr()),
+            src_pitches[i],
+            dest_pitches[i],
+            widths[i],
+            heights[i]
+        };
+        if (count == kMaxBatchCopies) {
+            launch_batch_2d_copy(batch, count, stream);
+            count = 0;
+        }
+    }
+    if (count > 0) {
+        launch_batch_2d_copy(batch, count, stream);
+    }
+}
+
 void cuda_1d_copy_async(
         at::Tensor& dest_tensor,
         const at::Tensor &src_tensor,
@@ -104,6 +236,9 @@ TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
   m.impl(
       TORCH_SELECTIVE_NAME("falkon::cuda_2d_copy"),
       TORCH_FN(cuda_2d_copy));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::cuda_2d_copy_batch_async"),
+      TORCH_FN(cuda_2d_copy_batch_async));
   m.impl(
       TORCH_SELECTIVE_NAME("falkon::cuda_1d_copy_async"),
       TORCH_FN(cuda_1d_copy_async));
@@ -0,0 +1,438 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/cuda/CUDAContext.h>
+#include <c10/cuda/CUDAException.h>
+
+#include <limits>
+
+#include "../helpers.h"
+#include "../fused_distance_kernel.h"
+
+namespace falkon {
+namespace ops {
+
+namespace {
+
+// Output tile of BLK_M x BLK_N entries per thread-block, with THR_M x THR_N entries per thread.
+#define BLK_M 64
+#define BLK_N 64
+#define BLK_K 16
+#define NT_M 16
+#define NT_N 16
+#define THR_M (BLK_M / NT_M)
+#define THR_N (BLK_N / NT_N)
+
+template <typename scalar_t>
+__device__ __forceinline__ scalar_t distance_kernel_fn(scalar_t sq_dist, const int kernel_type) {
+    // Same constants as in `falkon.kernels.distance_kernel`
+    const scalar_t sqrt3 = 1.7320508075688772;
+    const scalar_t sqrt5 = 2.23606797749979;
+    sq_dist = sq_dist < (scalar_t)1e-20 ? (scalar_t)1e-20 : sq_dist;
+    switch (kernel_type) {
+        case kGaussianKernel:
+            return ::exp(-sq_dist / 2);
+        case kLaplacianKernel:
+            return ::exp(-::sqrt(sq_dist));
+        case kMatern32Kernel: {
+            const scalar_t r = sqrt3 * ::sqrt(sq_dist);
+            return (1 + r) * ::exp(-r);
+        }
+        default: {
+            const scalar_t r = sqrt5 * ::sqrt(sq_dist);
+            return (1 + r + sq_dist * 5 / 3) * ::exp(-r);
+        }
+    }
+}
+
+/*
+ * Load a BLK x BLK_K tile of the rows [row0, row0 + BLK) and columns [col0, col0 + BLK_K)
+ * of `mat` into shared memory (stored transposed, k-major). Out-of-bounds entries are zero.
+ * Consecutive threads read consecutive elements along the contiguous dimension of `mat`.
+ */
+template <typename scalar_t, int BLK>
+__device__ __forceinline__ void load_tile(
+        const scalar_t* __restrict__ mat,
+        scalar_t (*tile)[BLK + 1],
+        const int64_t row0,
+        const int col0,
+        const int64_t rows,
+        const int cols,
+        const int64_t row_stride,
+        const int64_t col_stride,
+        const int tid) {
+    const bool k_contig = col_stride == 1;
+    #pragma unroll
+    for (int l = 0; l < (BLK * BLK_K) / (NT_M * NT_N); l++) {
+        const int idx = tid + l * NT_M * NT_N;
+        const int r = k_contig ? idx / BLK_K : idx % BLK;
+        const int k = k_contig ? idx % BLK_K : idx / BLK;
+        const int64_t g_row = row0 + r;
+        const int g_col = col0 + k;
+        tile[k][r] = (g_row < rows && g_col < cols) ? mat[g_row * row_stride + g_col * col_stride] : (scalar_t)0;
+    }
+}
+
+/*
+ * out[i, j] = f(norm1[i] + norm2[j] - 2 * <mat1[i], mat2[j]>)
+ * The dot-products are accumulated in registers with a shared-memory tiled GEMM, and the
+ * kernel function is applied before the single write of each output entry.
+ */
+template <typename scalar_t>
+__global__ void fused_distance_kernel_ker(
+        const scalar_t* __restrict__ mat1,
+        const scalar_t* __restrict__ mat2,
+        const scalar_t* __restrict__ norm1,
+        const scalar_t* __restrict__ norm2,
+        scalar_t* __restrict__ out,
+        const int64_t n,
+        const int64_t m,
+        const int d,
+        const int64_t m1_s0,
+        const int64_t m1_s1,
+        const int64_t m2_s0,
+        const int64_t m2_s1,
+        const int64_t out_s0,
+        const int64_t out_s1,
+        const int kernel_type) {
+    __shared__ scalar_t tile1[BLK_K][BLK_M + 1];
+    __shared__ scalar_t tile2[BLK_K][BLK_N + 1];
+
+    const int tx = threadIdx.x;
+    const int ty = threadIdx.y;
+    const int tid = ty * NT_M + tx;
+    const int64_t row0 = (int64_t)blockIdx.x * BLK_M;
+    const int64_t col0 = (int64_t)blockIdx.y * BLK_N;
+
+    scalar_t acc[THR_M][THR_N];
+    #pragma unroll
+    for (int a = 0; a < THR_M; a++) {
+        #pragma unroll
+        for (int b = 0; b < THR_N; b++) {
+            acc[a][b] = 0;
+        }
+    }
+
+    for (int k0 = 0; k0 < d; k0 += BLK_K) {
+        load_tile<scalar_t, BLK_M>(mat1, tile1, row0, k0, n, d, m1_s0, m1_s1, tid);
+        load_tile<scalar_t, BLK_N>(mat2, tile2, col0, k0, m, d, m2_s0, m2_s1, tid);
+        __syncthreads();
+        #pragma unroll
+        for (int k = 0; k < BLK_K; k++) {
+            scalar_t a_reg[THR_M], b_reg[THR_N];
+            #pragma unroll
+            for (int a = 0; a < THR_M; a++) {
+                a_reg[a] = tile1[k][tx + a * NT_M];
+            }
+            #pragma unroll
+            for (int b = 0; b < THR_N; b++) {
+                b_reg[b] = tile2[k][ty + b * NT_N];
+            }
+            #pragma unroll
+            for (int a = 0; a < THR_M; a++) {
+                #pragma unroll
+                for (int b = 0; b < THR_N; b++) {
+                    acc[a][b] += a_reg[a] * b_reg[b];
+                }
+            }
+        }
+        __syncthreads();
+    }
+
+    #pragma unroll
+    for (int a = 0; a < THR_M; a++) {
+        const int64_t row = row0 + tx + a * NT_M;
+        if (row >= n) {
+            continue;
+        }
+        const scalar_t n1 = norm1[row];
+        #pragma unroll
+        for (int b = 0; b < THR_N; b++) {
+            const int64_t col = col0 + ty + b * NT_N;
+            if (col < m) {
+                out[row * out_s0 + col * out_s1] = distance_kernel_fn<scalar_t>(
+                    n1 + norm2[col] - 2 * acc[a][b], kernel_type);
+            }
+        }
+    }
+}
+
+at::Tensor fused_distance_kernel_kernel(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out) {
+    CHECK_CUDA(mat1);
+    CHECK_CUDA(mat2);
+    CHECK_CUDA(norm1);
+    CHECK_CUDA(norm2);
+    CHECK_CUDA(out);
+    TORCH_CHECK(device_of(mat1) == device_of(out) && device_of(mat2) == device_of(out) &&
+                device_of(norm1) == device_of(out) && device_of(norm2) == device_of(out),
+        "All inputs must be on the same CUDA device.");
+    TORCH_CHECK(mat1.dim() == 2 && mat2.dim() == 2, "mat1 and mat2 must be 2D matrices.");
+    TORCH_CHECK(mat1.size(1) == mat2.size(1), "mat1 and mat2 must have the same number of columns.");
+    const int64_t n = mat1.size(0);
+    const int64_t m = mat2.size(0);
+    const int64_t d = mat1.size(1);
+    TORCH_CHECK(norm1.numel() == n, "norm1 must have as many elements as the rows of mat1.");
+    TORCH_CHECK(norm2.numel() == m, "norm2 must have as many elements as the rows of mat2.");
+    TORCH_CHECK(out.dim() == 2 && out.size(0) == n && out.size(1) == m,
+        "out must be of shape (", n, ", ", m, "). Found shape ", out.sizes());
+    TORCH_CHECK(kernel_type >= kGaussianKernel && kernel_type <= kMatern52Kernel,
+        "Invalid kernel_type ", kernel_type);
+    TORCH_CHECK(mat1.scalar_type() == out.scalar_type() && mat2.scalar_type() == out.scalar_type() &&
+                norm1.scalar_type() == out.scalar_type() && norm2.scalar_type() == out.scalar_type(),
+        "All inputs must have the same data-type.");
+    TORCH_CHECK(d <= std::numeric_limits<int>::max(), "Data dimension is too large.");
+    TORCH_CHECK(m <= (int64_t)BLK_N * 65535, "mat2 has too many rows.");
+    if (n == 0 || m == 0) {
+        return out;
+    }
+    const at::Tensor norm1_c = norm1.contiguous();
+    const at::Tensor norm2_c = norm2.contiguous();
+
+    const dim3 dimGrid((unsigned int)((n + BLK_M - 1) / BLK_M), (unsigned int)((m + BLK_N - 1) / BLK_N));
+    const dim3 dimBlock(NT_M, NT_N);
+
+    AT_DISPATCH_FLOATING_TYPES(out.scalar_type(), "dispatch_fused_distance_kernel", [&] {
+        at::DeviceGuard g(out.device());
+        at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+        fused_distance_kernel_ker<scalar_t><<<dimGrid, dimBlock, 0, stream.stream()>>>(
+            mat1.data_ptr<scalar_t>(),
+            mat2.data_ptr<scalar_t>(),
+            norm1_c.data_ptr<scalar_t>(),
+            norm2_c.data_ptr<scalar_t>(),
+            out.data_ptr<scalar_t>(),
+            n, m, (int)d,
+            mat1.stride(0), mat1.stride(1),
+            mat2.stride(0), mat2.stride(1),
+            out.stride(0), out.stride(1),
+            (int)kernel_type);
+        C10_CUDA_KERNEL_LAUNCH_CHECK();
+    });
+    return out;
+}
+
+// Kernel-vector product: each thread-block owns MV_BLK_M rows and MV_BLK_T columns of the output,
+// and loops over the rows of mat2 in steps of MV_BLK_N.
+#define MV_BLK_M 64
+#define MV_BLK_N 32
+#define MV_BLK_T 16
+#define MV_THR_N (MV_BLK_N / NT_N)
+#define MV_THR_T ((MV_BLK_M * MV_BLK_T) / (NT_M * NT_N))
+
+/*
+ * out[i, :] += sum_j f(norm1[i] + norm2[j] - 2 * <mat1[i], mat2[j]>) * vec[j, :]
+ * For every step along mat2, a MV_BLK_M x MV_BLK_N kernel tile is computed as in
+ * `fused_distance_kernel_ker`, but stored in shared memory instead of global memory. The tile
+ * is then multiplied with the matching rows of `vec`, and the products are accumulated in
+ * registers. Each output entry is only written once, at the end.
+ */
+template <typename scalar_t>
+__global__ void fused_distance_mmv_ker(
+        const scalar_t* __restrict__ mat1,
+        const scalar_t* __restrict__ mat2,
+        const scalar_t* __restrict__ vec,
+        const scalar_t* __restrict__ norm1,
+        const scalar_t* __restrict__ norm2,
+        scalar_t* __restrict__ out,
+        const int64_t n,
+        const int64_t m,
+        const int d,
+        const int t,
+        const int64_t m1_s0,
+        const int64_t m1_s1,
+        const int64_t m2_s0,
+        const int64_t m2_s1,
+        const int64_t v_s0,
+        const int64_t v_s1,
+        const int64_t out_s0,
+        const int64_t out_s1,
+        const int kernel_type) {
+    __shared__ scalar_t tile1[BLK_K][MV_BLK_M + 1];
+    __shared__ scalar_t tile2[BLK_K][MV_BLK_N + 1];
+    __shared__ scalar_t ker[MV_BLK_M][MV_BLK_N + 1];
+    __shared__ scalar_t vtile[MV_BLK_N][MV_BLK_T];
+
+    const int tx = threadIdx.x;
+    const int ty = threadIdx.y;
+    const int tid = ty * NT_M + tx;
+    const int64_t row0 = (int64_t)blockIdx.x * MV_BLK_M;
+    const int t0 = blockIdx.y * MV_BLK_T;
+    // Position of this thread in the (MV_BLK_M x MV_BLK_T) output tile.
+    const int out_r = tid % MV_BLK_M;
+    const int out_c = tid / MV_BLK_M;
+
+    scalar_t n1[THR_M];
+    #pragma unroll
+    for (int a = 0; a < THR_M; a++) {
+        const int64_t row = row0 + tx + a * NT_M;
+        n1[a] = row < n ? norm1[row] : (scalar_t)0;
+    }
+    scalar_t out_acc[MV_THR_T];
+    #pragma unroll
+    for (int q = 0; q < MV_THR_T; q++) {
+        out_acc[q] = 0;
+    }
+
+    for (int64_t col0 = 0; col0 < m; col0 += MV_BLK_N) {
+        scalar_t acc[THR_M][MV_THR_N];
+        #pragma unroll
+        for (int a = 0; a < THR_M; a++) {
+            #pragma unroll
+            for (int b = 0; b < MV_THR_N; b++) {
+                acc[a][b] = 0;
+            }
+        }
+        for (int k0 = 0; k0 < d; k0 += BLK_K) {
+            load_tile<scalar_t, MV_BLK_M>(mat1, tile1, row0, k0, n, d, m1_s0, m1_s1, tid);
+            load_tile<scalar_t, MV_BLK_N>(mat2, tile2, col0, k0, m, d, m2_s0, m2_s1, tid);
+            __syncthreads();
+            #pragma unroll
+            for (int k = 0; k < BLK_K; k++) {
+                scalar_t a_reg[THR_M], b_reg[MV_THR_N];
+                #pragma unroll
+                for (int a = 0; a < THR_M; a++) {
+                    a_reg[a] = tile1[k][tx + a * NT_M];
+                }
+                #pragma unroll
+                for (int b = 0; b < MV_THR_N; b++) {
+                    b_reg[b] = tile2[k][ty + b * NT_N];
+                }
+                #pragma unroll
+                for (int a = 0; a < THR_M; a++) {
+                    #pragma unroll
+                    for (int b = 0; b < MV_THR_N; b++) {
+                        acc[a][b] += a_reg[a] * b_reg[b];
+                    }
+                }
+            }
+            __syncthreads();
+        }
+
+        // Kernel tile to shared memory. Columns past the end of mat2 are zero, and so are the
+        // matching rows of `vtile`. Rows past the end of mat1 are never written to `out`.
+        #pragma unroll
+        for (int b = 0; b < MV_THR_N; b++) {
+            const int64_t col = col0 + ty + b * NT_N;
+            const scalar_t n2 = col < m ? norm2[col] : (scalar_t)0;
+            #pragma unroll
+            for (int a = 0; a < THR_M; a++) {
+                ker[tx + a * NT_M][ty + b * NT_N] = col < m ?
+                    distance_kernel_fn<scalar_t>(n1[a] + n2 - 2 * acc[a][b], kernel_type) : (scalar_t)0;
+            }
+        }
+        #pragma unroll
+        for (int l = 0; l < (MV_BLK_N * MV_BLK_T) / (NT_M * NT_N); l++) {
+            const int idx = tid + l * NT_M * NT_N;
+            const int j = idx / MV_BLK_T;
+            const int c = idx % MV_BLK_T;
+            vtile[j][c] = (col0 + j < m && t0 + c < t) ? vec[(col0 + j) * v_s0 + (t0 + c) * v_s1] : (scalar_t)0;
+        }
+        __syncthreads();
+
+        #pragma unroll 8
+        for (int j = 0; j < MV_BLK_N; j++) {
+            const scalar_t kval = ker[out_r][j];
+            #pragma unroll
+            for (int q = 0; q < MV_THR_T; q++) {
+                out_acc[q] += kval * vtile[j][out_c + q * (NT_M * NT_N / MV_BLK_M)];
+            }
+        }
+        __syncthreads();
+    }
+
+    const int64_t row = row0 + out_r;
+    if (row < n) {
+        #pragma unroll
+        for (int q = 0; q < MV_THR_T; q++) {
+            const int col = t0 + out_c + q * (NT_M * NT_N / MV_BLK_M);
+            if (col < t) {
+                out[row * out_s0 + col * out_s1] += out_acc[q];
+            }
+        }
+    }
+}
+
+at::Tensor fused_distance_mmv_kernel(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &vec,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out) {
+    CHECK_CUDA(mat1);
+    CHECK_CUDA(mat2);
+    CHECK_CUDA(vec);
+    CHECK_CUDA(norm1);
+    CHECK_CUDA(norm2);
+    CHECK_CUDA(out);
+    TORCH_CHECK(device_of(mat1) == device_of(out) && device_of(mat2) == device_of(out) &&
+                device_of(vec) == device_of(out) && device_of(norm1) == device_of(out) &&
+                device_of(norm2) == device_of(out),
+        "All inputs must be on the same CUDA device.");
+    TORCH_CHECK(mat1.dim() == 2 && mat2.dim() == 2 && vec.dim() == 2, "mat1, mat2 and vec must be 2D matrices.");
+    TORCH_CHECK(mat1.size(1) == mat2.size(1), "mat1 and mat2 must have the same number of columns.");
+    const int64_t n = mat1.size(0);
+    const int64_t m = mat2.size(0);
+    const int64_t d = mat1.size(1);
+    const int64_t t = vec.size(1);
+    TORCH_CHECK(vec.size(0) == m, "vec must have as many rows as mat2.");
+    TORCH_CHECK(norm1.numel() == n, "norm1 must have as many elements as the rows of mat1.");
+    TORCH_CHECK(norm2.numel() == m, "norm2 must have as many elements as the rows of mat2.");
+    TORCH_CHECK(out.dim() == 2 && out.size(0) == n && out.size(1) == t,
+        "out must be of shape (", n, ", ", t, "). Found shape ", out.sizes());
+    TORCH_CHECK(kernel_type >= kGaussianKernel && kernel_type <= kMatern52Kernel,
+        "Invalid kernel_type ", kernel_type);
+    TORCH_CHECK(mat1.scalar_type() == out.scalar_type() && mat2.scalar_type() == out.scalar_type() &&
+                vec.scalar_type() == out.scalar_type() && norm1.scalar_type() == out.scalar_type() &&
+                norm2.scalar_type() == out.scalar_type(),
+        "All inputs must have the same data-type.");
+    TORCH_CHECK(d <= std::numeric_limits<int>::max(), "Data dimension is too large.");
+    TORCH_CHECK(t <= (int64_t)MV_BLK_T * 65535, "vec has too many columns.");
+    if (n == 0 || m == 0 || t == 0) {
+        return out;
+    }
+    const at::Tensor norm1_c = norm1.contiguous();
+    const at::Tensor norm2_c = norm2.contiguous();
+
+    const dim3 dimGrid((unsigned int)((n + MV_BLK_M - 1) / MV_BLK_M), (unsigned int)((t + MV_BLK_T - 1) / MV_BLK_T));
+    const dim3 dimBlock(NT_M, NT_N);
+
+    AT_DISPATCH_FLOATING_TYPES(out.scalar_type(), "dispatch_fused_distance_mmv", [&] {
+        at::DeviceGuard g(out.device());
+        at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+        fused_distance_mmv_ker<scalar_t><<<dimGrid, dimBlock, 0, stream.stream()>>>(
+            mat1.data_ptr<scalar_t>(),
+            mat2.data_ptr<scalar_t>(),
+            vec.data_ptr<scalar_t>(),
+            norm1_c.data_ptr<scalar_t>(),
+            norm2_c.data_ptr<scalar_t>(),
+            out.data_ptr<scalar_t>(),
+            n, m, (int)d, (int)t,
+            mat1.stride(0), mat1.stride(1),
+            mat2.stride(0), mat2.stride(1),
+            vec.stride(0), vec.stride(1),
+            out.stride(0), out.stride(1),
+            (int)kernel_type);
+        C10_CUDA_KERNEL_LAUNCH_CHECK();
+    });
+    return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::fused_distance_kernel"),
+      TORCH_FN(fused_distance_kernel_kernel));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::fused_distance_mmv"),
+      TORCH_FN(fused_distance_mmv_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
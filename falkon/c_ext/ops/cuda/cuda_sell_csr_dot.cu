@@ -0,0 +1,183 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/AccumulateType.h>
+#include <ATen/cuda/CUDAContext.h>
+#include <c10/cuda/CUDAException.h>
+
+#include "../helpers.h"
+#include "../sell_csr_dot.h"
+
+namespace falkon {
+namespace ops {
+namespace {
+
+// Each warp processes one slice of the sliced-ELL matrix (one row per lane).
+#define NUM_WARPS 8
+// Number of non-zeros of a row of the CSR matrix which are staged in shared memory at once.
+#define SELL_CHUNK 1024
+#define MAX_GRID_SIZE 65535
+
+/*
+ * out[row_perm[r], j] = <A[r], B[j]> for a sliced-ELL matrix A with slices of C10_WARP_SIZE rows
+ * and a CSR matrix B. Both must have sorted column indices within each row.
+ *
+ * The rows of B (taken from blockIdx.y) are loaded into shared memory, and each lane looks up
+ * the non-zeros of its own row of A with a binary search. Since the non-zeros of a slice are
+ * stored column-major, the lanes of a warp read A with coalesced accesses, and since slices
+ * contain rows of similar length (rows are sorted by length) there is little divergence.
+ */
+template <typename scalar_t, typename index_t>
+__global__ void sell_csr_dot_ker(
+        const index_t* __restrict__ slice_ptr,
+        const index_t* __restrict__ sell_index,
+        const scalar_t* __restrict__ sell_data,
+        const index_t* __restrict__ row_perm,
+        const int64_t num_slices,
+        const int64_t N,
+        const index_t* __restrict__ indexptr2,
+        const index_t* __restrict__ indices2,
+        const scalar_t* __restrict__ data2,
+        const int64_t M,
+        scalar_t* __restrict__ out,
+        const int64_t out_s0,
+        const int64_t out_s1) {
+    using acc_t = at::acc_type<scalar_t, true>;
+    __shared__ index_t sh_index[SELL_CHUNK];
+    __shared__ scalar_t sh_data[SELL_CHUNK];
+    const int lane = threadIdx.x % C10_WARP_SIZE;
+
+    // All loops containing __syncthreads only depend on block-level values.
+    for (int64_t s_blk = (int64_t)blockIdx.x * NUM_WARPS; s_blk < num_slices; s_blk += (int64_t)gridDim.x * NUM_WARPS) {
+        const int64_t s = s_blk + threadIdx.x / C10_WARP_SIZE;
+        const int64_t r = s * C10_WARP_SIZE + lane;
+        const bool valid = s < num_slices && r < N;
+        int64_t a_start = 0, width = 0;
+        scalar_t *out_row = out;
+        if (valid) {
+            a_start = slice_ptr[s] + lane;
+            width = (slice_ptr[s + 1] - slice_ptr[s]) / C10_WARP_SIZE;
+            out_row = out + (int64_t)row_perm[r] * out_s0;
+        }
+        for (int64_t j = blockIdx.y; j < M; j += gridDim.y) {
+            const int64_t b_start = indexptr2[j], b_end = indexptr2[j + 1];
+            acc_t acc = 0;
+            for (int64_t c_start = b_start; c_start < b_end; c_start += SELL_CHUNK) {
+                const int c_len = (int)min((int64_t)SELL_CHUNK, b_end - c_start);
+                __syncthreads();
+                for (int t = threadIdx.x; t < c_len; t += blockDim.x) {
+                    sh_index[t] = indices2[c_start + t];
+                    sh_data[t] = data2[c_start + t];
+                }
+                __syncthreads();
+                const index_t first_col = sh_index[0], last_col = sh_index[c_len - 1];
+                int lo = 0;
+                for (int64_t k = 0; k < width; k++) {
+                    const int64_t p = a_start + k * C10_WARP_SIZE;
+                    const index_t col = sell_index[p];
+                    if (col < 0 || col > last_col) {  // padding, or past the end of this chunk
+                        break;
+                    }
+                    if (col < first_col) {
+                        continue;
+                    }
+                    int hi = c_len;
+                    while (lo < hi) {
+                        const int mid = lo + (hi - lo) / 2;
+                        if (sh_index[mid] < col) {
+                            lo = mid + 1;
+                        } else {
+                            hi = mid;
+                        }
+                    }
+                    if (lo < c_len && sh_index[lo] == col) {
+                        acc += static_cast<acc_t>(sell_data[p]) * static_cast<acc_t>(sh_data[lo]);
+                    }
+                }
+            }
+            if (valid) {
+                out_row[j * out_s1] = static_cast<scalar_t>(acc);
+            }
+        }
+    }
+}
+
+at::Tensor sell_csr_dot_kernel(
+        const at::Tensor &slice_ptr,
+        const at::Tensor &sell_index,
+        const at::Tensor &sell_data,
+        const at::Tensor &row_perm,
+        int64_t slice_size,
+        const at::Tensor &indexptr2,
+        const at::Tensor &indices2,
+        const at::Tensor &data2,
+        at::Tensor &out) {
+    CHECK_CUDA(slice_ptr);
+    CHECK_CUDA(sell_index);
+    CHECK_CUDA(sell_data);
+    CHECK_CUDA(row_perm);
+    CHECK_CUDA(indexptr2);
+    CHECK_CUDA(indices2);
+    CHECK_CUDA(data2);
+    CHECK_CUDA(out);
+    TORCH_CHECK(device_of(slice_ptr) == device_of(out) && device_of(sell_index) == device_of(out) &&
+                device_of(sell_data) == device_of(out) && device_of(row_perm) == device_of(out) &&
+                device_of(indexptr2) == device_of(out) && device_of(indices2) == device_of(out) &&
+                device_of(data2) == device_of(out), "All inputs must be on the same CUDA device.");
+    TORCH_CHECK(slice_size == C10_WARP_SIZE, "On CUDA, slice_size must be equal to the warp size (",
+                C10_WARP_SIZE, ") but found ", slice_size);
+    TORCH_CHECK(slice_ptr.is_contiguous() && sell_index.is_contiguous() && sell_data.is_contiguous() &&
+                row_perm.is_contiguous(), "Sliced-ELL arrays must be contiguous");
+    TORCH_CHECK(indexptr2.is_contiguous() && indices2.is_contiguous() && data2.is_contiguous(),
+                "CSR arrays must be contiguous");
+    TORCH_CHECK(sell_index.scalar_type() == slice_ptr.scalar_type() && row_perm.scalar_type() == slice_ptr.scalar_type() &&
+                indexptr2.scalar_type() == slice_ptr.scalar_type() && indices2.scalar_type() == slice_ptr.scalar_type(),
+                "All index arrays must be of the same type.");
+    TORCH_CHECK(sell_data.scalar_type() == out.scalar_type() && data2.scalar_type() == out.scalar_type(),
+                "Matrices A, B and out must be of the same type.");
+    const int64_t N = row_perm.numel(), M = indexptr2.numel() - 1;
+    const int64_t num_slices = slice_ptr.numel() - 1;
+    TORCH_CHECK(num_slices == (N + slice_size - 1) / slice_size, "Number of slices does not match number of rows");
+    TORCH_CHECK(out.dim() == 2 && out.size(0) == N && out.size(1) == M,
+                "Output must be a ", N, " x ", M, " matrix");
+    TORCH_CHECK(out.stride(0) == 1 || out.stride(1) == 1, "Output matrix must be either C- or F-contiguous");
+    if (N == 0 || M == 0) {
+        return out;
+    }
+
+    const dim3 dimGrid(
+        (unsigned int)std::min<int64_t>((num_slices + NUM_WARPS - 1) / NUM_WARPS, MAX_GRID_SIZE),
+        (unsigned int)std::min<int64_t>(M, MAX_GRID_SIZE));
+    AT_DISPATCH_FLOATING_TYPES(sell_data.scalar_type(), "sell_csr_dot_cuda", [&] {
+        AT_DISPATCH_INDEX_TYPES(slice_ptr.scalar_type(), "sell_csr_dot_cuda_index", [&] {
+            at::DeviceGuard g(out.device());
+            at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+            sell_csr_dot_ker<scalar_t, index_t><<<dimGrid, NUM_WARPS * C10_WARP_SIZE, 0, stream.stream()>>>(
+                slice_ptr.data_ptr<index_t>(),
+                sell_index.data_ptr<index_t>(),
+                sell_data.data_ptr<scalar_t>(),
+                row_perm.data_ptr<index_t>(),
+                num_slices,
+                N,
+                indexptr2.data_ptr<index_t>(),
+                indices2.data_ptr<index_t>(),
+                data2.data_ptr<scalar_t>(),
+                M,
+                out.data_ptr<scalar_t>(),
+                out.stride(0),
+                out.stride(1));
+            C10_CUDA_KERNEL_LAUNCH_CHECK();
+        });
+    });
+    return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::sell_csr_dot"),
+      TORCH_FN(sell_csr_dot_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
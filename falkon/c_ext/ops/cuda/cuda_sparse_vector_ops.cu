@@ -0,0 +1,211 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/AccumulateType.h>
+#include <ATen/cuda/CUDAContext.h>
+#include <ATen/cuda/DeviceUtils.cuh>
+#include <c10/cuda/CUDAException.h>
+
+#include "../helpers.h"
+#include "../sparse_vector_ops.h"
+
+namespace falkon {
+namespace ops {
+namespace {
+
+// Each warp processes one row of the CSR matrices at a time.
+#define NUM_WARPS 8
+#define MAX_GRID_SIZE 65535
+
+template <typename acc_t>
+__device__ __forceinline__ acc_t warp_sum(acc_t val) {
+    #pragma unroll
+    for (int offset = C10_WARP_SIZE / 2; offset > 0; offset /= 2) {
+        val += WARP_SHFL_DOWN(val, offset);
+    }
+    return val;
+}
+
+template <typename scalar_t, typename index_t, bool take_sqrt>
+__global__ void sparse_norm_ker(
+        const scalar_t* __restrict__ data,
+        const index_t* __restrict__ indptr,
+        scalar_t* __restrict__ out,
+        const int64_t N) {
+    using acc_t = at::acc_type<scalar_t, true>;
+    const int lane = threadIdx.x % C10_WARP_SIZE;
+    const int64_t warp_id = (int64_t)blockIdx.x * NUM_WARPS + threadIdx.x / C10_WARP_SIZE;
+    const int64_t num_warps = (int64_t)gridDim.x * NUM_WARPS;
+    for (int64_t i = warp_id; i < N; i += num_warps) {
+        acc_t val = 0;
+        for (int64_t j = indptr[i] + lane; j < indptr[i + 1]; j += C10_WARP_SIZE) {
+            const acc_t d = static_cast<acc_t>(data[j]);
+            val += d * d;
+        }
+        val = warp_sum(val);
+        if (lane == 0) {
+            out[i] = static_cast<scalar_t>(take_sqrt ? ::sqrt(val) : val);
+        }
+    }
+}
+
+/*
+ * Row-wise dot products of two CSR matrices with sorted column indices. The lanes of a warp
+ * go through the non-zeros of the shorter of the two rows, and look for the matching column
+ * of the other row with a binary search.
+ */
+template <typename scalar_t, typename index_t>
+__global__ void sparse_bdot_ker(
+        const scalar_t* __restrict__ data1,
+        const index_t* __restrict__ indices1,
+        const index_t* __restrict__ indptr1,
+        const scalar_t* __restrict__ data2,
+        const index_t* __restrict__ indices2,
+        const index_t* __restrict__ indptr2,
+        scalar_t* __restrict__ out,
+        const int64_t N) {
+    using acc_t = at::acc_type<scalar_t, true>;
+    const int lane = threadIdx.x % C10_WARP_SIZE;
+    const int64_t warp_id = (int64_t)blockIdx.x * NUM_WARPS + threadIdx.x / C10_WARP_SIZE;
+    const int64_t num_warps = (int64_t)gridDim.x * NUM_WARPS;
+    for (int64_t i = warp_id; i < N; i += num_warps) {
+        int64_t rs_a = indptr1[i], re_a = indptr1[i + 1];
+        int64_t rs_b = indptr2[i], re_b = indptr2[i + 1];
+        const scalar_t *data_a = data1, *data_b = data2;
+        const index_t *indices_a = indices1, *indices_b = indices2;
+        if (re_a - rs_a > re_b - rs_b) {
+            int64_t tmp = rs_a; rs_a = rs_b; rs_b = tmp;
+            tmp = re_a; re_a = re_b; re_b = tmp;
+            data_a = data2; data_b = data1;
+            indices_a = indices2; indices_b = indices1;
+        }
+        acc_t val = 0;
+        for (int64_t j = rs_a + lane; j < re_a; j += C10_WARP_SIZE) {
+            const index_t col = indices_a[j];
+            int64_t lo = rs_b, hi = re_b;
+            while (lo < hi) {
+                const int64_t mid = lo + (hi - lo) / 2;
+                if (indices_b[mid] < col) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (lo < re_b && indices_b[lo] == col) {
+                val += static_cast<acc_t>(data_a[j]) * static_cast<acc_t>(data_b[lo]);
+            }
+        }
+        val = warp_sum(val);
+        if (lane == 0) {
+            out[i] = static_cast<scalar_t>(val);
+        }
+    }
+}
+
+inline dim3 grid_for_rows(const int64_t N) {
+    return dim3((unsigned int)std::min<int64_t>((N + NUM_WARPS - 1) / NUM_WARPS, MAX_GRID_SIZE));
+}
+
+void check_csr_args(const at::Tensor &indexptr, const at::Tensor &data, const at::Tensor &out) {
+    CHECK_CUDA(indexptr);
+    CHECK_CUDA(data);
+    CHECK_CUDA(out);
+    TORCH_CHECK(device_of(indexptr) == device_of(out) && device_of(data) == device_of(out),
+        "All inputs must be on the same CUDA device.");
+    TORCH_CHECK(indexptr.dim() == 1 && indexptr.stride(0) == 1, "indexptr must be 1D and memory-contiguous");
+    TORCH_CHECK(data.dim() == 1 && data.stride(0) == 1, "data must be 1D and memory-contiguous");
+    TORCH_CHECK(out.size(0) == indexptr.size(0) - 1, "Input shape mismatch");
+    if (out.dim() >= 2) {
+        TORCH_CHECK(out.size(1) == 1, "Output array must be 1D");
+    }
+    TORCH_CHECK(out.stride(0) == 1 || out.size(0) <= 1, "Output array must be memory-contiguous");
+    TORCH_CHECK(out.scalar_type() == data.scalar_type(), "Matrices A, B and out must be of the same type.");
+}
+
+template <bool take_sqrt>
+at::Tensor sparse_norm_kernel(
+        const at::Tensor &indexptr,
+        const at::Tensor &data,
+        at::Tensor &out) {
+    check_csr_args(indexptr, data, out);
+    const int64_t N = indexptr.size(0) - 1;
+    if (N <= 0) {
+        return out;
+    }
+    AT_DISPATCH_FLOATING_TYPES(data.scalar_type(), "sparse_norm_kernel", [&] {
+        AT_DISPATCH_INDEX_TYPES(indexptr.scalar_type(), "sparse_norm_kernel", [&] {
+            at::DeviceGuard g(out.device());
+            at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+            sparse_norm_ker<scalar_t, index_t, take_sqrt><<<grid_for_rows(N), NUM_WARPS * C10_WARP_SIZE, 0, stream.stream()>>>(
+                data.data_ptr<scalar_t>(),
+                indexptr.data_ptr<index_t>(),
+                out.data_ptr<scalar_t>(),
+                N);
+            C10_CUDA_KERNEL_LAUNCH_CHECK();
+        });
+    });
+    return out;
+}
+
+at::Tensor sparse_square_norm_kernel(const at::Tensor &indexptr, const at::Tensor &data, at::Tensor &out) {
+    return sparse_norm_kernel<false>(indexptr, data, out);
+}
+
+at::Tensor sparse_row_norm_kernel(const at::Tensor &indexptr, const at::Tensor &data, at::Tensor &out) {
+    return sparse_norm_kernel<true>(indexptr, data, out);
+}
+
+at::Tensor sparse_bdot_kernel(
+        const at::Tensor &indexptr1,
+        const at::Tensor &indices1,
+        const at::Tensor &data1,
+        const at::Tensor &indexptr2,
+        const at::Tensor &indices2,
+        const at::Tensor &data2,
+        at::Tensor &out) {
+    check_csr_args(indexptr1, data1, out);
+    check_csr_args(indexptr2, data2, out);
+    CHECK_CUDA(indices1);
+    CHECK_CUDA(indices2);
+    TORCH_CHECK(indices1.dim() == 1 && indices1.stride(0) == 1, "indices must be 1D and memory-contiguous");
+    TORCH_CHECK(indices2.dim() == 1 && indices2.stride(0) == 1, "indices must be 1D and memory-contiguous");
+    TORCH_CHECK(indexptr1.scalar_type() == indices1.scalar_type() && indexptr1.scalar_type() == indexptr2.scalar_type() &&
+                indexptr1.scalar_type() == indices2.scalar_type(), "All index arrays must be of the same type.");
+    const int64_t N = indexptr1.size(0) - 1;
+    if (N <= 0) {
+        return out;
+    }
+    AT_DISPATCH_FLOATING_TYPES(data1.scalar_type(), "sparse_bdot_kernel", [&] {
+        AT_DISPATCH_INDEX_TYPES(indexptr1.scalar_type(), "sparse_bdot_kernel", [&] {
+            at::DeviceGuard g(out.device());
+            at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+            sparse_bdot_ker<scalar_t, index_t><<<grid_for_rows(N), NUM_WARPS * C10_WARP_SIZE, 0, stream.stream()>>>(
+                data1.data_ptr<scalar_t>(),
+                indices1.data_ptr<index_t>(),
+                indexptr1.data_ptr<index_t>(),
+                data2.data_ptr<scalar_t>(),
+                indices2.data_ptr<index_t>(),
+                indexptr2.data_ptr<index_t>(),
+                out.data_ptr<scalar_t>(),
+                N);
+            C10_CUDA_KERNEL_LAUNCH_CHECK();
+        });
+    });
+    return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::sparse_bdot"),
+      TORCH_FN(sparse_bdot_kernel));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::sparse_square_norm"),
+      TORCH_FN(sparse_square_norm_kernel));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::sparse_norm"),
+      TORCH_FN(sparse_row_norm_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
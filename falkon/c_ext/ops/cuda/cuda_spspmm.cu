@@ -1,7 +1,7 @@
 #include <torch/library.h>
 #include <ATen/cuda/CUDAContext.h>
 #include <ATen/cuda/Exceptions.h>
-#include <c10/cuda/CUDACachingAllocator.h>
+#include <ATen/ATen.h>
 
 #include <cusparse.h>
 
@@ -22,6 +22,18 @@ namespace {
 #include <library_types.h>
 #endif
 
+/*
+ * Pointer to at least `nbytes` bytes of device memory from the (uint8) `workspace` tensor.
+ * The workspace is only reallocated if it is too small.
+ */
+inline void* workspace_data(at::Tensor &workspace, size_t nbytes) {
+  const int64_t size = std::max<int64_t>((int64_t)nbytes, 1);
+  if (workspace.numel() < size) {
+    workspace.resize_({size});
+  }
+  return workspace.data_ptr();
+}
+
 #if IS_GENERIC_AVAILABLE()
 
 template<typename scalar_t>
@@ -33,7 +45,9 @@ run_spspmm_cuda(
     const at::Tensor &rowptrB,
     const at::Tensor &colB,
     const at::Tensor &valB,
-    int64_t N
+    int64_t N,
+    at::Tensor &workspace1,
+    at::Tensor &workspace2
 )
 {
   constexpr auto cuda_value_type = std::is_same<float, scalar_t>::value ? CUDA_R_32F : CUDA_R_64F;
@@ -44,9 +58,8 @@ run_spspmm_cuda(
   const int64_t M = rowptrA.numel() - 1, K = rowptrB.numel() - 1;
   const int nnzA = valA.numel(), nnzB = valB.numel();
   const scalar_t alpha = (scalar_t)1.0, beta = (scalar_t)0.0;
-  auto& allocator = *c10::cuda::CUDACachingAllocator::get();
 
-  // Convert indices to int (could be long at input)
+  // Convert indices to int (could be long at input, this is a no-op for int inputs)
   const at::Tensor &rowptrA_int = rowptrA.toType(at::kInt);
   const at::Tensor &colA_int = colA.toType(at::kInt);
   const at::Tensor &rowptrB_int = rowptrB.toType(at::kInt);
@@ -69,8 +82,7 @@ run_spspmm_cuda(
   TORCH_CUDASPARSE_CHECK(cusparseSpGEMM_workEstimation(handle, CUSPARSE_OPERATION_NON_TRANSPOSE, CUSPARSE_OPERATION_NON_TRANSPOSE,
                                                        &alpha, matA, matB, &beta, matC, cuda_value_type, CUSPARSE_SPGEMM_DEFAULT,
                                                        spgemmDesc, &bufferSize1, NULL));
-  auto dataPtr1 = allocator.allocate(bufferSize1);
-  dBuffer1 = dataPtr1.get();
+  dBuffer1 = workspace_data(workspace1, bufferSize1);
   // Step 2. Fill buffer 1?
   TORCH_CUDASPARSE_CHECK(cusparseSpGEMM_workEstimation(handle, CUSPARSE_OPERATION_NON_TRANSPOSE, CUSPARSE_OPERATION_NON_TRANSPOSE,
                                                        &alpha, matA, matB, &beta, matC, cuda_value_type, CUSPARSE_SPGEMM_DEFAULT,
@@ -79,8 +91,7 @@ run_spspmm_cuda(
   TORCH_CUDASPARSE_CHECK(cusparseSpGEMM_compute(handle, CUSPARSE_OPERATION_NON_TRANSPOSE, CUSPARSE_OPERATION_NON_TRANSPOSE,
                                                 &alpha, matA, matB, &beta, matC, cuda_value_type, CUSPARSE_SPGEMM_DEFAULT,
                                                 spgemmDesc, &bufferSize2, NULL));
-  auto dataPtr2 = allocator.allocate(bufferSize2);
-  dBuffer2 = dataPtr2.get();
+  dBuffer2 = workspace_data(workspace2, bufferSize2);
   // Step 4. compute the intermediate product of A * B
   TORCH_CUDASPARSE_CHECK(cusparseSpGEMM_compute(handle, CUSPARSE_OPERATION_NON_TRANSPOSE, CUSPARSE_OPERATION_NON_TRANSPOSE,
                                                 &alpha, matA, matB, &beta, matC, cuda_value_type, CUSPARSE_SPGEMM_DEFAULT,
@@ -214,7 +225,9 @@ run_spspmm_cuda(
     const at::Tensor &rowptrB,
     const at::Tensor &colB,
     const at::Tensor &valB,
-    int64_t N
+    int64_t N,
+    at::Tensor &workspace1,
+    at::Tensor &workspace2
 )
 {
   /* Input checks: all matrices should be in CSR format, matrix `D` is not used.
@@ -233,7 +246,7 @@ run_spspmm_cuda(
   *    cusparseXcsrgemm2 function
   */
 
-  // Convert indices to int (could be long at input)
+  // Convert indices to int (could be long at input, this is a no-op for int inputs)
   const at::Tensor &rowptrA_int = rowptrA.toType(at::kInt);
   const at::Tensor &colA_int = colA.toType(at::kInt);
   const at::Tensor &rowptrB_int = rowptrB.toType(at::kInt);
@@ -283,9 +296,7 @@ run_spspmm_cuda(
     &bufferSize /* Output */
   ));
 
-  auto& allocator = *c10::cuda::CUDACachingAllocator::get();
-  auto bufferDataPtr = allocator.allocate(bufferSize);
-  auto csrGemmBuffer = bufferDataPtr.get();
+  void* csrGemmBuffer = workspace_data(workspace1, bufferSize);
 
   // Step 3: Compute CSR row pointer. This will fill `rowptrC_data` and `nnzC`
   TORCH_CUDASPARSE_CHECK(cusparseXcsrgemm2Nnz(
@@ -309,7 +320,7 @@ run_spspmm_cuda(
     rowptrC.data_ptr<int>(), /* Output: column data array for C */
     &nnzC, /* Output: number of nnz entries in C */
     info,
-    bufferDataPtr.get() /* Additional workspace in GPU memory */
+    csrGemmBuffer /* Additional workspace in GPU memory */
   ));
 
   // Step 4: Compute CSR entries.
@@ -344,7 +355,7 @@ run_spspmm_cuda(
     rowptrC.data_ptr<int>(), /* Row-pointer array for C */
     colC.data_ptr<int>(), /* Column data array for C */
     info,
-    bufferDataPtr.get() /* Additional workspace in GPU memory */
+    csrGemmBuffer /* Additional workspace in GPU memory */
   ));
 
   // Step 5: Free the opaque structure.
@@ -356,14 +367,16 @@ run_spspmm_cuda(
 #endif
 
 std::tuple<at::Tensor, at::Tensor, at::Tensor>
-spspmm_cuda(
+spspmm_ws_cuda(
     const at::Tensor &rowptrA,
     const at::Tensor &colA,
     const at::Tensor &valA,
     const at::Tensor &rowptrB,
     const at::Tensor &colB,
     const at::Tensor &valB,
-    int64_t N
+    int64_t N,
+    at::Tensor &workspace1,
+    at::Tensor &workspace2
 )
 {
   CHECK_CUDA(rowptrA);
@@ -372,6 +385,8 @@ spspmm_cuda(
   CHECK_CUDA(rowptrB);
   CHECK_CUDA(colB);
   CHECK_CUDA(valB);
+  CHECK_CUDA(workspace1);
+  CHECK_CUDA(workspace2);
 
   TORCH_CHECK(rowptrA.dim() == 1);
   TORCH_CHECK(colA.dim() == 1);
@@ -385,22 +400,45 @@ spspmm_cuda(
 
   TORCH_CHECK(valA.dtype() == valB.dtype(), "Expected A, B with equal dtypes but found ",
     valA.dtype(), ", ", valB.dtype());
+  TORCH_CHECK(workspace1.scalar_type() == at::kByte && workspace2.scalar_type() == at::kByte,
+    "Workspaces must be uint8 tensors.");
+  TORCH_CHECK(workspace1.device() == valA.device() && workspace2.device() == valA.device(),
+    "Workspaces must be on the same device as the input matrices.");
 
   std::tuple<at::Tensor, at::Tensor, at::Tensor> out;
   at::DeviceGuard g(rowptrA.device());
 
   AT_DISPATCH_FLOATING_TYPES(valA.scalar_type(), "dispatch_spspmm", [&] {
-    out = run_spspmm_cuda<scalar_t>(rowptrA, colA, valA, rowptrB, colB, valB, N);
+    out = run_spspmm_cuda<scalar_t>(rowptrA, colA, valA, rowptrB, colB, valB, N, workspace1, workspace2);
   });
   return out;
 }
 
+std::tuple<at::Tensor, at::Tensor, at::Tensor>
+spspmm_cuda(
+    const at::Tensor &rowptrA,
+    const at::Tensor &colA,
+    const at::Tensor &valA,
+    const at::Tensor &rowptrB,
+    const at::Tensor &colB,
+    const at::Tensor &valB,
+    int64_t N
+)
+{
+  at::Tensor workspace1 = at::empty({0}, valA.options().dtype(at::kByte));
+  at::Tensor workspace2 = at::empty({0}, valA.options().dtype(at::kByte));
+  return spspmm_ws_cuda(rowptrA, colA, valA, rowptrB, colB, valB, N, workspace1, workspace2);
+}
+
 } // namespace
 
 TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
   m.impl(
       TORCH_SELECTIVE_NAME("falkon::spspmm"),
       TORCH_FN(spspmm_cuda));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::spspmm_ws"),
+      TORCH_FN(spspmm_ws_cuda));
 }
 
 } // namespace ops
@@ -0,0 +1,117 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/cuda/CUDAContext.h>
+#include <ATen/cuda/Exceptions.h>
+
+#include "../helpers.h"
+#include "cuda_helpers.cuh"
+
+namespace falkon {
+namespace ops {
+
+namespace {
+
+#define NB 32
+
+/*
+ * mat[i, j] = mat[i, j] * multiplier * row_vec[i] * col_vec[j] + (i == j) * diag_add
+ * on the upper or lower triangle of a F-contiguous matrix. The grid is 1D over the
+ * triangular tiles, each block handles one NB*NB tile.
+ */
+template <typename scalar_t, bool upper>
+__global__ void triang_affine_ker(
+        scalar_t* __restrict__ mat,
+        const scalar_t* __restrict__ row_vec,
+        const scalar_t* __restrict__ col_vec,
+        const scalar_t multiplier,
+        const scalar_t diag_add,
+        const int mat_stride,
+        const int mat_size) {
+    const int2 tile_pos = upper ? tri_index_upper(blockIdx.x) : tri_index_lower(blockIdx.x);
+    // tx runs along rows for coalesced accesses
+    const int col = tile_pos.x * NB + threadIdx.y;
+    const int row = tile_pos.y * NB + threadIdx.x;
+    if (col >= mat_size || row >= mat_size || (upper ? row > col : row < col)) {
+        return;
+    }
+    scalar_t mul = multiplier;
+    if (row_vec != nullptr) {
+        mul *= row_vec[row];
+    }
+    if (col_vec != nullptr) {
+        mul *= col_vec[col];
+    }
+    const int64_t pos = (int64_t)col * mat_stride + row;
+    scalar_t val = mat[pos] * mul;
+    if (row == col) {
+        val += diag_add;
+    }
+    mat[pos] = val;
+}
+
+at::Tensor triang_affine_kernel(
+        at::Tensor &mat,
+        const c10::optional<at::Tensor> &row_vec,
+        const c10::optional<at::Tensor> &col_vec,
+        const double multiplier,
+        const double diag_add,
+        const bool upper) {
+    CHECK_CUDA(mat);
+    TORCH_CHECK(mat.dim() == 2 && mat.size(0) == mat.size(1), "mat must be a square 2D matrix.");
+    TORCH_CHECK(mat.stride(0) == 1 || mat.stride(1) == 1, "mat must be contiguous in one dimension.");
+    const int64_t mat_size = mat.size(0);
+    at::Tensor row_vec_c, col_vec_c;
+    if (row_vec.has_value()) {
+        CHECK_CUDA(row_vec.value());
+        TORCH_CHECK(device_of(row_vec.value()) == device_of(mat), "mat and row_vec must be on the same CUDA device.");
+        TORCH_CHECK(row_vec->numel() == mat_size, "row_vec must be a vector with size matching mat.");
+        row_vec_c = row_vec->contiguous();
+    }
+    if (col_vec.has_value()) {
+        CHECK_CUDA(col_vec.value());
+        TORCH_CHECK(device_of(col_vec.value()) == device_of(mat), "mat and col_vec must be on the same CUDA device.");
+        TORCH_CHECK(col_vec->numel() == mat_size, "col_vec must be a vector with size matching mat.");
+        col_vec_c = col_vec->contiguous();
+    }
+
+    int64_t mat_stride = mat.stride(1);
+    bool bupper = upper;
+    // Flip operation if C-contiguous
+    if (!is_fortran_contig(mat)) {
+        bupper = !bupper;
+        std::swap(row_vec_c, col_vec_c);
+        mat_stride = mat.stride(0);
+    }
+
+    const int grid_height = ceildiv(mat_size, NB);
+    const dim3 dimGrid(grid_height * (grid_height + 1) / 2, 1);
+    const dim3 dimBlock(NB, NB);
+
+    AT_DISPATCH_FLOATING_TYPES(mat.scalar_type(), "dispatch_triang_affine", [&] {
+        at::DeviceGuard g(mat.device());
+        at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+        const scalar_t *row_ptr = row_vec_c.defined() ? row_vec_c.data_ptr<scalar_t>() : nullptr;
+        const scalar_t *col_ptr = col_vec_c.defined() ? col_vec_c.data_ptr<scalar_t>() : nullptr;
+        if (bupper) {
+            triang_affine_ker<scalar_t, true><<<dimGrid, dimBlock, 0, stream.stream()>>>(
+                mat.data_ptr<scalar_t>(), row_ptr, col_ptr, (scalar_t)multiplier, (scalar_t)diag_add,
+                (int)mat_stride, (int)mat_size);
+        } else {
+            triang_affine_ker<scalar_t, false><<<dimGrid, dimBlock, 0, stream.stream()>>>(
+                mat.data_ptr<scalar_t>(), row_ptr, col_ptr, (scalar_t)multiplier, (scalar_t)diag_add,
+                (int)mat_stride, (int)mat_size);
+        }
+    });
+    return mat;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::triang_affine"),
+      TORCH_FN(triang_affine_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
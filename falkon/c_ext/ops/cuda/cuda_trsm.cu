@@ -0,0 +1,89 @@
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/cuda/CUDAContext.h>
+#include <c10/cuda/CUDAGuard.h>
+
+#include "../helpers.h"
+#include "../trsm.h"
+#include "cublas_bindings.h"
+
+namespace falkon {
+namespace ops {
+namespace {
+
+/*
+ * Triangular solve with cuBLAS on the current stream, directly on the memory of the input
+ * tensors: no copy is made for either C or F-contiguous inputs.
+ */
+at::Tensor trsm_kernel(
+        const at::Tensor &A,
+        at::Tensor &B,
+        const double alpha,
+        const bool upper,
+        const bool transpose) {
+    CHECK_CUDA(A);
+    CHECK_CUDA(B);
+    TORCH_CHECK(A.device() == B.device(), "A and B must be on the same CUDA device.");
+    const TrsmParams p = trsm_params(A, B, upper, transpose);
+    if (p.m == 0 || p.n == 0) {
+        return B;
+    }
+    const c10::cuda::CUDAGuard g(A.device());
+    AT_DISPATCH_FLOATING_TYPES(A.scalar_type(), "trsm", [&] {
+        auto handle = at::cuda::getCurrentCUDABlasHandle();
+        const scalar_t cast_alpha = (scalar_t)alpha;
+        trsm<scalar_t>(
+            handle,
+            p.left ? CUBLAS_SIDE_LEFT : CUBLAS_SIDE_RIGHT,
+            p.upper ? CUBLAS_FILL_MODE_UPPER : CUBLAS_FILL_MODE_LOWER,
+            p.transpose ? CUBLAS_OP_T : CUBLAS_OP_N,
+            CUBLAS_DIAG_NON_UNIT,
+            (int)p.m,
+            (int)p.n,
+            &cast_alpha,
+            A.data_ptr<scalar_t>(),
+            (int)p.lda,
+            B.data_ptr<scalar_t>(),
+            (int)p.ldb);
+    });
+    return B;
+}
+
+/*
+ * The Falkon preconditioner stores T in upper(fC) and A.T in lower(fC), with their diagonals
+ * in dT and dA. Overwrite `out` with T^-1 A^-1 out, or with A^-T T^-T out if `transpose`.
+ */
+at::Tensor pc_apply_kernel(
+        at::Tensor &fC,
+        const at::Tensor &dT,
+        const at::Tensor &dA,
+        at::Tensor &out,
+        const bool transpose) {
+    const c10::cuda::CUDAGuard g(fC.device());
+    if (!transpose) {
+        fC.diagonal().copy_(dA);
+        trsm_kernel(fC, out, 1.0, /*upper=*/false, /*transpose=*/true);
+        fC.diagonal().copy_(dT);
+        trsm_kernel(fC, out, 1.0, /*upper=*/true, /*transpose=*/false);
+    } else {
+        fC.diagonal().copy_(dT);
+        trsm_kernel(fC, out, 1.0, /*upper=*/true, /*transpose=*/true);
+        fC.diagonal().copy_(dA);
+        trsm_kernel(fC, out, 1.0, /*upper=*/false, /*transpose=*/false);
+    }
+    return out;
+}
+
+} // namespace
+
+TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::trsm"),
+      TORCH_FN(trsm_kernel));
+  m.impl(
+      TORCH_SELECTIVE_NAME("falkon::pc_apply"),
+      TORCH_FN(pc_apply_kernel));
+}
+
+} // namespace ops
+} // namespace falkon
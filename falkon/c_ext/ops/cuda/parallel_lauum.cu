@@ -0,0 +1,419 @@
+#include "cublas_bindings.h"
+#include "../helpers.h"
+#include "../lauum.h"
+#include "cuda_helpers.cuh"
+#include "block_alloc.h"
+#include "staging_ring.cuh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+#include <ATen/ATen.h>
+#include <torch/library.h>
+#include <ATen/cuda/CUDAContext.h>
+#include <ATen/cuda/Exceptions.h>
+#include <c10/cuda/CUDAGuard.h>
+#include <c10/cuda/CUDAStream.h>
+
+
+namespace falkon {
+namespace ops {
+namespace {
+
+//#define DEBUG 1
+
+/*
+ * Barrier between the device workers. If a worker fails it aborts the barrier, so that
+ * the other workers stop instead of waiting forever. The first error is stored and
+ * rethrown from the calling thread.
+ */
+class WorkerBarrier {
+  public:
+    explicit WorkerBarrier(int num_workers) : num_workers_(num_workers) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (aborted_) {
+            AT_ERROR("Parallel LAUUM aborted by another device.");
+        }
+        const int generation = generation_;
+        if (++count_ == num_workers_) {
+            count_ = 0;
+            generation_++;
+            cv_.notify_all();
+            return;
+        }
+        cv_.wait(lock, [&] { return generation != generation_ || aborted_; });
+        if (generation == generation_) {
+            AT_ERROR("Parallel LAUUM aborted by another device.");
+        }
+    }
+
+    void abort(std::exception_ptr err) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!aborted_) {
+                error_ = err;
+            }
+            aborted_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    void rethrow() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+  private:
+    const int num_workers_;
+    int count_ = 0;
+    int generation_ = 0;
+    bool aborted_ = false;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+/*
+ * Copy the block A[row0:row0+rows, col0:col0+cols] between host and device. On the
+ * device, blocks are stored column-major in their "natural" orientation: as-is for
+ * F-contiguous A, and transposed for C-contiguous A (so that no transposition is needed
+ * during the copy). When `ring` is given (A in pageable memory), the copy goes through it.
+ */
+template <typename scalar_t>
+static inline void load_panel(
+        at::Tensor &data_h,
+        scalar_t *data_d,
+        const int ld_d,
+        const int row0,
+        const int col0,
+        const int rows,
+        const int cols,
+        StagingRing *ring,
+        const cudaStream_t stream) {
+    const bool f_order = is_fortran_contig(data_h);
+    const int64_t si = data_h.stride(0);
+    const int64_t sj = data_h.stride(1);
+    scalar_t *data_h_ptr = data_h.data_ptr<scalar_t>() + si * row0 + sj * col0;
+    if (ring != nullptr) {
+        staged_set_matrix<scalar_t>(
+            f_order ? rows : cols, f_order ? cols : rows, data_h_ptr, f_order ? sj : si, data_d, ld_d, *ring, stream);
+        return;
+    }
+    FLK_CUDABLAS_CHECK(cublasSetMatrixAsync(
+        /*rows=*/f_order ? rows : cols,
+        /*cols=*/f_order ? cols : rows,
+        /*elem_size=*/sizeof(scalar_t),
+        /*A=*/(void *)data_h_ptr,
+        /*lda=*/f_order ? sj : si,
+        /*B=*/(void *)data_d,
+        /*ldb=*/ld_d,
+        /*stream=*/stream
+    ));
+}
+template <typename scalar_t>
+static inline void get_panel(
+        const scalar_t *data_d,
+        const int ld_d,
+        at::Tensor &data_h,
+        const int row0,
+        const int col0,
+        const int rows,
+        const int cols,
+        StagingRing *ring,
+        const cudaStream_t stream) {
+    const bool f_order = is_fortran_contig(data_h);
+    const int64_t si = data_h.stride(0);
+    const int64_t sj = data_h.stride(1);
+    scalar_t *data_h_ptr = data_h.data_ptr<scalar_t>() + si * row0 + sj * col0;
+    if (ring != nullptr) {
+        staged_get_matrix<scalar_t>(
+            f_order ? rows : cols, f_order ? cols : rows, data_d, ld_d, data_h_ptr, f_order ? sj : si, *ring, stream);
+        return;
+    }
+    FLK_CUDABLAS_CHECK(cublasGetMatrixAsync(
+        /*rows=*/f_order ? rows : cols,
+        /*cols=*/f_order ? cols : rows,
+        /*elem_size=*/sizeof(scalar_t),
+        /*A=*/(void *)data_d,
+        /*lda=*/ld_d,
+        /*B=*/(void *)data_h_ptr,
+        /*ldb=*/f_order ? sj : si,
+        /*stream=*/stream
+    ));
+}
+
+/*
+ * Per-device worker for the out-of-core LAUUM on the lower triangle of A: tril(L.T @ L).
+ * The device computes the output block-rows `allocs[r]` with `allocs[r].device == device_id`.
+ *
+ * The outer loop runs over block-columns b. Column b (from the first row owned by this
+ * device) is loaded to the GPU, then for each owned block-row r >= b:
+ *  - r == b: out[b, b] = lauum(L[b, b]) + L[b+1:, b].T @ L[b+1:, b]   (LAUUM + SYRK)
+ *  - r >  b: out[r, b] = L[r, r].T @ L[r, b] + L[r+1:, r].T @ L[r+1:, b]   (TRMM + GEMM)
+ * where column r is loaded into a second buffer. The TRMM overwrites L[r, b] in the column
+ * buffer, which is fine since rows are processed in increasing order.
+ *
+ * When `write_opposite` is false the output overwrites the lower triangle of A. Since other
+ * devices read column b from host memory, a barrier separates the load of column b from
+ * the first write into it. When `write_opposite` is true the transposed output goes into the
+ * upper triangle, which is never read, and no synchronization between devices is needed.
+ *
+ * Computations run on one stream, while copies back to the host run on a second stream
+ * so that they overlap with the following tiles.
+ */
+void parallel_lauum_runner(
+        int device_id,
+        WorkerBarrier &barrier,
+        at::Tensor &A,
+        std::vector<blockAlloc> &allocs,
+        const bool write_opposite) {
+    // CUDA devices and stream
+    const at::cuda::CUDAGuard g(device_id);
+    at::cuda::CUDAStream s_comp = at::cuda::getStreamFromPool(false, device_id);
+    at::cuda::CUDAStream s_copy = at::cuda::getStreamFromPool(false, device_id);
+    c10::cuda::CUDAStreamGuard g0(s_comp);
+    // Fetch cuBLAS handle and set its stream to s_comp (automatically done by the getCurrentHandle code)
+    cublasHandle_t cublas_handle = at::cuda::getCurrentCUDABlasHandle();
+
+    cudaStream_t s_comp_c = s_comp.stream();
+    cudaStream_t s_copy_c = s_copy.stream();
+
+    const auto scalar_type = A.scalar_type();
+    const bool f_order = is_fortran_contig(A);
+    const int N = A.size(0);
+    const int k = allocs.size();
+
+    const int mbs = (*std::max_element(allocs.begin(), allocs.end(), [] (blockAlloc lhs, blockAlloc rhs) {
+        return lhs.size < rhs.size;
+    })).size;
+    const uint64_t mbs_sq = (uint64_t)mbs * mbs;
+    std::vector<int> my_rows;
+    for (int r = 0; r < k; r++) {
+        if (allocs[r].device == device_id) {
+            my_rows.push_back(r);
+        }
+    }
+
+    // GPU buffer allocation: 2 whole columns, 1 tile for the diagonal LAUUM and, if
+    // write_opposite, 1 tile for transposing the outputs.
+    // The leading dimension of a column depends on its orientation (see `load_panel`).
+    const int ld_col = f_order ? N : mbs;
+    const uint64_t col_size = (uint64_t)N * mbs;
+    const auto buf_opt = at::TensorOptions()
+        .dtype(A.dtype())
+        .device(at::kCUDA, device_id)
+        .layout(at::kStrided)
+        .requires_grad(false);
+    const auto data_buf = at::empty(2 * col_size + (write_opposite ? 2 : 1) * mbs_sq, buf_opt);
+
+    // Pageable host memory goes through pinned staging buffers, one ring per direction.
+    std::unique_ptr<StagingRing> h2d_ring, d2h_ring;
+    if (!A.is_pinned()) {
+        h2d_ring.reset(new StagingRing(STAGING_SLOTS, STAGING_SLOT_BYTES));
+        d2h_ring.reset(new StagingRing(STAGING_SLOTS, STAGING_SLOT_BYTES));
+    }
+
+    cudaEvent_t copy_done;
+    C10_CUDA_CHECK(cudaEventCreateWithFlags(&copy_done, cudaEventDisableTiming));
+
+    AT_DISPATCH_FLOATING_TYPES(scalar_type, "dispatch_parallel_lauum", [&] {
+    const scalar_t one = 1.0;
+
+    scalar_t *col_b = data_buf.data_ptr<scalar_t>();
+    scalar_t *col_r = col_b + col_size;
+    scalar_t *lauum_out = col_r + col_size;
+    scalar_t *temp = lauum_out + mbs_sq;
+    // Pointer to the p-th row of a column buffer
+    auto col_row = [&](scalar_t *col, int p) -> scalar_t* {
+        return f_order ? col + p : col + (uint64_t)p * mbs;
+    };
+    // dst (cols x rows, ld mbs) = src.T, where src is column-major rows x cols.
+    auto transpose = [&](const scalar_t *src, int ld_src, int rows, int cols, scalar_t *dst) {
+        const auto src_t = at::from_blob((void *)src, {rows, cols}, {1, ld_src}, buf_opt);
+        auto dst_t = at::from_blob((void *)dst, {cols, rows}, {1, mbs}, buf_opt);
+        dst_t.copy_(src_t.t());
+    };
+    // Copy a device block (in natural orientation) back to A[row0:row0+rows, col0:col0+cols]
+    auto write_back = [&](const scalar_t *data_d, int ld_d, int row0, int col0, int rows, int cols) {
+        cudaEvent_t comp_done;
+        C10_CUDA_CHECK(cudaEventCreateWithFlags(&comp_done, cudaEventDisableTiming));
+        C10_CUDA_CHECK(cudaEventRecord(comp_done, s_comp_c));
+        C10_CUDA_CHECK(cudaStreamWaitEvent(s_copy_c, comp_done, 0));
+        get_panel<scalar_t>(data_d, ld_d, A, row0, col0, rows, cols, d2h_ring.get(), s_copy_c);
+        C10_CUDA_CHECK(cudaEventRecord(copy_done, s_copy_c));
+        C10_CUDA_CHECK(cudaEventDestroy(comp_done));
+    };
+
+    try {
+        for (int b = 0; b < k; b++) {
+            const auto &bb = allocs[b];
+            // Only load the rows of column b needed by the block-rows of this device.
+            const auto min_row = std::lower_bound(my_rows.begin(), my_rows.end(), b);
+            const int b_start = min_row == my_rows.end() ? N : allocs[*min_row].start;
+            if (b_start < N) {
+                // The previous column may still be in use by the copy-back stream
+                C10_CUDA_CHECK(cudaStreamWaitEvent(s_comp_c, copy_done, 0));
+                load_panel<scalar_t>(
+                    A, col_b, ld_col, b_start, bb.start, N - b_start, bb.size, h2d_ring.get(), s_comp_c);
+            }
+            if (!write_opposite) {
+                // Column b must be on all devices before anyone overwrites it.
+                C10_CUDA_CHECK(cudaStreamSynchronize(s_comp_c));
+                barrier.wait();
+            }
+
+            for (auto r_it = min_row; r_it != my_rows.end(); ++r_it) {
+                const int r = *r_it;
+                const auto &br = allocs[r];
+                if (r == b) {
+                    C10_CUDA_CHECK(cudaStreamWaitEvent(s_comp_c, copy_done, 0));
+                    // lauum_out holds a copy of the tile: the triangle which is not written by LAUUM
+                    // must be preserved.
+                    if (write_opposite) {
+                        transpose(col_b, ld_col, bb.size, bb.size, lauum_out);
+                    } else {
+                        C10_CUDA_CHECK(cudaMemcpy2DAsync(
+                            lauum_out, mbs * sizeof(scalar_t), col_b, ld_col * sizeof(scalar_t),
+                            bb.size * sizeof(scalar_t), bb.size, cudaMemcpyDeviceToDevice, s_comp_c));
+                    }
+                    // A C-contiguous lower tile is an F-contiguous upper tile.
+                    auto lauum_in_t = at::from_blob((void *)col_b, {bb.size, bb.size}, {1, ld_col}, buf_opt);
+                    auto lauum_out_t = at::from_blob((void *)lauum_out, {bb.size, bb.size}, {1, mbs}, buf_opt);
+                    falkon::ops::lauum(bb.size, lauum_in_t, ld_col, lauum_out_t, mbs, /*lower=*/f_order);
+                    if (bb.end < N) {
+                        syrk<scalar_t>(cublas_handle,
+                                       f_order ? CUBLAS_FILL_MODE_LOWER : CUBLAS_FILL_MODE_UPPER,
+                                       f_order ? CUBLAS_OP_T : CUBLAS_OP_N,
+                                       bb.size, N - bb.end, &one, col_row(col_b, bb.size), ld_col,
+                                       &one, lauum_out, mbs);
+                    }
+                    if (write_opposite) {
+                        transpose(lauum_out, mbs, bb.size, bb.size, temp);
+                        write_back(temp, mbs, bb.start, bb.start, bb.size, bb.size);
+                    } else {
+                        write_back(lauum_out, mbs, bb.start, bb.start, bb.size, bb.size);
+                    }
+                } else {
+                    load_panel<scalar_t>(
+                        A, col_r, ld_col, br.start, br.start, N - br.start, br.size, h2d_ring.get(), s_comp_c);
+                    scalar_t *ccb = col_row(col_b, br.start - b_start);
+                    if (f_order) {
+                        trmm<scalar_t>(cublas_handle, CUBLAS_SIDE_LEFT, CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_T,
+                                       CUBLAS_DIAG_NON_UNIT, br.size, bb.size, &one, col_r, ld_col, ccb, ld_col,
+                                       ccb, ld_col);
+                        if (br.end < N) {
+                            gemm<scalar_t>(cublas_handle, CUBLAS_OP_T, CUBLAS_OP_N, br.size, bb.size, N - br.end,
+                                           &one, col_row(col_r, br.size), ld_col, col_row(ccb, br.size), ld_col,
+                                           &one, ccb, ld_col);
+                        }
+                    } else {
+                        // Transposed tiles: out[r, b].T = L[r, b].T @ L[r, r] + L[r+1:, b].T @ L[r+1:, r]
+                        trmm<scalar_t>(cublas_handle, CUBLAS_SIDE_RIGHT, CUBLAS_FILL_MODE_UPPER, CUBLAS_OP_T,
+                                       CUBLAS_DIAG_NON_UNIT, bb.size, br.size, &one, col_r, ld_col, ccb, ld_col,
+                                       ccb, ld_col);
+                        if (br.end < N) {
+                            gemm<scalar_t>(cublas_handle, CUBLAS_OP_N, CUBLAS_OP_T, bb.size, br.size, N - br.end,
+                                           &one, col_row(ccb, br.size), ld_col, col_row(col_r, br.size), ld_col,
+                                           &one, ccb, ld_col);
+                        }
+                    }
+                    if (write_opposite) {
+                        C10_CUDA_CHECK(cudaStreamWaitEvent(s_comp_c, copy_done, 0));
+                        const int rows_d = f_order ? br.size : bb.size;
+                        const int cols_d = f_order ? bb.size : br.size;
+                        transpose(ccb, ld_col, rows_d, cols_d, temp);
+                        write_back(temp, mbs, bb.start, br.start, bb.size, br.size);
+                    } else {
+                        write_back(ccb, ld_col, br.start, bb.start, br.size, bb.size);
+                    }
+                }
+#ifdef DEBUG
+                fprintf(stderr, "D:%d  launched tile [%d, %d]\n", device_id, r, b);
+#endif
+            }
+        }
+    } catch (...) {
+        // Unblock the other devices, and make sure that all pending copies are done before returning.
+        barrier.abort(std::current_exception());
+    }
+    });  // end dispatch float
+    C10_CUDA_CHECK(cudaStreamSynchronize(s_comp_c));
+    C10_CUDA_CHECK(cudaStreamSynchronize(s_copy_c));
+    C10_CUDA_CHECK(cudaEventDestroy(copy_done));
+}
+
+void parallel_lauum_worker(
+        int device_id,
+        WorkerBarrier &barrier,
+        at::Tensor &A,
+        std::vector<blockAlloc> &allocs,
+        const bool write_opposite) {
+    try {
+        parallel_lauum_runner(device_id, barrier, A, allocs, write_opposite);
+    } catch (...) {
+        barrier.abort(std::current_exception());
+    }
+}
+
+at::Tensor parallel_lauum_kernel(
+        c10::IntArrayRef devices,
+        std::vector<blockAlloc> allocations,
+        const bool write_opposite,
+        at::Tensor &A) {
+    CHECK_CPU(A);
+    AT_ASSERTM(A.dim() == 2, "A must be 2D");
+    TORCH_CHECK(A.size(0) == A.size(1), "A must be a square matrix. Found shape ", A.sizes(), ".");
+    TORCH_CHECK(
+        (A.stride(0) == 1 || A.stride(1) == 1),
+        "A must be contiguous in one dimension. Found strides: (", A.stride(0), ", ", A.stride(1), ")");
+    TORCH_CHECK(!allocations.empty(), "At least one block is needed for parallel LAUUM.");
+    WorkerBarrier barrier(devices.size());
+
+    std::vector<std::thread> threads;
+    for (const int64_t d : c10::irange(devices.size())) {
+        threads.push_back(
+            std::thread(&parallel_lauum_worker, (int)devices[d], std::ref(barrier), std::ref(A),
+                        std::ref(allocations), write_opposite));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    barrier.rethrow();
+    return A;
+}
+
+at::Tensor parallel_lauum_impl(
+     c10::IntArrayRef devices,
+     c10::IntArrayRef block_starts,
+     c10::IntArrayRef block_ends,
+     c10::IntArrayRef block_sizes,
+     c10::IntArrayRef block_devices,
+     c10::IntArrayRef block_ids,
+     const bool write_opposite,
+     at::Tensor& A) {
+    return parallel_lauum_kernel(
+        devices, make_block_allocs(block_starts, block_ends, block_sizes, block_devices, block_ids),
+        write_opposite, A);
+}
+
+} // namespace
+
+
+TORCH_LIBRARY_IMPL(falkon, CPU, m) {
+    m.impl(
+        TORCH_SELECTIVE_NAME("falkon::parallel_lauum"),
+        TORCH_FN(parallel_lauum_impl));
+}
+
+} // namespace ops
+} // namespace falkon
@@ -2,21 +2,37 @@
 #include "cusolver_bindings.h"
 #include "../helpers.h"
 #include "cuda_helpers.cuh"
+#include "block_alloc.h"
+#include "staging_ring.cuh"
+#include "../../tracing.h"
 
-#include <vector>
-#include <thread>
-#include <atomic>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
 #include <vector>
-#include <set>
 #include <stdio.h>
 
 #include <ATen/ATen.h>
 #include <torch/library.h>
 #include <ATen/cuda/CUDAContext.h>
 #include <ATen/cuda/Exceptions.h>
+#include <ATen/cuda/PeerToPeerAccess.h>
+#include <c10/cuda/CUDAException.h>
 #include <c10/cuda/CUDAGuard.h>
 #include <c10/cuda/CUDAStream.h>
+#ifndef USE_ROCM
+#include <nvtx3/nvToolsExt.h>
+#endif
 
 
 
@@ -24,32 +40,8 @@ namespace falkon {
 namespace ops {
 namespace {
 
-//#define DEBUG 1
-
-/* Input data structures */
-struct blockAlloc {
-    int start;
-    int end;
-    int size;
-    int device;
-    int id;
-};
-
-/* CUDA CallBacks */
-struct callBackData {
-    std::atomic<int> *work_unit;
-    const int x;
-    const int y;
-    const int callee;
-};
-
-void CUDART_CB copyCallBack(cudaStream_t stream, cudaError_t error, void *data) {
-    callBackData *tmp = (callBackData *)(data);
-#ifdef DEBUG
-    fprintf(stderr, "Incrementing work unit at [%d, %d] callee: %d - from %d\n", tmp->x, tmp->y, tmp->callee, tmp->work_unit->load());
-#endif
-    std::atomic_fetch_add(tmp->work_unit, 1);
-}
+// Maximum number of tasks which a single device may have queued on its streams.
+#define MAX_INFLIGHT_TASKS 4
 
 /* Data-loading helper functions */
 template <typename scalar_t>
@@ -100,42 +92,402 @@ static inline void get_block(
         /*stream=*/stream
     ));
 }
+
+/* Tile transfers between pageable host memory and the device, through a pinned staging ring */
 template <typename scalar_t>
-static inline void opt_load_block(
+static inline void staged_load_block(
         at::Tensor &data_h,
-        scalar_t*     &data_d,
-        const int block_id,
-        std::set<int> &col0_fill,
+        scalar_t *data_d,
         const blockAlloc& alloc_i,
         const blockAlloc& alloc_j,
         const int mbs,
+        StagingRing &ring,
         const cudaStream_t stream)
 {
-    if (col0_fill.find(block_id) == col0_fill.end()) {
-        load_block<scalar_t>(data_h, data_d, alloc_i, alloc_j, mbs, stream);
-        col0_fill.insert(block_id);
-    }
+    const int64_t sj = data_h.stride(1);
+    const scalar_t *src = data_h.data_ptr<scalar_t>() + alloc_i.start + sj * alloc_j.start;
+    staged_set_matrix<scalar_t>(alloc_i.size, alloc_j.size, src, sj, data_d, mbs, ring, stream);
 }
+template <typename scalar_t>
+static inline void staged_get_block(
+        scalar_t *data_d,
+        at::Tensor &data_h,
+        const blockAlloc& alloc_i,
+        const blockAlloc& alloc_j,
+        const int mbs,
+        StagingRing &ring,
+        const cudaStream_t stream)
+{
+    const int64_t sj = data_h.stride(1);
+    scalar_t *dst = data_h.data_ptr<scalar_t>() + alloc_i.start + sj * alloc_j.start;
+    staged_get_matrix<scalar_t>(alloc_i.size, alloc_j.size, data_d, mbs, dst, sj, ring, stream);
+}
+
+/*
+ * Accumulates the GPU time spent in host-to-device copies, device-to-host copies, compute and
+ * peer-to-peer copies (from other devices), using pairs of timing events. Active with the
+ * `debug` option (for the totals) or when tracing is enabled (each interval is then exported
+ * as a trace event). The elapsed times are collected once all work on the device is finished.
+ */
+enum potrfPhase { PHASE_H2D = 0, PHASE_D2H = 1, PHASE_COMPUTE = 2, PHASE_P2P = 3 };
+
+struct phaseInterval {
+    potrfPhase phase;
+    cudaStream_t stream;
+    cudaEvent_t start;
+    cudaEvent_t end;
+    double bytes;
+    double flops;
+};
+
+class PhaseTimer {
+  public:
+    PhaseTimer(bool debug, cudaStream_t ref_stream) :
+            enabled_(debug || tracing::enabled()), trace_(tracing::enabled()) {
+        if (trace_) {
+            // Device events are placed on the host clock relative to this reference.
+            C10_CUDA_CHECK(cudaEventCreate(&ref_));
+            C10_CUDA_CHECK(cudaEventRecord(ref_, ref_stream));
+            C10_CUDA_CHECK(cudaEventSynchronize(ref_));
+            ref_ns_ = tracing::now_ns();
+        }
+    }
+    ~PhaseTimer() {
+        for (auto &it : intervals_) {
+            C10_CUDA_CHECK_WARN(cudaEventDestroy(it.start));
+            C10_CUDA_CHECK_WARN(cudaEventDestroy(it.end));
+        }
+        if (trace_) {
+            C10_CUDA_CHECK_WARN(cudaEventDestroy(ref_));
+        }
+    }
+    bool is_tracing() const {
+        return trace_;
+    }
+    void begin(potrfPhase phase, cudaStream_t stream, double bytes = 0, double flops = 0) {
+        if (!enabled_) {
+            return;
+        }
+        cudaEvent_t start, end;
+        C10_CUDA_CHECK(cudaEventCreate(&start));
+        C10_CUDA_CHECK(cudaEventCreate(&end));
+        C10_CUDA_CHECK(cudaEventRecord(start, stream));
+        intervals_.push_back({phase, stream, start, end, bytes, flops});
+    }
+    void end(cudaStream_t stream) {
+        if (!enabled_) {
+            return;
+        }
+        C10_CUDA_CHECK(cudaEventRecord(intervals_.back().end, stream));
+    }
+    /* Total milliseconds per phase. All recorded events must have completed. */
+    std::array<double, 4> totals() const {
+        std::array<double, 4> out = {0, 0, 0, 0};
+        for (const auto &it : intervals_) {
+            float ms;
+            C10_CUDA_CHECK(cudaEventElapsedTime(&ms, it.start, it.end));
+            out[it.phase] += ms;
+        }
+        return out;
+    }
+    /* Record all intervals as trace events of `device_id`. All recorded events must have completed. */
+    void export_trace(int device_id) const {
+        if (!trace_) {
+            return;
+        }
+        static const char *names[4] = {"potrf.h2d", "potrf.d2h", "potrf.compute", "potrf.p2p"};
+        for (const auto &it : intervals_) {
+            float start_ms, end_ms;
+            C10_CUDA_CHECK(cudaEventElapsedTime(&start_ms, ref_, it.start));
+            C10_CUDA_CHECK(cudaEventElapsedTime(&end_ms, ref_, it.end));
+            tracing::record({names[it.phase], device_id, reinterpret_cast<int64_t>(it.stream),
+                             ref_ns_ + static_cast<int64_t>(start_ms * 1e6),
+                             ref_ns_ + static_cast<int64_t>(end_ms * 1e6), it.bytes, it.flops});
+        }
+    }
+
+  private:
+    const bool enabled_;
+    const bool trace_;
+    cudaEvent_t ref_;
+    int64_t ref_ns_ = 0;
+    std::vector<phaseInterval> intervals_;
+};
+
+/*
+ * Tile-task DAG for the right-looking blocked Cholesky decomposition.
+ *
+ * The lower triangle of A is tiled into k*k blocks. Tile (b, y) (with b >= y) is the
+ * target of y + 1 tasks, indexed by the column i which they consume:
+ *  - i < y, b > y: GEMM  A[b, y] -= L[b, i] @ L[y, i].T
+ *  - i < y, b = y: SYRK  A[b, b] -= L[b, i] @ L[b, i].T
+ *  - i = y, b = y: POTRF L[y, y] = chol(A[y, y])
+ *  - i = y, b > y: TRSM  L[b, y] = A[b, y] @ L[y, y].-T
+ * Tasks on the same tile are chained in order of i, and each task depends on the final
+ * (factorized) tiles of column i which it reads. Each task keeps an atomic counter of
+ * unfinished dependencies: when the counter reaches zero the task is pushed to the ready
+ * queue of the device which owns its block-row. Idle devices steal ready tasks from other
+ * devices' queues. When the tiles are resident on the devices (`tile_owner`), each task is
+ * owned by the device which stores its target tile, and is never stolen. Workers never poll:
+ * they either sleep on the scheduler's condition variable, or on the (blocking-sync) CUDA
+ * event of their oldest in-flight task.
+ * The scheduler is not lock-free: only the dependency counters are atomic, while the ready
+ * queues are guarded by a single mutex, taken for the short pushes and pops (the waits on CUDA
+ * events happen outside of it).
+ */
+struct tileTask {
+    int b;
+    int y;
+    int i;
+};
+
+class PotrfScheduler {
+  public:
+    PotrfScheduler(const std::vector<blockAlloc> &allocs, c10::IntArrayRef devices,
+                   const std::vector<int> *tile_owner = nullptr)
+            : k_(allocs.size()), num_devices_(devices.size()), steal_(tile_owner == nullptr),
+              queues_(devices.size()) {
+        std::map<int, int> device_idx;
+        for (const int64_t d : c10::irange(devices.size())) {
+            device_idx[(int)devices[d]] = (int)d;
+        }
+        tile_offset_.resize(k_ * k_, -1);
+        int num_tasks = 0;
+        for (int b = 0; b < k_; b++) {
+            for (int y = 0; y <= b; y++) {
+                tile_offset_[b * k_ + y] = num_tasks;
+                for (int i = 0; i <= y; i++) {
+                    tasks_.push_back({b, y, i});
+                    if (tile_owner != nullptr) {
+                        owner_.push_back((*tile_owner)[b * k_ + y]);
+                        continue;
+                    }
+                    const auto dev_it = device_idx.find(allocs[b].device);
+                    owner_.push_back(dev_it == device_idx.end() ? 0 : dev_it->second);
+                }
+                num_tasks += y + 1;
+            }
+        }
+        num_tasks_ = num_tasks;
+        deps_ = std::unique_ptr<std::atomic<int>[]>(new std::atomic<int>[num_tasks_]);
+        for (int t = 0; t < num_tasks_; t++) {
+            const tileTask &task = tasks_[t];
+            int num_deps = task.i > 0 ? 1 : 0;
+            if (task.i < task.y) {
+                num_deps += task.b == task.y ? 1 : 2;
+            } else if (task.b > task.y) {
+                num_deps += 1;
+            }
+            deps_[t].store(num_deps);
+        }
+        push_ready(task_id(0, 0, 0));
+    }
+
+    inline int task_id(int b, int y, int i) const {
+        return tile_offset_[b * k_ + y] + i;
+    }
+    inline const tileTask &task(int t) const {
+        return tasks_[t];
+    }
+
+    /* Non-blocking: fetch a ready task for device `dev_idx`, stealing from other devices if needed. */
+    bool try_pop(int dev_idx, int &task) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return pop_locked(dev_idx, task);
+    }
+
+    /* Blocking: wait until a task is ready. Returns false once all tasks are done, or on abort. */
+    bool wait_pop(int dev_idx, int &task) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            if (aborted_ || num_done_ == num_tasks_) {
+                return false;
+            }
+            if (pop_locked(dev_idx, task)) {
+                return true;
+            }
+            cv_.wait(lock);
+        }
+    }
+
+    /* Mark a task as finished, releasing all tasks which depend on it. */
+    void complete(int t) {
+        const tileTask &task = tasks_[t];
+        std::vector<int> succ;
+        if (task.i < task.y) {
+            succ.push_back(t + 1);
+        } else if (task.b == task.y) {
+            for (int b2 = task.y + 1; b2 < k_; b2++) {
+                succ.push_back(task_id(b2, task.y, task.y));
+            }
+        } else {
+            for (int y2 = task.y + 1; y2 <= task.b; y2++) {
+                succ.push_back(task_id(task.b, y2, task.y));
+            }
+            for (int b2 = task.b + 1; b2 < k_; b2++) {
+                succ.push_back(task_id(b2, task.b, task.y));
+            }
+        }
+        for (const int s : succ) {
+            if (std::atomic_fetch_sub(&deps_[s], 1) == 1) {
+                push_ready(s);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            num_done_++;
+        }
+        cv_.notify_all();
+    }
+
+    void abort(std::exception_ptr err) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!aborted_) {
+                error_ = err;
+            }
+            aborted_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    bool aborted() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return aborted_;
+    }
+
+    void rethrow() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+  private:
+    // Lower tuples run first: tasks feeding the next panel are on the critical path.
+    inline std::tuple<int, int, int, int> priority(int t) const {
+        const tileTask &task = tasks_[t];
+        const int rank = task.i < task.y ? 2 : (task.b == task.y ? 0 : 1);
+        return std::make_tuple(task.i, rank, task.y, task.b);
+    }
+
+    void push_ready(int t) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto &queue = queues_[owner_[t]];
+            const auto it = std::upper_bound(queue.begin(), queue.end(), t, [this](int lhs, int rhs) {
+                return priority(lhs) < priority(rhs);
+            });
+            queue.insert(it, t);
+        }
+        cv_.notify_all();
+    }
+
+    bool pop_locked(int dev_idx, int &task) {
+        int victim = -1;
+        if (!queues_[dev_idx].empty()) {
+            victim = dev_idx;
+        } else if (steal_) {
+            for (int d = 0; d < num_devices_; d++) {
+                if (queues_[d].empty()) {
+                    continue;
+                }
+                if (victim == -1 || priority(queues_[d].front()) < priority(queues_[victim].front())) {
+                    victim = d;
+                }
+            }
+        }
+        if (victim == -1) {
+            return false;
+        }
+        task = queues_[victim].front();
+        queues_[victim].pop_front();
+        return true;
+    }
+
+    const int k_;
+    const int num_devices_;
+    const bool steal_;
+    int num_tasks_;
+    std::vector<tileTask> tasks_;
+    std::vector<int> owner_;
+    std::vector<int> tile_offset_;
+    std::unique_ptr<std::atomic<int>[]> deps_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::deque<int>> queues_;
+    int num_done_ = 0;
+    bool aborted_ = false;
+    std::exception_ptr error_;
+};
+
+/*
+ * Device-side cache of tiles. Each slot holds one mbs*mbs tile of A, identified by its
+ * block coordinates and by its version (the number of tasks applied to it). Slots are
+ * evicted in LRU order. Loads run on their own stream: `loaded` is recorded once the tile
+ * is on the device. `used` is recorded after the last task reading or writing the slot, and
+ * `released` after the last copy-back reading from it: both must be waited on before the
+ * slot is overwritten.
+ */
+template <typename scalar_t>
+struct tileSlot {
+    scalar_t *ptr;
+    int b = -1;
+    int y = -1;
+    int version = -1;
+    uint64_t last_use = 0;
+    cudaEvent_t loaded;
+    cudaEvent_t used;
+    cudaEvent_t released;
+};
+
+struct inflightTask {
+    int task;
+    int64_t launched_ns;  // Only set when tracing
+    cudaEvent_t done;
+};
+
+/*
+ * Lower triangle of A distributed over the devices in a 2D block-cyclic layout (see
+ * `parallel_potrf_resident`). Tile (b, y) is stored at `ptr[b * k + y]` (with leading
+ * dimension mbs) on device `device[b * k + y]`, whose index in the list of devices is
+ * `owner[b * k + y]`.
+ */
+struct residentTiles {
+    std::vector<void *> ptr;
+    std::vector<int> device;
+    std::vector<int> owner;
+};
 
-/* Main parallel POTRF function */
+/*
+ * Per-device worker: executes tasks of the DAG on `device_id`.
+ * If `resident` is null, the tiles are loaded from A (in host memory) and written back to it.
+ * Otherwise A is the storage of the tiles owned by this device: tasks update them in place,
+ * and the tiles owned by other devices are copied from their owner (peer-to-peer).
+ */
 void parallel_potrf_runner(
+        int dev_idx,
         int device_id,
-        std::vector<std::vector<std::atomic<int>>> &work,
+        PotrfScheduler &sched,
         at::Tensor &A,
-        std::vector<blockAlloc> &allocs) {
+        std::vector<blockAlloc> &allocs,
+        const residentTiles *resident,
+        const at::Tensor &workspace,
+        const bool debug) {
+    const auto wall_start = std::chrono::steady_clock::now();
     // CUDA devices and stream
     const at::cuda::CUDAGuard g(device_id);
-    at::cuda::CUDAStream s1 = at::cuda::getStreamFromPool(false, device_id);
-    at::cuda::CUDAStream s2 = at::cuda::getStreamFromPool(false, device_id);
-    at::cuda::CUDAStream s3 = at::cuda::getStreamFromPool(false, device_id);
-    c10::cuda::CUDAStreamGuard g0(s1);
-    // Fetch cuBLAS handle and set cuBLAS, cuSOLVER streams to s1 (automatically done by the getCurrentHandle code)
+    at::cuda::CUDAStream s_comp = at::cuda::getStreamFromPool(false, device_id);
+    at::cuda::CUDAStream s_load = at::cuda::getStreamFromPool(false, device_id);
+    at::cuda::CUDAStream s_copy = at::cuda::getStreamFromPool(false, device_id);
+    c10::cuda::CUDAStreamGuard g0(s_comp);
+    // Fetch cuBLAS handle and set cuBLAS, cuSOLVER streams to s_comp (automatically done by the getCurrentHandle code)
     cublasHandle_t cublas_handle = at::cuda::getCurrentCUDABlasHandle();
     auto cusolver_handle = at::cuda::getCurrentCUDASolverDnHandle();
 
-    cudaStream_t s1_c = s1.stream();
-    cudaStream_t s2_c = s2.stream();
-    cudaStream_t s3_c = s3.stream();
+    cudaStream_t s_comp_c = s_comp.stream();
+    cudaStream_t s_load_c = s_load.stream();
+    cudaStream_t s_copy_c = s_copy.stream();
 
     const auto scalar_type = A.scalar_type();
     const int k = allocs.size();
@@ -144,34 +496,40 @@ void parallel_potrf_runner(
         return lhs.size < rhs.size;
     })).size;
     const uint64_t mbs_sq = mbs*mbs;
-    // Figure out `my_blocks` the blocks of the current stage
-    std::vector<blockAlloc> my_blocks;
-    std::set<int> my_block_ids;
-    for (auto &block : allocs) {
-        if (block.device == device_id) {
-            my_blocks.push_back(block);
-            my_block_ids.insert(block.id);
-        }
-    }
-    std::map<std::pair<int, int>, callBackData> callback_data;
-    for (int i = 0; i < k; i++) {
-        for (int j = 0; j < k; j++) {
-            const callBackData cback_data = {.work_unit = &(work[i][j]), .x = i, .y = j, .callee = -1};
-            callback_data.insert(std::pair<std::pair<int, int>, callBackData>(std::pair<int, int>(i, j), cback_data));
-        }
-    }
-
-    // col0_fill keeps track of the 'current' column: which blocks are loaded or not.
-    std::set<int> col0_fill;
 
-    // First GPU buffer allocation.
-    const uint64_t buf_size = mbs_sq * (k + k + 1);
+    // GPU buffer allocation: same budget as the column-based algorithm, 2 columns and 1 tile.
+    // The tiles are carved out of the caller's workspace for this device, if one was given.
+    // Resident tiles are updated in place, so only the 2 columns of tiles read from other devices
+    // are cached.
+    const int num_slots = resident == nullptr ? k + k + 1 : k + k;
     const auto buf_opt = at::TensorOptions()
         .dtype(A.dtype())
         .device(at::kCUDA, device_id)
         .layout(at::kStrided)
         .requires_grad(false);
-    const auto data_buf = at::empty(buf_size, buf_opt);
+    at::Tensor data_buf;
+    if (workspace.defined()) {
+        TORCH_CHECK(workspace.is_cuda() && workspace.get_device() == device_id,
+                    "parallel_potrf workspace must be on device ", device_id, ".");
+        TORCH_CHECK(workspace.scalar_type() == scalar_type && workspace.is_contiguous(),
+                    "parallel_potrf workspace must be a contiguous tensor of the same data-type as A.");
+        TORCH_CHECK(workspace.numel() >= (int64_t)(mbs_sq * num_slots),
+                    "parallel_potrf workspace on device ", device_id, " has ", workspace.numel(),
+                    " elements, but ", mbs_sq * num_slots, " are needed.");
+        data_buf = workspace.view({-1}).narrow(0, 0, mbs_sq * num_slots);
+    } else {
+        data_buf = at::empty(mbs_sq * num_slots, buf_opt);
+    }
+
+    // Pageable host memory goes through pinned staging buffers, one ring per direction.
+    const bool staged = resident == nullptr && !A.is_pinned();
+    std::unique_ptr<StagingRing> h2d_ring, d2h_ring;
+    if (staged) {
+        h2d_ring.reset(new StagingRing(STAGING_SLOTS, STAGING_SLOT_BYTES));
+        d2h_ring.reset(new StagingRing(STAGING_SLOTS, STAGING_SLOT_BYTES));
+    }
+    PhaseTimer timer(debug, s_comp_c);
+    const double elem_size = A.element_size();
 
     AT_DISPATCH_FLOATING_TYPES(scalar_type, "dispatch_parallel_potrf", [&] {
     const scalar_t mone = -1.0;
@@ -183,196 +541,382 @@ void parallel_potrf_runner(
         cusolver_handle,
         CUBLAS_FILL_MODE_LOWER,
         /*n=*/mbs,
-        A.data_ptr<scalar_t>(),
+        data_buf.data_ptr<scalar_t>(),
         /*lda=*/mbs,
         &potrf_buf_size);
     const auto potrf_buf = at::empty(potrf_buf_size, buf_opt);
     const auto potrf_info_buf = at::zeros(1, at::dtype(at::kInt).device(at::kCUDA, device_id));
-
-    // Data buffers
-    scalar_t *data_buf_ptr = data_buf.data_ptr<scalar_t>();
+    const auto potrf_info_h = at::zeros(1, at::dtype(at::kInt).pinned_memory(true));
     scalar_t *potrf_buf_ptr = potrf_buf.data_ptr<scalar_t>();
     int *potrf_info_buf_ptr = potrf_info_buf.data_ptr<int>();
-    scalar_t *col0_h[k];
-    for (int i = 0; i < k; i++) {
-        col0_h[i] = data_buf_ptr;
-        data_buf_ptr += mbs_sq;
-    }
-    scalar_t *col1_h[k];
-    for (int i = 0; i < k; i++) {
-        col1_h[i] = data_buf_ptr;
-        data_buf_ptr += mbs_sq;
-    }
-    scalar_t *g_buf = data_buf_ptr;
-
-    // Book-keeping variables (used in the loop)
-    uint col_updates_left;
-    uint trail_updates_left;
-    int potrf_info_h = 0;
-    scalar_t **col_buf_h;
-    scalar_t **next_buf_h;
-    cudaStream_t s_copyback;
-    // Start the main loop
-    for (int i = 0; i < k; i++) {
-#ifdef DEBUG
-        fprintf(stderr, "Starting iteration %d\n", i);
-#endif
-        // Setup double-buffering (via pre-inserting elements in col0_fill)
-        // and number of updates.
-        col_updates_left = 0;
-        trail_updates_left = 0;
-        for (const auto& mb : my_blocks) {
-            if (mb.id > i) {
-                col_updates_left += 1;
-                trail_updates_left += mb.id - i;
-                if (i != 0) {col0_fill.insert(mb.id);}
+    int *potrf_info_h_ptr = potrf_info_h.data_ptr<int>();
+
+    // The cache slots come first, followed by one (never evicted) slot per resident tile.
+    std::vector<tileSlot<scalar_t>> slots(num_slots);
+    std::vector<int> resident_slot;
+    for (int s = 0; s < num_slots; s++) {
+        slots[s].ptr = data_buf.data_ptr<scalar_t>() + s * mbs_sq;
+    }
+    if (resident != nullptr) {
+        resident_slot.resize(k * k, -1);
+        for (int b = 0; b < k; b++) {
+            for (int y = 0; y <= b; y++) {
+                const int tile = b * k + y;
+                if (resident->owner[tile] == dev_idx) {
+                    resident_slot[tile] = slots.size();
+                    tileSlot<scalar_t> slot;
+                    slot.ptr = static_cast<scalar_t *>(resident->ptr[tile]);
+                    slot.b = b;
+                    slot.y = y;
+                    slot.version = 0;
+                    slots.push_back(slot);
+                }
             }
         }
-        // Switch the double-buffered col0, col1
-        if (i % 2 == 0) {
-            col_buf_h = col0_h;
-            next_buf_h = col1_h;
-            s_copyback = s2_c;
-        } else {
-            col_buf_h = col1_h;
-            next_buf_h = col0_h;
-            s_copyback = s3_c;
-        }
-        C10_CUDA_CHECK(cudaStreamSynchronize(s_copyback));
-
-        // 1. POTRF
-        scalar_t * i_block = col_buf_h[i];
-        const auto& i_alloc = allocs[i];
-        if (i_alloc.device == device_id) {
-            while (work[i][i] != i) { std::this_thread::yield(); }
-            opt_load_block<scalar_t>(A, i_block, i, col0_fill, i_alloc, i_alloc, mbs, s1_c); // [i, i]
-            potrf<scalar_t>(cusolver_handle, CUBLAS_FILL_MODE_LOWER, /*n=*/i_alloc.size,
-                            /*A=*/i_block, /*lda=*/mbs, /*work=*/potrf_buf_ptr, /*lwork=*/potrf_buf_size,
-                            potrf_info_buf_ptr);
-            C10_CUDA_CHECK(cudaStreamSynchronize(s1_c));
-            if (potrf_info_h != 0) {
-                AT_ERROR("Cholesky decomposition failed: leading minor of order ",
-                         potrf_info_h, " is not positive definite.");
+    }
+    for (auto &slot : slots) {
+        C10_CUDA_CHECK(cudaEventCreateWithFlags(&slot.loaded, cudaEventDisableTiming));
+        C10_CUDA_CHECK(cudaEventCreateWithFlags(&slot.used, cudaEventDisableTiming));
+        C10_CUDA_CHECK(cudaEventCreateWithFlags(&slot.released, cudaEventDisableTiming));
+    }
+    uint64_t use_clock = 0;
+
+    // Return a slot containing tile (b, y) at the given version, loading it from A (or from the
+    // device which owns it) if necessary. `pinned` slots are never evicted.
+    auto acquire = [&](int b, int y, int version, bool writable, std::initializer_list<int> pinned) -> int {
+        if (resident != nullptr && resident_slot[b * k + y] != -1) {
+            const int rs = resident_slot[b * k + y];
+            TORCH_INTERNAL_ASSERT(slots[rs].version == version);
+            slots[rs].last_use = ++use_clock;
+            return rs;
+        }
+        // Tasks run on the device which stores their target tile.
+        TORCH_INTERNAL_ASSERT(resident == nullptr || !writable);
+        int found = -1;
+        for (int s = 0; s < num_slots; s++) {
+            if (slots[s].b == b && slots[s].y == y) {
+                found = s;
+                break;
             }
-            get_block<scalar_t>(i_block, A, i_alloc, i_alloc, mbs, s_copyback);
-            C10_CUDA_CHECK(cudaStreamAddCallback(s_copyback, copyCallBack, &callback_data.at(std::pair<int, int>(i, i)), 0));
-#ifdef DEBUG
-            fprintf(stderr, "D:%d  Iteration %d stage %d - finished [%d, %d]\n", device_id, i, 1, i, i);
-#endif
         }
-
-        // 2. COLUMN UPDATE
-        while (work[i][i] < i + 1) { std::this_thread::yield(); }
-        // Keep track of which blocks we have already processed.
-        // work table cannot work for this here, since it is set asynchronously.
-        std::unordered_set<int> processed_idx;
-        while (col_updates_left > 0) {
-            for (const auto& b_alloc : my_blocks) {
-                const int b = b_alloc.id;
-                if (b <= i || processed_idx.find(b) != processed_idx.end() || work[b][i] != i) {
+        if (found != -1 && slots[found].version == version) {
+            if (writable) {
+                C10_CUDA_CHECK(cudaStreamWaitEvent(s_comp_c, slots[found].released, 0));
+            }
+            slots[found].last_use = ++use_clock;
+            return found;
+        }
+        if (found == -1) {
+            // Pick an empty slot, or the least recently used one.
+            for (int s = 0; s < num_slots; s++) {
+                if (std::find(pinned.begin(), pinned.end(), s) != pinned.end()) {
                     continue;
                 }
-                scalar_t *b_block = col_buf_h[b];
-
-                opt_load_block<scalar_t>(A, i_block, i, col0_fill, i_alloc, i_alloc, mbs, s1_c); // [i, i]
-                opt_load_block<scalar_t>(A, b_block, b, col0_fill, b_alloc, i_alloc, mbs, s1_c); // [b, i]
-                falkon::ops::trsm<scalar_t>(
-                    cublas_handle, CUBLAS_SIDE_RIGHT, CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_T, CUBLAS_DIAG_NON_UNIT,
-                    b_alloc.size, i_alloc.size, &one, i_block, mbs, b_block, mbs);
-                C10_CUDA_CHECK(cudaStreamSynchronize(s1_c));
-
-                get_block<scalar_t>(b_block, A, b_alloc, i_alloc, mbs, s_copyback);
-                C10_CUDA_CHECK(cudaStreamAddCallback(s_copyback, copyCallBack, &callback_data.at(std::pair<int, int>(b, i)), 0));
-
-                col_updates_left--;
-                processed_idx.insert(b);
-#ifdef DEBUG
-                fprintf(stderr, "D:%d  Iteration %d stage %d - finished [%d, %d]\n", device_id, i, 2, b, i);
+                if (slots[s].b == -1) {
+                    found = s;
+                    break;
+                }
+                if (found == -1 || slots[s].last_use < slots[found].last_use) {
+                    found = s;
+                }
+            }
+        }
+        // Stale or evicted slot: once it's not used by compute or copy-back anymore, reload it
+        // on the load stream, so that the transfer overlaps with the previous tasks' compute.
+        C10_CUDA_CHECK(cudaStreamWaitEvent(s_load_c, slots[found].used, 0));
+        C10_CUDA_CHECK(cudaStreamWaitEvent(s_load_c, slots[found].released, 0));
+        if (resident != nullptr) {
+            // Tiles are only read from other devices once they are final, and their last task
+            // has completed (the scheduler only releases the readers after that).
+            const int tile = b * k + y;
+            timer.begin(PHASE_P2P, s_load_c, elem_size * mbs * allocs[y].size);
+            C10_CUDA_CHECK(cudaMemcpyPeerAsync(
+                slots[found].ptr, device_id, resident->ptr[tile], resident->device[tile],
+                sizeof(scalar_t) * mbs * allocs[y].size, s_load_c));
+        } else if (staged) {
+            timer.begin(PHASE_H2D, s_load_c, elem_size * allocs[b].size * allocs[y].size);
+            staged_load_block<scalar_t>(A, slots[found].ptr, allocs[b], allocs[y], mbs, *h2d_ring, s_load_c);
+        } else {
+            timer.begin(PHASE_H2D, s_load_c, elem_size * allocs[b].size * allocs[y].size);
+            load_block<scalar_t>(A, slots[found].ptr, allocs[b], allocs[y], mbs, s_load_c);
+        }
+        timer.end(s_load_c);
+        C10_CUDA_CHECK(cudaEventRecord(slots[found].loaded, s_load_c));
+        C10_CUDA_CHECK(cudaStreamWaitEvent(s_comp_c, slots[found].loaded, 0));
+        slots[found].b = b;
+        slots[found].y = y;
+        slots[found].version = version;
+        slots[found].last_use = ++use_clock;
+        return found;
+    };
+
+    // Launch all the work of a task on the device streams, and return its completion event.
+    auto launch = [&](int t) -> cudaEvent_t {
+        const tileTask &task = sched.task(t);
+#ifndef USE_ROCM
+        if (timer.is_tracing()) {
+            nvtxRangePushA("potrf.launch");
+        }
 #endif
+        const auto &b_alloc = allocs[task.b];
+        const auto &y_alloc = allocs[task.y];
+        const auto &i_alloc = allocs[task.i];
+        const int w = acquire(task.b, task.y, task.i, true, {});
+        scalar_t *w_block = slots[w].ptr;
+        int reads[2] = {-1, -1};
+        if (task.i < task.y) {
+            const int lb = acquire(task.b, task.i, task.i + 1, false, {w});
+            reads[0] = lb;
+            if (task.b != task.y) {
+                const int ly = acquire(task.y, task.i, task.i + 1, false, {w, lb});
+                reads[1] = ly;
+                timer.begin(PHASE_COMPUTE, s_comp_c, 0, 2.0 * b_alloc.size * y_alloc.size * i_alloc.size);
+                gemm<scalar_t>(cublas_handle, CUBLAS_OP_N, CUBLAS_OP_T, b_alloc.size, y_alloc.size, i_alloc.size,
+                               &mone, slots[lb].ptr, mbs, slots[ly].ptr, mbs, &one, w_block, mbs);
+            } else {
+                timer.begin(PHASE_COMPUTE, s_comp_c, 0, 1.0 * b_alloc.size * b_alloc.size * i_alloc.size);
+                syrk<scalar_t>(cublas_handle, CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_N, b_alloc.size,
+                               i_alloc.size, &mone, slots[lb].ptr, mbs, &one, w_block, mbs);
+            }
+        } else if (task.b == task.y) {
+            timer.begin(PHASE_COMPUTE, s_comp_c, 0, 1.0 * b_alloc.size * b_alloc.size * b_alloc.size / 3);
+            potrf<scalar_t>(cusolver_handle, CUBLAS_FILL_MODE_LOWER, /*n=*/b_alloc.size,
+                            /*A=*/w_block, /*lda=*/mbs, /*work=*/potrf_buf_ptr, /*lwork=*/potrf_buf_size,
+                            potrf_info_buf_ptr);
+            C10_CUDA_CHECK(cudaMemcpyAsync(potrf_info_h_ptr, potrf_info_buf_ptr, sizeof(int),
+                                           cudaMemcpyDeviceToHost, s_comp_c));
+        } else {
+            const int lyy = acquire(task.y, task.y, task.y + 1, false, {w});
+            reads[0] = lyy;
+            timer.begin(PHASE_COMPUTE, s_comp_c, 0, 1.0 * b_alloc.size * y_alloc.size * y_alloc.size);
+            falkon::ops::trsm<scalar_t>(
+                cublas_handle, CUBLAS_SIDE_RIGHT, CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_T, CUBLAS_DIAG_NON_UNIT,
+                b_alloc.size, y_alloc.size, &one, slots[lyy].ptr, mbs, w_block, mbs);
+        }
+        timer.end(s_comp_c);
+        slots[w].version = task.i + 1;
+        C10_CUDA_CHECK(cudaEventRecord(slots[w].used, s_comp_c));
+        for (const int r : reads) {
+            if (r != -1) {
+                C10_CUDA_CHECK(cudaEventRecord(slots[r].used, s_comp_c));
             }
         }
 
-        // 3. TRAILING UPDATE
-        // Note that this loop does not need `processed_idx` like loop 2
-        // since it is processed in order. In fact the outer while loop
-        // is unnecessary
-#ifdef DEBUG
-        fprintf(stderr, "Starting stage 3\n");
+        cudaEvent_t done;
+        C10_CUDA_CHECK(cudaEventCreateWithFlags(&done, cudaEventDisableTiming | cudaEventBlockingSync));
+        if (resident != nullptr) {
+            // The tile was updated in place.
+            C10_CUDA_CHECK(cudaEventRecord(done, s_comp_c));
+#ifndef USE_ROCM
+            if (timer.is_tracing()) {
+                nvtxRangePop();
+            }
 #endif
-        while (trail_updates_left > 0) {
-            for (const auto& b_alloc : my_blocks) {
-                int b = b_alloc.id;
-                if (b < i + 1) { continue; }
-                while (work[b][i] != i + 1) { std::this_thread::yield(); }
-
-                scalar_t * b_block = col_buf_h[b];
-                for (int y = b; y > i; y--) {
-                    while (work[y][i] != i + 1 || work[b][y] != i) { std::this_thread::yield(); }
-                    const auto& y_alloc = allocs[y];
-                    scalar_t *y_block = col_buf_h[y];
-                    opt_load_block<scalar_t>(A, y_block, y, col0_fill, y_alloc, i_alloc, mbs, s1_c); // [y, i]
-                    load_block<scalar_t>(A, g_buf, b_alloc, y_alloc, mbs, s1_c); // [b, y]
-                    if (b_alloc.id != y_alloc.id) {
-                        gemm<scalar_t>(cublas_handle, CUBLAS_OP_N, CUBLAS_OP_T, b_alloc.size, y_alloc.size, i_alloc.size,
-                                       &mone, b_block, mbs, y_block, mbs, &one, g_buf, mbs);
-                    } else {
-                        syrk<scalar_t>(cublas_handle, CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_N, b_alloc.size,
-                                       i_alloc.size, &mone, b_block, mbs, &one, g_buf, mbs);
-                    }
-                    if (y == i + 1) {
-                        // We are on the column which will be tackled next, can copy directly to col0
-                        C10_CUDA_CHECK(
-                            cudaMemcpyAsync(next_buf_h[b], g_buf, mbs_sq * sizeof(scalar_t),
-                            cudaMemcpyDeviceToDevice, s1_c));
-                        C10_CUDA_CHECK(cudaStreamSynchronize(s1_c));
-                        get_block<scalar_t>(next_buf_h[b], A, b_alloc, y_alloc, mbs, s_copyback);
-                        C10_CUDA_CHECK(cudaStreamAddCallback(s_copyback, copyCallBack, &callback_data.at(std::pair<int, int>(b, y)), 0));
-                    } else {
-                        // We must free the `g_buf` variable before the next round.
-                        get_block<scalar_t>(g_buf, A, b_alloc, y_alloc, mbs, s1_c);
-                        C10_CUDA_CHECK(cudaStreamSynchronize(s1_c));
-                        std::atomic_fetch_add(&work[b][y], 1);
-                    }
-                    trail_updates_left--;
-#ifdef DEBUG
-                    fprintf(stderr, "D:%d  Iteration %d stage %d - finished [%d, %d]\n", device_id, i, 3, b, y);
+            return done;
+        }
+        // Copy-back on the second stream, so that it overlaps with the next task's compute.
+        C10_CUDA_CHECK(cudaStreamWaitEvent(s_copy_c, slots[w].used, 0));
+        timer.begin(PHASE_D2H, s_copy_c, elem_size * b_alloc.size * y_alloc.size);
+        if (staged) {
+            staged_get_block<scalar_t>(w_block, A, b_alloc, y_alloc, mbs, *d2h_ring, s_copy_c);
+        } else {
+            get_block<scalar_t>(w_block, A, b_alloc, y_alloc, mbs, s_copy_c);
+        }
+        timer.end(s_copy_c);
+        C10_CUDA_CHECK(cudaEventRecord(slots[w].released, s_copy_c));
+        C10_CUDA_CHECK(cudaEventRecord(done, s_copy_c));
+#ifndef USE_ROCM
+        if (timer.is_tracing()) {
+            nvtxRangePop();
+        }
 #endif
+        return done;
+    };
+
+    // Wait for completion of a task (the caller must have already removed it from `inflight`)
+    auto retire = [&](const inflightTask &it) {
+        C10_CUDA_CHECK(cudaEventSynchronize(it.done));
+        C10_CUDA_CHECK(cudaEventDestroy(it.done));
+        const tileTask &task = sched.task(it.task);
+        if (task.i == task.y && task.b == task.y && *potrf_info_h_ptr != 0) {
+            AT_ERROR("Cholesky decomposition failed: leading minor of order ",
+                     allocs[task.b].start + *potrf_info_h_ptr, " is not positive definite.");
+        }
+        sched.complete(it.task);
+        if (timer.is_tracing()) {
+            // Host-side lifetime of the task, from its launch to its retirement.
+            tracing::record({"potrf.task", -1, device_id, it.launched_ns, tracing::now_ns(), 0, 0});
+        }
+    };
+
+    std::deque<inflightTask> inflight;
+    try {
+        int t;
+        while (!sched.aborted()) {
+            // Retire finished tasks without blocking
+            while (!inflight.empty()) {
+                const cudaError_t status = cudaEventQuery(inflight.front().done);
+                if (status == cudaErrorNotReady) {
+                    break;
                 }
+                C10_CUDA_CHECK(status);
+                const inflightTask it = inflight.front();
+                inflight.pop_front();
+                retire(it);
+            }
+            if (inflight.size() < MAX_INFLIGHT_TASKS && sched.try_pop(dev_idx, t)) {
+                inflight.push_back({t, timer.is_tracing() ? tracing::now_ns() : 0, launch(t)});
+            } else if (!inflight.empty()) {
+                // Sleep until the oldest task is done
+                const inflightTask it = inflight.front();
+                inflight.pop_front();
+                retire(it);
+            } else if (sched.wait_pop(dev_idx, t)) {
+                inflight.push_back({t, timer.is_tracing() ? tracing::now_ns() : 0, launch(t)});
+            } else {
+                break;
             }
         }
-        col0_fill.clear();
+    } catch (...) {
+        sched.abort(std::current_exception());
+    }
+    C10_CUDA_CHECK(cudaStreamSynchronize(s_comp_c));
+    C10_CUDA_CHECK(cudaStreamSynchronize(s_load_c));
+    C10_CUDA_CHECK(cudaStreamSynchronize(s_copy_c));
+    for (auto &it : inflight) {
+        C10_CUDA_CHECK(cudaEventDestroy(it.done));
+    }
+    for (auto &slot : slots) {
+        C10_CUDA_CHECK(cudaEventDestroy(slot.loaded));
+        C10_CUDA_CHECK(cudaEventDestroy(slot.used));
+        C10_CUDA_CHECK(cudaEventDestroy(slot.released));
     }
-    C10_CUDA_CHECK(cudaStreamSynchronize(s1_c));
-    C10_CUDA_CHECK(cudaStreamSynchronize(s2_c));
-    C10_CUDA_CHECK(cudaStreamSynchronize(s3_c));
     });  // end dispatch float
+    timer.export_trace(device_id);
+
+    if (debug) {
+        const double wall_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - wall_start).count();
+        const auto ms = timer.totals();
+        const double transfer_ms = ms[PHASE_H2D] + ms[PHASE_D2H] + ms[PHASE_P2P];
+        // Fraction of the transfer time hidden behind other work on the device. Idle time
+        // (waiting on other devices) counts as non-overlapped, so this is a lower bound.
+        double overlap = transfer_ms > 0 ? (transfer_ms + ms[PHASE_COMPUTE] - wall_ms) / transfer_ms : 0.0;
+        overlap = std::min(1.0, std::max(0.0, overlap));
+        fprintf(stderr, "parallel_potrf D:%d  H2D %.2fms  D2H %.2fms  P2P %.2fms  compute %.2fms  wall %.2fms  "
+                "transfer overlap %.1f%% (%s)\n", device_id, ms[PHASE_H2D], ms[PHASE_D2H], ms[PHASE_P2P],
+                ms[PHASE_COMPUTE], wall_ms, overlap * 100,
+                resident != nullptr ? "resident" : (staged ? "pinned staging" : "direct"));
+    }
 }
 
 at::Tensor parallel_potrf_kernel(
         c10::IntArrayRef devices,
         std::vector<blockAlloc> allocations,
-        at::Tensor &A) {
+        at::Tensor &A,
+        const bool debug,
+        at::TensorList workspaces) {
     CHECK_CPU(A);
-    // Initialize the atomic table
-    int k = allocations.size();
-    std::vector<std::vector<std::atomic<int>>> work(k);
-    for (int i = 0; i < k; i++) {
-        work[i] = std::vector<std::atomic<int>>(k);
-        for (int j = 0; j < k; j++) {
-            work[i][j].store(0);
+    TORCH_CHECK(workspaces.empty() || workspaces.size() == devices.size(),
+                "parallel_potrf needs one workspace per device, or none (got ", workspaces.size(),
+                " workspaces for ", devices.size(), " devices).");
+    PotrfScheduler sched(allocations, devices);
+
+    std::vector<at::Tensor> dev_workspaces(devices.size());
+    for (const int64_t d : c10::irange(workspaces.size())) {
+        dev_workspaces[d] = workspaces[d];
+    }
+    std::vector<std::thread> threads;
+    for (const int64_t d : c10::irange(devices.size())) {
+        threads.push_back(
+            std::thread(&parallel_potrf_runner, (int)d, (int)devices[d], std::ref(sched), std::ref(A),
+                        std::ref(allocations), nullptr, std::cref(dev_workspaces[d]), debug));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    sched.rethrow();
+    return A;
+}
+
+void parallel_potrf_resident_kernel(
+        c10::IntArrayRef devices,
+        std::vector<blockAlloc> allocations,
+        int64_t grid_rows,
+        at::TensorList tiles,
+        const bool debug,
+        at::TensorList workspaces) {
+    const int num_devices = devices.size();
+    const int k = allocations.size();
+    TORCH_CHECK(grid_rows > 0 && num_devices % grid_rows == 0,
+                "parallel_potrf_resident: the ", num_devices, " devices cannot be arranged in a grid with ",
+                grid_rows, " rows.");
+    TORCH_CHECK(tiles.size() == devices.size(),
+                "parallel_potrf_resident needs the tiles of each device (got ", tiles.size(),
+                " tensors for ", num_devices, " devices).");
+    TORCH_CHECK(workspaces.empty() || workspaces.size() == devices.size(),
+                "parallel_potrf_resident needs one workspace per device, or none (got ", workspaces.size(),
+                " workspaces for ", num_devices, " devices).");
+    const int grid_cols = num_devices / grid_rows;
+    int mbs = 0;
+    for (const auto &alloc : allocations) {
+        mbs = std::max(mbs, alloc.size);
+    }
+    const int64_t mbs_sq = (int64_t)mbs * mbs;
+
+    // Tile (b, y) belongs to the device at position (b mod grid_rows, y mod grid_cols) of the grid,
+    // and is stored after the tiles (b', y') < (b, y) of the same device, in row-major order.
+    residentTiles resident;
+    resident.ptr.resize(k * k, nullptr);
+    resident.device.resize(k * k, -1);
+    resident.owner.resize(k * k, -1);
+    std::vector<int64_t> num_tiles(num_devices, 0);
+    for (int b = 0; b < k; b++) {
+        for (int y = 0; y <= b; y++) {
+            const int owner = (b % grid_rows) * grid_cols + (y % grid_cols);
+            resident.owner[b * k + y] = owner;
+            resident.device[b * k + y] = devices[owner];
+            resident.ptr[b * k + y] = static_cast<char *>(tiles[owner].data_ptr()) +
+                num_tiles[owner] * mbs_sq * tiles[owner].element_size();
+            num_tiles[owner]++;
         }
     }
+    for (const int d : c10::irange(num_devices)) {
+        TORCH_CHECK(tiles[d].is_cuda() && tiles[d].get_device() == devices[d],
+                    "parallel_potrf_resident: the tiles of device ", devices[d], " must be stored on it.");
+        TORCH_CHECK(tiles[d].is_contiguous() && tiles[d].scalar_type() == tiles[0].scalar_type(),
+                    "parallel_potrf_resident: the tiles must be stored in contiguous tensors of the same data-type.");
+        TORCH_CHECK(tiles[d].numel() == num_tiles[d] * mbs_sq,
+                    "parallel_potrf_resident: device ", devices[d], " owns ", num_tiles[d], " tiles of ",
+                    mbs_sq, " elements, but its storage has ", tiles[d].numel(), " elements.");
+    }
+    // Enable direct copies between the devices which are connected.
+    for (const int d1 : c10::irange(num_devices)) {
+        for (const int d2 : c10::irange(num_devices)) {
+            if (d1 != d2) {
+                at::cuda::get_p2p_access(devices[d1], devices[d2]);
+            }
+        }
+    }
+    PotrfScheduler sched(allocations, devices, &resident.owner);
 
+    std::vector<at::Tensor> dev_tiles(tiles.begin(), tiles.end());
+    std::vector<at::Tensor> dev_workspaces(devices.size());
+    for (const int64_t d : c10::irange(workspaces.size())) {
+        dev_workspaces[d] = workspaces[d];
+    }
     std::vector<std::thread> threads;
-    for (const int64_t device_id : devices) {
+    for (const int64_t d : c10::irange(devices.size())) {
         threads.push_back(
-            std::thread(&parallel_potrf_runner, device_id, std::ref(work), std::ref(A), std::ref(allocations)));
+            std::thread(&parallel_potrf_runner, (int)d, (int)devices[d], std::ref(sched), std::ref(dev_tiles[d]),
+                        std::ref(allocations), &resident, std::cref(dev_workspaces[d]), debug));
     }
 
     for (auto& t : threads) {
         t.join();
     }
-    return A;
+    sched.rethrow();
 }
 
 at::Tensor parallel_potrf(
@@ -382,19 +926,28 @@ at::Tensor parallel_potrf(
      c10::IntArrayRef block_sizes,
      c10::IntArrayRef block_devices,
      c10::IntArrayRef block_ids,
-     at::Tensor& A) {
-    std::vector<blockAlloc> out_allocs;
-    for (const int i : c10::irange(block_starts.size())) {
-        blockAlloc ba = {
-            .start = (int)block_starts[i],
-            .end   = (int)block_ends[i],
-            .size  = (int)block_sizes[i],
-            .device= (int)block_devices[i],
-            .id    = (int)block_ids[i]
-        };
-        out_allocs.push_back(ba);
-    }
-    return parallel_potrf_kernel(devices, out_allocs, A);
+     at::Tensor& A,
+     const bool debug,
+     at::TensorList workspaces) {
+    return parallel_potrf_kernel(
+        devices, make_block_allocs(block_starts, block_ends, block_sizes, block_devices, block_ids), A, debug,
+        workspaces);
+}
+
+void parallel_potrf_resident(
+     c10::IntArrayRef devices,
+     c10::IntArrayRef block_starts,
+     c10::IntArrayRef block_ends,
+     c10::IntArrayRef block_sizes,
+     c10::IntArrayRef block_devices,
+     c10::IntArrayRef block_ids,
+     int64_t grid_rows,
+     at::TensorList tiles,
+     const bool debug,
+     at::TensorList workspaces) {
+    parallel_potrf_resident_kernel(
+        devices, make_block_allocs(block_starts, block_ends, block_sizes, block_devices, block_ids), grid_rows,
+        tiles, debug, workspaces);
 }
 
 } // namespace
@@ -406,5 +959,11 @@ TORCH_LIBRARY_IMPL(falkon, CPU, m) {
         TORCH_FN(parallel_potrf));
 }
 
+TORCH_LIBRARY_IMPL(falkon, CUDA, m) {
+    m.impl(
+        TORCH_SELECTIVE_NAME("falkon::parallel_potrf_resident"),
+        TORCH_FN(parallel_potrf_resident));
+}
+
 } // namespace ops
 } // namespace falkon
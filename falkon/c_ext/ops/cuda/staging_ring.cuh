@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <ATen/ATen.h>
+#include <c10/cuda/CUDAException.h>
+#include <cuda_runtime.h>
+
+namespace falkon {
+namespace ops {
+
+/*
+ * Ring of pinned host buffers used to stage tile transfers when A lives in pageable memory
+ * (on which cuBLAS "async" copies are synchronous). Tiles are split in chunks of whole
+ * columns which fit a slot:
+ *  - host to device: the worker thread packs a chunk in the next free slot, and enqueues
+ *    the copy to the device. Packing the next chunk overlaps with the transfer.
+ *  - device to host: the chunk is copied to the slot, and unpacked into A by a host
+ *    function enqueued on the same stream, so the worker never blocks.
+ * A slot is reused once its `free` event (recorded after the last operation on it) fires.
+ * The memory comes from the PyTorch caching host allocator, so it is recycled across calls.
+ * Shared by the out-of-core multi-GPU runners (POTRF and LAUUM).
+ */
+#define STAGING_SLOTS 3
+#define STAGING_SLOT_BYTES (32 << 20)
+
+struct stagingUnpack {
+    const char *src;
+    char *dst;
+    int64_t dst_ld;
+    int64_t col_bytes;
+    int num_cols;
+};
+
+static void CUDART_CB unpack_columns(void *data) {
+    const stagingUnpack *u = static_cast<stagingUnpack *>(data);
+    for (int c = 0; c < u->num_cols; c++) {
+        std::memcpy(u->dst + c * u->dst_ld, u->src + c * u->col_bytes, u->col_bytes);
+    }
+}
+
+class StagingRing {
+  public:
+    StagingRing(int num_slots, int64_t slot_bytes)
+            : num_slots_(num_slots),
+              slot_bytes_(slot_bytes),
+              buf_(at::empty({num_slots * slot_bytes}, at::dtype(at::kByte).pinned_memory(true))),
+              free_(num_slots),
+              unpack_(num_slots) {
+        for (auto &ev : free_) {
+            C10_CUDA_CHECK(cudaEventCreateWithFlags(&ev, cudaEventDisableTiming | cudaEventBlockingSync));
+        }
+    }
+    ~StagingRing() {
+        for (auto &ev : free_) {
+            C10_CUDA_CHECK_WARN(cudaEventSynchronize(ev));
+            C10_CUDA_CHECK_WARN(cudaEventDestroy(ev));
+        }
+    }
+
+    /* Block until the next slot of the ring is not in use anymore, and return it. */
+    int next() {
+        const int s = cur_;
+        cur_ = (cur_ + 1) % num_slots_;
+        C10_CUDA_CHECK(cudaEventSynchronize(free_[s]));
+        return s;
+    }
+    inline char *ptr(int s) const {
+        return static_cast<char *>(buf_.data_ptr()) + s * slot_bytes_;
+    }
+    inline int64_t slot_bytes() const {
+        return slot_bytes_;
+    }
+    inline cudaEvent_t free_event(int s) const {
+        return free_[s];
+    }
+    inline stagingUnpack &unpack_args(int s) {
+        return unpack_[s];
+    }
+
+  private:
+    const int num_slots_;
+    const int64_t slot_bytes_;
+    const at::Tensor buf_;
+    std::vector<cudaEvent_t> free_;
+    std::vector<stagingUnpack> unpack_;
+    int cur_ = 0;
+};
+
+/*
+ * Copy the column-major (rows x cols) matrix at `src` (pageable host memory, leading dimension
+ * `ld_src`) to `dst` on the device (leading dimension `ld_dst`), through the staging ring.
+ */
+template <typename scalar_t>
+static inline void staged_set_matrix(
+        const int rows,
+        const int cols,
+        const scalar_t *src,
+        const int64_t ld_src,
+        scalar_t *dst,
+        const int64_t ld_dst,
+        StagingRing &ring,
+        const cudaStream_t stream) {
+    const int64_t col_bytes = rows * sizeof(scalar_t);
+    TORCH_CHECK(col_bytes <= ring.slot_bytes(),
+                "Tile column of ", col_bytes, " bytes does not fit in a staging buffer.");
+    const int cols_per_slot = ring.slot_bytes() / col_bytes;
+    for (int c0 = 0; c0 < cols; c0 += cols_per_slot) {
+        const int nc = std::min(cols_per_slot, cols - c0);
+        const int s = ring.next();
+        char *stage = ring.ptr(s);
+        for (int c = 0; c < nc; c++) {
+            std::memcpy(stage + c * col_bytes, src + (c0 + c) * ld_src, col_bytes);
+        }
+        C10_CUDA_CHECK(cudaMemcpy2DAsync(
+            dst + (int64_t)c0 * ld_dst, ld_dst * sizeof(scalar_t), stage, col_bytes, col_bytes, nc,
+            cudaMemcpyHostToDevice, stream));
+        C10_CUDA_CHECK(cudaEventRecord(ring.free_event(s), stream));
+    }
+}
+
+/*
+ * Copy the column-major (rows x cols) device matrix at `src` (leading dimension `ld_src`) to
+ * `dst` in pageable host memory (leading dimension `ld_dst`), through the staging ring. The
+ * host side of the copy completes asynchronously, in stream order.
+ */
+template <typename scalar_t>
+static inline void staged_get_matrix(
+        const int rows,
+        const int cols,
+        const scalar_t *src,
+        const int64_t ld_src,
+        scalar_t *dst,
+        const int64_t ld_dst,
+        StagingRing &ring,
+        const cudaStream_t stream) {
+    const int64_t col_bytes = rows * sizeof(scalar_t);
+    TORCH_CHECK(col_bytes <= ring.slot_bytes(),
+                "Tile column of ", col_bytes, " bytes does not fit in a staging buffer.");
+    const int cols_per_slot = ring.slot_bytes() / col_bytes;
+    for (int c0 = 0; c0 < cols; c0 += cols_per_slot) {
+        const int nc = std::min(cols_per_slot, cols - c0);
+        const int s = ring.next();
+        char *stage = ring.ptr(s);
+        C10_CUDA_CHECK(cudaMemcpy2DAsync(
+            stage, col_bytes, src + (int64_t)c0 * ld_src, ld_src * sizeof(scalar_t), col_bytes, nc,
+            cudaMemcpyDeviceToHost, stream));
+        stagingUnpack &u = ring.unpack_args(s);
+        u.src = stage;
+        u.dst = reinterpret_cast<char *>(dst + c0 * ld_dst);
+        u.dst_ld = ld_dst * sizeof(scalar_t);
+        u.col_bytes = col_bytes;
+        u.num_cols = nc;
+        C10_CUDA_CHECK(cudaLaunchHostFunc(stream, unpack_columns, &u));
+        C10_CUDA_CHECK(cudaEventRecord(ring.free_event(s), stream));
+    }
+}
+
+} // namespace ops
+} // namespace falkon
@@ -49,6 +49,27 @@ void cuda_2d_copy(
         height
     );
 }
+void cuda_2d_copy_batch_async(
+        at::TensorList dest_tensors,
+        at::IntArrayRef dest_pitches,
+        at::TensorList src_tensors,
+        at::IntArrayRef src_pitches,
+        at::IntArrayRef widths,
+        at::IntArrayRef heights) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::cuda_2d_copy_batch_async", "")
+                       .typed<decltype(cuda_2d_copy_batch_async)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        dest_tensors,
+        dest_pitches,
+        src_tensors,
+        src_pitches,
+        widths,
+        heights
+    );
+}
 void cuda_1d_copy_async(
         at::Tensor& dest_tensor,
         const at::Tensor &src_tensor,
@@ -87,6 +108,8 @@ TORCH_LIBRARY_FRAGMENT(falkon, m) {
       "falkon::cuda_2d_copy_async(Tensor (a!) dest_tensor, int dest_pitch, Tensor src_tensor, int src_pitch, int width, int height) -> ()"));
   m.def(TORCH_SELECTIVE_SCHEMA(
       "falkon::cuda_2d_copy(Tensor (a!) dest_tensor, int dest_pitch, Tensor src_tensor, int src_pitch, int width, int height) -> ()"));
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::cuda_2d_copy_batch_async(Tensor(a!)[] dest_tensors, int[] dest_pitches, Tensor[] src_tensors, int[] src_pitches, int[] widths, int[] heights) -> ()"));
   m.def(TORCH_SELECTIVE_SCHEMA(
       "falkon::cuda_1d_copy_async(Tensor (a!) dest_tensor, Tensor src_tensor, int count) -> ()"));
   m.def(TORCH_SELECTIVE_SCHEMA(
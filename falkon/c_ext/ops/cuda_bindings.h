@@ -19,6 +19,13 @@ void cuda_2d_copy(
         const int64_t src_pitch,
         const int64_t width,
         const int64_t height);
+void cuda_2d_copy_batch_async(
+        at::TensorList dest_tensors,
+        at::IntArrayRef dest_pitches,
+        at::TensorList src_tensors,
+        at::IntArrayRef src_pitches,
+        at::IntArrayRef widths,
+        at::IntArrayRef heights);
 void cuda_1d_copy_async(
         at::Tensor& dest_tensor,
         const at::Tensor &src_tensor,
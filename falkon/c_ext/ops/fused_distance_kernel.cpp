@@ -0,0 +1,64 @@
+#include "fused_distance_kernel.h"
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <torch/library.h>
+#include <torch/types.h>
+
+namespace falkon {
+namespace ops {
+
+at::Tensor fused_distance_kernel(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::fused_distance_kernel", "")
+                       .typed<decltype(fused_distance_kernel)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        mat1,
+        mat2,
+        norm1,
+        norm2,
+        kernel_type,
+        out
+    );
+}
+
+at::Tensor fused_distance_mmv(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &vec,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::fused_distance_mmv", "")
+                       .typed<decltype(fused_distance_mmv)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        mat1,
+        mat2,
+        vec,
+        norm1,
+        norm2,
+        kernel_type,
+        out
+    );
+}
+
+TORCH_LIBRARY_FRAGMENT(falkon, m) {
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::fused_distance_kernel(Tensor mat1, Tensor mat2, Tensor norm1, Tensor norm2, int kernel_type, Tensor(a!) out) -> Tensor(a!)"));
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::fused_distance_mmv(Tensor mat1, Tensor mat2, Tensor vec, Tensor norm1, Tensor norm2, int kernel_type, Tensor(a!) out) -> Tensor(a!)"));
+}
+
+} // namespace ops
+} // namespace falkon
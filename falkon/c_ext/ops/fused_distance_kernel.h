@@ -0,0 +1,45 @@
+#pragma once
+
+#include <ATen/ATen.h>
+
+namespace falkon {
+namespace ops {
+
+/*
+ * Kernel functions supported by `fused_distance_kernel`, applied to the squared
+ * distance d2 (clamped to be at least 1e-20) with r = sqrt(d2):
+ *  - gaussian:  exp(-d2 / 2)
+ *  - laplacian: exp(-r)
+ *  - matern32:  (1 + sqrt(3) r) * exp(-sqrt(3) r)
+ *  - matern52:  (1 + sqrt(5) r + 5/3 d2) * exp(-sqrt(5) r)
+ */
+enum DistanceKernelType : int64_t {
+    kGaussianKernel = 0,
+    kLaplacianKernel = 1,
+    kMatern32Kernel = 2,
+    kMatern52Kernel = 3,
+};
+
+at::Tensor fused_distance_kernel(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out);
+
+/*
+ * out += k(mat1, mat2) @ vec, where k is one of the distance kernels above. The kernel matrix is
+ * evaluated tile by tile and multiplied with `vec` straight away, so it is never stored in full.
+ */
+at::Tensor fused_distance_mmv(
+        const at::Tensor &mat1,
+        const at::Tensor &mat2,
+        const at::Tensor &vec,
+        const at::Tensor &norm1,
+        const at::Tensor &norm2,
+        const int64_t kernel_type,
+        at::Tensor &out);
+
+} // namespace ops
+} // namespace falkon
@@ -29,9 +29,37 @@ at::Tensor lauum(
     );
 }
 
+at::Tensor parallel_lauum(
+     c10::IntArrayRef devices,
+     c10::IntArrayRef block_starts,
+     c10::IntArrayRef block_ends,
+     c10::IntArrayRef block_sizes,
+     c10::IntArrayRef block_devices,
+     c10::IntArrayRef block_ids,
+     bool write_opposite,
+     at::Tensor& A) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::parallel_lauum", "")
+                       .typed<decltype(parallel_lauum)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        devices,
+        block_starts,
+        block_ends,
+        block_sizes,
+        block_devices,
+        block_ids,
+        write_opposite,
+        A
+    );
+}
+
 TORCH_LIBRARY_FRAGMENT(falkon, m) {
   m.def(TORCH_SELECTIVE_SCHEMA(
       "falkon::lauum(int n, Tensor A, int lda, Tensor(a!) B, int ldb, bool lower) -> Tensor(a!)"));
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::parallel_lauum(int[] devices, int[] block_starts, int[] block_ends, int[] block_sizes, int[] block_devices, int[] block_ids, bool write_opposite, Tensor(a!) A) -> Tensor(a!)"));
 }
 
 } // namespace ops
@@ -13,5 +13,15 @@ at::Tensor lauum(
         const int64_t ldb,
         const bool lower);
 
+at::Tensor parallel_lauum(
+     c10::IntArrayRef devices,
+     c10::IntArrayRef block_starts,
+     c10::IntArrayRef block_ends,
+     c10::IntArrayRef block_sizes,
+     c10::IntArrayRef block_devices,
+     c10::IntArrayRef block_ids,
+     bool write_opposite,
+     at::Tensor& A);
+
 } // namespace ops
 } // namespace falkon
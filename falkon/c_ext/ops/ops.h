@@ -3,12 +3,16 @@
 #include "copy_transpose.h"
 #include "copy_triang.h"
 #include "csr2dense.h"
+#include "fused_distance_kernel.h"
 #include "cublas_bindings.h"
 #include "lauum.h"
 #include "mul_triang.h"
+#include "sell_csr_dot.h"
 #include "sparse_vector_ops.h"
 #include "spspmm.h"
 #include "square_norm.h"
+#include "triang_affine.h"
+#include "trsm.h"
 #include "vec_mul_triang.h"
 #include "cuda/parallel_potrf.h"
 #include "potrf.h"
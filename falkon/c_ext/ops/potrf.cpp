@@ -32,7 +32,9 @@ at::Tensor parallel_potrf(
      c10::IntArrayRef block_sizes,
      c10::IntArrayRef block_devices,
      c10::IntArrayRef block_ids,
-     at::Tensor& A) {
+     at::Tensor& A,
+     bool debug,
+     at::TensorList workspaces) {
     static auto op = c10::Dispatcher::singleton()
                        .findSchemaOrThrow("falkon::parallel_potrf", "")
                        .typed<decltype(parallel_potrf)>();
@@ -45,7 +47,39 @@ at::Tensor parallel_potrf(
         block_sizes,
         block_devices,
         block_ids,
-        A
+        A,
+        debug,
+        workspaces
+    );
+}
+
+void parallel_potrf_resident(
+     c10::IntArrayRef devices,
+     c10::IntArrayRef block_starts,
+     c10::IntArrayRef block_ends,
+     c10::IntArrayRef block_sizes,
+     c10::IntArrayRef block_devices,
+     c10::IntArrayRef block_ids,
+     int64_t grid_rows,
+     at::TensorList tiles,
+     bool debug,
+     at::TensorList workspaces) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::parallel_potrf_resident", "")
+                       .typed<decltype(parallel_potrf_resident)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    op.call(
+        devices,
+        block_starts,
+        block_ends,
+        block_sizes,
+        block_devices,
+        block_ids,
+        grid_rows,
+        tiles,
+        debug,
+        workspaces
     );
 }
 
@@ -53,7 +87,9 @@ TORCH_LIBRARY_FRAGMENT(falkon, m) {
   m.def(TORCH_SELECTIVE_SCHEMA(
       "falkon::potrf(Tensor(a!) mat, bool upper, bool clean, bool overwrite) -> Tensor(a!)"));
   m.def(TORCH_SELECTIVE_SCHEMA(
-      "falkon::parallel_potrf(int[] devices, int[] block_starts, int[] block_ends, int[] block_sizes, int[] block_devices, int[] block_ids, Tensor(a!) A) -> Tensor(a!)"));
+      "falkon::parallel_potrf(int[] devices, int[] block_starts, int[] block_ends, int[] block_sizes, int[] block_devices, int[] block_ids, Tensor(a!) A, bool debug=False, Tensor[] workspaces=[]) -> Tensor(a!)"));
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::parallel_potrf_resident(int[] devices, int[] block_starts, int[] block_ends, int[] block_sizes, int[] block_devices, int[] block_ids, int grid_rows, Tensor(a!)[] tiles, bool debug=False, Tensor[] workspaces=[]) -> ()"));
 }
 
 } // namespace ops
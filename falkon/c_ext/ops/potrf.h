@@ -18,7 +18,21 @@ at::Tensor parallel_potrf(
      c10::IntArrayRef block_sizes,
      c10::IntArrayRef block_devices,
      c10::IntArrayRef block_ids,
-     at::Tensor& A);
+     at::Tensor& A,
+     bool debug,
+     at::TensorList workspaces);
+
+void parallel_potrf_resident(
+     c10::IntArrayRef devices,
+     c10::IntArrayRef block_starts,
+     c10::IntArrayRef block_ends,
+     c10::IntArrayRef block_sizes,
+     c10::IntArrayRef block_devices,
+     c10::IntArrayRef block_ids,
+     int64_t grid_rows,
+     at::TensorList tiles,
+     bool debug,
+     at::TensorList workspaces);
 
 } // namespace ops
 } // namespace falkon
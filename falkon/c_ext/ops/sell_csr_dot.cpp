@@ -0,0 +1,44 @@
+#include "sell_csr_dot.h"
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <torch/library.h>
+#include <torch/types.h>
+
+namespace falkon {
+namespace ops {
+
+at::Tensor sell_csr_dot(
+        const at::Tensor &slice_ptr,
+        const at::Tensor &sell_index,
+        const at::Tensor &sell_data,
+        const at::Tensor &row_perm,
+        int64_t slice_size,
+        const at::Tensor &indexptr2,
+        const at::Tensor &indices2,
+        const at::Tensor &data2,
+        at::Tensor &out) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::sell_csr_dot", "")
+                       .typed<decltype(sell_csr_dot)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        slice_ptr,
+        sell_index,
+        sell_data,
+        row_perm,
+        slice_size,
+        indexptr2,
+        indices2,
+        data2,
+        out
+    );
+}
+
+TORCH_LIBRARY_FRAGMENT(falkon, m) {
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::sell_csr_dot(Tensor slice_ptr, Tensor sell_index, Tensor sell_data, Tensor row_perm, int slice_size, Tensor indexptr2, Tensor indices2, Tensor data2, Tensor(a!) out) -> Tensor(a!)"));
+}
+
+} // namespace ops
+} // namespace falkon
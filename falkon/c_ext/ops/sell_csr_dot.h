@@ -0,0 +1,20 @@
+#pragma once
+
+#include <ATen/ATen.h>
+
+namespace falkon {
+namespace ops {
+
+at::Tensor sell_csr_dot(
+    const at::Tensor &slice_ptr,
+    const at::Tensor &sell_index,
+    const at::Tensor &sell_data,
+    const at::Tensor &row_perm,
+    int64_t slice_size,
+    const at::Tensor &indexptr2,
+    const at::Tensor &indices2,
+    const at::Tensor &data2,
+    at::Tensor &out);
+
+} // namespace ops
+} // namespace falkon
@@ -32,9 +32,45 @@ spspmm(
     );
 }
 
+/*
+ * Same as `spspmm`, but the scratch-space needed by the multiplication is taken from the two
+ * (uint8) workspace tensors, which are grown if too small. Reusing the same workspaces for
+ * many products avoids allocating the buffers again on each call.
+ */
+std::tuple<at::Tensor, at::Tensor, at::Tensor>
+spspmm_ws(
+        const at::Tensor &rowptrA,
+        const at::Tensor &colA,
+        const at::Tensor &valA,
+        const at::Tensor &rowptrB,
+        const at::Tensor &colB,
+        const at::Tensor &valB,
+        int64_t N,
+        at::Tensor &workspace1,
+        at::Tensor &workspace2) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::spspmm_ws", "")
+                       .typed<decltype(spspmm_ws)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        rowptrA,
+        colA,
+        valA,
+        rowptrB,
+        colB,
+        valB,
+        N,
+        workspace1,
+        workspace2
+    );
+}
+
 TORCH_LIBRARY_FRAGMENT(falkon, m) {
   m.def(TORCH_SELECTIVE_SCHEMA(
       "falkon::spspmm(Tensor rowptrA, Tensor colA, Tensor valA, Tensor rowptrB, Tensor colB, Tensor valB, int N) -> (Tensor, Tensor, Tensor)"));
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::spspmm_ws(Tensor rowptrA, Tensor colA, Tensor valA, Tensor rowptrB, Tensor colB, Tensor valB, int N, Tensor(a!) workspace1, Tensor(b!) workspace2) -> (Tensor, Tensor, Tensor)"));
 }
 
 } // namespace ops
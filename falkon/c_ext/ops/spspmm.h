@@ -15,5 +15,17 @@ spspmm(
     const at::Tensor &valB,
     int64_t N);
 
+std::tuple<at::Tensor, at::Tensor, at::Tensor>
+spspmm_ws(
+    const at::Tensor &rowptrA,
+    const at::Tensor &colA,
+    const at::Tensor &valA,
+    const at::Tensor &rowptrB,
+    const at::Tensor &colB,
+    const at::Tensor &valB,
+    int64_t N,
+    at::Tensor &workspace1,
+    at::Tensor &workspace2);
+
 } // namespace ops
 } // namespace falkon
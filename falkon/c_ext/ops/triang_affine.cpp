@@ -0,0 +1,38 @@
+#include "triang_affine.h"
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <torch/library.h>
+#include <torch/types.h>
+
+namespace falkon {
+namespace ops {
+
+at::Tensor triang_affine(
+        at::Tensor &mat,
+        const c10::optional<at::Tensor> &row_vec,
+        const c10::optional<at::Tensor> &col_vec,
+        const double multiplier,
+        const double diag_add,
+        const bool upper) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::triang_affine", "")
+                       .typed<decltype(triang_affine)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        mat,
+        row_vec,
+        col_vec,
+        multiplier,
+        diag_add,
+        upper
+    );
+}
+
+TORCH_LIBRARY_FRAGMENT(falkon, m) {
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::triang_affine(Tensor(a!) mat, Tensor? row_vec, Tensor? col_vec, float multiplier, float diag_add, bool upper) -> Tensor(a!)"));
+}
+
+} // namespace ops
+} // namespace falkon
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ATen/ATen.h>
+
+namespace falkon {
+namespace ops {
+
+at::Tensor triang_affine(
+        at::Tensor &mat,
+        const c10::optional<at::Tensor> &row_vec,
+        const c10::optional<at::Tensor> &col_vec,
+        const double multiplier,
+        const double diag_add,
+        const bool upper);
+
+} // namespace ops
+} // namespace falkon
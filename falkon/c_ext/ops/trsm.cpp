@@ -0,0 +1,58 @@
+#include "trsm.h"
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <torch/library.h>
+#include <torch/types.h>
+
+namespace falkon {
+namespace ops {
+
+at::Tensor trsm(
+        const at::Tensor &A,
+        at::Tensor &B,
+        const double alpha,
+        const bool upper,
+        const bool transpose) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::trsm", "")
+                       .typed<decltype(trsm)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        A,
+        B,
+        alpha,
+        upper,
+        transpose
+    );
+}
+
+at::Tensor pc_apply(
+        at::Tensor &fC,
+        const at::Tensor &dT,
+        const at::Tensor &dA,
+        at::Tensor &out,
+        const bool transpose) {
+    static auto op = c10::Dispatcher::singleton()
+                       .findSchemaOrThrow("falkon::pc_apply", "")
+                       .typed<decltype(pc_apply)>();
+    at::AutoDispatchBelowAutograd guard;
+    at::tracer::impl::NoTracerDispatchMode tracer_guard;
+    return op.call(
+        fC,
+        dT,
+        dA,
+        out,
+        transpose
+    );
+}
+
+TORCH_LIBRARY_FRAGMENT(falkon, m) {
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::trsm(Tensor A, Tensor(a!) B, float alpha, bool upper, bool transpose) -> Tensor(a!)"));
+  m.def(TORCH_SELECTIVE_SCHEMA(
+      "falkon::pc_apply(Tensor(a!) fC, Tensor dT, Tensor dA, Tensor(b!) out, bool transpose) -> Tensor(b!)"));
+}
+
+} // namespace ops
+} // namespace falkon
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <ATen/ATen.h>
+
+namespace falkon {
+namespace ops {
+
+at::Tensor trsm(
+        const at::Tensor &A,
+        at::Tensor &B,
+        const double alpha,
+        const bool upper,
+        const bool transpose);
+
+at::Tensor pc_apply(
+        at::Tensor &fC,
+        const at::Tensor &dT,
+        const at::Tensor &dA,
+        at::Tensor &out,
+        const bool transpose);
+
+/*
+ * BLAS parameters for solving op(A) X = B in place of B, where A and B may each be
+ * either C or F-contiguous. A C-contiguous A is the F-contiguous A.T, so the triangle and
+ * the transposition are flipped. A C-contiguous B is the F-contiguous B.T, so we solve the
+ * transposed system X.T op(A).T = B.T from the right instead.
+ */
+struct TrsmParams {
+    bool left;
+    bool upper;
+    bool transpose;
+    int64_t m;
+    int64_t n;
+    int64_t lda;
+    int64_t ldb;
+};
+
+inline TrsmParams trsm_params(const at::Tensor &A, const at::Tensor &B, bool upper, bool transpose) {
+    TORCH_CHECK(A.dim() == 2 && A.size(0) == A.size(1), "A must be a square 2D matrix.");
+    TORCH_CHECK(B.dim() == 1 || B.dim() == 2, "B must be a 1D or 2D tensor.");
+    TORCH_CHECK(B.size(0) == A.size(0), "B must have as many rows as A (", B.size(0), " != ", A.size(0), ").");
+    TORCH_CHECK(A.scalar_type() == B.scalar_type(), "A and B must have the same data-type.");
+    TORCH_CHECK(A.stride(0) == 1 || A.stride(1) == 1, "A must be contiguous in one dimension.");
+    const int64_t rows = B.size(0);
+    const int64_t cols = B.dim() == 1 ? 1 : B.size(1);
+    TrsmParams p;
+    if (A.stride(0) == 1) {
+        p.upper = upper;
+        p.transpose = transpose;
+        p.lda = std::max<int64_t>(A.stride(1), std::max<int64_t>(1, A.size(0)));
+    } else {
+        p.upper = !upper;
+        p.transpose = !transpose;
+        p.lda = std::max<int64_t>(A.stride(0), std::max<int64_t>(1, A.size(0)));
+    }
+    if (B.dim() == 1 || cols == 1 || B.stride(0) == 1) {
+        TORCH_CHECK(B.stride(0) == 1 || rows == 1, "B must be contiguous in one dimension.");
+        p.left = true;
+        p.m = rows;
+        p.n = cols;
+        p.ldb = cols == 1 ? std::max<int64_t>(1, rows) : B.stride(1);
+    } else {
+        TORCH_CHECK(B.stride(1) == 1, "B must be contiguous in one dimension.");
+        p.left = false;
+        p.transpose = !p.transpose;
+        p.m = cols;
+        p.n = rows;
+        p.ldb = std::max<int64_t>(B.stride(0), cols);
+    }
+    return p;
+}
+
+} // namespace ops
+} // namespace falkon
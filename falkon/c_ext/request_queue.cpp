@@ -0,0 +1,155 @@
+#include "request_queue.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <torch/library.h>
+
+namespace falkon {
+
+namespace {
+using steady = std::chrono::steady_clock;
+
+steady::time_point deadline_after(double ms) {
+    return steady::now() + std::chrono::duration_cast<steady::duration>(std::chrono::duration<double, std::milli>(ms));
+}
+
+// Spin for a short while before sleeping: most waits are shorter than a sleep's granularity.
+void backoff(int &num_waits) {
+    if (num_waits < 64) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    num_waits++;
+}
+} // namespace
+
+RequestQueue::RequestQueue() {
+    tail_ = new Node();
+    head_.store(tail_, std::memory_order_relaxed);
+}
+
+RequestQueue::~RequestQueue() {
+    int64_t id;
+    at::Tensor rows;
+    while (try_pop(id, rows)) {}
+    delete tail_;
+}
+
+void RequestQueue::push(int64_t id, at::Tensor rows) {
+    TORCH_CHECK(id >= 0, "Request ids must be non-negative.");
+    TORCH_CHECK(rows.dim() == 2, "Request data must be a 2D tensor.");
+    // The size is incremented before checking `closed_` (both sequentially consistent), so that
+    // a consumer which sees the queue closed and empty knows no other request will be added.
+    size_.fetch_add(1);
+    if (closed_.load()) {
+        size_.fetch_sub(1);
+        TORCH_CHECK(false, "Cannot push requests to a closed queue.");
+    }
+    Node *node = new Node();
+    node->id = id;
+    node->rows = std::move(rows);
+    Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+    // Between the exchange and this store the consumer sees the queue as (temporarily) shorter.
+    prev->next.store(node, std::memory_order_release);
+}
+
+bool RequestQueue::try_pop(int64_t &id, at::Tensor &rows) {
+    Node *next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+        return false;
+    }
+    // `next` becomes the new stub node, after its data has been moved out.
+    id = next->id;
+    rows = std::move(next->rows);
+    delete tail_;
+    tail_ = next;
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::tuple<at::Tensor, at::Tensor, at::Tensor> RequestQueue::pop_batch(
+        int64_t max_rows, double max_delay_ms, double timeout_ms) {
+    TORCH_CHECK(max_rows > 0, "max_rows must be positive.");
+    std::vector<int64_t> ids, counts;
+    std::vector<at::Tensor> rows;
+    int64_t num_rows = 0;
+
+    auto add = [&](int64_t id, at::Tensor &&r) {
+        ids.push_back(id);
+        counts.push_back(r.size(0));
+        num_rows += r.size(0);
+        rows.push_back(std::move(r));
+    };
+
+    if (pending_id_ >= 0) {
+        add(pending_id_, std::move(pending_rows_));
+        pending_id_ = -1;
+        size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    int64_t id;
+    at::Tensor r;
+    int num_waits = 0;
+    // 1. Wait for the first request
+    if (ids.empty()) {
+        const auto timeout = deadline_after(timeout_ms);
+        while (!try_pop(id, r)) {
+            if (closed_.load(std::memory_order_acquire) || steady::now() >= timeout) {
+                return std::make_tuple(
+                    at::empty({0}, at::kLong), at::empty({0}, at::kLong), at::empty({0, 0}));
+            }
+            backoff(num_waits);
+        }
+        add(id, std::move(r));
+    }
+    // 2. Fill the batch until it is full or the deadline has passed
+    const auto deadline = deadline_after(max_delay_ms);
+    num_waits = 0;
+    while (num_rows < max_rows) {
+        if (try_pop(id, r)) {
+            if (num_rows + r.size(0) > max_rows) {
+                // Still counted in `size()` until it is returned.
+                pending_id_ = id;
+                pending_rows_ = std::move(r);
+                size_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            add(id, std::move(r));
+            continue;
+        }
+        if (closed_.load(std::memory_order_acquire) || steady::now() >= deadline) {
+            break;
+        }
+        backoff(num_waits);
+    }
+
+    return std::make_tuple(
+        at::tensor(ids, at::kLong), at::tensor(counts, at::kLong), rows.size() == 1 ? rows[0] : at::cat(rows, 0));
+}
+
+int64_t RequestQueue::size() const {
+    return size_.load();
+}
+
+void RequestQueue::close() {
+    closed_.store(true);
+}
+
+bool RequestQueue::is_closed() const {
+    return closed_.load();
+}
+
+TORCH_LIBRARY_FRAGMENT(falkon, m) {
+    m.class_<RequestQueue>("RequestQueue")
+        .def(torch::init<>())
+        .def("push", &RequestQueue::push)
+        .def("pop_batch", &RequestQueue::pop_batch)
+        .def("size", &RequestQueue::size)
+        .def("close", &RequestQueue::close)
+        .def("is_closed", &RequestQueue::is_closed);
+}
+
+} // namespace falkon
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <tuple>
+
+#include <ATen/ATen.h>
+#include <torch/custom_class.h>
+
+namespace falkon {
+
+/*
+ * Multi-producer single-consumer queue of prediction requests.
+ *
+ * Producers (any number of threads) push requests without taking any lock: each push allocates
+ * a node and atomically swaps it into the head of a linked list (Vyukov's MPSC queue). A single
+ * consumer pops batches of requests, waiting until either enough rows have been collected, or
+ * a deadline (counted from the arrival of the first request of the batch) has passed.
+ */
+class RequestQueue : public torch::CustomClassHolder {
+  public:
+    RequestQueue();
+    ~RequestQueue() override;
+
+    // Add request `id` with data `rows` (a 2D tensor) to the queue.
+    void push(int64_t id, at::Tensor rows);
+
+    /*
+     * Pop a batch with at most `max_rows` rows (a single request with more rows is returned on its
+     * own). Waits up to `timeout_ms` for the first request, then up to `max_delay_ms` for more.
+     * Returns the ids of the requests, their number of rows, and their concatenated rows. The ids
+     * are empty if the timeout expired or the queue was closed.
+     */
+    std::tuple<at::Tensor, at::Tensor, at::Tensor> pop_batch(int64_t max_rows, double max_delay_ms, double timeout_ms);
+
+    // Number of requests in the queue.
+    int64_t size() const;
+
+    // Wake up the consumer: once the queue is empty, `pop_batch` returns immediately.
+    void close();
+
+    bool is_closed() const;
+
+  private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        int64_t id = -1;
+        at::Tensor rows;
+    };
+
+    // Consumer side only. Pops the oldest request into `id` and `rows`, returns false if empty.
+    bool try_pop(int64_t &id, at::Tensor &rows);
+
+    std::atomic<Node *> head_;  // last pushed node
+    Node *tail_;                // stub node, whose `next` is the oldest request
+    std::atomic<int64_t> size_{0};
+    std::atomic<bool> closed_{false};
+    // A request popped by `pop_batch` which did not fit in the batch, returned by the next call.
+    int64_t pending_id_ = -1;
+    at::Tensor pending_rows_;
+};
+
+} // namespace falkon
@@ -0,0 +1,79 @@
+#include "tracing.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <torch/library.h>
+
+namespace falkon {
+namespace tracing {
+
+std::atomic<bool> g_enabled{false};
+
+namespace {
+std::mutex registry_mutex;
+std::vector<std::shared_ptr<std::vector<Event>>> registry;
+
+std::vector<Event> &thread_buffer() {
+    thread_local std::shared_ptr<std::vector<Event>> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<std::vector<Event>>();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(buffer);
+    }
+    return *buffer;
+}
+} // namespace
+
+void set_enabled(bool enabled) {
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(const Event &event) {
+    thread_buffer().push_back(event);
+}
+
+std::tuple<std::vector<std::string>, at::Tensor, at::Tensor, at::Tensor> collect() {
+    std::vector<Event> events;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (auto &buf : registry) {
+            events.insert(events.end(), buf->begin(), buf->end());
+            buf->clear();
+        }
+    }
+    const int64_t n = events.size();
+    std::vector<std::string> names;
+    names.reserve(n);
+    auto tracks = at::empty({n, 2}, at::kLong);
+    auto times = at::empty({n, 2}, at::kLong);
+    auto work = at::empty({n, 2}, at::kDouble);
+    auto tracks_a = tracks.accessor<int64_t, 2>();
+    auto times_a = times.accessor<int64_t, 2>();
+    auto work_a = work.accessor<double, 2>();
+    for (int64_t i = 0; i < n; i++) {
+        names.emplace_back(events[i].name);
+        tracks_a[i][0] = events[i].device;
+        tracks_a[i][1] = events[i].track;
+        times_a[i][0] = events[i].start_ns;
+        times_a[i][1] = events[i].end_ns;
+        work_a[i][0] = events[i].bytes;
+        work_a[i][1] = events[i].flops;
+    }
+    return std::make_tuple(names, tracks, times, work);
+}
+
+TORCH_LIBRARY_FRAGMENT(falkon, m) {
+    m.def("_trace_set_enabled", &set_enabled);
+    m.def("_trace_collect", &collect);
+}
+
+} // namespace tracing
+} // namespace falkon
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+namespace falkon {
+namespace tracing {
+
+/*
+ * Trace events of the native ops, collected by `falkon.utils.tracing`.
+ *
+ * Recording is switched on and off at runtime: when off, `enabled()` is a single relaxed atomic
+ * load. Each thread appends its events to its own buffer, which is registered (under a lock)
+ * the first time the thread records an event, so recording never contends with other threads.
+ * Times are nanoseconds of the steady clock, the same clock as Python's `time.monotonic_ns`.
+ */
+struct Event {
+    const char *name;  // Must be a string literal
+    int64_t device;    // CUDA device, or -1 for host events
+    int64_t track;     // Stream (device events) or thread id (host events)
+    int64_t start_ns;
+    int64_t end_ns;
+    double bytes;
+    double flops;
+};
+
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void set_enabled(bool enabled);
+
+int64_t now_ns();
+
+void record(const Event &event);
+
+/*
+ * Remove all recorded events and return them as (names, [device, track] (N x 2),
+ * [start_ns, end_ns] (N x 2), [bytes, flops] (N x 2)). Must not run concurrently with traced ops.
+ */
+std::tuple<std::vector<std::string>, at::Tensor, at::Tensor, at::Tensor> collect();
+
+} // namespace tracing
+} // namespace falkon
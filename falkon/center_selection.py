@@ -1,3 +1,4 @@
+import math
 import warnings
 from abc import ABC, abstractmethod
 from typing import Optional, Tuple, Union
@@ -5,11 +6,14 @@ from typing import Optional, Tuple, Union
 import numpy as np
 import torch
 
+import falkon
+from falkon.options import FalkonOptions
 from falkon.sparse import SparseTensor
 from falkon.utils import check_random_generator
+from falkon.utils.helpers import sizeof_dtype
 from falkon.utils.tensor_helpers import create_same_stride
 
-__all__ = ("CenterSelector", "FixedSelector", "UniformSelector")
+__all__ = ("CenterSelector", "FixedSelector", "UniformSelector", "LeverageScoreSelector")
 _tensor_type = Union[torch.Tensor, SparseTensor]
 _opt_tns_tup = Union[_tensor_type, Tuple[_tensor_type, torch.Tensor]]
 _opt_tns_idx_tup = Union[Tuple[_tensor_type, torch.Tensor], Tuple[_tensor_type, torch.Tensor, torch.Tensor]]
@@ -229,7 +233,8 @@ class UniformSelector(CenterSelector):
         if isinstance(X, SparseTensor):
             X_sp = X.to_scipy()
             centers = X_sp[idx, :].copy()
-            Xc = SparseTensor.from_scipy(centers)
+            # Keep the index type of the data (e.g. if `X` already uses persistent int32 indices)
+            Xc = SparseTensor.from_scipy(centers).index_to(X.index.dtype)
             th_idx = torch.from_numpy(idx.astype(np.int64)).to(X.device)
         else:
             Xc = create_same_stride(
@@ -279,3 +284,203 @@ class UniformSelector(CenterSelector):
         if len(out) == 2:
             return out[0]
         return out[0], out[1]
+
+
+class LeverageScoreSelector(CenterSelector):
+    """Center selector which samples points proportionally to their approximate ridge leverage scores
+
+    The ridge leverage score of a point measures how much it contributes to the kernel matrix
+    at a given regularization: points in dense regions of the data have low scores, while
+    isolated points have high scores. Nystrom centers sampled according to leverage scores give
+    the same accuracy as uniformly sampled centers with fewer centers, which in turn reduces the
+    cost of the preconditioner and of the conjugate gradient iterations.
+
+    Exact leverage scores require the full kernel matrix. Instead, they are approximated with
+    a recursive procedure (in the spirit of BLESS, Rudi et al. 2018). Starting from a small
+    uniformly sampled dictionary and a large penalty, the penalty is decreased geometrically
+    by `lambda_ratio` at each level. At each level a set of candidate points is sampled
+    uniformly from the data, their scores are approximated with the dictionary of the previous
+    level, and the new dictionary is sampled from the candidates according to these scores. Its
+    size is proportional to the estimated effective dimension (the sum of the leverage scores),
+    and at most `num_centers`. Finally, `num_centers` points are sampled without replacement from
+    a last set of candidates, according to the scores at the target `penalty`.
+
+    The scores of the candidates are computed in blocks of rows, with the usual (multi-GPU)
+    kernel matrix computations. With a dictionary of size `m`, each block needs a triangular
+    solve against the Cholesky factor of the `m x m` regularized dictionary kernel.
+
+    Only dense data is supported.
+
+    Parameters
+    ----------
+    random_gen
+        A numpy random number generator object or a random seed.
+    num_centers
+        The number of centers which should be selected by this class.
+    kernel
+        The kernel of the model which will use the centers.
+    penalty
+        The regularization parameter of the leverage scores: this should be the penalty of
+        the model (:class:`~falkon.models.Falkon` uses the same scaling by the number of points).
+    oversample
+        The number of candidates of each level is `oversample` times the size of the dictionary
+        which is sampled from them.
+    lambda_ratio
+        The ratio between the penalties of successive levels.
+    opt
+        Options for the kernel computations.
+    """
+
+    def __init__(
+        self,
+        random_gen,
+        num_centers: int,
+        kernel: "falkon.kernels.Kernel",
+        penalty: float,
+        oversample: float = 4.0,
+        lambda_ratio: float = 10.0,
+        opt: Optional[FalkonOptions] = None,
+    ):
+        super().__init__(random_gen)
+        if oversample < 1:
+            raise ValueError(f"oversample must be at least 1, but is {oversample}.")
+        if lambda_ratio <= 1:
+            raise ValueError(f"lambda_ratio must be larger than 1, but is {lambda_ratio}.")
+        self.num_centers = num_centers
+        self.kernel = kernel
+        self.penalty = penalty
+        self.oversample = oversample
+        self.lambda_ratio = lambda_ratio
+        self.opt = opt or FalkonOptions()
+
+    def _uniform(self, n: int, size: int) -> np.ndarray:
+        return self.random_gen.choice(n, size=min(n, size), replace=False)
+
+    def _scores(self, X: torch.Tensor, cand_idx: np.ndarray, dict_idx: np.ndarray, penalty: float) -> np.ndarray:
+        """Approximate ridge leverage scores of the candidates `X[cand_idx]`, using the dictionary `X[dict_idx]`.
+
+        Each dictionary point stands for ``N / m`` points of the data, so the penalty ``penalty * N``
+        of the full problem becomes ``penalty * m`` on the dictionary.
+        """
+        N, m = X.shape[0], len(dict_idx)
+        th_dict_idx = torch.from_numpy(dict_idx.astype(np.int64)).to(X.device)
+        D = torch.index_select(X, dim=0, index=th_dict_idx)
+        K_dd = self.kernel(D, D, opt=self.opt)
+        K_dd.diagonal().add_(penalty * m)
+        L = torch.linalg.cholesky(K_dd)
+        # Blocks of candidates of at most ~128MB of kernel.
+        blk = max(1, (2**27) // (m * sizeof_dtype(X.dtype)))
+        scores = []
+        for start in range(0, len(cand_idx), blk):
+            th_idx = torch.from_numpy(cand_idx[start : start + blk].astype(np.int64)).to(X.device)
+            X_b = torch.index_select(X, dim=0, index=th_idx)
+            k_bd = self.kernel(X_b, D, opt=self.opt)
+            k_bb = self.kernel(X_b, X_b, diag=True, opt=self.opt)
+            Z = torch.linalg.solve_triangular(L, k_bd.T, upper=False)
+            scores.append((k_bb - Z.square().sum(0)).clamp_min_(0.0) / (penalty * N))
+        return torch.cat(scores).cpu().numpy().astype(np.float64)
+
+    def _sample(self, cand_idx: np.ndarray, scores: np.ndarray, size: int) -> np.ndarray:
+        size = min(size, len(cand_idx), int(np.count_nonzero(scores)))
+        if size == 0:  # Degenerate scores: fall back to uniform sampling
+            return self.random_gen.choice(cand_idx, size=1, replace=False)
+        return self.random_gen.choice(cand_idx, size=size, replace=False, p=scores / scores.sum())
+
+    def select_indices(self, X: _tensor_type, Y: Optional[torch.Tensor]) -> _opt_tns_idx_tup:
+        """Select M observations from 2D tensor `X` according to their approximate leverage scores.
+
+        This method behaves the same as :meth:`select` but additionally returns a `LongTensor`
+        containing the indices of the chosen points.
+
+        Parameters
+        ----------
+        X
+            N x D dense tensor containing the whole input dataset. If N is lower than the number
+            of centers this class is programmed to pick, a warning will be raised and only N
+            centers will be returned.
+        Y
+            Optional N x T tensor containing the input targets. If `Y` is provided,
+            the same observations selected for `X` will also be selected from `Y`.
+
+        Returns
+        -------
+        (X_M, indices)
+            The selected centers and the corresponding indices. The centers will be stored in a
+            new, memory-contiguous tensor and all characteristics of the input tensor will be
+            preserved.
+        (X_M, Y_M, indices)
+            If parameter`Y` is not `None` then the entries of `Y` corresponding to the
+            selected centers of `X` will also be returned.
+        """
+        if isinstance(X, SparseTensor):
+            raise NotImplementedError("Leverage score selection is only implemented for dense data.")
+        N = X.shape[0]
+        num_centers = self.num_centers
+        if num_centers > N:
+            warnings.warn(
+                "Number of centers M greater than the " f"number of data-points. Setting `num_centers` to {N}",
+                stacklevel=2,
+            )
+            num_centers = N
+
+        # The kernel values are at most of the order of the largest diagonal entry, so leverage
+        # scores at a penalty of that order are all small: start from there.
+        first_idx = self._uniform(N, max(1, math.ceil(self.oversample)))
+        lam = max(float(self.kernel(X[first_idx], X[first_idx], diag=True, opt=self.opt).max()), self.penalty)
+        num_levels = max(0, math.ceil(math.log(lam / self.penalty, self.lambda_ratio)))
+        lambdas = [lam / self.lambda_ratio**h for h in range(1, num_levels)]
+
+        dict_idx = first_idx
+        for lam in lambdas:
+            cand_idx = self._uniform(N, math.ceil(self.oversample * num_centers))
+            scores = self._scores(X, cand_idx, dict_idx, lam)
+            # The scores of the candidates estimate the effective dimension of the whole data.
+            eff_dim = scores.sum() * N / len(cand_idx)
+            dict_size = max(len(first_idx), min(num_centers, math.ceil(self.oversample * eff_dim)))
+            dict_idx = self._sample(cand_idx, scores, dict_size)
+
+        cand_idx = self._uniform(N, math.ceil(self.oversample * num_centers))
+        if len(cand_idx) <= num_centers:
+            idx = cand_idx
+        else:
+            scores = self._scores(X, cand_idx, dict_idx, self.penalty)
+            idx = self._sample(cand_idx, scores, num_centers)
+            if len(idx) < num_centers:  # Fewer candidates with non-zero scores than centers
+                rest = np.setdiff1d(cand_idx, idx, assume_unique=True)
+                idx = np.concatenate((idx, self.random_gen.choice(rest, size=num_centers - len(idx), replace=False)))
+
+        th_idx = torch.from_numpy(idx.astype(np.int64)).to(X.device)
+        Xc = create_same_stride((len(idx), X.shape[1]), other=X, dtype=X.dtype, device=X.device, pin_memory=False)
+        torch.index_select(X, dim=0, index=th_idx, out=Xc)
+        if Y is not None:
+            Yc = create_same_stride((len(idx), Y.shape[1]), other=Y, dtype=Y.dtype, device=Y.device, pin_memory=False)
+            torch.index_select(Y, dim=0, index=th_idx.to(Y.device), out=Yc)
+            return Xc, Yc, th_idx
+        return Xc, th_idx
+
+    def select(self, X: _tensor_type, Y: Optional[torch.Tensor]) -> _opt_tns_tup:
+        """Select M observations from 2D tensor `X` according to their approximate leverage scores.
+
+        Parameters
+        ----------
+        X
+            N x D dense tensor containing the whole input dataset. If N is lower than the number
+            of centers this class is programmed to pick, a warning will be raised and only N
+            centers will be returned.
+        Y
+            Optional N x T tensor containing the input targets. If `Y` is provided,
+            the same observations selected for `X` will also be selected from `Y`.
+
+        Returns
+        -------
+        X_M
+            The selected centers. They will be in a new, memory-contiguous tensor.
+            All characteristics of the input tensor will be preserved.
+        (X_M, Y_M)
+            If `Y` was different than `None` then the entries of `Y` corresponding to the
+            selected centers of `X` will also be returned.
+        """
+        out = self.select_indices(X, Y)
+        if len(out) == 2:
+            return out[0]
+        return out[0], out[1]
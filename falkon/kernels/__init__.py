@@ -4,6 +4,7 @@ from .diff_kernel import DiffKernel
 from .distance_kernel import GaussianKernel, LaplacianKernel, MaternKernel
 from .dot_prod_kernel import LinearKernel, PolynomialKernel, SigmoidKernel
 from .precomputed_kernel import PrecomputedKernel
+from .tiered_knm_kernel import TieredKnmKernel
 
 __all__ = (
     "Kernel",
@@ -16,4 +17,5 @@ __all__ = (
     "PolynomialKernel",
     "SigmoidKernel",
     "PrecomputedKernel",
+    "TieredKnmKernel",
 )
@@ -1,6 +1,6 @@
 import abc
 import dataclasses
-from typing import Any, Dict, Optional, Union
+from typing import Any, Dict, List, Optional, Union
 
 import torch
 from torch import nn
@@ -112,6 +112,37 @@ class DiffKernel(Kernel, abc.ABC):
         """
         return self.core_fn(X1, X2, out=None, diag=diag, **kwargs, **self.diff_params, **self._other_params)
 
+    def compute_mmv_grad(
+        self, X1: torch.Tensor, X2: torch.Tensor, v: torch.Tensor, grad_out: torch.Tensor, **kwargs
+    ) -> Optional[List[Optional[torch.Tensor]]]:
+        """Gradients of the kernel-vector product ``k(X1, X2) @ v``, given the gradient of its output.
+
+        This is called on each (N x M) block by the backward pass of the differentiable
+        kernel-vector products. Kernels which implement it compute the gradients in closed form
+        from a single evaluation of the kernel block, instead of building and back-propagating
+        through the autograd graph of :meth:`compute_diff`. The default implementation returns
+        None, in which case autograd is used.
+
+        Parameters
+        ----------
+        X1 : torch.Tensor
+            The left matrix for computing the kernel (N x D)
+        X2 : torch.Tensor
+            The right matrix for computing the kernel (M x D)
+        v : torch.Tensor
+            The vector multiplied by the kernel (M x T)
+        grad_out : torch.Tensor
+            The gradient with respect to the kernel-vector product (N x T)
+
+        Returns
+        -------
+        grads : list of torch.Tensor or None
+            The gradients with respect to ``X1``, ``X2``, ``v`` and each of the :meth:`diff_params`
+            (in order), with None for the inputs which do not require gradients. None if the
+            gradients must be computed with autograd.
+        """
+        return None
+
     @abc.abstractmethod
     def detach(self) -> "Kernel":
         """Detaches all differentiable parameters of the kernel from the computation graph.
@@ -1,20 +1,29 @@
-from typing import Dict, Optional, Type, Union
+from typing import Dict, List, Optional, Type, Union
 
 import numpy as np
 import torch
 
 import falkon
-from falkon import sparse
+from falkon import c_ext, sparse
 from falkon.kernels import KeopsKernelMixin
 from falkon.kernels.diff_kernel import DiffKernel
 from falkon.la_helpers import square_norm
-from falkon.mmv_ops.utils import CUDA_EXTRA_MM_RAM
+from falkon.mmv_ops.utils import CUDA_EXTRA_MM_RAM, REDUCED_DIST_BUF_BYTES
 from falkon.options import FalkonOptions
 from falkon.sparse import SparseTensor
+from falkon.utils import workspace
 from falkon.utils.helpers import sizeof_dtype
 
 SQRT3 = 1.7320508075688772
 SQRT5 = 2.23606797749979
+# Kernel types of the `fused_distance_kernel` C++ op
+FUSED_GAUSSIAN = 0
+FUSED_LAPLACIAN = 1
+FUSED_MATERN32 = 2
+FUSED_MATERN52 = 3
+# Largest data dimension for which the CUDA `fused_distance_kernel` op is used. Its inner
+# product loop is much slower than cuBLAS when the GEMM is not dominated by the epilogue.
+FUSED_MAX_D = 128
 
 
 def validate_sigma(sigma: Union[float, torch.Tensor]) -> torch.Tensor:
@@ -85,6 +94,82 @@ def _distance_kernel_extra_mem(
     return out_dict
 
 
+_REDUCED_DTYPES = (torch.float16, torch.bfloat16)
+
+
+def _single_precision_core(core_fn, mat1, mat2, out: Optional[torch.Tensor], diag: bool, *args) -> torch.Tensor:
+    """Compute the kernel between reduced precision (fp16 or bf16) inputs from fp32 copies of them.
+
+    Only used outside of the kernel tiles of the GPU kernel-vector products (see
+    :func:`_reduced_precision_core`), e.g. for the diagonal or for differentiable kernels.
+    """
+    out32 = None
+    if out is not None:
+        out32 = torch.empty(out.shape, dtype=torch.float32, device=out.device)
+    out32 = core_fn(mat1.float(), mat2.float(), out32, diag, *args)
+    if out is None:
+        return out32.to(dtype=mat1.dtype)
+    return out.copy_(out32)
+
+
+def _reduced_precision_core(
+    core_fn, kernel_fn, mat1, mat2, out: Optional[torch.Tensor], diag: bool, sigma: torch.Tensor, *args
+) -> torch.Tensor:
+    """Compute the kernel tile `out` between reduced precision (fp16 or bf16) tiles on the GPU.
+
+    The squared distances are the difference between the norms and the dot-products, which
+    cancel out for inputs with large norms and small distances. The norms are therefore computed
+    in fp32, and the cross-term GEMM runs on the reduced precision tiles with fp32 accumulation
+    and output. The distances and `kernel_fn` (which maps them to the kernel, in place) are
+    evaluated a block of rows at a time, in an fp32 buffer of at most ``REDUCED_DIST_BUF_BYTES``
+    borrowed from the workspace, and only the kernel is rounded to the tile data-type.
+    """
+    if out is None or diag or not mat1.is_cuda or mat1.dim() != 2 or mat1.requires_grad or mat2.requires_grad:
+        return _single_precision_core(core_fn, mat1, mat2, out, diag, sigma, *args)
+    sigma = sigma.to(device=mat1.device, dtype=torch.float32)
+    mat1_div_sig = torch.div(mat1, sigma, out=torch.empty(mat1.shape, dtype=mat1.dtype, device=mat1.device))
+    mat2_div_sig = torch.div(mat2, sigma, out=torch.empty(mat2.shape, dtype=mat2.dtype, device=mat2.device))
+    norm_sq_mat1 = torch.linalg.vector_norm(mat1_div_sig, dim=-1, keepdim=True, dtype=torch.float32).square_()
+    norm_sq_mat2 = torch.linalg.vector_norm(mat2_div_sig, dim=-1, keepdim=True, dtype=torch.float32).square_()
+    n, m, d = mat1.shape[0], mat2.shape[0], mat1.shape[1]
+    blk_rows = max(1, min(n, REDUCED_DIST_BUF_BYTES // (sizeof_dtype(torch.float32) * m)))
+    with workspace.borrow(blk_rows * m, torch.float32, out.device) as buf:
+        for i in range(0, n, blk_rows):
+            rows = min(blk_rows, n - i)
+            sq_dist = buf[: rows * m].view(rows, m)
+            # Column-major: sq_dist.T (m x rows) = -2 * mat2_div_sig @ mat1_div_sig[i:i + rows].T
+            c_ext.cublas_gemm(
+                mat2_div_sig, d, True, mat1_div_sig[i : i + rows], d, False, sq_dist, m, m, rows, d, -2.0, 0.0
+            )
+            sq_dist.add_(norm_sq_mat1[i : i + rows]).add_(norm_sq_mat2.T).clamp_min_(1e-20)
+            out[i : i + rows].copy_(kernel_fn(sq_dist, *args))
+    return out
+
+
+def _rbf_from_sq_dist(sq_dist: torch.Tensor) -> torch.Tensor:
+    return sq_dist.mul_(-0.5).exp_()
+
+
+def _laplacian_from_sq_dist(sq_dist: torch.Tensor) -> torch.Tensor:
+    return sq_dist.sqrt_().neg_().exp_()
+
+
+def _matern_from_sq_dist(sq_dist: torch.Tensor, nu: float) -> torch.Tensor:
+    if nu == 0.5:
+        return _laplacian_from_sq_dist(sq_dist)
+    elif nu == float("inf"):
+        return _rbf_from_sq_dist(sq_dist)
+    elif nu == 1.5:
+        # (1 + sqrt(3)*D) * exp(-sqrt(3)*D))
+        sq_dist.sqrt_().mul_(SQRT3)
+        exp_neg = torch.neg(sq_dist).exp_()
+        return sq_dist.add_(1.0).mul_(exp_neg)
+    # nu == 2.5: (1 + sqrt(5)*D + (sqrt(5)*D)^2 / 3 ) * exp(-sqrt(5)*D)
+    dist = torch.sqrt(sq_dist).mul_(SQRT5)
+    sq_dist.mul_(5.0 / 3.0).add_(dist).add_(1.0)
+    return sq_dist.mul_(dist.neg_().exp_())
+
+
 def _sq_dist(mat1, mat2, norm_mat1, norm_mat2, out: Optional[torch.Tensor]) -> torch.Tensor:
     if mat1.dim() == 3:
         if out is None:
@@ -101,11 +186,51 @@ def _sq_dist(mat1, mat2, norm_mat1, norm_mat2, out: Optional[torch.Tensor]) -> t
     return out
 
 
+def _can_fuse(mat1: torch.Tensor, mat2: torch.Tensor, out: Optional[torch.Tensor]) -> bool:
+    """Whether the kernel can be computed with the `fused_distance_kernel` op.
+
+    The op writes each kernel entry once, instead of the multiple passes over the output of
+    `_sq_dist` followed by the kernel function. It is not differentiable, so it is only used
+    when an output tensor is provided (see the notes in :func:`rbf_core`). On the GPU it is
+    only used up to :data:`FUSED_MAX_D` dimensions, since the CPU op uses a BLAS GEMM but the
+    CUDA op computes the inner products itself.
+    """
+    return (
+        out is not None
+        and mat1.dim() == 2
+        and (not mat1.is_cuda or mat1.shape[1] <= FUSED_MAX_D)
+        and out.dtype in (torch.float32, torch.float64)
+        and (out.stride(0) == 1 or out.stride(1) == 1)
+        and not (mat1.requires_grad or mat2.requires_grad)
+    )
+
+
+def distance_mmv_core(
+    mat1: torch.Tensor, mat2: torch.Tensor, v: torch.Tensor, out: torch.Tensor, sigma: torch.Tensor, kernel_type: int
+) -> torch.Tensor:
+    """Accumulate the kernel-vector product ``k(mat1, mat2) @ v`` into `out`.
+
+    Uses the `fused_distance_mmv` op, which does not store the kernel matrix. Only the
+    inputs divided by `sigma` and their squared norms are allocated.
+    """
+    sigma = sigma.to(device=mat1.device, dtype=mat1.dtype)
+    mat1_div_sig = mat1 / sigma
+    mat2_div_sig = mat2 / sigma
+    norm_sq_mat1 = square_norm(mat1_div_sig, -1, False)  # n
+    norm_sq_mat2 = square_norm(mat2_div_sig, -1, False)  # m
+    return c_ext.fused_distance_mmv(
+        mat1_div_sig, mat2_div_sig, v, norm_sq_mat1, norm_sq_mat2, kernel_type=kernel_type, out=out
+    )
+
+
 def _sparse_sq_dist(
     X1_csr: SparseTensor, X2_csr: SparseTensor, X1: SparseTensor, X2: SparseTensor, out: torch.Tensor
 ) -> torch.Tensor:
-    sq1 = torch.empty(X1_csr.size(0), dtype=X1_csr.dtype, device=X1_csr.device)
-    sparse.sparse_square_norm(X1_csr, sq1)
+    # Use the copy of X1 which is on the output device, if it is a CSR matrix (X2 is not, since
+    # it is transposed for the sparse matrix multiplication).
+    sq1_src = X1 if X1.is_csr and X1.device == out.device else X1_csr
+    sq1 = torch.empty(sq1_src.size(0), dtype=sq1_src.dtype, device=sq1_src.device)
+    sparse.sparse_square_norm(sq1_src, sq1)
     sq1 = sq1.reshape(-1, 1)
     sq2 = torch.empty(X2_csr.size(0), dtype=X2_csr.dtype, device=X2_csr.device)
     sparse.sparse_square_norm(X2_csr, sq2)
@@ -144,6 +269,8 @@ def rbf_core(
     Note 1: if out is None, then this function will be differentiable wrt all three remaining inputs.
     Note 2: this function can deal with batched inputs
     """
+    if mat1.dtype in _REDUCED_DTYPES:
+        return _reduced_precision_core(rbf_core, _rbf_from_sq_dist, mat1, mat2, out, diag, sigma)
     # Move hparams
     sigma = sigma.to(device=mat1.device, dtype=mat1.dtype)
     if diag:
@@ -152,6 +279,10 @@ def rbf_core(
     mat2_div_sig = mat2 / sigma
     norm_sq_mat1 = square_norm(mat1_div_sig, -1, True)  # b*n*1 or n*1
     norm_sq_mat2 = square_norm(mat2_div_sig, -1, True)  # b*m*1 or m*1
+    if _can_fuse(mat1_div_sig, mat2_div_sig, out):
+        return c_ext.fused_distance_kernel(
+            mat1_div_sig, mat2_div_sig, norm_sq_mat1, norm_sq_mat2, kernel_type=FUSED_GAUSSIAN, out=out
+        )
 
     out = _sq_dist(mat1_div_sig, mat2_div_sig, norm_sq_mat1, norm_sq_mat2, out)
     out.mul_(-0.5)
@@ -159,6 +290,43 @@ def rbf_core(
     return out
 
 
+def rbf_mmv_grad(
+    mat1: torch.Tensor, mat2: torch.Tensor, v: torch.Tensor, grad_out: torch.Tensor, sigma: torch.Tensor
+) -> List[Optional[torch.Tensor]]:
+    """Closed-form gradients of the Gaussian kernel-vector product ``k(mat1, mat2) @ v``.
+
+    With ``W = k(mat1, mat2) * (grad_out @ v.T)``, its row-sums ``r`` and column-sums ``c``:
+    the gradient wrt `v` is ``k.T @ grad_out``, wrt `mat1` is ``(W @ mat2 - r * mat1) / sigma**2``,
+    wrt `mat2` is ``(W.T @ mat1 - c * mat2) / sigma**2``, and wrt `sigma` is the sum over all
+    entries of ``W * (mat1_i - mat2_j)**2 / sigma**3``. A single kernel block is computed, and
+    only the gradients of the inputs which require them.
+    """
+    need = [t.requires_grad for t in (mat1, mat2, v, sigma)]
+    grads: List[Optional[torch.Tensor]] = [None] * 4
+    with torch.no_grad():
+        sig = sigma.to(device=mat1.device, dtype=mat1.dtype)
+        x1, x2, v = mat1.detach(), mat2.detach(), v.detach()
+        K = rbf_core(x1, x2, out=None, diag=False, sigma=sig)
+        if need[2]:
+            grads[2] = K.T @ grad_out
+        W = K.mul_(grad_out @ v.T)
+        r = W.sum(1, keepdim=True)  # n*1
+        c = W.sum(0).unsqueeze(1)  # m*1
+        sig_sq = sig.square()
+        WX2 = W @ x2 if need[0] or need[3] else None
+        if need[3]:
+            g_sig = (r * x1.square()).sum(0) - 2 * (x1 * WX2).sum(0) + (c * x2.square()).sum(0)
+            g_sig.div_(sig_sq * sig)
+            if sigma.numel() == 1:
+                g_sig = g_sig.sum()
+            grads[3] = g_sig.reshape(sigma.shape).to(device=sigma.device, dtype=sigma.dtype)
+        if need[0]:
+            grads[0] = WX2.sub_(r * x1).div_(sig_sq)
+        if need[1]:
+            grads[1] = (W.T @ x1).sub_(c * x2).div_(sig_sq)
+    return grads
+
+
 def rbf_core_sparse(
     mat1: SparseTensor,
     mat2: SparseTensor,
@@ -182,6 +350,8 @@ def rbf_core_sparse(
 def laplacian_core(
     mat1: torch.Tensor, mat2: torch.Tensor, out: Optional[torch.Tensor], diag: bool, sigma: torch.Tensor
 ):
+    if mat1.dtype in _REDUCED_DTYPES:
+        return _reduced_precision_core(laplacian_core, _laplacian_from_sq_dist, mat1, mat2, out, diag, sigma)
     if diag:
         return _distancek_diag(mat1, out)
     # Move hparams
@@ -190,6 +360,10 @@ def laplacian_core(
     mat2_div_sig = mat2 / sigma
     norm_sq_mat1 = square_norm(mat1_div_sig, -1, True)  # b*n*1
     norm_sq_mat2 = square_norm(mat2_div_sig, -1, True)  # b*m*1
+    if _can_fuse(mat1_div_sig, mat2_div_sig, out):
+        return c_ext.fused_distance_kernel(
+            mat1_div_sig, mat2_div_sig, norm_sq_mat1, norm_sq_mat2, kernel_type=FUSED_LAPLACIAN, out=out
+        )
     orig_out = out
     out = _sq_dist(mat1_div_sig, mat2_div_sig, norm_sq_mat1, norm_sq_mat2, out)
     out.sqrt_()  # Laplacian: sqrt of squared-difference
@@ -228,6 +402,8 @@ def laplacian_core_sparse(
 def matern_core(
     mat1: torch.Tensor, mat2: torch.Tensor, out: Optional[torch.Tensor], diag: bool, sigma: torch.Tensor, nu: float
 ):
+    if mat1.dtype in _REDUCED_DTYPES:
+        return _reduced_precision_core(matern_core, _matern_from_sq_dist, mat1, mat2, out, diag, sigma, nu)
     if diag:
         return _distancek_diag(mat1, out)
     # Move hparams
@@ -241,6 +417,15 @@ def matern_core(
     mat2_div_sig = mat2 / sigma
     norm_sq_mat1 = square_norm(mat1_div_sig, -1, True)  # b*n*1
     norm_sq_mat2 = square_norm(mat2_div_sig, -1, True)  # b*m*1
+    if _can_fuse(mat1_div_sig, mat2_div_sig, out) and nu in (1.5, 2.5):
+        return c_ext.fused_distance_kernel(
+            mat1_div_sig,
+            mat2_div_sig,
+            norm_sq_mat1,
+            norm_sq_mat2,
+            kernel_type=FUSED_MATERN32 if nu == 1.5 else FUSED_MATERN52,
+            out=out,
+        )
 
     out = _sq_dist(mat1_div_sig, mat2_div_sig, norm_sq_mat1, norm_sq_mat2, out)
     if nu == 1.5:
@@ -406,6 +591,20 @@ class GaussianKernel(DiffKernel, KeopsKernelMixin):
             kernel_cls=self.__class__,
         )
 
+    def supports_reduced_precision(self) -> bool:
+        return True
+
+    def fused_mmv_type(self) -> Optional[int]:
+        return FUSED_GAUSSIAN
+
+    def compute_mmv_fused(self, X1: torch.Tensor, X2: torch.Tensor, v: torch.Tensor, out: torch.Tensor):
+        return distance_mmv_core(X1, X2, v, out, self.sigma, FUSED_GAUSSIAN)
+
+    def compute_mmv_grad(self, X1: torch.Tensor, X2: torch.Tensor, v: torch.Tensor, grad_out: torch.Tensor, **kwargs):
+        if X1.dim() != 2:
+            return None
+        return rbf_mmv_grad(X1, X2, v, grad_out, self.sigma)
+
     def detach(self) -> "GaussianKernel":
         return GaussianKernel(self.sigma.detach(), opt=self.params)
 
@@ -480,6 +679,15 @@ class LaplacianKernel(DiffKernel, KeopsKernelMixin):
             kernel_cls=self.__class__,
         )
 
+    def supports_reduced_precision(self) -> bool:
+        return True
+
+    def fused_mmv_type(self) -> Optional[int]:
+        return FUSED_LAPLACIAN
+
+    def compute_mmv_fused(self, X1: torch.Tensor, X2: torch.Tensor, v: torch.Tensor, out: torch.Tensor):
+        return distance_mmv_core(X1, X2, v, out, self.sigma, FUSED_LAPLACIAN)
+
     def detach(self) -> "LaplacianKernel":
         return LaplacianKernel(self.sigma.detach(), opt=self.params)
 
@@ -583,6 +791,20 @@ class MaternKernel(DiffKernel, KeopsKernelMixin):
             nu=self.nu,
         )
 
+    def supports_reduced_precision(self) -> bool:
+        return True
+
+    def fused_mmv_type(self) -> Optional[int]:
+        return {
+            0.5: FUSED_LAPLACIAN,
+            1.5: FUSED_MATERN32,
+            2.5: FUSED_MATERN52,
+            float("inf"): FUSED_GAUSSIAN,
+        }[self.nu]
+
+    def compute_mmv_fused(self, X1: torch.Tensor, X2: torch.Tensor, v: torch.Tensor, out: torch.Tensor):
+        return distance_mmv_core(X1, X2, v, out, self.sigma, self.fused_mmv_type())
+
     def detach(self) -> "MaternKernel":
         return MaternKernel(self.sigma.detach(), self.nondiff_params["nu"], opt=self.params)
 
@@ -5,6 +5,7 @@ from typing import Dict, List, Optional, Union
 import torch
 
 from falkon.kernels import Kernel
+from falkon.mmv_ops.fmmv import should_use_fused_mmv
 from falkon.options import FalkonOptions, KeopsOptions
 from falkon.sparse import SparseTensor
 from falkon.utils.switches import decide_keops
@@ -269,7 +270,8 @@ class KeopsKernelMixin(Kernel, abc.ABC):
         return self.keops_can_handle_mmv(X1, X2, v, opt) and self.keops_can_handle_mmv(X2, X1, w, opt)
 
     def _decide_mmv_impl(self, X1, X2, v, opt: FalkonOptions):
-        if self.keops_can_handle_mmv(X1, X2, v, opt):
+        # The native fused kernel-vector product (in `fmmv`) takes precedence over KeOps.
+        if self.keops_can_handle_mmv(X1, X2, v, opt) and not should_use_fused_mmv(self, X1, X2, opt):
             return self.keops_mmv_impl
         else:
             return super()._decide_mmv_impl(X1, X2, v, opt)
@@ -573,5 +573,49 @@ class Kernel(torch.nn.Module, ABC):
         """
         return {}
 
+    def fused_mmv_type(self) -> Optional[int]:
+        """The kernel type of the native `fused_distance_mmv` op which evaluates this kernel.
+
+        Kernels which return a kernel type (instead of the default `None`) must also implement
+        :meth:`compute_mmv_fused`. Their kernel-vector products may then run without storing
+        the kernel matrix, when the ``fused_mmv`` option is set.
+        """
+        return None
+
+    def supports_reduced_precision(self) -> bool:
+        """Whether :meth:`compute` accepts half-precision (``torch.float16`` or ``torch.bfloat16``) inputs and outputs.
+
+        Only kernels which return True have their GPU kernel-vector products computed with
+        reduced precision tiles, when the ``mmv_precision`` option is set.
+        """
+        return False
+
+    def compute_mmv_fused(
+        self,
+        X1: torch.Tensor,
+        X2: torch.Tensor,
+        v: torch.Tensor,
+        out: torch.Tensor,
+    ) -> torch.Tensor:
+        """Accumulate the kernel-vector product ``k(X1, X2) @ v`` into ``out``, without materializing the kernel.
+
+        Parameters
+        ----------
+        X1 : torch.Tensor
+            The left matrix for computing the kernel (N x D)
+        X2 : torch.Tensor
+            The right matrix for computing the kernel (M x D)
+        v : torch.Tensor
+            The vector to be multiplied by the kernel (M x T)
+        out : torch.Tensor
+            The output (N x T), to which the kernel-vector product is added.
+
+        Returns
+        -------
+        out : torch.Tensor
+            The accumulated output. Should use the same underlying storage as the parameter ``out``.
+        """
+        raise NotImplementedError(f"{self.__class__.__name__} does not support fused kernel-vector products.")
+
     def __str__(self):
         return f"<{self.name} kernel>"
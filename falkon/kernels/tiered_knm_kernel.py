@@ -0,0 +1,233 @@
+import logging
+import os
+import tempfile
+import time
+from contextlib import ExitStack
+from dataclasses import dataclass
+from typing import Iterator, List, Optional, Tuple, Union
+
+import torch
+from torch import Tensor
+
+from falkon.kernels import Kernel
+from falkon.options import FalkonOptions
+from falkon.sparse import SparseTensor
+from falkon.utils.helpers import sizeof_dtype
+from falkon.utils.staging import PinnedStager
+
+__all__ = ("TieredKnmKernel",)
+logger = logging.getLogger(__name__)
+
+_GPU, _RAM, _DISK, _RECOMPUTE = "gpu", "ram", "disk", "recompute"
+
+
+@dataclass
+class _KnmTile:
+    start: int
+    length: int
+    tier: str
+    data: Optional[Tensor] = None
+    disk_offset: int = 0
+
+
+class TieredKnmKernel(Kernel):
+    """The kernel between the training data and the Nystrom centers, cached in row-tiles.
+
+    The row-tiles of the (N x M) kernel matrix are computed once, and each is stored in the
+    first tier with enough free space: GPU memory (up to `gpu_mem` bytes), host memory (up to
+    `cpu_mem` bytes, pinned when `device` is a GPU), and a file in `cache_dir`. A tile is only
+    written to the file if reading it back (at `disk_bandwidth` bytes per second) is estimated to
+    be faster than recomputing it, where the cost of recomputing is measured while the tiles are
+    first computed. Tiles which are not stored anywhere are recomputed at every kernel-vector
+    product.
+
+    Kernel-vector products between the data and the centers (in both directions) and double
+    kernel-vector products then run tile by tile on `device`. Tiles read from the file are
+    staged in pinned memory by a background thread (see :class:`~falkon.utils.staging.PinnedStager`),
+    so that reading the next tile overlaps with the computation on the current one. Products
+    involving any other data are computed by `kernel`.
+
+    Tiered caches are built by :class:`~falkon.models.Falkon` when the ``knm_cache`` option is set.
+
+    Parameters
+    ----------
+    kernel
+        The kernel which is cached.
+    X
+        The (N x D) dense training data.
+    centers
+        The (M x D) Nystrom centers.
+    tile_rows
+        The number of rows of each tile.
+    device
+        Where the cached kernel-vector products are computed.
+    gpu_mem
+        Maximum number of bytes of tiles stored in the memory of `device` (ignored for CPU devices).
+    cpu_mem
+        Maximum number of bytes of tiles stored in host memory.
+    cache_dir
+        Directory of the file holding the tiles which do not fit in memory. The file is removed
+        as soon as it has been written (and memory-mapped), so it never outlives the kernel.
+        If None, such tiles are recomputed.
+    disk_bandwidth
+        Estimated read bandwidth of `cache_dir`, in bytes per second.
+    opt
+        Options for the kernel-vector products.
+    """
+
+    def __init__(
+        self,
+        kernel: Kernel,
+        X: Tensor,
+        centers: Tensor,
+        tile_rows: int,
+        device: Union[str, torch.device],
+        gpu_mem: float,
+        cpu_mem: float,
+        cache_dir: Optional[str] = None,
+        disk_bandwidth: float = 2e9,
+        opt: Optional[FalkonOptions] = None,
+    ):
+        super().__init__("tiered-knm", opt)
+        if isinstance(X, SparseTensor) or isinstance(centers, SparseTensor):
+            raise NotImplementedError("Tiered Knm caches are only implemented for dense data.")
+        self.kernel = kernel
+        self.X = X
+        self.centers = centers
+        self.device = torch.device(device)
+        self.tiles: List[_KnmTile] = []
+        self._disk: Optional[Tensor] = None
+
+        N, M = X.shape[0], centers.shape[0]
+        use_gpu = self.device.type == "cuda"
+        if not use_gpu:
+            gpu_mem = 0
+        dts = sizeof_dtype(X.dtype)
+        comp_time_per_byte = float("inf")
+        disk_file, disk_rows = None, 0
+        try:
+            for start in range(0, N, tile_rows):
+                length = min(tile_rows, N - start)
+                nbytes = length * M * dts
+                t_s = time.time()
+                k_tile = kernel(X[start : start + length], centers, opt=self.params).detach()
+                comp_time_per_byte = min(comp_time_per_byte, (time.time() - t_s) / nbytes)
+                tile = _KnmTile(start, length, _RECOMPUTE)
+                if nbytes <= gpu_mem:
+                    tile.tier, tile.data = _GPU, k_tile.to(self.device)
+                    gpu_mem -= nbytes
+                elif nbytes <= cpu_mem:
+                    tile.tier, tile.data = _RAM, k_tile.pin_memory() if use_gpu else k_tile
+                    cpu_mem -= nbytes
+                elif cache_dir is not None and 1 / disk_bandwidth < comp_time_per_byte:
+                    if disk_file is None:
+                        disk_file = tempfile.NamedTemporaryFile(dir=cache_dir, prefix="falkon-knm-", delete=False)
+                    disk_file.write(k_tile.contiguous().numpy().tobytes())
+                    tile.tier, tile.disk_offset = _DISK, disk_rows
+                    disk_rows += length
+                self.tiles.append(tile)
+        finally:
+            if disk_file is not None:
+                disk_file.close()
+        if disk_file is not None:
+            # The mapping stays valid after the file is unlinked, and its space is freed with it.
+            self._disk = torch.from_file(disk_file.name, shared=False, size=disk_rows * M, dtype=X.dtype)
+            self._disk = self._disk.reshape(disk_rows, M)
+            os.unlink(disk_file.name)
+        if self.params.debug:
+            logger.info(f"Tiered Knm cache with {len(self.tiles)} tiles: {self.tier_counts()}")
+
+    def tier_counts(self) -> dict:
+        """Number of tiles stored in each tier (``gpu``, ``ram``, ``disk``) or recomputed (``recompute``)."""
+        counts = {_GPU: 0, _RAM: 0, _DISK: 0, _RECOMPUTE: 0}
+        for tile in self.tiles:
+            counts[tile.tier] += 1
+        return counts
+
+    def _matches(self, X1, X2) -> bool:
+        return (X1 is self.X and X2 is self.centers) or (X1 is self.centers and X2 is self.X)
+
+    def _iter_tiles(self) -> Iterator[Tuple[_KnmTile, Optional[Tensor]]]:
+        """Each tile, with its kernel block on `device` (or None if the tile must be recomputed)."""
+        stream = torch.cuda.current_stream(self.device) if self.device.type == "cuda" else None
+        disk_blocks = [(t.disk_offset, t.length) for t in self.tiles if t.tier == _DISK]
+        with ExitStack() as stack:
+            stager = None
+            if len(disk_blocks) > 0:
+                stager = stack.enter_context(PinnedStager(self._disk, disk_blocks, self.device))
+            for tile in self.tiles:
+                if tile.tier == _GPU:
+                    yield tile, tile.data
+                elif tile.tier == _RAM:
+                    yield tile, tile.data.to(self.device, non_blocking=True)
+                elif tile.tier == _DISK:
+                    k_tile = stager.get().to(self.device, non_blocking=True)
+                    stager.release(stream)
+                    yield tile, k_tile
+                else:
+                    yield tile, None
+
+    def compute(self, X1: Tensor, X2: Tensor, out: Tensor, diag: bool, **kwargs) -> Tensor:
+        return self.kernel.compute(X1, X2, out, diag, **kwargs)
+
+    def compute_sparse(self, X1: SparseTensor, X2: SparseTensor, out: Tensor, diag: bool, **kwargs) -> Tensor:
+        return self.kernel.compute_sparse(X1, X2, out, diag, **kwargs)
+
+    def _decide_mmv_impl(self, X1, X2, v, opt):
+        if self._matches(X1, X2):
+            return self.mmv_impl
+        return self.kernel._decide_mmv_impl(X1, X2, v, opt)
+
+    def _decide_dmmv_impl(self, X1, X2, v, w, opt):
+        if self._matches(X1, X2):
+            return self.dmmv_impl
+        return self.kernel._decide_dmmv_impl(X1, X2, v, w, opt)
+
+    def mmv_impl(self, X1, X2, v, out, opt, **kwargs) -> Tensor:
+        transpose = X1 is self.centers
+        num_out = self.centers.shape[0] if transpose else self.X.shape[0]
+        if out is None:
+            out = torch.empty(num_out, v.shape[1], dtype=v.dtype, device=v.device)
+        v_dev = v.to(self.device)
+        if transpose:
+            acc = torch.zeros(num_out, v.shape[1], dtype=v.dtype, device=self.device)
+        for tile, k_tile in self._iter_tiles():
+            rows = slice(tile.start, tile.start + tile.length)
+            if transpose:
+                if k_tile is None:
+                    acc.add_(self.kernel.mmv(self.centers, self.X[rows], v[rows], opt=opt).to(self.device))
+                else:
+                    acc.addmm_(k_tile.T, v_dev[rows])
+            elif k_tile is None:
+                out[rows].copy_(self.kernel.mmv(self.X[rows], self.centers, v, opt=opt))
+            else:
+                out[rows].copy_(k_tile @ v_dev)
+        if transpose:
+            out.copy_(acc)
+        return out
+
+    def dmmv_impl(self, X1, X2, v, w, out, opt, **kwargs) -> Tensor:
+        ref = v if v is not None else w
+        num_out, num_rhs = self.centers.shape[0], ref.shape[1]
+        if out is None:
+            out = torch.empty(num_out, num_rhs, dtype=ref.dtype, device=ref.device)
+        v_dev = None if v is None else v.to(self.device)
+        w_dev = None if w is None else w.to(self.device)
+        acc = torch.zeros(num_out, num_rhs, dtype=ref.dtype, device=self.device)
+        for tile, k_tile in self._iter_tiles():
+            rows = slice(tile.start, tile.start + tile.length)
+            w_rows = None if w is None else w[rows]
+            if k_tile is None:
+                acc.add_(self.kernel.dmmv(self.X[rows], self.centers, v, w_rows, opt=opt).to(self.device))
+                continue
+            if v_dev is None:
+                kv = w_dev[rows]
+            else:
+                kv = k_tile @ v_dev
+                if w_dev is not None:
+                    kv.add_(w_dev[rows])
+            acc.addmm_(k_tile.T, kv)
+        return out.copy_(acc)
+
+    def __str__(self):
+        return f"<tiered knm cache of {self.kernel}: {self.tier_counts()}>"
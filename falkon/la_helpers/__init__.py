@@ -1,11 +1,23 @@
-from .wrapper import copy_triang, mul_triang, potrf, square_norm, trsm, vec_mul_triang, zero_triang
+from .wrapper import (
+    copy_triang,
+    mul_triang,
+    pc_apply,
+    potrf,
+    square_norm,
+    triang_affine,
+    trsm,
+    vec_mul_triang,
+    zero_triang,
+)
 
 __all__ = (
     "zero_triang",
     "mul_triang",
     "copy_triang",
     "vec_mul_triang",
+    "triang_affine",
     "potrf",
     "trsm",
+    "pc_apply",
     "square_norm",
 )
@@ -13,8 +13,10 @@ __all__ = (
     "mul_triang",
     "copy_triang",
     "vec_mul_triang",
+    "triang_affine",
     "potrf",
     "trsm",
+    "pc_apply",
     "square_norm",
 )
 
@@ -96,6 +98,52 @@ def vec_mul_triang(mat: torch.Tensor, multipliers: torch.Tensor, upper: bool, si
     return c_ext.vec_mul_triang(mat, multipliers, upper=upper, side=side == 1)
 
 
+def triang_affine(
+    mat: torch.Tensor,
+    upper: bool,
+    multiplier: float = 1.0,
+    diag_add: float = 0.0,
+    row_multipliers: Optional[torch.Tensor] = None,
+    col_multipliers: Optional[torch.Tensor] = None,
+) -> torch.Tensor:
+    """Scale a triangular matrix and shift its diagonal, in a single pass over the data.
+
+    For every element in the chosen triangle (including the diagonal) this computes
+    ``mat[i, j] = mat[i, j] * multiplier * row_multipliers[i] * col_multipliers[j]``,
+    and then adds ``diag_add`` to the diagonal. This is equivalent to a call to
+    :func:`mul_triang`, two calls to :func:`vec_mul_triang` and a diagonal addition, but
+    only reads and writes the matrix once. CUDA and CPU tensors are supported.
+    This operation runs in-place.
+
+    Parameters
+    ----------
+    mat
+        The input square tensor. This can also be a CUDA tensor.
+    upper
+        Whether to consider the upper, or the lower triangular part of `mat`.
+    multiplier
+        The scalar by which the triangular input matrix will be multiplied.
+    diag_add
+        The scalar which will be added to the diagonal of `mat` (after the multiplications).
+    row_multipliers
+        Optional vector, the i-th row of the matrix will be multiplied by its i-th element.
+    col_multipliers
+        Optional vector, the j-th column of the matrix will be multiplied by its j-th element.
+
+    Returns
+    -------
+    mat
+        The same tensor as was passed as input, with the desired operation performed on it.
+    """
+    if row_multipliers is not None:
+        row_multipliers = row_multipliers.reshape(-1)
+    if col_multipliers is not None:
+        col_multipliers = col_multipliers.reshape(-1)
+    return c_ext.triang_affine(
+        mat, row_multipliers, col_multipliers, multiplier=multiplier, diag_add=diag_add, upper=upper
+    )
+
+
 def potrf(mat: torch.Tensor, upper: bool, clean: bool, overwrite: bool, cuda: bool) -> torch.Tensor:
     if mat.is_cuda or cuda:
         raise NotImplementedError(
@@ -104,18 +152,34 @@ def potrf(mat: torch.Tensor, upper: bool, clean: bool, overwrite: bool, cuda: bo
     return c_ext.potrf(mat, upper=upper, clean=clean, overwrite=overwrite)
 
 
-def trsm(v: torch.Tensor, A: torch.Tensor, alpha: float, lower: int = 0, transpose: int = 0) -> torch.Tensor:
+def trsm(
+    v: torch.Tensor,
+    A: torch.Tensor,
+    alpha: float,
+    lower: int = 0,
+    transpose: int = 0,
+    out: Optional[torch.Tensor] = None,
+) -> torch.Tensor:
+    """Solve the triangular system of equations :math:`op(A) x = \\alpha v` for `x`.
+
+    Torch inputs (on the CPU or on a CUDA device) are solved by the ``trsm`` operation of the
+    c extension, which works directly on C or F-contiguous tensors: the only copy made is
+    the output. The output may be specified with `out` (a C or F-contiguous torch tensor, which
+    may be `v` itself), in which case no memory is allocated. Numpy inputs are solved by scipy.
+    """
     if isinstance(A, torch.Tensor):
         if isinstance(v, torch.Tensor):
             if not check_same_device(A, v):
                 raise ValueError("A and v must be on the same device.")
-            if A.is_cuda and v.is_cuda:
-                from falkon.la_helpers.cuda_trsm import cuda_trsm
-
-                return cuda_trsm(A, v, alpha, bool(lower), bool(transpose))
-            else:
-                A = A.numpy()
-                v = v.numpy()
+            if A.stride(0) != 1 and A.stride(1) != 1:
+                A = A.contiguous()
+            if out is None:
+                if v.stride(0) != 1 and (v.dim() == 1 or v.stride(1) != 1):
+                    v = v.contiguous()
+                out = v.clone()
+            elif out.data_ptr() != v.data_ptr():
+                out.copy_(v)
+            return c_ext.trsm(A, out, alpha, upper=not lower, transpose=bool(transpose))
         else:  # v is numpy array (thus CPU)
             if A.is_cuda:
                 raise ValueError("A and v must be on the same device.")
@@ -125,5 +189,26 @@ def trsm(v: torch.Tensor, A: torch.Tensor, alpha: float, lower: int = 0, transpo
     return torch.from_numpy(vout)
 
 
+def pc_apply(
+    fC: torch.Tensor,
+    dT: torch.Tensor,
+    dA: torch.Tensor,
+    v: torch.Tensor,
+    transpose: bool,
+    out: Optional[torch.Tensor] = None,
+) -> torch.Tensor:
+    """Apply the Falkon preconditioner stored in `fC` (see :class:`falkon.preconditioner.FalkonPreconditioner`).
+
+    Computes :math:`T^{-1}A^{-1}v`, or :math:`A^{-\\top}T^{-\\top}v` if `transpose` is set, with
+    both triangular solves (and the diagonal swaps between them) in a single call to the c extension.
+    The result is written in `out` if specified (which may be `v` itself), otherwise in a new tensor.
+    """
+    if out is None:
+        out = torch.empty_like(v, memory_format=torch.preserve_format)
+    if out.data_ptr() != v.data_ptr():
+        out.copy_(v)
+    return c_ext.pc_apply(fC, dT, dA, out, transpose=transpose)
+
+
 def square_norm(mat: torch.Tensor, dim: int, keepdim: Optional[bool] = None) -> torch.Tensor:
     return c_ext.square_norm(mat, dim, keepdim)
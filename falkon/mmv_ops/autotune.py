@@ -0,0 +1,281 @@
+"""Measured block-size selection for the out-of-core kernel operations.
+
+The memory-based block size selectors (e.g. :func:`falkon.utils.helpers.select_dim_over_nm_v2`)
+choose the largest blocks which fit in memory. This is not always the fastest choice: with
+skinny data the host-to-device transfers dominate, while small kernel blocks may leave the
+GPU underutilized. When the ``mmv_autotune`` option is set, a few candidate block shapes
+are benchmarked the first time a given (operation, device, data-type, kernel, dimension)
+combination is seen, and the fastest one is stored in a JSON file on disk.
+
+The cache lives in the directory pointed to by the ``FALKON_CACHE_DIR`` environment
+variable, or in ``~/.cache/falkon`` by default.
+"""
+
+import json
+import os
+import tempfile
+import threading
+from typing import Callable, Dict, List, Optional, Sequence, Tuple
+
+import torch
+
+import falkon
+
+__all__ = ("tune_mmv_blk_sizes", "tune_dmmv_blk_size", "tune_mm_blk_sizes", "clear_cache")
+
+_CACHE_FILE_NAME = "mmv_blk_sizes.json"
+_NUM_WARMUP = 1
+_NUM_REPS = 3
+_cache_lock = threading.Lock()
+_mem_cache: Optional[Dict[str, List[int]]] = None
+
+
+def _cache_path() -> str:
+    cache_dir = os.environ.get("FALKON_CACHE_DIR", os.path.join(os.path.expanduser("~"), ".cache", "falkon"))
+    return os.path.join(cache_dir, _CACHE_FILE_NAME)
+
+
+def _load_cache() -> Dict[str, List[int]]:
+    global _mem_cache
+    if _mem_cache is None:
+        try:
+            with open(_cache_path(), "r") as fh:
+                _mem_cache = json.load(fh)
+        except (OSError, ValueError):
+            _mem_cache = {}
+    return _mem_cache
+
+
+def _cache_get(key: str) -> Optional[List[int]]:
+    with _cache_lock:
+        return _load_cache().get(key)
+
+
+def _cache_put(key: str, value: List[int]) -> None:
+    with _cache_lock:
+        cache = _load_cache()
+        cache[key] = value
+        path = _cache_path()
+        try:
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            # Atomic replace, in case multiple processes tune at the same time.
+            fd, tmp_path = tempfile.mkstemp(dir=os.path.dirname(path), suffix=".tmp")
+            with os.fdopen(fd, "w") as fh:
+                json.dump(cache, fh, indent=1, sort_keys=True)
+            os.replace(tmp_path, path)
+        except OSError:
+            pass  # A read-only cache only means that tuning is repeated in the next session.
+
+
+def clear_cache() -> None:
+    """Remove all tuned block sizes, both from memory and from disk."""
+    global _mem_cache
+    with _cache_lock:
+        _mem_cache = {}
+        try:
+            os.remove(_cache_path())
+        except OSError:
+            pass
+
+
+def _make_key(op: str, dev: torch.device, dtype: torch.dtype, kernel, d: int, t: int, ooc: Sequence[bool]) -> str:
+    dev_name = torch.cuda.get_device_name(dev) if dev.type == "cuda" else "cpu"
+    ooc_str = "".join("1" if o else "0" for o in ooc)
+    return f"{op}|{dev_name}|{dtype}|{kernel.__class__.__name__}|d={d}|t={t}|ooc={ooc_str}"
+
+
+def _candidates_nm(
+    default: Tuple[int, int], max_n: int, max_m: int, fits: Callable[[int, int], bool]
+) -> List[Tuple[int, int]]:
+    """Shrunk and reshaped variants of the memory-maximizing block shape `default`."""
+    default = (min(default[0], max_n), min(default[1], max_m))
+    out = []
+    for scale in (1, 2, 4, 8):
+        for aspect in (1, 2, 0.5):
+            bn = min(max_n, max(1, int(default[0] / scale * aspect)))
+            bm = min(max_m, max(1, int(default[1] / scale / aspect)))
+            if (bn, bm) not in out and fits(bn, bm):
+                out.append((bn, bm))
+    if default not in out:
+        out.insert(0, default)
+    return out
+
+
+def _bench(dev: torch.device, fn: Callable[[], None]) -> float:
+    """Average run-time of `fn` (in milliseconds) on the current stream of `dev`."""
+    stream = torch.cuda.current_stream(dev)
+    for _ in range(_NUM_WARMUP):
+        fn()
+    start, end = torch.cuda.Event(enable_timing=True), torch.cuda.Event(enable_timing=True)
+    start.record(stream)
+    for _ in range(_NUM_REPS):
+        fn()
+    end.record(stream)
+    end.synchronize()
+    return start.elapsed_time(end) / _NUM_REPS
+
+
+def _host_buffer(shape, dtype, ic: bool) -> Optional[torch.Tensor]:
+    if ic:
+        return None
+    return torch.randn(*shape, dtype=dtype).pin_memory()
+
+
+def _tune(key: str, dev: torch.device, candidates: Sequence[Tuple[int, ...]], run_cand) -> Tuple[int, ...]:
+    """Benchmark all candidates, cache and return the one with the lowest time per kernel entry."""
+    best, best_cost = candidates[0], float("inf")
+    with torch.cuda.device(dev), torch.inference_mode():
+        for cand in candidates:
+            try:
+                elapsed, num_entries = run_cand(cand)
+            except RuntimeError:  # Most likely out of memory.
+                torch.cuda.empty_cache()
+                continue
+            cost = elapsed / num_entries
+            if cost < best_cost:
+                best, best_cost = cand, cost
+        torch.cuda.empty_cache()
+    if best_cost < float("inf"):
+        _cache_put(key, list(best))
+    return best
+
+
+def tune_mmv_blk_sizes(
+    dev: torch.device,
+    dtype: torch.dtype,
+    kernel: "falkon.kernels.Kernel",
+    d: int,
+    t: int,
+    max_n: int,
+    max_m: int,
+    default: Tuple[int, int],
+    fits: Callable[[int, int], bool],
+    m1_ic: bool,
+    m2_ic: bool,
+    v_ic: bool,
+) -> Tuple[int, int]:
+    """Block sizes (blk_n, blk_m) for the kernel-vector product (`fmmv`).
+
+    Each candidate is timed on one tile of the out-of-core loop: the copy of the `m2` and `v`
+    blocks (if they are not in-core), the kernel block computation, and the matrix-vector product.
+    """
+    key = _make_key("mmv", dev, dtype, kernel, d, t, (not m1_ic, not m2_ic, not v_ic))
+    cached = _cache_get(key)
+    if cached is not None:
+        bn, bm = min(cached[0], max_n), min(cached[1], max_m)
+        return (bn, bm) if fits(bn, bm) else default
+
+    def run_cand(cand):
+        bn, bm = cand
+        m1 = torch.randn(bn, d, dtype=dtype, device=dev)
+        m2 = torch.randn(bm, d, dtype=dtype, device=dev)
+        v = torch.randn(bm, t, dtype=dtype, device=dev)
+        ker = torch.empty(bn, bm, dtype=dtype, device=dev)
+        out = torch.zeros(bn, t, dtype=dtype, device=dev)
+        m2_h, v_h = _host_buffer((bm, d), dtype, m2_ic), _host_buffer((bm, t), dtype, v_ic)
+
+        def fn():
+            if m2_h is not None:
+                m2.copy_(m2_h, non_blocking=True)
+            if v_h is not None:
+                v.copy_(v_h, non_blocking=True)
+            kernel.compute(m1, m2, ker, diag=False)
+            out.addmm_(ker, v)
+
+        return _bench(dev, fn), bn * bm
+
+    return tuple(_tune(key, dev, _candidates_nm(default, max_n, max_m, fits), run_cand))
+
+
+def tune_dmmv_blk_size(
+    dev: torch.device,
+    dtype: torch.dtype,
+    kernel: "falkon.kernels.Kernel",
+    d: int,
+    t: int,
+    m: int,
+    max_n: int,
+    default: int,
+    fits: Callable[[int], bool],
+    m1_ic: bool,
+) -> int:
+    """Block size `blk_n` for the double kernel-vector product (`fdmmv`), where `m` is not split.
+
+    Each candidate is timed on one iteration of the loop over `n`: the copy of the `m1` block
+    (if it is not in-core), the kernel block computation and the two matrix-vector products.
+    """
+    key = _make_key("dmmv", dev, dtype, kernel, d, t, (not m1_ic,))
+    cached = _cache_get(key)
+    if cached is not None:
+        bn = min(cached[0], max_n)
+        return bn if fits(bn) else default
+    candidates = []
+    for scale in (1, 2, 4, 8):
+        bn = max(1, int(default / scale))
+        if (bn,) not in candidates and fits(bn):
+            candidates.append((bn,))
+    if (default,) not in candidates:
+        candidates.insert(0, (default,))
+
+    def run_cand(cand):
+        (bn,) = cand
+        m1 = torch.randn(bn, d, dtype=dtype, device=dev)
+        m2 = torch.randn(m, d, dtype=dtype, device=dev)
+        v = torch.randn(m, t, dtype=dtype, device=dev)
+        w = torch.empty(bn, t, dtype=dtype, device=dev)
+        ker = torch.empty(bn, m, dtype=dtype, device=dev)
+        out = torch.zeros(m, t, dtype=dtype, device=dev)
+        m1_h = _host_buffer((bn, d), dtype, m1_ic)
+
+        def fn():
+            if m1_h is not None:
+                m1.copy_(m1_h, non_blocking=True)
+            kernel.compute(m1, m2, ker, diag=False)
+            torch.mm(ker, v, out=w)
+            out.addmm_(ker.T, w)
+
+        return _bench(dev, fn), bn * m
+
+    return _tune(key, dev, candidates, run_cand)[0]
+
+
+def tune_mm_blk_sizes(
+    dev: torch.device,
+    dtype: torch.dtype,
+    kernel: "falkon.kernels.Kernel",
+    d: int,
+    max_n: int,
+    max_m: int,
+    default: Tuple[int, int],
+    fits: Callable[[int, int], bool],
+    is_ooc: bool,
+) -> Tuple[int, int]:
+    """Block sizes (n, m) for the kernel matrix computation (`fmm`).
+
+    Each candidate is timed on one tile: the copy of the `m2` block if the data is out-of-core,
+    the kernel block computation and the copy of the kernel block back to the host.
+    """
+    key = _make_key("mm", dev, dtype, kernel, d, 0, (is_ooc,))
+    cached = _cache_get(key)
+    if cached is not None:
+        bn, bm = min(cached[0], max_n), min(cached[1], max_m)
+        return (bn, bm) if fits(bn, bm) else default
+
+    def run_cand(cand):
+        bn, bm = cand
+        m1 = torch.randn(bn, d, dtype=dtype, device=dev)
+        m2 = torch.randn(bm, d, dtype=dtype, device=dev)
+        ker = torch.empty(bn, bm, dtype=dtype, device=dev)
+        m2_h = _host_buffer((bm, d), dtype, not is_ooc)
+        ker_h = _host_buffer((bn, bm), dtype, not is_ooc)
+
+        def fn():
+            if m2_h is not None:
+                m2.copy_(m2_h, non_blocking=True)
+            kernel.compute(m1, m2, ker, diag=False)
+            if ker_h is not None:
+                ker_h.copy_(ker, non_blocking=True)
+
+        return _bench(dev, fn), bn * bm
+
+    return tuple(_tune(key, dev, _candidates_nm(default, max_n, max_m, fits), run_cand))
@@ -0,0 +1,134 @@
+"""GPU-resident copies of host data which is used repeatedly by out-of-core operations.
+
+The conjugate gradient solver computes one double kernel-vector product (:func:`falkon.mmv_ops.fmmv.fdmmv`)
+per iteration, and each of these products streams the full data matrix from host memory to the GPUs.
+A :class:`DeviceDataCache` keeps, on each GPU, the leading rows of the share of the data which
+that GPU processes in `fdmmv`. While the cache is active (i.e. within its context manager),
+`fdmmv` reads those rows from GPU memory, and only copies the remaining rows from the host.
+"""
+
+import threading
+from typing import Dict, List, Optional
+
+import torch
+
+import falkon
+from falkon.mmv_ops.utils import CUDA_EXTRA_MM_RAM, _get_gpu_info
+from falkon.options import BaseOptions
+from falkon.utils import TicToc
+from falkon.utils.device_copy import copy
+from falkon.utils.helpers import calc_gpu_block_sizes, sizeof_dtype
+from falkon.utils.tensor_helpers import create_same_stride
+
+__all__ = ("DeviceDataCache", "find_data_cache")
+
+_active_lock = threading.Lock()
+_active_caches: List["DeviceDataCache"] = []
+
+
+def find_data_cache(X: torch.Tensor) -> Optional["DeviceDataCache"]:
+    """The active cache which holds (part of) the host tensor `X`, if there is one."""
+    with _active_lock:
+        for cache in _active_caches:
+            if cache.matches(X):
+                return cache
+    return None
+
+
+class DeviceDataCache:
+    """Keeps as many rows of a host data matrix as fit resident in the memory of each GPU.
+
+    The rows are split between GPUs in the same way as in :func:`falkon.mmv_ops.fmmv.fdmmv`.
+    Memory which is needed by `fdmmv` itself to process a reasonably sized block of data
+    (`min_blk_n` rows) is left free on each device.
+
+    Parameters
+    ----------
+    X
+        The (N x D) dense data matrix, in host memory.
+    kernel
+        The kernel which will be used with the data. Its extra memory requirements are taken into
+        account when deciding how much memory to leave free.
+    m
+        The number of rows of the second matrix used in `fdmmv` (e.g. the number of centers).
+    t
+        The number of columns of the vectors used in `fdmmv`.
+    opt
+        Options for the memory limits (``max_gpu_mem``, ``memory_slack``).
+    min_blk_n
+        Minimum number of rows for which working memory is reserved on each device.
+    """
+
+    def __init__(
+        self,
+        X: torch.Tensor,
+        kernel: "falkon.kernels.Kernel",
+        m: int,
+        t: int,
+        opt: BaseOptions,
+        min_blk_n: int = 4096,
+    ):
+        if X.is_cuda:
+            raise ValueError("DeviceDataCache is meant for data in host memory.")
+        self._X = X
+        self._key = (X.data_ptr(), X.shape, X.stride(), X.dtype)
+        self.blocks: Dict[int, torch.Tensor] = {}
+        self.block_starts: Dict[int, int] = {}
+
+        n, d = X.shape
+        dts = sizeof_dtype(X.dtype)
+        gpu_info = _get_gpu_info(opt, slack=opt.memory_slack)
+        block_sizes = calc_gpu_block_sizes(gpu_info, n)
+        extra_mem = kernel.extra_mem(is_differentiable=False, is_sparse=False, dtype=X.dtype)
+        with TicToc("Data cache", debug=opt.debug):
+            for i, g in enumerate(gpu_info):
+                bwidth = block_sizes[i + 1] - block_sizes[i]
+                blk_n = min(bwidth, min_blk_n)
+                reserve = (
+                    m * (d + 2 * t)  # X2, v and output
+                    + blk_n * (m + 2 * (d + t))  # kernel block, double-buffered X1 and w blocks
+                    + extra_mem.get("nm", 0) * blk_n * m
+                    + extra_mem.get("nd", 0) * blk_n * d
+                    + extra_mem.get("md", 0) * m * d
+                    + extra_mem.get("n", 0) * blk_n
+                    + extra_mem.get("m", 0) * m
+                    + extra_mem.get("d", 0) * d
+                    + extra_mem.get("0", 0)
+                ) * dts + CUDA_EXTRA_MM_RAM
+                num_rows = int(min(bwidth, max(0, (g.usable_memory - reserve) // (d * dts))))
+                if num_rows <= 0:
+                    continue
+                start = block_sizes[i]
+                dev_block = create_same_stride((num_rows, d), X, X.dtype, device=f"cuda:{g.Id}")
+                with torch.cuda.device(g.Id):
+                    copy(X[start : start + num_rows], dev_block, non_blocking=False)
+                self.blocks[g.Id] = dev_block
+                self.block_starts[g.Id] = start
+
+    def matches(self, X: torch.Tensor) -> bool:
+        return (X.data_ptr(), X.shape, X.stride(), X.dtype) == self._key
+
+    def nbytes(self, device_id: int) -> int:
+        block = self.blocks.get(device_id)
+        if block is None:
+            return 0
+        return block.numel() * block.element_size()
+
+    def resident_rows(self, device_id: int, start: int, length: int) -> Optional[torch.Tensor]:
+        """The cached leading rows of `X[start: start + length]` on a given device, if any."""
+        block = self.blocks.get(device_id)
+        if block is None or self.block_starts[device_id] != start:
+            return None
+        return block[:length]
+
+    def __enter__(self):
+        with _active_lock:
+            _active_caches.append(self)
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        with _active_lock:
+            _active_caches.remove(self)
+        self.blocks.clear()
+        self.block_starts.clear()
+        self._X = None
@@ -6,11 +6,15 @@ import torch
 import torch.cuda as tcd
 
 import falkon
+from falkon.mmv_ops.autotune import tune_mm_blk_sizes
 from falkon.mmv_ops.utils import _call_direct, _check_contiguity, _extract_flat, _get_gpu_info, _start_wait_processes
 from falkon.options import BaseOptions
+from falkon.sparse.sparse_ops import SpgemmPlan
 from falkon.sparse.sparse_tensor import SparseTensor
+from falkon.utils import workspace
 from falkon.utils.device_copy import copy
 from falkon.utils.helpers import calc_gpu_block_sizes, select_dim_over_nm, sizeof_dtype
+from falkon.utils.staging import PinnedStager
 from falkon.utils.tensor_helpers import create_fortran, create_same_stride
 
 
@@ -26,6 +30,7 @@ class ArgsFmm:
     num_streams: int = 1
     kwargs_m1: Dict[str, torch.Tensor] = field(default_factory=dict)
     kwargs_m2: Dict[str, torch.Tensor] = field(default_factory=dict)
+    autotune: bool = False
 
 
 def mm_run_starter(proc_idx, queue, device_id):
@@ -95,33 +100,40 @@ def mm_run_starter(proc_idx, queue, device_id):
                 max_mem=avail_mem,
             )
     else:
-        if is_ooc or change_dtype:
-            # Need to allocate extra buffers for data-type change, or device change
-            n, m = select_dim_over_nm(
-                max_n=X1.shape[0],
-                max_m=X2.shape[0],
-                d=X1.shape[1],
-                coef_nd=extra_mem.get("nd", 0) + 1,
-                coef_md=extra_mem.get("md", 0) + 1,
-                coef_nm=extra_mem.get("nm", 0) + 1,
-                coef_n=extra_mem.get("n", 0),
-                coef_m=extra_mem.get("m", 0),
-                rest=extra_mem.get("d", 0),
-                max_mem=avail_mem,
-            )
-        else:
-            # No allocation will be performed by us. Only in-kernel stuff.
-            n, m = select_dim_over_nm(
+        # Need to allocate extra buffers for data-type change, or device change. Otherwise
+        # no allocation will be performed by us, only in-kernel stuff.
+        buf_coef = 1 if is_ooc or change_dtype else 0
+        d = X1.shape[1]
+        coef_nd = extra_mem.get("nd", 0) + buf_coef
+        coef_md = extra_mem.get("md", 0) + buf_coef
+        coef_nm = extra_mem.get("nm", 0) + buf_coef
+        coef_n, coef_m, rest = extra_mem.get("n", 0), extra_mem.get("m", 0), extra_mem.get("d", 0)
+        n, m = select_dim_over_nm(
+            max_n=X1.shape[0],
+            max_m=X2.shape[0],
+            d=d,
+            coef_nd=coef_nd,
+            coef_md=coef_md,
+            coef_nm=coef_nm,
+            coef_n=coef_n,
+            coef_m=coef_m,
+            rest=rest,
+            max_mem=avail_mem,
+        )
+        if a.autotune and dev.type == "cuda" and not a.kwargs_m1 and not a.kwargs_m2:
+            n, m = tune_mm_blk_sizes(
+                dev,
+                computation_dtype,
+                kernel,
+                d=d,
                 max_n=X1.shape[0],
                 max_m=X2.shape[0],
-                d=X1.shape[1],
-                coef_nd=extra_mem.get("nd", 0),
-                coef_md=extra_mem.get("md", 0),
-                coef_nm=extra_mem.get("nm", 0),
-                coef_n=extra_mem.get("n", 0),
-                coef_m=extra_mem.get("m", 0),
-                rest=extra_mem.get("d", 0),
-                max_mem=avail_mem,
+                default=(n, m),
+                fits=lambda bn, bm: (
+                    coef_nm * bn * bm + (coef_nd * d + coef_n) * bn + (coef_md * d + coef_m) * bm + rest
+                    <= avail_mem
+                ),
+                is_ooc=is_ooc,
             )
 
     # Run
@@ -238,6 +250,7 @@ def sparse_mm_run_thread(
             stream = tcd.current_stream(dev) if tid == -1 else tcd.Stream(dev)
             stack.enter_context(tcd.device(dev))
             stack.enter_context(tcd.stream(stream))
+            stack.enter_context(SpgemmPlan(dev))
 
         for j in range(0, M, m):
             lenj = min(m, M - j)
@@ -313,19 +326,6 @@ def mm_run_thread(
     N, D = m1.shape
     M = m2.shape[0]
 
-    """ Initialize extra buffers """
-    flat_offset = 0
-    total_memory = 0
-    has_gpu_bufs = is_ooc or change_dtype
-    if has_gpu_bufs:
-        total_memory += n * m + n * D + m * D
-    flat_dev_t = torch.empty(size=(total_memory,), dtype=comp_dt, device=dev)
-    dev_nm, dev_m1, dev_m2 = None, None, None
-    if has_gpu_bufs:
-        dev_nm, flat_offset = _extract_flat(flat_dev_t, size=(n, m), other=out, offset=flat_offset)
-        dev_m1, flat_offset = _extract_flat(flat_dev_t, size=(n, D), other=m1, offset=flat_offset)
-        dev_m2, flat_offset = _extract_flat(flat_dev_t, size=(m, D), other=m2, offset=flat_offset)
-
     """ Run splitting along N, M """
     with ExitStack() as stack, torch.inference_mode():
         stream = None
@@ -333,6 +333,24 @@ def mm_run_thread(
             stream = tcd.current_stream(dev) if tid == -1 else tcd.Stream(dev)
             stack.enter_context(tcd.device(dev))
             stack.enter_context(tcd.stream(stream))
+        """ Initialize extra buffers """
+        flat_offset = 0
+        total_memory = 0
+        has_gpu_bufs = is_ooc or change_dtype
+        if has_gpu_bufs:
+            total_memory += n * m + n * D + m * D
+        flat_dev_t = stack.enter_context(workspace.borrow(total_memory, comp_dt, dev))
+        dev_nm, dev_m1, dev_m2 = None, None, None
+        if has_gpu_bufs:
+            dev_nm, flat_offset = _extract_flat(flat_dev_t, size=(n, m), other=out, offset=flat_offset)
+            dev_m1, flat_offset = _extract_flat(flat_dev_t, size=(n, D), other=m1, offset=flat_offset)
+            dev_m2, flat_offset = _extract_flat(flat_dev_t, size=(m, D), other=m2, offset=flat_offset)
+
+        # Pageable host blocks of m1 are staged (and converted to `comp_dt`) in pinned memory.
+        m1_stage = None
+        if has_gpu_bufs:
+            m1_blocks = [(i, min(n, N - i)) for i in range(0, N, n)]
+            m1_stage = stack.enter_context(PinnedStager(m1, m1_blocks, dev, dtype=comp_dt))
 
         for i in range(0, N, n):
             leni = min(n, N - i)
@@ -340,11 +358,12 @@ def mm_run_thread(
 
             if has_gpu_bufs:
                 c_dev_m1 = copy(
-                    m1[i : i + leni, :],
+                    m1_stage.get(),
                     dev_m1[:leni, :],
                     non_blocking=True,
                     allow_dtype_change=True,
                 )
+                m1_stage.release(stream)
             else:
                 c_dev_m1 = m1[i : i + leni, :]
 
@@ -507,6 +526,7 @@ class KernelMmFnFull(torch.autograd.Function):
                         differentiable=diff,
                         kwargs_m1=c_kwargs_m1,
                         kwargs_m2=kwargs_m2 or {},
+                        autotune=options.mmv_autotune,
                     ),
                     g.Id,
                 )
@@ -544,6 +564,7 @@ class KernelMmFnFull(torch.autograd.Function):
             differentiable=diff,
             kwargs_m1=kwargs_m1 or {},
             kwargs_m2=kwargs_m2 or {},
+            autotune=options.mmv_autotune,
         )
         return _call_direct(mm_run_starter, (args, data_dev.index))
 
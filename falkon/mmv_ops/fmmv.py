@@ -1,15 +1,19 @@
 from collections import defaultdict
 from contextlib import ExitStack
 from dataclasses import dataclass, field
-from typing import Dict, Optional, Tuple, Union
+from typing import Dict, List, Optional, Tuple, Union
 
 import numpy as np
 import torch
 import torch.cuda as tcd
 import torch.cuda.comm
+import torch.cuda.nccl
 
 import falkon
+from falkon.mmv_ops.autotune import tune_dmmv_blk_size, tune_mmv_blk_sizes
+from falkon.mmv_ops.data_cache import find_data_cache
 from falkon.mmv_ops.utils import (
+    REDUCED_DIST_BUF_BYTES,
     _call_direct,
     _check_contiguity,
     _dev_from_id,
@@ -20,10 +24,13 @@ from falkon.mmv_ops.utils import (
     create_output_mat,
 )
 from falkon.options import BaseOptions
-from falkon.sparse import SparseTensor
-from falkon.utils.device_copy import copy
+from falkon.sparse import SlicedEllTensor, SparseTensor, SpgemmPlan
+from falkon.utils import workspace
+from falkon.utils.device_copy import copy, copy_batch
 from falkon.utils.helpers import calc_gpu_block_sizes, select_dim_over_n, select_dim_over_nm_v2, sizeof_dtype
-from falkon.utils.tensor_helpers import create_same_stride, extract_fortran
+from falkon.utils.staging import PinnedStager
+from falkon.utils.tensor_helpers import create_same_stride, extract_fortran, is_contig
+from falkon.utils.tracing import trace_range
 
 
 @dataclass(frozen=True)
@@ -38,6 +45,67 @@ class ArgsFmmv:
     differentiable: bool = False
     kwargs_m1: Dict[str, torch.Tensor] = field(default_factory=dict)
     kwargs_m2: Dict[str, torch.Tensor] = field(default_factory=dict)
+    num_streams: int = 1
+    autotune: bool = False
+    X1_dev: Optional[torch.Tensor] = None  # GPU-resident copy of the leading rows of X1
+    fused: bool = False  # Use the kernel's fused kernel-vector product (dense, non-differentiable only)
+    sliced_ell: bool = False  # Convert sparse tiles of X1 to the sliced-ELL format (sparse, CUDA only)
+    comp_dt: Optional[torch.dtype] = None  # Reduced-precision data-type of the tiles (dense, CUDA only)
+
+
+def should_use_fused_mmv(
+    kernel: "falkon.kernels.Kernel",
+    X1: Union[torch.Tensor, SparseTensor],
+    X2: Union[torch.Tensor, SparseTensor],
+    opt: BaseOptions,
+) -> bool:
+    """Whether GPU kernel-vector products will use :meth:`~falkon.kernels.Kernel.compute_mmv_fused`.
+
+    This requires the ``fused_mmv`` option, dense floating-point inputs, and a kernel which
+    supports the native fused operation.
+    """
+    return (
+        opt.fused_mmv
+        and not opt.use_cpu
+        and torch.cuda.is_available()
+        and isinstance(X1, torch.Tensor)
+        and isinstance(X2, torch.Tensor)
+        and not (X1.is_sparse or X2.is_sparse)
+        and X1.dtype in (torch.float32, torch.float64)
+        and kernel.fused_mmv_type() is not None
+    )
+
+
+_REDUCED_PRECISION_DTYPES = {"bf16": torch.bfloat16, "fp16": torch.float16}
+
+
+def reduced_mmv_dtype(
+    kernel: "falkon.kernels.Kernel",
+    X1: Union[torch.Tensor, SparseTensor],
+    opt: BaseOptions,
+) -> Optional[torch.dtype]:
+    """The data-type of the tiles of GPU kernel-vector products, according to the ``mmv_precision`` option.
+
+    Returns None (the tiles have the data-type of the inputs) unless a reduced precision is
+    requested, the inputs are dense and single-precision, and the kernel supports reduced
+    precision tiles. Fused kernel-vector products are always computed in the input data-type.
+    """
+    if opt.mmv_precision == "default":
+        return None
+    if opt.mmv_precision not in _REDUCED_PRECISION_DTYPES:
+        raise ValueError(
+            f"mmv_precision must be one of 'default', {', '.join(repr(k) for k in _REDUCED_PRECISION_DTYPES)}, "
+            f"but got {opt.mmv_precision!r}."
+        )
+    if (
+        opt.use_cpu
+        or not torch.cuda.is_available()
+        or not isinstance(X1, torch.Tensor)
+        or X1.dtype != torch.float32
+        or not kernel.supports_reduced_precision()
+    ):
+        return None
+    return _REDUCED_PRECISION_DTYPES[opt.mmv_precision]
 
 
 def _init_two_streams(
@@ -57,6 +125,77 @@ def _init_two_streams(
     return s1, s2
 
 
+def _init_pipeline_streams(
+    stack: ExitStack, dev: torch.device, tid: int, copies: bool = True
+) -> Tuple[Optional[tcd.Stream], Optional[tcd.Stream], Optional[tcd.Stream]]:
+    """
+    Initialize the compute, host-to-device and device-to-host streams of a copy/compute/writeback
+    pipeline (if device is a GPU). As in :func:`_init_two_streams`, the compute stream is the
+    `current_stream` when called from the main thread (tid == -1), and it is entered as the
+    current stream.
+    If there are no `copies` (all data is already on `dev`), the copy streams are the compute
+    stream itself. All work is then issued on a single stream, so that it can be captured in a
+    CUDA graph.
+    """
+    s_comp, s_h2d, s_d2h = None, None, None
+    if dev.type == "cuda":
+        s_comp = tcd.current_stream(dev) if tid == -1 else tcd.Stream(dev)
+        s_h2d = tcd.Stream(dev) if copies else s_comp
+        s_d2h = tcd.Stream(dev) if copies else s_comp
+        stack.enter_context(tcd.device(dev))
+        stack.enter_context(tcd.stream(s_comp))
+    return s_comp, s_h2d, s_d2h
+
+
+def _pipeline_events(dev: torch.device, num_buffers: int) -> Optional[List[tcd.Event]]:
+    if dev.type != "cuda":
+        return None
+    return [tcd.Event() for _ in range(num_buffers)]
+
+
+def _record(stream: Optional[tcd.Stream], events: Optional[List[tcd.Event]], idx: int):
+    if stream is not None and events is not None:
+        events[idx].record(stream)
+
+
+def _wait(stream: Optional[tcd.Stream], events: Optional[List[tcd.Event]], idx: int):
+    # Waiting on an event which was never recorded is a no-op.
+    if stream is not None and events is not None:
+        stream.wait_event(events[idx])
+
+
+def _maybe_stream(stack: ExitStack, stream: Optional[tcd.Stream]):
+    if stream is not None:
+        stack.enter_context(tcd.stream(stream))
+
+
+def _pipeline_finish(
+    s_comp: Optional[tcd.Stream], s_h2d: Optional[tcd.Stream], s_d2h: Optional[tcd.Stream], out_ic: bool
+):
+    """Join the copy streams into the compute stream, and wait for host outputs to be written."""
+    if s_comp is None:
+        return
+    s_comp.wait_stream(s_h2d)
+    s_comp.wait_stream(s_d2h)
+    if not out_ic:
+        s_d2h.synchronize()
+
+
+def _reduce_partial_outputs(partials: List[torch.Tensor], root: int) -> torch.Tensor:
+    """Sum the partial outputs computed on different GPUs, on the device of ``partials[root]``.
+
+    The reduction runs on the devices with NCCL when it is available (in which case the sum is
+    written in-place into ``partials[root]``), otherwise with peer-to-peer copies.
+    """
+    # NCCL needs C-contiguous inputs: F-contiguous partials (which all share the same strides)
+    # are reduced through their transposes.
+    nccl_inputs = [p if p.is_contiguous() else p.T for p in partials]
+    if torch.cuda.nccl.is_available(nccl_inputs):
+        torch.cuda.nccl.reduce(nccl_inputs, root=root)
+        return partials[root]
+    return torch.cuda.comm.reduce_add(partials, destination=partials[root].device.index)
+
+
 def _mmv_blk_sizes(
     n: int,
     d: int,
@@ -73,44 +212,77 @@ def _mmv_blk_sizes(
     kernel: "falkon.kernels.Kernel",
     is_differentiable: bool,
     is_sparse: bool,
+    dev: Optional[torch.device] = None,
+    autotune: bool = False,
+    num_buffers: int = 1,
+    fused: bool = False,
+    sliced_ell: bool = False,
+    comp_dt: Optional[torch.dtype] = None,
 ) -> Tuple[int, int, int]:
     extra_mem = kernel.extra_mem(is_differentiable, is_sparse, dtype)
     normal_mem = defaultdict(int)
-    normal_mem["nm"] = 1  # kernel block
+    # With reduced precision tiles (`comp_dt`), all inputs are converted into tiles on the device,
+    # which take `tile_scale` times the memory of the input data-type. The squared distances are
+    # computed in a fixed-size single precision buffer, a block of rows at a time.
+    tile_scale = 1.0
+    if comp_dt is not None:
+        tile_scale = sizeof_dtype(comp_dt) / sizeof_dtype(dtype)
+        m1_ic = m2_ic = v_ic = False
+        autotune = False
+        normal_mem["0"] += REDUCED_DIST_BUF_BYTES / sizeof_dtype(dtype)
+    normal_mem["nm"] += tile_scale  # kernel block
+    if fused:  # The kernel block is never stored, and the memory needed is linear in blk_n, blk_m.
+        normal_mem["nm"] = 0
+        extra_mem = {k: val for k, val in extra_mem.items() if k != "nm"}
     if is_sparse:
         m1_sparsity = m1_sparsity * 2  # to account for the storage complexity of CSR matrices
         m2_sparsity = m2_sparsity * 2  # to account for the storage complexity of CSR matrices
-    multiplier = 1
+        if sliced_ell:  # padded sliced-ELL copy of m1, and the temporary buffers of the conversion
+            m1_sparsity = m1_sparsity * 4
+    multiplier = num_buffers  # data blocks are replicated for each pipeline stage
     if is_differentiable:
         multiplier = 2  # for gradients
     if not m1_ic:
-        normal_mem["n"] += d * m1_sparsity * multiplier
+        normal_mem["n"] += d * m1_sparsity * multiplier * tile_scale
     if not m2_ic:
-        normal_mem["m"] += d * m2_sparsity * multiplier
+        normal_mem["m"] += d * m2_sparsity * multiplier * tile_scale
     if not out_ic:
         normal_mem["n"] += t * multiplier
     if not v_ic:
-        normal_mem["m"] += t * multiplier
+        normal_mem["m"] += t * multiplier * tile_scale
 
+    coef_nm = normal_mem["nm"] + extra_mem.get("nm", 0)
+    coef_n = normal_mem["n"] + extra_mem.get("n", 0) + extra_mem.get("nd", 0) * d
+    coef_m = normal_mem["m"] + extra_mem.get("m", 0) + extra_mem.get("md", 0) * d
+    rest = normal_mem["0"] + extra_mem.get("d", 0) * d + extra_mem.get("0", 0)
     blk_n, blk_m = select_dim_over_nm_v2(
-        max_n=n,
-        max_m=m,
-        max_mem=avail_mem,
-        coef_nm=normal_mem["nm"] + extra_mem.get("nm", 0),
-        coef_n=normal_mem["n"] + extra_mem.get("n", 0) + extra_mem.get("nd", 0) * d,
-        coef_m=normal_mem["m"] + extra_mem.get("m", 0) + extra_mem.get("md", 0) * d,
-        rest=normal_mem["0"] + extra_mem.get("d", 0) * d + extra_mem.get("0", 0),
+        max_n=n, max_m=m, max_mem=avail_mem, coef_nm=coef_nm, coef_n=coef_n, coef_m=coef_m, rest=rest
     )
-    mem_needed = blk_m * blk_n
-    if not out_ic:
-        mem_needed += blk_n * t
+    if autotune and not fused and dev is not None and dev.type == "cuda" and not is_sparse and not is_differentiable:
+        blk_n, blk_m = tune_mmv_blk_sizes(
+            dev,
+            dtype,
+            kernel,
+            d=d,
+            t=t,
+            max_n=n,
+            max_m=m,
+            default=(blk_n, blk_m),
+            fits=lambda bn, bm: coef_nm * bn * bm + coef_n * bn + coef_m * bm + rest <= avail_mem,
+            m1_ic=m1_ic,
+            m2_ic=m2_ic,
+            v_ic=v_ic,
+        )
+    mem_needed = 0 if fused else blk_m * blk_n
+    if not out_ic and comp_dt is None:  # Reduced precision output blocks are allocated separately
+        mem_needed += blk_n * t * num_buffers
     if not v_ic:
-        mem_needed += blk_m * t
+        mem_needed += blk_m * t * num_buffers
     if not is_sparse:
         if not m1_ic:
-            mem_needed += blk_n * d
+            mem_needed += blk_n * d * num_buffers
         if not m2_ic:
-            mem_needed += blk_m * d
+            mem_needed += blk_m * d * num_buffers
     return blk_n, blk_m, mem_needed
 
 
@@ -131,6 +303,13 @@ def mmv_run_starter(proc_idx, queue, device_id):
         _is_incore(dev, v.device),
         _is_incore(dev, out.device),
     )
+    # Number of buffered tiles for the copy-compute-writeback pipeline (dense, out-of-core only).
+    num_buffers = 1
+    if not (is_sparse or differentiable or all((m1_ic, m2_ic, v_ic, out_ic))):
+        num_buffers = max(1, a.num_streams)
+    fused = a.fused and dev.type == "cuda" and not (is_sparse or differentiable or a.kwargs_m1 or a.kwargs_m2)
+    sliced_ell = a.sliced_ell and is_sparse and dev.type == "cuda"
+    comp_dt = a.comp_dt if dev.type == "cuda" and not (is_sparse or differentiable or fused) else None
     blk_n, blk_m, mem_needed = _mmv_blk_sizes(
         n=X1.size(-2),
         d=X1.size(-1),
@@ -147,6 +326,12 @@ def mmv_run_starter(proc_idx, queue, device_id):
         kernel=kernel,
         is_differentiable=differentiable,
         is_sparse=is_sparse,
+        dev=dev,
+        autotune=a.autotune and not a.kwargs_m1 and not a.kwargs_m2,
+        num_buffers=num_buffers,
+        fused=fused,
+        sliced_ell=sliced_ell,
+        comp_dt=comp_dt,
     )
     if differentiable:
         assert not is_sparse, "Sparse + differentiable mmvs are not supported"
@@ -167,6 +352,7 @@ def mmv_run_starter(proc_idx, queue, device_id):
             tid=proc_idx,
             kwargs_m1=a.kwargs_m1,
             kwargs_m2=a.kwargs_m2,
+            sliced_ell=sliced_ell,
         )
     else:
         return mmv_run_thread(
@@ -182,6 +368,9 @@ def mmv_run_starter(proc_idx, queue, device_id):
             tid=proc_idx,
             kwargs_m1=a.kwargs_m1,
             kwargs_m2=a.kwargs_m2,
+            num_buffers=num_buffers,
+            fused=fused,
+            comp_dt=comp_dt,
         )
 
 
@@ -198,6 +387,7 @@ def sparse_mmv_run_thread(
     tid: int,
     kwargs_m1: Dict[str, torch.Tensor],
     kwargs_m2: Dict[str, torch.Tensor],
+    sliced_ell: bool = False,
 ):
     """Inner loop to compute (part of) a kernel-vector product for sparse input matrices.
 
@@ -233,6 +423,9 @@ def sparse_mmv_run_thread(
         Keyword arguments containing tensors which should be split along with ``m2``.
         For example this could be a set of indices corresponding to ``m2``, which are then
         correctly split and available in the kernel computation.
+    sliced_ell
+        Whether tiles of ``m1`` should be converted to the sliced-ELL format on the device (when
+        out-of-core). Tiles of ``m2`` are then kept in CSC format, which avoids transposing them.
 
     Returns
     -------
@@ -243,19 +436,24 @@ def sparse_mmv_run_thread(
     N, D = m1.shape
     M, T = v.shape
 
-    """ Initialize extra buffers """
-    flat_gpu = torch.empty(size=(mem_needed,), dtype=m1.dtype, device=dev)
-    flat_offset = 0
-    # ker_gpu must be fortran-ordered due to cusparse csr2dense function (TODO: only on CUDA)
-    ker_gpu = extract_fortran(flat_gpu, size=(blk_n, blk_m), offset=flat_offset)
-    flat_offset += np.prod(ker_gpu.shape)
-    dev_v, dev_out = None, None
-    if not incore:
-        dev_out, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=out, offset=flat_offset)
-        dev_v, flat_offset = _extract_flat(flat_gpu, size=(blk_m, T), other=v, offset=flat_offset)
+    # Host CSR copies (with int32 indices) of the tiles of m2, built once and reused for all tiles of m1.
+    m2_tiles: Dict[int, SparseTensor] = {}
 
     with ExitStack() as stack, torch.inference_mode():
         s1, s2 = _init_two_streams(stack, dev, tid)  # enters stream 1
+        if dev.type == "cuda":
+            stack.enter_context(SpgemmPlan(dev))
+        """ Initialize extra buffers """
+        flat_gpu = stack.enter_context(workspace.borrow(mem_needed, m1.dtype, dev))
+        flat_offset = 0
+        # ker_gpu must be fortran-ordered due to cusparse csr2dense function (TODO: only on CUDA)
+        ker_gpu = extract_fortran(flat_gpu, size=(blk_n, blk_m), offset=flat_offset)
+        flat_offset += np.prod(ker_gpu.shape)
+        dev_v, dev_out = None, None
+        if not incore:
+            dev_out, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=out, offset=flat_offset)
+            dev_v, flat_offset = _extract_flat(flat_gpu, size=(blk_m, T), other=v, offset=flat_offset)
+
         for i in range(0, N, blk_n):
             leni = min(blk_n, N - i)
             c_kwargs_m1 = {k: v[i:leni] for k, v in kwargs_m1.items()}
@@ -267,6 +465,8 @@ def sparse_mmv_run_thread(
             else:  # CPU -> CUDA
                 c_dev_out = dev_out[:leni]
                 c_dev_m1 = c_m1.index_to_int().to(device=dev, non_blocking=True)
+                if sliced_ell:
+                    c_dev_m1 = SlicedEllTensor.from_csr(c_dev_m1)
             c_dev_out.fill_(0.0)
 
             for j in range(0, M, blk_m):
@@ -278,11 +478,14 @@ def sparse_mmv_run_thread(
                     c_dev_m2 = c_m2.transpose_csc()
                     c_dev_v = v[j : j + lenj]
                 else:  # CPU -> CUDA
-                    c_dev_m2 = (
-                        SparseTensor.from_scipy(c_m2.transpose_csc().to_scipy().tocsr(copy=False))
-                        .index_to_int()
-                        .to(device=dev, non_blocking=True)
-                    )
+                    if j not in m2_tiles:
+                        if sliced_ell:
+                            m2_tiles[j] = c_m2.index_to_int().transpose_csc()
+                        else:
+                            m2_tiles[j] = SparseTensor.from_scipy(
+                                c_m2.transpose_csc().to_scipy().tocsr(copy=False)
+                            ).index_to_int_()
+                    c_dev_m2 = m2_tiles[j].to(device=dev, non_blocking=True)
                     with ExitStack() as stack2:
                         if dev.type == "cuda":
                             stack2.enter_context(tcd.stream(s2))
@@ -319,6 +522,9 @@ def mmv_run_thread(
     tid: int,
     kwargs_m1: Dict[str, torch.Tensor],
     kwargs_m2: Dict[str, torch.Tensor],
+    num_buffers: int = 1,
+    fused: bool = False,
+    comp_dt: Optional[torch.dtype] = None,
 ):
     # data(CUDA), dev(CUDA) or data(CPU), dev(CPU)
     m1_ic, m2_ic, v_ic, out_ic = (
@@ -327,77 +533,130 @@ def mmv_run_thread(
         _is_incore(dev, v.device),
         _is_incore(dev, out.device),
     )
-    incore = all((m1_ic, m2_ic, v_ic, out_ic))
     N, D = m1.shape
     M, T = v.shape
-
-    # Initialize extra buffers
-    # dev_ker = create_fortran((blk_n, blk_m), dtype=m1.dtype, device=dev)
-    flat_gpu = torch.empty(size=(mem_needed,), dtype=m1.dtype, device=dev)
-    flat_offset = 0
-    dev_ker, flat_offset = _extract_flat(flat_gpu, size=(blk_n, blk_m), other=out, offset=flat_offset)
-    if m1_ic:
-        dev_m1 = None
-    else:
-        dev_m1, flat_offset = _extract_flat(flat_gpu, size=(blk_n, D), other=m1, offset=flat_offset)
-    if m2_ic:
-        dev_m2 = None
-    else:
-        dev_m2, flat_offset = _extract_flat(flat_gpu, size=(blk_m, D), other=m2, offset=flat_offset)
-    if v_ic:
-        dev_v = None
-    else:
-        dev_v, flat_offset = _extract_flat(flat_gpu, size=(blk_m, T), other=v, offset=flat_offset)
-    if out_ic:
-        dev_out = None
-    else:
-        dev_out, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=out, offset=flat_offset)
+    # With reduced precision (`comp_dt`) the inputs are always converted into device tiles, and
+    # the output blocks accumulate the tile products in the data-type of `out`.
+    reduced = comp_dt is not None
+    tile_dt = comp_dt if reduced else m1.dtype
+    m1_tiled, m2_tiled, v_tiled = not m1_ic or reduced, not m2_ic or reduced, not v_ic or reduced
+    es = sizeof_dtype(tile_dt)
+
+    # `*_ready` events mark the end of a copy into a buffer, `*_free` events the end of its last use.
+    m1_ready, m1_free = _pipeline_events(dev, num_buffers), _pipeline_events(dev, num_buffers)
+    tile_ready, tile_free = _pipeline_events(dev, num_buffers), _pipeline_events(dev, num_buffers)
+    out_ready, out_free = _pipeline_events(dev, num_buffers), _pipeline_events(dev, num_buffers)
 
     with ExitStack() as stack, torch.inference_mode():
-        s1, s2 = _init_two_streams(stack, dev, tid)
-        for i in range(0, N, blk_n):
+        s_comp, s_h2d, s_d2h = _init_pipeline_streams(
+            stack, dev, tid, copies=not (m1_ic and m2_ic and v_ic and out_ic)
+        )
+        # Initialize extra buffers. Out-of-core blocks get `num_buffers` copies each so that the
+        # copy of the next tile (on the h2d stream) and the write-back of the previous output block
+        # (on the d2h stream) can overlap with kernel computations.
+        flat_gpu = stack.enter_context(workspace.borrow(mem_needed, tile_dt, dev))
+        flat_offset = 0
+        dev_ker = None  # The fused kernel-vector product does not need a kernel block
+        if not fused:
+            dev_ker, flat_offset = _extract_flat(flat_gpu, size=(blk_n, blk_m), other=out, offset=flat_offset)
+        dev_m1, dev_m2, dev_v, dev_out = [], [], [], []
+        for _ in range(num_buffers):
+            if m1_tiled:
+                buf, flat_offset = _extract_flat(flat_gpu, size=(blk_n, D), other=m1, offset=flat_offset)
+                dev_m1.append(buf)
+            if m2_tiled:
+                buf, flat_offset = _extract_flat(flat_gpu, size=(blk_m, D), other=m2, offset=flat_offset)
+                dev_m2.append(buf)
+            if v_tiled:
+                buf, flat_offset = _extract_flat(flat_gpu, size=(blk_m, T), other=v, offset=flat_offset)
+                dev_v.append(buf)
+            if not out_ic:
+                if reduced:
+                    buf = create_same_stride((blk_n, T), out, out.dtype, dev)
+                else:
+                    buf, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=out, offset=flat_offset)
+                dev_out.append(buf)
+        # Pageable host blocks of m1 are staged in pinned memory ahead of their copy.
+        m1_stage = None
+        if m1_tiled:
+            m1_blocks = [(i, min(blk_n, N - i)) for i in range(0, N, blk_n)]
+            m1_stage = stack.enter_context(
+                PinnedStager(m1, m1_blocks, dev, dtype=tile_dt, num_buffers=num_buffers + 1)
+            )
+        tile_idx = 0
+        for blk_idx, i in enumerate(range(0, N, blk_n)):
             leni = min(blk_n, N - i)
-            c_kwargs_m1 = {k: v[i:leni] for k, v in kwargs_m1.items()}
-            if m1_ic:
+            b = blk_idx % num_buffers
+            c_kwargs_m1 = {k: v[i : i + leni] for k, v in kwargs_m1.items()}
+            if not m1_tiled:
                 c_dev_m1 = m1[i : i + leni, :]
             else:
-                c_dev_m1 = copy(m1[i : i + leni, :], dev_m1[:leni, :], non_blocking=True)
+                with ExitStack() as stack2:
+                    _maybe_stream(stack2, s_h2d)
+                    _wait(s_h2d, m1_free, b)
+                    stack2.enter_context(trace_range("mmv.h2d", s_h2d, nbytes=leni * D * es))
+                    c_dev_m1 = copy(m1_stage.get(), dev_m1[b][:leni, :], non_blocking=True, allow_dtype_change=True)
+                    m1_stage.release(s_h2d)
+                    _record(s_h2d, m1_ready, b)
+                _wait(s_comp, m1_ready, b)
             if out_ic:
                 c_dev_out = out[i : i + leni]
             else:
-                c_dev_out = dev_out[:leni]
+                _wait(s_comp, out_free, b)
+                c_dev_out = dev_out[b][:leni]
             c_dev_out.fill_(0.0)
 
             for j in range(0, M, blk_m):
                 lenj = min(blk_m, M - j)
-                c_kwargs_m2 = {k: v[j:lenj] for k, v in kwargs_m2.items()}
-                if m2_ic:
-                    c_dev_m2 = m2[j : j + lenj, :]
-                else:
-                    c_dev_m2 = copy(m2[j : j + lenj, :], dev_m2[:lenj, :], non_blocking=True)
-                # c_dev_m2 = m2[j: j + lenj].to(dev, copy=False, non_blocking=True)
-                if v_ic:
-                    c_dev_v = v[j : j + lenj, :]
-                else:
+                t = tile_idx % num_buffers
+                tile_idx += 1
+                c_kwargs_m2 = {k: v[j : j + lenj] for k, v in kwargs_m2.items()}
+                c_dev_m2 = None if m2_tiled else m2[j : j + lenj, :]
+                c_dev_v = None if v_tiled else v[j : j + lenj, :]
+                if m2_tiled or v_tiled:
+                    tile_bytes = lenj * ((D if m2_tiled else 0) + (T if v_tiled else 0)) * es
                     with ExitStack() as stack2:
-                        if dev.type == "cuda":
-                            stack2.enter_context(tcd.stream(s2))
-                        c_dev_v = copy(v[j : j + lenj, :], dev_v[:lenj, :], non_blocking=True)
-                c_dev_ker = dev_ker[:leni, :lenj].fill_(0.0)
-
-                c_dev_ker = kernel.compute(c_dev_m1, c_dev_m2, c_dev_ker, diag=False, **c_kwargs_m1, **c_kwargs_m2)
-                if not incore:
-                    s2.synchronize()
-                c_dev_out.addmm_(c_dev_ker, c_dev_v)
-                if not incore:
-                    s1.synchronize()  # sync necessary to avoid s2 overwriting dev_v/dev_w
+                        _maybe_stream(stack2, s_h2d)
+                        _wait(s_h2d, tile_free, t)
+                        stack2.enter_context(trace_range("mmv.h2d", s_h2d, nbytes=tile_bytes))
+                        srcs, dsts = [], []
+                        if m2_tiled:
+                            c_dev_m2 = dev_m2[t][:lenj, :]
+                            srcs.append(m2[j : j + lenj, :])
+                            dsts.append(c_dev_m2)
+                        if v_tiled:
+                            c_dev_v = dev_v[t][:lenj, :]
+                            srcs.append(v[j : j + lenj, :])
+                            dsts.append(c_dev_v)
+                        copy_batch(srcs, dsts)
+                        _record(s_h2d, tile_ready, t)
+                    _wait(s_comp, tile_ready, t)
+                with trace_range("mmv.tile", s_comp, flops=2.0 * leni * lenj * (D + T)):
+                    if fused:
+                        kernel.compute_mmv_fused(c_dev_m1, c_dev_m2, c_dev_v, c_dev_out)
+                    else:
+                        c_dev_ker = dev_ker[:leni, :lenj].fill_(0.0)
+                        c_dev_ker = kernel.compute(
+                            c_dev_m1, c_dev_m2, c_dev_ker, diag=False, **c_kwargs_m1, **c_kwargs_m2
+                        )
+                        if reduced:  # The product accumulates in fp32, and is added to the fp32 output
+                            c_dev_out.add_(torch.mm(c_dev_ker, c_dev_v))
+                        else:
+                            c_dev_out.addmm_(c_dev_ker, c_dev_v)
+                _record(s_comp, tile_free, t)
             # end iter over M
+            _record(s_comp, m1_free, b)
             if not out_ic:
-                copy(c_dev_out, out[i : i + leni], non_blocking=True)
-            # if not out_ic:
-            #     out[i: i + leni].copy_(c_dev_out, non_blocking=True)
-        if tid != -1 and s1 is not None:
-            s1.synchronize()
+                _record(s_comp, out_ready, b)
+                with ExitStack() as stack2:
+                    _maybe_stream(stack2, s_d2h)
+                    _wait(s_d2h, out_ready, b)
+                    stack2.enter_context(trace_range("mmv.d2h", s_d2h, nbytes=leni * T * out.element_size()))
+                    copy(c_dev_out, out[i : i + leni], non_blocking=True)
+                    _record(s_d2h, out_free, b)
+        _pipeline_finish(s_comp, s_h2d, s_d2h, out_ic)
+        if tid != -1 and s_comp is not None:
+            s_comp.synchronize()
         # end iter over N
     # exit context manager (device, stream)
 
@@ -452,21 +711,29 @@ def mmv_diff_run_thread(
                     c_dev_v_g = (
                         None if grads[2] is None else grads[2][j : j + lenj, :].to(dev, non_blocking=True, copy=False)
                     )
-                c_dev_ker = kernel.compute_diff(c_dev_m1, c_dev_m2, diag=False, **c_kwargs_m1, **c_kwargs_m2)
                 if not incore:
                     s2.synchronize()
-                # main MMV operation on current block
-                c_dev_mmv = c_dev_ker @ c_dev_v
-                # Build inputs for torch.autograd.grad
-                c_inputs = [c_dev_m1, c_dev_m2, c_dev_v] + list(kernel.diff_params.values())
-                c_dev_grads = torch.autograd.grad(
-                    c_dev_mmv,
-                    [c_inputs[idx] for idx in input_idxs],
-                    grad_outputs=c_dev_out,
+                # Closed-form gradients of the current block, if the kernel implements them.
+                c_dev_grads = kernel.compute_mmv_grad(
+                    c_dev_m1, c_dev_m2, c_dev_v, c_dev_out, **c_kwargs_m1, **c_kwargs_m2
                 )
+                if c_dev_grads is None:
+                    c_dev_ker = kernel.compute_diff(c_dev_m1, c_dev_m2, diag=False, **c_kwargs_m1, **c_kwargs_m2)
+                    # main MMV operation on current block
+                    c_dev_mmv = c_dev_ker @ c_dev_v
+                    # Build inputs for torch.autograd.grad
+                    c_inputs = [c_dev_m1, c_dev_m2, c_dev_v] + list(kernel.diff_params.values())
+                    c_dev_grads = [None] * len(c_inputs)
+                    c_dev_grads_ag = torch.autograd.grad(
+                        c_dev_mmv,
+                        [c_inputs[idx] for idx in input_idxs],
+                        grad_outputs=c_dev_out,
+                    )
+                    for c_grad, c_idx in zip(c_dev_grads_ag, input_idxs):
+                        c_dev_grads[c_idx] = c_grad
                 c_dev_grads_old = [c_dev_m1_g, c_dev_m2_g, c_dev_v_g] + grads[3:]
-                for c_grad, c_idx in zip(c_dev_grads, input_idxs):
-                    c_dev_grads_old[c_idx].add_(c_grad)
+                for c_idx in input_idxs:
+                    c_dev_grads_old[c_idx].add_(c_dev_grads[c_idx])
                 # Move grads to host
                 if grads[1] is not None:
                     grads[1][j : j + lenj, :].copy_(c_dev_m2_g, non_blocking=True)
@@ -502,45 +769,87 @@ def _dmmv_blk_sizes(
     kernel: "falkon.kernels.Kernel",
     is_differentiable: bool,
     is_sparse: bool,
+    dev: Optional[torch.device] = None,
+    autotune: bool = False,
+    num_buffers: int = 1,
+    sliced_ell: bool = False,
+    comp_dt: Optional[torch.dtype] = None,
 ) -> Tuple[int, int]:
     extra_mem = kernel.extra_mem(is_differentiable, is_sparse, dtype)
     normal_mem = defaultdict(int)
-    normal_mem["nm"] = 1  # kernel block
-    normal_mem["nt"] = 1  # w block (TODO: This alloc should be removed if it's IC)
+    # With reduced precision tiles (see `_mmv_blk_sizes`), the w and output accumulators keep the
+    # data-type of the inputs.
+    tile_scale = 1.0
+    if comp_dt is not None:
+        tile_scale = sizeof_dtype(comp_dt) / sizeof_dtype(dtype)
+        m1_ic = m2_ic = v_ic = False
+        autotune = False
+        # Squared distance buffer (see `_mmv_blk_sizes`), and the w block cast to reduced precision.
+        normal_mem["0"] += REDUCED_DIST_BUF_BYTES / sizeof_dtype(dtype)
+        normal_mem["nt"] += tile_scale
+    normal_mem["nm"] += tile_scale  # kernel block
+    normal_mem["nt"] += num_buffers  # w block (TODO: This alloc should be removed if it's IC)
     if is_sparse:
         m1_sparsity = m1_sparsity * 2  # to account for the storage complexity of CSR matrices
         m2_sparsity = m2_sparsity * 2  # to account for the storage complexity of CSR matrices
+        if sliced_ell:  # padded sliced-ELL copy of m1, and the temporary buffers of the conversion
+            m1_sparsity = m1_sparsity * 4
     if not m1_ic:
-        normal_mem["nd"] += m1_sparsity
+        normal_mem["nd"] += m1_sparsity * num_buffers * tile_scale
     if not m2_ic:
-        normal_mem["md"] += m2_sparsity
+        normal_mem["md"] += m2_sparsity * tile_scale
     if not out_ic:
         normal_mem["mt"] += 1
     if not v_ic:
-        normal_mem["mt"] += 1
-
+        normal_mem["mt"] += tile_scale
+
+    coef_nm = normal_mem["nm"] + extra_mem.get("nm", 0)
+    coef_nd = normal_mem["nd"] + extra_mem.get("nd", 0)
+    coef_md = normal_mem["md"] + extra_mem.get("md", 0)
+    coef_n = (normal_mem["nt"] + extra_mem.get("nt", 0)) * t + extra_mem.get("n", 0)
+    coef_m = (normal_mem["mt"] + extra_mem.get("mt", 0)) * t + extra_mem.get("m", 0)
+    coef_d = extra_mem.get("d", 0)
+    rest = normal_mem["0"] + extra_mem.get("0", 0)
     blk_n = select_dim_over_n(
         max_n=n,
         m=m,
         d=d,
         max_mem=avail_mem,
-        coef_nm=normal_mem["nm"] + extra_mem.get("nm", 0),
-        coef_nd=normal_mem["nd"] + extra_mem.get("nd", 0),
-        coef_md=normal_mem["md"] + extra_mem.get("md", 0),
-        coef_n=(normal_mem["nt"] + extra_mem.get("nt", 0)) * t + extra_mem.get("n", 0),
-        coef_m=(normal_mem["mt"] + extra_mem.get("mt", 0)) * t + extra_mem.get("m", 0),
-        coef_d=extra_mem.get("d", 0),
-        rest=extra_mem.get("0", 0),
+        coef_nm=coef_nm,
+        coef_nd=coef_nd,
+        coef_md=coef_md,
+        coef_n=coef_n,
+        coef_m=coef_m,
+        coef_d=coef_d,
+        rest=rest,
     )
-    mem_needed = blk_n * (m + t)  # for kernel block and w
+    if autotune and dev is not None and dev.type == "cuda" and not is_sparse and not is_differentiable:
+        fixed_mem = coef_md * m * d + coef_m * m + coef_d * d + rest
+        blk_n = tune_dmmv_blk_size(
+            dev,
+            dtype,
+            kernel,
+            d=d,
+            t=t,
+            m=m,
+            max_n=n,
+            default=blk_n,
+            fits=lambda bn: (coef_nm * m + coef_nd * d + coef_n) * bn + fixed_mem <= avail_mem,
+            m1_ic=m1_ic,
+        )
+    mem_needed = blk_n * m  # for kernel block
+    if comp_dt is None:  # Reduced precision w and output blocks are allocated separately
+        mem_needed += blk_n * t * num_buffers
+        if not out_ic:
+            mem_needed += m * t
+    else:
+        mem_needed += blk_n * t  # w block cast to reduced precision
     if not m1_ic and not is_sparse:
-        mem_needed += blk_n * d  # m1
+        mem_needed += blk_n * d * num_buffers  # m1
     if not m2_ic and not is_sparse:
         mem_needed += m * d  # m2
     if not v_ic:
         mem_needed += m * t
-    if not out_ic:
-        mem_needed += m * t
     return blk_n, mem_needed
 
 
@@ -555,16 +864,24 @@ def dmmv_run_starter(proc_idx, queue, device_id):
 
     # Choose batch sizes
     avail_mem = max_mem / sizeof_dtype(X1.dtype)
+    m1_ic = _is_incore(dev, X1.device)
+    w_ic = _is_incore(dev, w.device) if w is not None else False
+    # Number of buffered m1 (and w) blocks for the copy-compute pipeline (dense, out-of-core only).
+    num_buffers = 1
+    if not is_sparse and not (m1_ic and (w is None or w_ic)):
+        num_buffers = max(1, a.num_streams)
+    sliced_ell = a.sliced_ell and is_sparse and dev.type == "cuda"
+    comp_dt = a.comp_dt if dev.type == "cuda" and not is_sparse else None
     blk_n, mem_needed = _dmmv_blk_sizes(
         n=X1.size(-2),
         d=X1.size(-1),
         m=X2.size(-2),
         t=v.size(-1),
         avail_mem=avail_mem,
-        m1_ic=_is_incore(dev, X1.device),
+        m1_ic=m1_ic,
         m2_ic=_is_incore(dev, X2.device),
         v_ic=_is_incore(dev, v.device),
-        w_ic=_is_incore(dev, w.device) if w is not None else False,
+        w_ic=w_ic,
         out_ic=_is_incore(dev, out.device),
         m1_sparsity=X1.density if is_sparse else 1.0,
         m2_sparsity=X2.density if is_sparse else 1.0,
@@ -572,6 +889,11 @@ def dmmv_run_starter(proc_idx, queue, device_id):
         kernel=kernel,
         is_differentiable=False,
         is_sparse=is_sparse,
+        dev=dev,
+        autotune=a.autotune and not a.kwargs_m1 and not a.kwargs_m2,
+        num_buffers=num_buffers,
+        sliced_ell=sliced_ell,
+        comp_dt=comp_dt,
     )
 
     if is_sparse:
@@ -588,6 +910,7 @@ def dmmv_run_starter(proc_idx, queue, device_id):
             tid=proc_idx,
             kwargs_m1=a.kwargs_m1,
             kwargs_m2=a.kwargs_m2,
+            sliced_ell=sliced_ell,
         )
     else:
         dmmv_run_thread(
@@ -603,6 +926,9 @@ def dmmv_run_starter(proc_idx, queue, device_id):
             tid=proc_idx,
             kwargs_m1=a.kwargs_m1,
             kwargs_m2=a.kwargs_m2,
+            num_buffers=num_buffers,
+            m1_dev=a.X1_dev,
+            comp_dt=comp_dt,
         )
 
 
@@ -619,37 +945,43 @@ def sparse_dmmv_run_thread(
     tid: int,
     kwargs_m1: Dict[str, torch.Tensor],
     kwargs_m2: Dict[str, torch.Tensor],
+    sliced_ell: bool = False,
 ):
     incore = _is_incore(dev, m1.device)
     dev_out_exists = out.device == dev  # out has already been allocated on the computation device
     N, D = m1.shape
     M, T = v.shape
 
-    """ Initialize extra buffers """
-    flat_gpu = torch.empty(size=(mem_needed,), dtype=m1.dtype, device=dev)
-    flat_offset = 0
-    # ker_gpu must be fortran-ordered due to cusparse csr2dense function (TODO: only on CUDA)
-    ker_gpu = extract_fortran(flat_gpu, size=(blk_n, M), offset=flat_offset)
-    flat_offset += np.prod(ker_gpu.shape)
-    dev_w, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=v if w is None else w, offset=flat_offset)
-    dev_out, dev_v, dev_m2 = out, v, m2
-    if not incore:
-        if not dev_out_exists:
-            dev_out, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=out, offset=flat_offset)
-        dev_v, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=v, offset=flat_offset)
-
     with ExitStack() as stack, torch.inference_mode():
         s1 = None
         if dev.type == "cuda":
             s1 = tcd.current_stream(dev) if tid == -1 else tcd.Stream(dev)
             stack.enter_context(tcd.device(dev))
             stack.enter_context(tcd.stream(s1))
+            stack.enter_context(SpgemmPlan(dev))
+        """ Initialize extra buffers """
+        flat_gpu = stack.enter_context(workspace.borrow(mem_needed, m1.dtype, dev))
+        flat_offset = 0
+        # ker_gpu must be fortran-ordered due to cusparse csr2dense function (TODO: only on CUDA)
+        ker_gpu = extract_fortran(flat_gpu, size=(blk_n, M), offset=flat_offset)
+        flat_offset += np.prod(ker_gpu.shape)
+        dev_w, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=v if w is None else w, offset=flat_offset)
+        dev_out, dev_v, dev_m2 = out, v, m2
+        if not incore:
+            if not dev_out_exists:
+                dev_out, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=out, offset=flat_offset)
+            dev_v, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=v, offset=flat_offset)
         dev_out.fill_(0.0)  # Needs to be inside inference mode
         if not incore:  # Note that CUDA-incore is not allowed to happen (CPU->CUDA)
             copy(v, dev_v, non_blocking=True)
-            dev_m2 = (
-                SparseTensor.from_scipy(m2.transpose_csc().to_scipy().tocsr(copy=False)).index_to_int().to(device=dev)
-            )
+            if sliced_ell:
+                dev_m2 = m2.index_to_int().to(device=dev).transpose_csc()
+            else:
+                dev_m2 = (
+                    SparseTensor.from_scipy(m2.transpose_csc().to_scipy().tocsr(copy=False))
+                    .index_to_int()
+                    .to(device=dev)
+                )
         else:
             dev_m2 = m2.transpose_csc()
 
@@ -662,6 +994,8 @@ def sparse_dmmv_run_thread(
                 c_dev_m1 = c_m1
             else:  # CPU -> CUDA
                 c_dev_m1 = c_m1.index_to_int().to(device=dev, non_blocking=True)
+                if sliced_ell:
+                    c_dev_m1 = SlicedEllTensor.from_csr(c_dev_m1)
             if w is None:
                 c_dev_w = dev_w[:leni, :].fill_(0.0)
             else:
@@ -693,6 +1027,9 @@ def dmmv_run_thread(
     tid: int,
     kwargs_m1: Dict[str, torch.Tensor],
     kwargs_m2: Dict[str, torch.Tensor],
+    num_buffers: int = 1,
+    m1_dev: Optional[torch.Tensor] = None,
+    comp_dt: Optional[torch.dtype] = None,
 ):
     # k(x2, x1) @ (k(x1, x2) @ v + w)
     # data(CUDA), dev(CUDA) or data(CPU), dev(CPU)
@@ -704,67 +1041,140 @@ def dmmv_run_thread(
     )
     N, D = m1.shape
     M, T = v.shape
-
-    # Initialize extra buffers
-    flat_gpu = torch.empty(size=(mem_needed,), dtype=m1.dtype, device=dev)
-    flat_offset = 0
-    dev_ker, flat_offset = _extract_flat(flat_gpu, size=(blk_n, M), other=out, offset=flat_offset)
-    dev_w, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=v if w is None else w, offset=flat_offset)
-    if m1_ic:
-        dev_m1 = None
-    else:
-        dev_m1, flat_offset = _extract_flat(flat_gpu, size=(blk_n, D), other=m1, offset=flat_offset)
-    if m2_ic:
-        dev_m2 = m2
-    else:
-        dev_m2, flat_offset = _extract_flat(flat_gpu, size=(M, D), other=m2, offset=flat_offset)
-    if v_ic:
-        dev_v = v
-    else:
-        dev_v, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=v, offset=flat_offset)
-    if out_ic:
-        dev_out = out
-    else:
-        dev_out, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=out, offset=flat_offset)
+    # With reduced precision (`comp_dt`) the inputs are always converted into device tiles, while
+    # the w and output blocks accumulate the tile products in the data-type of `out`.
+    reduced = comp_dt is not None
+    tile_dt = comp_dt if reduced else m1.dtype
+    es = sizeof_dtype(tile_dt)
+    # Rows of m1 which are already on the device (see `falkon.mmv_ops.data_cache`) form their own
+    # blocks, the remaining rows are copied from the host.
+    num_resident = 0 if m1_ic or m1_dev is None else m1_dev.shape[0]
+    blocks = [(i, min(blk_n, num_resident - i)) for i in range(0, num_resident, blk_n)]
+    num_resident_blocks = len(blocks)
+    blocks.extend((i, min(blk_n, N - i)) for i in range(num_resident, N, blk_n))
+
+    # `blk_ready` marks the end of the copies into a buffer, `blk_free` the end of its last use.
+    blk_ready, blk_free = _pipeline_events(dev, num_buffers), _pipeline_events(dev, num_buffers)
 
     with ExitStack() as stack, torch.inference_mode():
-        s1, s2 = _init_two_streams(stack, dev, tid)
+        w_ic = w is None or _is_incore(dev, w.device)
+        s_comp, s_h2d, s_d2h = _init_pipeline_streams(
+            stack, dev, tid, copies=not (m1_ic and m2_ic and v_ic and out_ic and w_ic)
+        )
+        # Initialize extra buffers. The m1 and w blocks get `num_buffers` copies each so that the
+        # copy of the next block (on the h2d stream) can overlap with kernel computations.
+        flat_gpu = stack.enter_context(workspace.borrow(mem_needed, tile_dt, dev))
+        flat_offset = 0
+        dev_ker, flat_offset = _extract_flat(flat_gpu, size=(blk_n, M), other=out, offset=flat_offset)
+        dev_w, dev_m1 = [], []
+        for _ in range(num_buffers):
+            w_like = v if w is None else w
+            if reduced:
+                buf = create_same_stride((blk_n, T), w_like, out.dtype, dev)
+            else:
+                buf, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=w_like, offset=flat_offset)
+            dev_w.append(buf)
+            if not m1_ic or reduced:
+                buf, flat_offset = _extract_flat(flat_gpu, size=(blk_n, D), other=m1, offset=flat_offset)
+                dev_m1.append(buf)
+        dev_w_tile = None
+        if reduced:  # Only used on the compute stream
+            dev_w_tile, flat_offset = _extract_flat(flat_gpu, size=(blk_n, T), other=v, offset=flat_offset)
+        if m2_ic and not reduced:
+            dev_m2 = m2
+        else:
+            dev_m2, flat_offset = _extract_flat(flat_gpu, size=(M, D), other=m2, offset=flat_offset)
+        if v_ic and not reduced:
+            dev_v = v
+        else:
+            dev_v, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=v, offset=flat_offset)
+        if out_ic:
+            dev_out = out
+        elif reduced:
+            dev_out = create_same_stride((M, T), out, out.dtype, dev)
+        else:
+            dev_out, flat_offset = _extract_flat(flat_gpu, size=(M, T), other=out, offset=flat_offset)
+        # Pageable host blocks are staged in pinned memory (only the blocks of m1 which are not resident).
+        m1_stage, w_stage = None, None
+        if not m1_ic:
+            m1_stage = stack.enter_context(
+                PinnedStager(m1, blocks[num_resident_blocks:], dev, dtype=tile_dt, num_buffers=num_buffers + 1)
+            )
+        if w is not None:
+            w_stage = stack.enter_context(PinnedStager(w, blocks, dev, num_buffers=num_buffers + 1))
         dev_out.fill_(0.0)
-        if not m2_ic:
-            copy(m2, dev_m2, non_blocking=True)
-        if not v_ic:
+        m2_tiled, v_tiled = dev_m2 is not m2, dev_v is not v
+        if m2_tiled or v_tiled:
+            rhs_bytes = ((M * D if m2_tiled else 0) + (M * T if v_tiled else 0)) * es
             with ExitStack() as stack2:
-                if s2 is not None:
-                    stack2.enter_context(tcd.stream(s2))
-                copy(v, dev_v, non_blocking=True)
-        for i in range(0, N, blk_n):
-            leni = min(blk_n, N - i)
-            c_kwargs_m1 = {k: v[i:leni] for k, v in kwargs_m1.items()}
+                _maybe_stream(stack2, s_h2d)
+                stack2.enter_context(trace_range("dmmv.h2d", s_h2d, nbytes=rhs_bytes))
+                srcs, dsts = [], []
+                if m2_tiled:
+                    srcs.append(m2)
+                    dsts.append(dev_m2)
+                if v_tiled:
+                    srcs.append(v)
+                    dsts.append(dev_v)
+                copy_batch(srcs, dsts)
+        for blk_idx, (i, leni) in enumerate(blocks):
+            b = blk_idx % num_buffers
+            c_kwargs_m1 = {k: v[i : i + leni] for k, v in kwargs_m1.items()}
+            c_dev_m1 = None
             if m1_ic:
                 c_dev_m1 = m1[i : i + leni, :]
-            else:
-                c_dev_m1 = copy(m1[i : i + leni, :], dev_m1[:leni, :], non_blocking=True)
-            if w is not None:
-                with ExitStack() as stack2:
-                    if s2 is not None:
-                        stack2.enter_context(tcd.stream(s2))
-                    c_dev_w = copy(w[i : i + leni, :], dev_w[:leni, :], non_blocking=True)
-            else:
-                c_dev_w = dev_w[:leni, :].fill_(0.0)
-
-            c_dev_ker = dev_ker[:leni, :].fill_(0.0)
-            c_dev_ker = kernel.compute(c_dev_m1, dev_m2, c_dev_ker, diag=False, **c_kwargs_m1, **kwargs_m2)
-            if s2 is not None:
-                s2.synchronize()
-            c_dev_w.addmm_(c_dev_ker, dev_v)
-            dev_out.addmm_(c_dev_ker.T, c_dev_w)
-            if s1 is not None:
-                s1.synchronize()  # sync necessary to avoid s2 overwriting dev_v/dev_w
+            elif i < num_resident:
+                c_dev_m1 = m1_dev[i : i + leni, :]
+            c_dev_w = None
+            # Stream ordering guarantees that m2 and v are copied before the first block is ready.
+            blk_bytes = leni * ((0 if c_dev_m1 is not None else D) + (0 if w is None else T)) * es
+            with ExitStack() as stack2:
+                _maybe_stream(stack2, s_h2d)
+                _wait(s_h2d, blk_free, b)
+                stack2.enter_context(trace_range("dmmv.h2d", s_h2d, nbytes=blk_bytes))
+                m1_copied = c_dev_m1 is None
+                srcs, dsts = [], []
+                if m1_copied:
+                    c_dev_m1 = dev_m1[b][:leni, :]
+                    srcs.append(m1_stage.get())
+                    dsts.append(c_dev_m1)
+                if w is not None:
+                    c_dev_w = dev_w[b][:leni, :]
+                    srcs.append(w_stage.get())
+                    dsts.append(c_dev_w)
+                copy_batch(srcs, dsts)
+                if m1_copied:
+                    m1_stage.release(s_h2d)
+                if w is not None:
+                    w_stage.release(s_h2d)
+                _record(s_h2d, blk_ready, b)
+            _wait(s_comp, blk_ready, b)
+            if c_dev_w is None:
+                c_dev_w = dev_w[b][:leni, :].fill_(0.0)
+            if c_dev_m1.dtype != tile_dt:  # In-core or resident rows, converted to reduced precision
+                c_dev_m1 = dev_m1[b][:leni, :].copy_(c_dev_m1)
+
+            with trace_range("dmmv.tile", s_comp, flops=2.0 * leni * M * (D + 2 * T)):
+                c_dev_ker = dev_ker[:leni, :].fill_(0.0)
+                c_dev_ker = kernel.compute(c_dev_m1, dev_m2, c_dev_ker, diag=False, **c_kwargs_m1, **kwargs_m2)
+                if reduced:  # The products accumulate in fp32, and are added to the fp32 w and output
+                    c_dev_w.add_(torch.mm(c_dev_ker, dev_v))
+                    dev_out.add_(torch.mm(c_dev_ker.T, dev_w_tile[:leni, :].copy_(c_dev_w)))
+                else:
+                    c_dev_w.addmm_(c_dev_ker, dev_v)
+                    dev_out.addmm_(c_dev_ker.T, c_dev_w)
+            _record(s_comp, blk_free, b)
 
         if not out_ic:
-            copy(dev_out, out, non_blocking=True)
-        if tid != -1 and s1 is not None:
-            s1.synchronize()
+            with ExitStack() as stack2:
+                _maybe_stream(stack2, s_d2h)
+                if s_d2h is not None:
+                    s_d2h.wait_stream(s_comp)
+                stack2.enter_context(trace_range("dmmv.d2h", s_d2h, nbytes=M * T * out.element_size()))
+                copy(dev_out, out, non_blocking=True)
+        _pipeline_finish(s_comp, s_h2d, s_d2h, out_ic)
+        if tid != -1 and s_comp is not None:
+            s_comp.synchronize()
 
 
 # noinspection PyMethodOverriding
@@ -833,6 +1243,11 @@ class KernelMmvFnFull(torch.autograd.Function):
                         differentiable=diff,
                         kwargs_m1=c_kwargs_m1,
                         kwargs_m2=kwargs_m2 or {},
+                        num_streams=options.num_fmm_streams,
+                        autotune=options.mmv_autotune,
+                        fused=should_use_fused_mmv(kernel, X1, X2, options),
+                        sliced_ell=is_sparse and options.sparse_sliced_ell,
+                        comp_dt=reduced_mmv_dtype(kernel, X1, options),
                     ),
                     g.Id,
                 )
@@ -880,6 +1295,10 @@ class KernelMmvFnFull(torch.autograd.Function):
             differentiable=diff,
             kwargs_m1=kwargs_m1 or {},
             kwargs_m2=kwargs_m2 or {},
+            num_streams=options.num_fmm_streams,
+            autotune=options.mmv_autotune,
+            fused=should_use_fused_mmv(kernel, X1, X2, options),
+            comp_dt=reduced_mmv_dtype(kernel, X1, options),
         )
         return _call_direct(mmv_run_starter, (args, data_dev.index))
 
@@ -1075,23 +1494,37 @@ def fdmmv(
                 max_mem=single_gpu_info.usable_memory,
                 kwargs_m1=kwargs_m1 or {},
                 kwargs_m2=kwargs_m2 or {},
+                num_streams=opt.num_fmm_streams,
+                autotune=opt.mmv_autotune,
+                comp_dt=reduced_mmv_dtype(kernel, X1, opt),
             )
             _call_direct(dmmv_run_starter, (args, data_dev.index))
         elif comp_dev_type == "cuda":
             gpu_info = _get_gpu_info(opt, slack=opt.memory_slack)
             args = []  # Arguments passed to each subprocess
             wrlk = []  # Outputs for each subprocess
+            wrlk_gpu_info = []  # Device of each output
             block_sizes = calc_gpu_block_sizes(gpu_info, N)
+            data_cache = None if is_sparse else find_data_cache(X1)
             for i, g in enumerate(gpu_info):
                 bwidth = block_sizes[i + 1] - block_sizes[i]
                 if bwidth <= 0:
                     continue
-                if len(gpu_info) == 1 and out.device.index == g.Id:
+                X1_dev = None
+                if data_cache is not None:
+                    X1_dev = data_cache.resident_rows(g.Id, block_sizes[i], bwidth)
+                    # Free memory already excludes the cache, but `max_gpu_mem` does not.
+                    g.usable_memory = min(
+                        g.usable_memory, (opt.max_gpu_mem - data_cache.nbytes(g.Id)) * opt.memory_slack
+                    )
+                if out.is_cuda and out.device.index == g.Id and is_contig(out):
+                    # The partial output of this device is accumulated directly into `out`
                     cur_out_gpu = out
                 else:
                     cur_out_gpu = create_same_stride((M, T), out, out.dtype, f"cuda:{g.Id}")
                     g.usable_memory -= M * T * sizeof_dtype(X1.dtype)
                 wrlk.append(cur_out_gpu)
+                wrlk_gpu_info.append(g)
                 if is_sparse:
                     X1_block = X1.narrow_rows(block_sizes[i], bwidth)
                 else:
@@ -1111,18 +1544,26 @@ def fdmmv(
                             max_mem=g.usable_memory,
                             kwargs_m1=c_kwargs_m1,
                             kwargs_m2=kwargs_m2 or {},
+                            num_streams=opt.num_fmm_streams,
+                            autotune=opt.mmv_autotune,
+                            X1_dev=X1_dev,
+                            sliced_ell=is_sparse and opt.sparse_sliced_ell,
+                            comp_dt=reduced_mmv_dtype(kernel, X1, opt),
                         ),
                         g.Id,
                     )
                 )
             _start_wait_processes(dmmv_run_starter, args)
-            if len(wrlk) > 1:  # Sum up all subprocess outputs and copy to `out` on host.
-                # noinspection PyTypeChecker
-                fastest_device: int = np.argmax([d.speed for d in gpu_info])
-                copy(
-                    torch.cuda.comm.reduce_add(wrlk, destination=gpu_info[fastest_device].Id),
-                    out,
-                )
+            if len(wrlk) > 1:
+                # Sum up all subprocess outputs on the device which holds `out` (or on the fastest
+                # device if `out` is on the host, followed by a single copy to the host).
+                root = next((i for i, o in enumerate(wrlk) if o.data_ptr() == out.data_ptr()), None)
+                if root is None:
+                    # noinspection PyTypeChecker
+                    root = int(np.argmax([d.speed for d in wrlk_gpu_info]))
+                reduced = _reduce_partial_outputs(wrlk, root)
+                if reduced.data_ptr() != out.data_ptr():
+                    copy(reduced, out)
             else:
                 if wrlk[0].data_ptr() != out.data_ptr():
                     copy(wrlk[0], out)
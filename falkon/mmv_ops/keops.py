@@ -1,11 +1,12 @@
 import warnings
 from dataclasses import dataclass
-from typing import List, Optional
+from typing import List, Optional, Tuple
 
 import keopscore
 import torch
 from pykeops.torch import Genred
 
+from falkon.mmv_ops import keops_cache
 from falkon.mmv_ops.utils import _get_gpu_info, _start_wait_processes, create_output_mat
 from falkon.options import BaseOptions, FalkonOptions
 from falkon.utils import decide_cuda
@@ -23,6 +24,7 @@ class ArgsFmmv:
     gpu_ram: float
     backend: str
     function: callable
+    mem_coef: Optional[Tuple[float, float, float]] = None
 
 
 def _decide_backend(opt: BaseOptions, num_dim: int) -> str:
@@ -33,7 +35,7 @@ def _decide_backend(opt: BaseOptions, num_dim: int) -> str:
         return "GPU_1D"
 
 
-def _estimate_split(N, M, D, T, R, ds):
+def _estimate_split(N, M, D, T, R, ds, mem_coef=None):
     """Estimate the splits along dimensions N and M for a MVM to fit in memory
 
     The operations consist of computing the product between a kernel
@@ -41,9 +43,9 @@ def _estimate_split(N, M, D, T, R, ds):
     This typically requires storage of the input and output matrices,
     which occupies (M + N)*(D + T) memory locations plus some intermediate
     buffers to perform computations.
-    TODO: It is not clear how much intermediate memory KeOps requires;
-    the only thing that is certain is that it is quadratic in D.
-    For now we sidestep this issue by using a smaller R than what is
+    The intermediate memory used by KeOps is given by `mem_coef`, measured for
+    each formula (see :func:`falkon.mmv_ops.keops_cache.formula_memory`). If it is
+    not available, we sidestep the issue by using a smaller R than what is
     actually available in GPU memory.
 
     This function calculates the split along N and M into blocks of size n*m
@@ -65,6 +67,9 @@ def _estimate_split(N, M, D, T, R, ds):
      - ds : int
         The size in bytes of each element in the data matrices
         (e.g. 4 if the data is in single precision).
+     - mem_coef : (float, float, float) or None
+        The intermediate memory used by KeOps, as fixed bytes, bytes per row
+        of the first matrix and bytes per row of the second matrix.
 
     Returns
     --------
@@ -84,28 +89,28 @@ def _estimate_split(N, M, D, T, R, ds):
     Notes
     ------
     We find 'good' values of M, N such that
-    N*(D+T) + M*(D+T) <= R/ds
+    N*((D+T)*ds + per_n) + M*((D+T)*ds + per_m) <= R - fixed
     """
-    R = R / ds
-
-    # We have a linear equation in two variables (N, M)
-    slope = -1
-    intercept = R / (D + T)
+    fixed, per_n, per_m = (0.0, 0.0, 0.0) if mem_coef is None else mem_coef
+    R_avail = R - fixed
+    # Bytes per row of the two matrices
+    row_n = (D + T) * ds + per_n
+    row_m = (D + T) * ds + per_m
 
     slack_points = 10
     # We try to pick a point at the edges such that only one kind of split
     # is necessary
-    if N < intercept - 1:
-        M = min(M, intercept + slope * N)
-    elif M < intercept - 1:
-        N = min(N, intercept + slope * M)
+    if N * row_n < R_avail - row_m:
+        M = min(M, (R_avail - N * row_n) / row_m)
+    elif M * row_m < R_avail - row_n:
+        N = min(N, (R_avail - M * row_m) / row_n)
     else:
-        # All points on the slope such that N, M > 0 are possible
-        N = intercept - slack_points - 1
-        M = intercept + slope * N
+        # All points on the line such that N, M > 0 are possible
+        M = slack_points + 1
+        N = (R_avail - M * row_m) / row_n
 
     if N <= 0 or M <= 0:
-        raise RuntimeError("Insufficient available GPU memory (available %.2fGB)" % (R * ds / 2**30))
+        raise RuntimeError("Insufficient available GPU memory (available %.2fGB)" % (R / 2**30))
 
     return int(N), int(M)
 
@@ -127,7 +132,7 @@ def _single_gpu_method(proc_idx, queue, device_id):
     device = torch.device(f"cuda:{device_id}")
 
     # Second round of subdivision (only if necessary due to RAM constraints)
-    n, m = _estimate_split(N, M, D, T, R, sizeof_dtype(X1.dtype))
+    n, m = _estimate_split(N, M, D, T, R, sizeof_dtype(X1.dtype), a.mem_coef)
 
     other_vars_dev = [ov.to(device, copy=False) for ov in other_vars]
     out_ic = oout.device.index == device_id
@@ -191,6 +196,8 @@ def run_keops_mmv(
     differentiable = any([X1.requires_grad, X2.requires_grad, v.requires_grad] + [o.requires_grad for o in other_vars])
 
     comp_dev_type = backend[:3].lower().replace("gpu", "cuda")  # 'cpu' or 'cuda'
+    if opt.keops_cache_dir is not None:
+        keops_cache.use_cache_dir(opt.keops_cache_dir)
     keopscore.config.config.use_cuda = comp_dev_type == "cuda"  # workaround for keops issue#248
     out = create_output_mat(
         out,
@@ -226,8 +233,15 @@ def run_keops_mmv(
             sync_current_stream(device)
             out = fn(X1, X2, v, *other_vars, out=out, backend=backend)
     else:  # cpu data, gpu computations: out-of-core
-        # slack should be high due to imprecise memory usage estimates for keops
-        gpu_info = _get_gpu_info(opt, slack=opt.keops_memory_slack)
+        device = torch.device("cuda", torch.cuda.current_device())
+        mem_coef = keops_cache.formula_memory(
+            fn, formula, aliases, D, T, other_vars, X1.dtype, backend, device, opt, measure=opt.keops_measure_memory
+        )
+        if mem_coef is not None:
+            gpu_info = _get_gpu_info(opt)
+        else:
+            # slack should be high due to imprecise memory usage estimates for keops
+            gpu_info = _get_gpu_info(opt, slack=opt.keops_memory_slack)
         block_sizes = calc_gpu_block_sizes(gpu_info, N)
 
         args = []  # Arguments passed to each subprocess
@@ -247,6 +261,7 @@ def run_keops_mmv(
                         function=fn,
                         backend=backend,
                         gpu_ram=g.usable_memory,
+                        mem_coef=mem_coef,
                     ),
                     g.Id,
                 )
@@ -0,0 +1,256 @@
+"""Ahead-of-time compilation of KeOps formulas, and measured memory usage of the formulas.
+
+KeOps compiles each formula the first time it is called with a new data-type or new
+dimensions, which takes tens of seconds. :func:`warm_cache` compiles the formulas of the
+built-in kernels for a set of data-types, data dimensions (``D``) and numbers of output
+columns (``T``) into a cache directory. When the ``keops_cache_dir`` option points to that
+directory (for example after copying it into a container image), KeOps loads the compiled
+formulas instead of compiling them again. The compiled formulas are only valid for the same
+versions of KeOps, CUDA and the compiler they were built with.
+
+The cache directory also stores the memory which each formula uses on the GPU, on top of its
+inputs and output (see :func:`formula_memory`). The out-of-core KeOps kernel-vector products
+use it to size their blocks. Formulas which are not in the cache are measured the first time
+they are used only if the ``keops_measure_memory`` option is set, since measuring resets the
+peak memory statistics of the GPU.
+
+The cache can be created from the command line::
+
+    python -m falkon.mmv_ops.keops_cache --cache-dir /opt/keops-cache --dtypes float32 --dims 10 28 --outputs 1
+"""
+import argparse
+import dataclasses
+import json
+import logging
+import os
+import threading
+import time
+from typing import Dict, List, Optional, Sequence, Tuple
+
+import pykeops
+import torch
+
+from falkon.options import FalkonOptions
+from falkon.utils import decide_cuda
+
+__all__ = ("BUILTIN_KERNELS", "use_cache_dir", "formula_memory", "warm_cache")
+logger = logging.getLogger(__name__)
+
+_MEMORY_FILE = "falkon_keops_memory.json"
+# Number of rows of the smallest probe used to measure the memory of a formula.
+_PROBE_ROWS = 2048
+
+# Memory model (fixed bytes, bytes per row of X1, bytes per row of X2) of each formula.
+_memory: Dict[str, Tuple[float, float, float]] = {}
+_lock = threading.Lock()
+_cache_dir: Optional[str] = None
+
+
+def _builtin_kernel(name: str, sigma):
+    from falkon import kernels
+
+    if name == "gaussian":
+        return kernels.GaussianKernel(sigma)
+    if name == "laplacian":
+        return kernels.LaplacianKernel(sigma)
+    if name.startswith("matern-"):
+        return kernels.MaternKernel(sigma, nu=float(name[len("matern-") :]))
+    if name == "linear":
+        return kernels.LinearKernel(beta=1.0, gamma=1.0)
+    if name == "polynomial":
+        return kernels.PolynomialKernel(beta=1.0, gamma=1.0, degree=2.0)
+    raise ValueError(f"Unknown kernel {name!r}. Available kernels: {', '.join(BUILTIN_KERNELS)}.")
+
+
+BUILTIN_KERNELS = (
+    "gaussian",
+    "laplacian",
+    "matern-0.5",
+    "matern-1.5",
+    "matern-2.5",
+    "matern-inf",
+    "linear",
+    "polynomial",
+)
+
+
+def _formula_key(formula: str, aliases: List[str], dtype: torch.dtype, backend: str, opt: FalkonOptions) -> str:
+    # The dimensions of the variables are part of the aliases.
+    return "|".join([formula, ";".join(aliases), str(dtype), backend, opt.keops_acc_dtype, opt.keops_sum_scheme])
+
+
+def use_cache_dir(path: str):
+    """Make KeOps compile into (and load from) `path`, and load the formula memory stored there."""
+    global _cache_dir
+    path = os.path.abspath(path)
+    with _lock:
+        if path == _cache_dir:
+            return
+        os.makedirs(path, exist_ok=True)
+        pykeops.set_build_folder(path)
+        mem_file = os.path.join(path, _MEMORY_FILE)
+        if os.path.isfile(mem_file):
+            with open(mem_file, "r") as fh:
+                _memory.update({k: tuple(v) for k, v in json.load(fh).items()})
+        _cache_dir = path
+
+
+def _save_memory():
+    if _cache_dir is None:
+        return
+    mem_file = os.path.join(_cache_dir, _MEMORY_FILE)
+    tmp_file = f"{mem_file}.{os.getpid()}.tmp"
+    with open(tmp_file, "w") as fh:
+        json.dump(_memory, fh, indent=1)
+    os.replace(tmp_file, mem_file)
+
+
+def _measure(fn, D, T, other_vars, dtype, backend, device) -> Tuple[float, float, float]:
+    other_vars_dev = [ov.to(device) for ov in other_vars]
+    n0 = m0 = _PROBE_ROWS
+    peaks = []
+    with torch.cuda.device(device), torch.autograd.inference_mode():
+        for n, m in ((n0, m0), (2 * n0, m0), (n0, 2 * m0)):
+            X1 = torch.randn(n, D, dtype=dtype, device=device)
+            X2 = torch.randn(m, D, dtype=dtype, device=device)
+            v = torch.randn(m, T, dtype=dtype, device=device)
+            out = torch.empty(n, T, dtype=dtype, device=device)
+            torch.cuda.synchronize(device)
+            torch.cuda.reset_peak_memory_stats(device)
+            base = torch.cuda.memory_allocated(device)
+            fn(X1, X2, v, *other_vars_dev, out=out, device_id=device.index, backend=backend)
+            torch.cuda.synchronize(device)
+            peaks.append(max(0, torch.cuda.max_memory_allocated(device) - base))
+            del X1, X2, v, out
+    per_n = max(0.0, (peaks[1] - peaks[0]) / n0)
+    per_m = max(0.0, (peaks[2] - peaks[0]) / m0)
+    fixed = max(0.0, peaks[0] - per_n * n0 - per_m * m0)
+    return fixed, per_n, per_m
+
+
+def formula_memory(
+    fn,
+    formula: str,
+    aliases: List[str],
+    D: int,
+    T: int,
+    other_vars: List[torch.Tensor],
+    dtype: torch.dtype,
+    backend: str,
+    device: torch.device,
+    opt: FalkonOptions,
+    measure: bool = True,
+) -> Optional[Tuple[float, float, float]]:
+    """GPU memory used by the KeOps formula `fn`, on top of its inputs and output.
+
+    The memory is modelled as ``fixed + per_n * n + per_m * m`` bytes for a product between
+    ``n`` rows of ``X1`` and ``m`` rows of ``X2``. The coefficients are measured (on `device`)
+    from the peak memory of three small products, the first time a formula is used, and are
+    stored in the cache directory if ``keops_cache_dir`` is set. The KeOps 1D reduction scheme
+    only allocates a few pointers per call outside of PyTorch, so the peak memory of PyTorch
+    includes all sizeable allocations (such as contiguous copies of the inputs).
+    Measuring resets the peak memory statistics of `device`: if `measure` is False, only the
+    coefficients which were already measured (or loaded from the cache directory) are returned.
+
+    Returns
+    -------
+    fixed, per_n, per_m
+        The coefficients of the memory model, in bytes, or None if they are not known and
+        `measure` is False.
+    """
+    key = _formula_key(formula, aliases, dtype, backend, opt)
+    with _lock:
+        mem = _memory.get(key)
+        if mem is None and measure:
+            mem = _measure(fn, D, T, other_vars, dtype, backend, device)
+            _memory[key] = mem
+            _save_memory()
+    return mem
+
+
+def warm_cache(
+    cache_dir: str,
+    dtypes: Sequence[torch.dtype] = (torch.float32,),
+    dims: Sequence[int] = (10,),
+    outputs: Sequence[int] = (1,),
+    kernel_names: Sequence[str] = BUILTIN_KERNELS,
+    ard: bool = False,
+    opt: Optional[FalkonOptions] = None,
+) -> List[Tuple[str, torch.dtype, int, int, float]]:
+    """Compile the KeOps formulas of built-in kernels into `cache_dir`, and measure their memory.
+
+    A formula is compiled for each combination of kernel, data-type, dimension ``D`` and number of
+    output columns ``T``. The same formulas are used by the kernel-vector products ``mmv`` and
+    ``dmmv`` (the formulas for gradients with respect to the kernel parameters are not compiled).
+    If a GPU is used (according to `opt`), the GPU formulas are compiled, otherwise the CPU ones.
+
+    Parameters
+    ----------
+    cache_dir
+        The cache directory. Set the ``keops_cache_dir`` option to this directory to use the cache.
+    dtypes
+        Data-types of the data
+    dims
+        Dimensions of the data
+    outputs
+        Numbers of columns of the vectors multiplied by the kernel (e.g. the number of classes)
+    kernel_names
+        Names of the kernels, a subset of :data:`BUILTIN_KERNELS`
+    ard
+        Whether the length-scales of the distance kernels are vectors (one length-scale per
+        dimension) instead of scalars. The two variants need different formulas.
+    opt
+        Additional options (e.g. ``keops_acc_dtype``, which changes the formulas)
+
+    Returns
+    -------
+    compiled
+        The kernel name, data-type, ``D``, ``T`` and time taken by each combination.
+    """
+    if opt is None:
+        opt = FalkonOptions()
+    opt = dataclasses.replace(opt, keops_active="force", keops_cache_dir=cache_dir, keops_measure_memory=True)
+    use_cuda = decide_cuda(opt)
+    compiled = []
+    for name in kernel_names:
+        for dtype in dtypes:
+            for D in dims:
+                sigma = torch.ones(D, dtype=dtype) if ard else 1.0
+                kernel = _builtin_kernel(name, sigma)
+                for T in outputs:
+                    t_s = time.time()
+                    # With CPU inputs and a GPU backend, the out-of-core path also measures the memory.
+                    X1 = torch.randn(_PROBE_ROWS, D, dtype=dtype)
+                    X2 = torch.randn(_PROBE_ROWS, D, dtype=dtype)
+                    v = torch.randn(_PROBE_ROWS, T, dtype=dtype)
+                    kernel.keops_mmv_impl(X1, X2, v, kernel, None, opt, None, None)
+                    elapsed = time.time() - t_s
+                    logger.info(
+                        f"Compiled {'GPU' if use_cuda else 'CPU'} formula of {name} kernel "
+                        f"(dtype={dtype}, D={D}, T={T}) in {elapsed:.2f}s"
+                    )
+                    compiled.append((name, dtype, D, T, elapsed))
+    return compiled
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    p = argparse.ArgumentParser(description="Compile the KeOps formulas of the Falkon kernels ahead of time")
+    p.add_argument("--cache-dir", type=str, required=True, help="Directory of the compiled formulas")
+    p.add_argument("--dtypes", type=str, nargs="+", default=["float32"], choices=["float32", "float64"])
+    p.add_argument("--dims", type=int, nargs="+", required=True, help="Dimensions of the data")
+    p.add_argument("--outputs", type=int, nargs="+", default=[1], help="Numbers of output columns")
+    p.add_argument("--kernels", type=str, nargs="+", default=list(BUILTIN_KERNELS), choices=BUILTIN_KERNELS)
+    p.add_argument("--ard", action="store_true", help="Use one length-scale per dimension")
+    p.add_argument("--cpu", action="store_true", help="Compile the CPU formulas")
+    args = p.parse_args()
+
+    warm_cache(
+        cache_dir=args.cache_dir,
+        dtypes=[getattr(torch, dt) for dt in args.dtypes],
+        dims=args.dims,
+        outputs=args.outputs,
+        kernel_names=args.kernels,
+        ard=args.ard,
+        opt=FalkonOptions(use_cpu=args.cpu),
+    )
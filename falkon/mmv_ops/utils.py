@@ -42,6 +42,9 @@ def _check_contiguity(*args: Tuple[Optional[torch.Tensor], str]) -> None:
 # Recently? Pytorch addmm and similar (baddbmm) require 8 extra megs of device memory.
 # This *could* be related to a switch to using cublasLt, but more investigation is needed.
 CUDA_EXTRA_MM_RAM = 8519680
+# Single precision buffer in which the squared distances of reduced precision kernel tiles are
+# computed, a block of rows at a time (see `falkon.kernels.distance_kernel`).
+REDUCED_DIST_BUF_BYTES = 32 * 2**20
 
 
 def _get_gpu_info(opt: BaseOptions, slack: float = 0.9) -> List[DeviceInfo]:
@@ -1,9 +1,12 @@
 from .falkon import Falkon
 from .incore_falkon import InCoreFalkon
 from .logistic_falkon import LogisticFalkon
+from .predictor import PredictionServer, Predictor
 
 __all__ = (
     "Falkon",
     "LogisticFalkon",
     "InCoreFalkon",
+    "Predictor",
+    "PredictionServer",
 )
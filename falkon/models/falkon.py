@@ -1,19 +1,22 @@
+import copy
 import dataclasses
 import time
 import logging
 import warnings
-from typing import Callable, Optional, Tuple, Union, Any
+from typing import Callable, Iterable, Optional, Tuple, Union, Any
 
 import torch
 from torch import Tensor
 
 import falkon
 from falkon.models.model_utils import FalkonBase
+from falkon.models.streaming import KnmStatistics
 from falkon.options import FalkonOptions
 from falkon.preconditioner import FalkonPreconditioner
 from falkon.sparse import SparseTensor
-from falkon.utils import TicToc
+from falkon.utils import TicToc, distributed
 from falkon.utils.devices import get_device_info
+from falkon.utils.memmap import is_file_backed
 
 __all__ = ("Falkon",)
 logger = logging.getLogger(__name__)
@@ -109,6 +112,13 @@ class Falkon(FalkonBase):
     >>> model.fit(X, Y)
     >>> model.fit(X, Y, warm_start=model.beta_)
 
+    Distributed fit: each process of an initialized ``torch.distributed`` group passes its own
+    shard of the data (here `X_shard`, `Y_shard`) and obtains the same model.
+
+    >>> options = FalkonOptions(distributed=True)
+    >>> model = Falkon(kernel=kernel, penalty=1e-6, M=500, options=options)
+    >>> model.fit(X_shard, Y_shard)
+
     References
     ----------
      - Alessandro Rudi, Luigi Carratino, Lorenzo Rosasco, "FALKON: An optimal large
@@ -159,24 +169,34 @@ class Falkon(FalkonBase):
             if pc_opt.debug:
                 logger.info("Preconditioner will run on %s" % ("CPU" if pc_opt.use_cpu else ("%d GPUs" % self.num_gpus)))
             pc = FalkonPreconditioner(self.penalty, self.kernel, pc_opt)
+            if self.options.distributed and distributed.get_rank() != 0:
+                # The preconditioner is received from rank 0 (whose shard contains the centers).
+                # All ranks have the same `weight_fn`, so rank 0 weighted it iff it is set.
+                pc._weighted = self.weight_fn is not None
+                return distributed.broadcast_attrs(pc, ("fC", "dT", "dA")).to(ny_points.device)
             ny_weight_vec = None
             if self.weight_fn is not None:
                 assert ny_indices is not None
                 ny_weight_vec = self.weight_fn(Y[ny_indices], X[ny_indices], ny_indices)
             pc.init(ny_points, weight_vec=ny_weight_vec)
+            if self.options.distributed:
+                distributed.broadcast_attrs(pc, ("fC", "dT", "dA"))
         return pc
 
     def init_kernel_matrix(self, X: Tensor, ny_pts: Tensor) -> falkon.kernels.Kernel:
         """
         Decide whether to store the full kernel. If dimensions are such that it is convenient
         to precompute it, it is saved in a :class:`PrecomputedKernel` which is used for
-        subsequent computations. Otherwise return the original kernel..
+        subsequent computations. With the ``knm_cache`` option it is instead cached in tiles
+        by a :class:`TieredKnmKernel`. Otherwise return the original kernel..
         """
         k_opt = dataclasses.replace(self.options, use_cpu=True)
         cpu_info = get_device_info(k_opt)
         available_ram = min(k_opt.max_cpu_mem, cpu_info[-1].free_memory) * 0.9
         kernel = self.kernel
-        if self._can_store_knm(X, ny_pts, available_ram):
+        if self._use_knm_cache(X):
+            kernel = self._tiered_knm_kernel(X, ny_pts, available_ram)
+        elif self._can_store_knm(X, ny_pts, available_ram):
             Knm = self.kernel(X, ny_pts, opt=self.options)
             kernel = falkon.kernels.PrecomputedKernel(Knm, opt=self.options)
         return kernel
@@ -218,7 +238,9 @@ class Falkon(FalkonBase):
         X : torch.Tensor
             The tensor of training data, of shape [num_samples, num_dimensions].
             If X is in Fortran order (i.e. column-contiguous) then we can avoid
-            an extra copy of the data.
+            an extra copy of the data. X may also be memory-mapped from a file
+            (see :func:`falkon.utils.memmap.load_memmap`), in which case it is
+            read from the file one block at a time.
         Y : torch.Tensor
             The tensor of training targets, of shape [num_samples, num_outputs].
             If X and Y represent a classification problem, Y can be encoded as a one-hot
@@ -253,15 +275,25 @@ class Falkon(FalkonBase):
         """
         X, Y, Xts, Yts = self._check_fit_inputs(X, Y, Xts, Yts)
         self._reset_state()
+        if self.options.distributed:
+            distributed.check_distributed()
+            if isinstance(X, SparseTensor):
+                raise NotImplementedError("Distributed fitting is only implemented for dense data.")
 
         # Start training timer
         t_s = time.time()
 
         with torch.autograd.inference_mode():
-            if self.weight_fn is None:  # don't need indices.
+            if self.options.distributed and distributed.get_rank() != 0:
+                # The centers are selected from the shard of rank 0 only.
+                ny_points, ny_indices = None, None
+            elif self.weight_fn is None:  # don't need indices.
                 ny_points, ny_indices = self.center_selection.select(X, None), None
             else:
                 ny_points, ny_indices = self.center_selection.select_indices(X, None)
+            if self.options.distributed:
+                # All processes use the centers selected from the shard of rank 0.
+                ny_points = distributed.broadcast_tensor(ny_points).to(X.device)
             num_centers = ny_points.shape[0]
 
             # Decide whether to use CUDA for preconditioning and iterations
@@ -270,34 +302,220 @@ class Falkon(FalkonBase):
                 and (not self.options.cpu_preconditioner)
                 and num_centers >= get_min_cuda_preconditioner_size(X.dtype, self.options)
             )
-            tot_mmv_mem_usage = X.shape[0] * X.shape[1] * num_centers
-            _use_cuda_mmv = self.use_cuda_ and tot_mmv_mem_usage / self.num_gpus >= get_min_cuda_mmv_size(
-                X.dtype, self.options
-            )
-
             if self.use_cuda_:
                 ny_points = ny_points.pin_memory()
 
             self.precond = self.init_pc(ny_points, _use_cuda_preconditioner, X, Y, ny_indices)
+            self._fit_with_pc(X, Y, Xts, Yts, ny_points, warm_start, t_s)
+        return self
 
-            if _use_cuda_mmv:
-                # Cache must be emptied to ensure enough memory is visible to the optimizer
-                torch.cuda.empty_cache()
-                X = X.pin_memory()
+    def partial_fit(
+        self,
+        X: torch.Tensor,
+        Y: torch.Tensor,
+        Xts: Optional[torch.Tensor] = None,
+        Yts: Optional[torch.Tensor] = None,
+        add_centers: Optional[torch.Tensor] = None,
+        remove_centers: Optional[torch.Tensor] = None,
+    ):
+        """Refit an already fitted model on new data, reusing its preconditioner and solution.
 
-            calc_kernel = self.init_kernel_matrix(X, ny_points)
-            self.fit_times_.append(time.time() - t_s)  # Preparation time
+        This is useful when the training data changes a little (e.g. new samples arrive), or
+        when only the penalty changes. The Nystrom centers of the previous fit are kept (unless
+        `add_centers` or `remove_centers` are specified), so the preconditioner factor `T` is
+        reused: it is not recomputed at all if the penalty is unchanged, and otherwise only the
+        second factor is (see :meth:`falkon.preconditioner.FalkonPreconditioner.update`). A few
+        centers can be added or removed with a low-rank update of `T`. The conjugate gradient
+        optimizer starts from the previous solution (mapped to the updated preconditioner), so
+        it typically needs fewer iterations than a fit from scratch.
+
+        If the model has not been fitted yet, this is equivalent to :meth:`fit`. As with :meth:`fit`,
+        `fit_times_` and `val_errors_` are reset, and only describe the last (partial) fit.
+
+        Parameters
+        -----------
+        X : torch.Tensor
+            The tensor of training data, of shape [num_samples, num_dimensions].
+        Y : torch.Tensor
+            The tensor of training targets, of shape [num_samples, num_outputs].
+        Xts : torch.Tensor or None
+            Tensor of validation data, of shape [num_test_samples, num_dimensions].
+        Yts : torch.Tensor or None
+            Tensor of validation targets, of shape [num_test_samples, num_outputs].
+        add_centers : torch.Tensor or None
+            Dense tensor of shape [num_new_centers, num_dimensions], with Nystrom centers which are
+            appended to the current ones.
+        remove_centers : torch.Tensor or None
+            Indices of the current Nystrom centers which are removed (before adding `add_centers`).
 
-            # Define the callback function which runs after each CG iteration. Optionally computes
-            # and displays the validation error.
-            validation_cback = None
-            if self.error_fn is not None and self.error_every is not None:
-                validation_cback = self._get_callback_fn(X, Y, Xts, Yts, ny_points, self.precond)
+        Returns
+        --------
+        model: Falkon
+            The fitted model
+        """
+        if self.precond is None or self.alpha_ is None:
+            if add_centers is not None or remove_centers is not None:
+                raise RuntimeError("Centers can only be added to or removed from a fitted model.")
+            return self.fit(X, Y, Xts, Yts)
+        if self.weight_fn is not None:
+            raise NotImplementedError("partial_fit is not implemented for weighted models.")
+        if self.options.distributed:
+            raise NotImplementedError("partial_fit is not implemented for distributed models.")
+        X, Y, Xts, Yts = self._check_fit_inputs(X, Y, Xts, Yts)
+        # The timings and validation errors describe this fit only, as after `fit`.
+        self.fit_times_, self.val_errors_ = [], []
+        t_s = time.time()
 
-            alpha, beta = self.run_solver(_use_cuda_mmv, calc_kernel, X, Y, ny_points, warm_start, validation_cback)
-            self.alpha_, self.beta_, self.ny_points_ = alpha, beta, ny_points
+        with torch.autograd.inference_mode():
+            ny_points, alpha = self.ny_points_, self.alpha_
+            if remove_centers is not None:
+                if isinstance(ny_points, SparseTensor):
+                    raise NotImplementedError("Centers can only be removed from models with dense centers.")
+                keep = torch.ones(ny_points.shape[0], dtype=torch.bool)
+                keep[remove_centers.cpu()] = False
+                ny_points, alpha = ny_points[keep.to(ny_points.device)], alpha[keep.to(alpha.device)]
+            if add_centers is not None:
+                if isinstance(ny_points, SparseTensor) or isinstance(add_centers, SparseTensor):
+                    raise NotImplementedError("Centers can only be added to models with dense centers.")
+                add_centers = add_centers.to(dtype=ny_points.dtype, device=ny_points.device)
+                ny_points = torch.cat((ny_points, add_centers), dim=0)
+                alpha = torch.cat((alpha, alpha.new_zeros(add_centers.shape[0], alpha.shape[1])), dim=0)
+            if self.use_cuda_ and (remove_centers is not None or add_centers is not None):
+                ny_points = ny_points.pin_memory()
+
+            penalty = self.penalty if self.penalty != self.precond._lambda else None
+            if penalty is not None or remove_centers is not None or add_centers is not None:
+                with TicToc("Updating preconditioner", debug=self.options.debug):
+                    self.precond.update(
+                        penalty=penalty, centers=self.ny_points_, new_centers=add_centers, remove_idx=remove_centers
+                    )
+
+            warm_start = None
+            if alpha.shape[1] == Y.shape[1]:
+                warm_start = self.precond.apply_inverse(alpha).to(self.beta_.device)
+            self._fit_with_pc(X, Y, Xts, Yts, ny_points, warm_start, t_s)
         return self
 
+    def fit_stream(
+        self,
+        chunks: Iterable[Tuple[torch.Tensor, torch.Tensor]],
+        centers: Optional[torch.Tensor] = None,
+        warm_start: Optional[torch.Tensor] = None,
+        tile_rows: Optional[int] = None,
+    ):
+        """Fits the Falkon KRR model on a stream of data chunks, with a single pass over the data.
+
+        The conjugate gradient iterations of :meth:`fit` need a pass over the whole training set
+        each. Instead, this method accumulates the sufficient statistics
+        :math:`K_{nm}^\\top K_{nm}` and :math:`K_{nm}^\\top Y` over the chunks (see
+        :class:`falkon.models.streaming.KnmStatistics`), and then solves the preconditioned problem
+        using only these (M x M) and (M x t) matrices. The data is never stored, so the stream
+        may be larger than the available memory or storage, but an additional
+        (M x M) matrix must fit in memory (on the GPU if CUDA is used). With CUDA, the iterations
+        also run on the GPU, with a device copy of the preconditioner.
+
+        Parameters
+        -----------
+        chunks
+            An iterable of ``(X, Y)`` tuples of dense tensors, where `X` has shape
+            [chunk_size, num_dimensions] and `Y` has shape [chunk_size, num_outputs].
+            It is consumed once.
+        centers : torch.Tensor or None
+            The Nystrom centers. If None, they are selected from the first chunk with the
+            center selection strategy of the model.
+        warm_start : torch.Tensor or None
+            Starting point for the conjugate gradient optimizer, in the preconditioner space
+            (see :meth:`fit`).
+        tile_rows : int or None
+            Maximum number of rows for which the kernel is computed at once (see
+            :class:`falkon.models.streaming.KnmStatistics`).
+
+        Returns
+        --------
+        model: Falkon
+            The fitted model
+        """
+        if self.weight_fn is not None:
+            raise NotImplementedError("fit_stream is not implemented for weighted models.")
+        if self.options.distributed:
+            raise NotImplementedError("fit_stream is not implemented for distributed models.")
+        self._reset_state()
+        t_s = time.time()
+
+        with torch.autograd.inference_mode():
+            chunks = iter(chunks)
+            first_chunk = next(chunks, None)
+            if first_chunk is None:
+                raise ValueError("The stream of data chunks is empty.")
+            X, Y, _, _ = self._check_fit_inputs(first_chunk[0], first_chunk[1], None, None)
+            ny_points = self.center_selection.select(X, None) if centers is None else centers
+            if isinstance(X, SparseTensor) or isinstance(ny_points, SparseTensor):
+                raise NotImplementedError("fit_stream is only implemented for dense data.")
+            ny_points = ny_points.to(dtype=X.dtype)
+            _use_cuda_preconditioner = (
+                self.use_cuda_
+                and (not self.options.cpu_preconditioner)
+                and ny_points.shape[0] >= get_min_cuda_preconditioner_size(X.dtype, self.options)
+            )
+            if self.use_cuda_:
+                ny_points = ny_points.pin_memory()
+            self.precond = self.init_pc(ny_points, _use_cuda_preconditioner, X, Y)
+
+            with TicToc("Accumulating sufficient statistics", debug=self.options.debug):
+                stats_dev = torch.device("cuda", torch.cuda.current_device()) if self.use_cuda_ else "cpu"
+                stats = KnmStatistics(
+                    self.kernel, ny_points, Y.shape[1], stats_dev, tile_rows=tile_rows, opt=self.options
+                )
+                stats.update(X, Y)
+                del X, Y, first_chunk
+                for X, Y in chunks:
+                    X, Y, _, _ = self._check_fit_inputs(X, Y, None, None)
+                    stats.update(X, Y)
+                KtK, KtY = stats.finalize()
+                num_rows = stats.num_rows
+                del stats
+            self.fit_times_.append(time.time() - t_s)  # Preparation time
+
+            with TicToc("Computing Falkon iterations", debug=self.options.debug):
+                # The iterations run where the statistics were accumulated. The preconditioner
+                # computed on the GPU is kept in (pinned) host memory, so a device copy is used.
+                pc_dev = self.precond.fC.device
+                solve_pc = copy.copy(self.precond).to(KtK.device)
+                if warm_start is not None:
+                    warm_start = warm_start.to(KtK.device)
+                optim = falkon.optim.FalkonConjugateGradient(self.kernel, solve_pc, self.options)
+                beta = optim.solve_stats(KtK, KtY, num_rows, self.penalty, warm_start, self.maxiter)
+                alpha = solve_pc.apply(beta)
+                del solve_pc, KtK, KtY
+            self.alpha_, self.beta_, self.ny_points_ = alpha.to(pc_dev), beta.to(pc_dev), ny_points
+        return self
+
+    def _fit_with_pc(self, X, Y, Xts, Yts, ny_points, warm_start, t_s):
+        """Run the optimizer with the current preconditioner, and store the fitted coefficients."""
+        num_centers = ny_points.shape[0]
+        tot_mmv_mem_usage = X.shape[0] * X.shape[1] * num_centers
+        _use_cuda_mmv = self.use_cuda_ and tot_mmv_mem_usage / self.num_gpus >= get_min_cuda_mmv_size(
+            X.dtype, self.options
+        )
+        if _use_cuda_mmv:
+            # Cache must be emptied to ensure enough memory is visible to the optimizer
+            torch.cuda.empty_cache()
+            # Memory-mapped data is streamed from the file (pinning would load all of it in RAM).
+            if not is_file_backed(X):
+                X = X.pin_memory()
+
+        calc_kernel = self.init_kernel_matrix(X, ny_points)
+        self.fit_times_.append(time.time() - t_s)  # Preparation time
+
+        # Define the callback function which runs after each CG iteration. Optionally computes
+        # and displays the validation error.
+        validation_cback = None
+        if self.error_fn is not None and self.error_every is not None:
+            validation_cback = self._get_callback_fn(X, Y, Xts, Yts, ny_points, self.precond)
+
+        alpha, beta = self.run_solver(_use_cuda_mmv, calc_kernel, X, Y, ny_points, warm_start, validation_cback)
+        self.alpha_, self.beta_, self.ny_points_ = alpha, beta, ny_points
+
     def _predict(self, X, ny_points, alpha: torch.Tensor) -> torch.Tensor:
         with torch.autograd.inference_mode():
             if ny_points is None:
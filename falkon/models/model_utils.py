@@ -192,6 +192,41 @@ class FalkonBase(base.BaseEstimator, ABC):
         else:
             return False
 
+    def _use_knm_cache(self, X) -> bool:
+        return self.options.knm_cache and not self.options.never_store_kernel and isinstance(X, torch.Tensor)
+
+    def _tiered_knm_kernel(self, X, ny_points, available_ram) -> "falkon.kernels.TieredKnmKernel":
+        """Compute the k_NM kernel in tiles, cached on the GPU, in RAM and on disk (see the ``knm_cache`` option).
+
+        The tiles (of about 256MB each) are stored on the GPU on which the solver runs when CUDA is
+        used: the device of `X` if it is on a GPU, and otherwise the GPU with the most free memory.
+        At most half of its free memory is used, so that the kernel-vector products on the tiles
+        which must be recomputed still have room.
+        """
+        device, gpu_mem = torch.device("cpu"), 0
+        if self.use_cuda_ and not self.options.use_cpu:
+            gpu_info = {k: v for k, v in devices.get_device_info(self.options).items() if k >= 0}
+            if X.is_cuda:
+                dev_id = X.device.index if X.device.index is not None else torch.cuda.current_device()
+            else:
+                dev_id = max(gpu_info, key=lambda k: gpu_info[k].free_memory)
+            device = torch.device("cuda", dev_id)
+            gpu_mem = min(self.options.max_gpu_mem, gpu_info[dev_id].free_memory) * 0.5
+        row_bytes = ny_points.shape[0] * sizeof_dtype(X.dtype)
+        tile_rows = max(1, min(X.shape[0], 2**28 // row_bytes))
+        return falkon.kernels.TieredKnmKernel(
+            self.kernel,
+            X,
+            ny_points,
+            tile_rows=tile_rows,
+            device=device,
+            gpu_mem=gpu_mem,
+            cpu_mem=available_ram,
+            cache_dir=self.options.knm_cache_dir,
+            disk_bandwidth=self.options.knm_cache_disk_bandwidth,
+            opt=self.options,
+        )
+
     @abstractmethod
     def fit(
         self, X: torch.Tensor, Y: torch.Tensor, Xts: Optional[torch.Tensor] = None, Yts: Optional[torch.Tensor] = None
@@ -224,6 +259,36 @@ class FalkonBase(base.BaseEstimator, ABC):
 
         return self._predict(X, self.ny_points_, self.alpha_)
 
+    def predictor(
+        self, device: Union[str, torch.device, None] = None, max_batch_size: int = 64, cuda_graph: bool = False
+    ) -> "falkon.models.predictor.Predictor":
+        """Create a :class:`~falkon.models.predictor.Predictor` for low-latency predictions.
+
+        Parameters
+        -----------
+        device
+            The device on which predictions will run. Defaults to the device of the model's
+            coefficients.
+        max_batch_size
+            The maximum number of rows predicted at once.
+        cuda_graph
+            Whether each batch should be computed by replaying a CUDA graph.
+
+        Returns
+        --------
+        predictor : Predictor
+            The predictor, which holds a copy of the centers and coefficients of this model.
+        """
+        from falkon.models.predictor import Predictor
+
+        if self.alpha_ is None or self.ny_points_ is None:
+            raise RuntimeError("A predictor can only be created from a fitted model.")
+        if device is None:
+            device = self.alpha_.device
+        return Predictor(
+            self.kernel, self.ny_points_, self.alpha_, device, max_batch_size=max_batch_size, cuda_graph=cuda_graph
+        )
+
     def __repr__(self, **kwargs):
         return super().__repr__(N_CHAR_MAX=5000)
 
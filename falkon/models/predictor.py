@@ -0,0 +1,272 @@
+import copy
+import itertools
+import logging
+import threading
+from concurrent.futures import Future
+from typing import Callable, Dict, Optional, Union
+
+import torch
+
+import falkon
+from falkon import c_ext
+from falkon.kernels.distance_kernel import FUSED_MAX_D
+from falkon.la_helpers import square_norm
+from falkon.sparse import SparseTensor
+
+__all__ = ("Predictor", "PredictionServer")
+logger = logging.getLogger(__name__)
+
+
+class Predictor:
+    """Low-latency predictions with a fitted model, for small batches of data.
+
+    :meth:`falkon.models.Falkon.predict` goes through the generic kernel-vector product, which
+    decides how to split the computation, which devices to use and allocates its buffers at every
+    call. For batches of a few rows this overhead dominates the actual computation. A predictor
+    instead keeps the Nystrom centers and the coefficients on a single device, together with all
+    the buffers it needs for batches of up to `max_batch_size` rows, and computes predictions by
+    calling the kernel directly.
+
+    For distance kernels which support fused kernel-vector products (see
+    :meth:`~falkon.kernels.Kernel.fused_mmv_type`), the centers are stored already divided by the
+    kernel length-scale together with their squared norms, and a batch is predicted with a single
+    call to the fused kernel-vector op (on CUDA devices, only for data with at most
+    :data:`~falkon.kernels.distance_kernel.FUSED_MAX_D` dimensions). Other kernels compute the
+    small kernel block into a preallocated buffer, followed by a matrix multiplication.
+
+    On CUDA devices the whole batch computation can optionally be captured in a CUDA graph (with
+    ``cuda_graph=True``), which is replayed for every batch. Batches smaller than `max_batch_size`
+    are zero-padded to the captured size.
+
+    Predictors should be created with :meth:`falkon.models.model_utils.FalkonBase.predictor`.
+
+    Parameters
+    ----------
+    kernel
+        The kernel of the fitted model.
+    centers
+        The (M x D) Nystrom centers of the fitted model. Must be a dense tensor.
+    alpha
+        The (M x T) coefficients of the fitted model.
+    device
+        The device on which predictions are computed. Inputs on other devices are copied to it,
+        and the returned predictions are also on this device.
+    max_batch_size
+        Maximum number of rows which are predicted at once. Larger inputs are split in batches.
+    cuda_graph
+        Whether to capture the computation in a CUDA graph. Only valid for CUDA devices.
+
+    Examples
+    --------
+    >>> model = Falkon(kernel=kernel, penalty=1e-6, M=500).fit(X, Y)
+    >>> predictor = model.predictor(device="cuda:0", max_batch_size=64, cuda_graph=True)
+    >>> preds = predictor(X_new)
+    """
+
+    def __init__(
+        self,
+        kernel: falkon.kernels.Kernel,
+        centers: torch.Tensor,
+        alpha: torch.Tensor,
+        device: Union[str, torch.device],
+        max_batch_size: int = 64,
+        cuda_graph: bool = False,
+    ):
+        if isinstance(centers, SparseTensor) or centers.is_sparse:
+            raise NotImplementedError("Predictors are only implemented for dense Nystrom centers.")
+        if max_batch_size <= 0:
+            raise ValueError(f"max_batch_size must be positive, but is {max_batch_size}.")
+        self.device = torch.device(device)
+        if cuda_graph and self.device.type != "cuda":
+            raise ValueError("CUDA graphs can only be used on CUDA devices.")
+        self.kernel = kernel
+        self.max_batch_size = max_batch_size
+        self.cuda_graph = cuda_graph
+        self.dtype = alpha.dtype
+
+        self.centers = centers.to(device=self.device, dtype=self.dtype).contiguous()
+        self.alpha = alpha.to(device=self.device).contiguous()
+        num_centers, dim = self.centers.shape
+        num_out = self.alpha.shape[1]
+
+        self.fused_type: Optional[int] = None
+        # The CUDA fused op is only faster than the generic path in low dimensions (see `_can_fuse`).
+        if hasattr(kernel, "sigma") and (self.device.type != "cuda" or dim <= FUSED_MAX_D):
+            self.fused_type = kernel.fused_mmv_type()
+        if self.fused_type is not None:
+            self.sigma = kernel.sigma.to(device=self.device, dtype=self.dtype)
+            self.centers = self.centers / self.sigma
+            self.centers_norm = square_norm(self.centers, -1, False)
+            self.batch_norm = torch.empty(max_batch_size, dtype=self.dtype, device=self.device)
+            self.kernel_buf = None
+        else:
+            # The hyperparameters are moved to the device once: they cannot be copied from the host
+            # while a CUDA graph is being captured.
+            self.device_kernel = copy.deepcopy(kernel).to(device=self.device, dtype=self.dtype)
+            self.kernel_buf = torch.empty(max_batch_size, num_centers, dtype=self.dtype, device=self.device)
+        self.batch_buf = torch.zeros(max_batch_size, dim, dtype=self.dtype, device=self.device)
+        self.out_buf = torch.empty(max_batch_size, num_out, dtype=self.dtype, device=self.device)
+        self._graph: Optional[torch.cuda.CUDAGraph] = None
+
+    def _compute(self, n: int) -> torch.Tensor:
+        """Predictions for the first `n` rows of the batch buffer, written into the output buffer."""
+        X, out = self.batch_buf[:n], self.out_buf[:n]
+        with torch.inference_mode():
+            if self.fused_type is not None:
+                torch.sum(X.square(), dim=1, out=self.batch_norm[:n])
+                out.fill_(0.0)
+                return c_ext.fused_distance_mmv(
+                    X, self.centers, self.alpha, self.batch_norm[:n], self.centers_norm, self.fused_type, out
+                )
+            ker = self.device_kernel.compute(X, self.centers, self.kernel_buf[:n], diag=False)
+            return torch.mm(ker, self.alpha, out=out)
+
+    def _capture(self):
+        stream = torch.cuda.Stream(self.device)
+        stream.wait_stream(torch.cuda.current_stream(self.device))
+        with torch.cuda.stream(stream):
+            # Warm-up outside of the graph (e.g. for lazy library initialization)
+            self._compute(self.max_batch_size)
+        torch.cuda.current_stream(self.device).wait_stream(stream)
+        self._graph = torch.cuda.CUDAGraph()
+        with torch.cuda.graph(self._graph):
+            self._compute(self.max_batch_size)
+
+    def _load_batch(self, X: torch.Tensor):
+        n = X.shape[0]
+        if self.fused_type is not None:
+            torch.div(X, self.sigma, out=self.batch_buf[:n])
+        else:
+            self.batch_buf[:n].copy_(X)
+        if self.cuda_graph and n < self.max_batch_size:
+            self.batch_buf[n:].fill_(0.0)
+
+    def predict(self, X: torch.Tensor) -> torch.Tensor:
+        """Predictions of the model on the (N x D) data `X`.
+
+        The returned (N x T) tensor is on the predictor's device. When `N` is at most
+        `max_batch_size` the predictions are computed in a single batch.
+        """
+        if X.dim() != 2 or X.shape[1] != self.batch_buf.shape[1]:
+            raise ValueError(f"Data must be a 2D tensor with {self.batch_buf.shape[1]} columns, found {X.shape}.")
+        with torch.inference_mode():
+            X = X.to(device=self.device, dtype=self.dtype, non_blocking=True)
+            out = torch.empty(X.shape[0], self.out_buf.shape[1], dtype=self.dtype, device=self.device)
+            for i in range(0, X.shape[0], self.max_batch_size):
+                n = min(self.max_batch_size, X.shape[0] - i)
+                self._load_batch(X[i : i + n])
+                if self.cuda_graph:
+                    if self._graph is None:
+                        self._capture()
+                    self._graph.replay()
+                else:
+                    self._compute(n)
+                out[i : i + n].copy_(self.out_buf[:n])
+            return out
+
+    __call__ = predict
+
+    def __str__(self):
+        return (
+            f"Predictor(kernel={self.kernel}, num_centers={self.centers.shape[0]}, device={self.device}, "
+            f"max_batch_size={self.max_batch_size}, cuda_graph={self.cuda_graph})"
+        )
+
+
+class PredictionServer:
+    """Batch many small concurrent prediction requests into few large predictions.
+
+    Callers :meth:`submit` their rows from any number of threads, and immediately get a future
+    for the predictions. The requests go through a lock-free multi-producer queue (implemented in
+    the C++ extension) to a single dispatcher thread. The dispatcher waits for the first request,
+    collects further requests until either `max_batch_size` rows are ready or `max_delay_ms`
+    milliseconds have passed, computes all their predictions with one call to `predictor`, and
+    completes the futures.
+
+    The latency of a request is thus bounded by `max_delay_ms` plus the time of one batched
+    prediction, while under high load the predictions run in full batches.
+
+    Parameters
+    ----------
+    predictor
+        The function used to compute predictions, typically a :class:`Predictor`.
+    max_batch_size
+        Maximum number of rows in a batch (a single request with more rows is predicted on its
+        own). Defaults to the `max_batch_size` of `predictor`.
+    max_delay_ms
+        Maximum time the first request of a batch waits for other requests.
+
+    Examples
+    --------
+    >>> with PredictionServer(model.predictor(device="cuda:0"), max_delay_ms=0.5) as server:
+    ...     future = server.submit(x)  # From any thread
+    ...     pred = future.result()
+    """
+
+    _poll_ms = 100.0
+
+    def __init__(
+        self,
+        predictor: Callable[[torch.Tensor], torch.Tensor],
+        max_batch_size: Optional[int] = None,
+        max_delay_ms: float = 1.0,
+    ):
+        if max_batch_size is None:
+            max_batch_size = getattr(predictor, "max_batch_size", None)
+            if max_batch_size is None:
+                raise ValueError("max_batch_size must be specified for predictors which do not define it.")
+        self.predictor = predictor
+        self.max_batch_size = max_batch_size
+        self.max_delay_ms = max_delay_ms
+
+        self._queue = c_ext.request_queue()
+        self._ids = itertools.count()
+        self._futures: Dict[int, Future] = {}
+        self._thread = threading.Thread(target=self._dispatch, name="PredictionServer", daemon=True)
+        self._thread.start()
+
+    def submit(self, X: torch.Tensor) -> Future:
+        """Request predictions for the rows of `X` (a 1D tensor is treated as a single row).
+
+        Returns a future whose result is the 2D tensor of predictions.
+        """
+        if X.dim() == 1:
+            X = X.reshape(1, -1)
+        req_id = next(self._ids)
+        future = Future()
+        self._futures[req_id] = future
+        try:
+            self._queue.push(req_id, X)
+        except RuntimeError:
+            del self._futures[req_id]
+            raise
+        return future
+
+    def _dispatch(self):
+        while True:
+            ids, counts, rows = self._queue.pop_batch(self.max_batch_size, self.max_delay_ms, self._poll_ms)
+            if ids.shape[0] == 0:
+                if self._queue.is_closed() and self._queue.size() == 0:
+                    return
+                continue
+            futures = [self._futures.pop(i) for i in ids.tolist()]
+            try:
+                preds = self.predictor(rows)
+            except Exception as e:
+                logger.warning(f"Batched prediction failed: {e}")
+                for future in futures:
+                    future.set_exception(e)
+                continue
+            for future, pred in zip(futures, torch.split(preds, counts.tolist(), dim=0)):
+                future.set_result(pred)
+
+    def close(self):
+        """Stop accepting requests. Requests already submitted are still completed."""
+        self._queue.close()
+        self._thread.join()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
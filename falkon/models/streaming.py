@@ -0,0 +1,112 @@
+import dataclasses
+from typing import Optional, Tuple, Union
+
+import torch
+
+from falkon import c_ext
+from falkon.kernels import Kernel
+from falkon.la_helpers import copy_triang
+from falkon.options import FalkonOptions
+from falkon.sparse import SparseTensor
+from falkon.utils.helpers import sizeof_dtype
+from falkon.utils.tensor_helpers import create_fortran, extract_fortran
+
+__all__ = ("KnmStatistics",)
+
+
+class KnmStatistics:
+    """Running sufficient statistics of the Falkon problem, accumulated over chunks of data.
+
+    The Falkon linear system only depends on the data through the (M x M) matrix
+    :math:`K_{nm}^\\top K_{nm}`, the (M x t) matrix :math:`K_{nm}^\\top Y` and the number of
+    points `n`. These are sums over the data points, so they can be computed in a single pass
+    over a stream of chunks: each chunk is split in row-tiles of at most `tile_rows` rows, the
+    kernel between a tile and the centers is computed on `device`, and added to the statistics
+    (with a SYRK, which only updates the lower triangle, on CUDA devices).
+
+    The statistics are used by :meth:`falkon.models.Falkon.fit_stream`, and by
+    :meth:`falkon.optim.FalkonConjugateGradient.solve_stats`.
+
+    Parameters
+    ----------
+    kernel
+        The kernel of the model.
+    centers
+        The dense (M x D) Nystrom centers.
+    num_outputs
+        The number of columns `t` of the targets.
+    device
+        The device on which the kernel tiles are computed and the statistics are stored.
+    tile_rows
+        Maximum number of rows of each kernel tile. If None, tiles of about 256MB are used.
+    opt
+        Options for the kernel computations.
+    """
+
+    def __init__(
+        self,
+        kernel: Kernel,
+        centers: torch.Tensor,
+        num_outputs: int,
+        device: Union[str, torch.device],
+        tile_rows: Optional[int] = None,
+        opt: Optional[FalkonOptions] = None,
+    ):
+        if isinstance(centers, SparseTensor):
+            raise NotImplementedError("Streaming statistics are only implemented for dense data.")
+        self.kernel = kernel
+        self.device = torch.device(device)
+        self.params = opt if opt is not None else FalkonOptions()
+        if self.device.type == "cpu":
+            self.params = dataclasses.replace(self.params, use_cpu=True)
+        self.centers = centers.to(self.device)
+        M, dtype = centers.shape[0], centers.dtype
+        if tile_rows is None:
+            tile_rows = max(1, (1 << 28) // (M * sizeof_dtype(dtype)))
+        self.tile_rows = tile_rows
+
+        self.KtK = torch.zeros(M, M, dtype=dtype, device=self.device).T  # Fortran order for SYRK
+        self.KtY = torch.zeros(M, num_outputs, dtype=dtype, device=self.device)
+        self.num_rows = 0
+        self._tile_buf = create_fortran((tile_rows * M,), dtype, self.device)
+
+    def update(self, X: torch.Tensor, Y: torch.Tensor):
+        """Add the contribution of the (N x D) data `X` with (N x t) targets `Y`."""
+        if isinstance(X, SparseTensor):
+            raise NotImplementedError("Streaming statistics are only implemented for dense data.")
+        if X.shape[0] != Y.shape[0]:
+            raise ValueError(f"X and Y must have the same number of samples (found {X.shape[0]} and {Y.shape[0]})")
+        M = self.centers.shape[0]
+        for start in range(0, X.shape[0], self.tile_rows):
+            n = min(self.tile_rows, X.shape[0] - start)
+            X_tile = X[start : start + n].to(self.device, non_blocking=True)
+            Y_tile = Y[start : start + n].to(self.device, non_blocking=True)
+            k_tile = extract_fortran(self._tile_buf, (n, M), offset=0)
+            self.kernel(X_tile, self.centers, out=k_tile, opt=self.params)
+            if self.device.type == "cuda":
+                with torch.cuda.device(self.device):
+                    # lower(KtK) += k_tile.T @ k_tile
+                    c_ext.cublas_syrk(
+                        A=k_tile,
+                        lda=k_tile.stride(1),
+                        alpha=1.0,
+                        C=self.KtK,
+                        ldc=self.KtK.stride(1),
+                        beta=1.0,
+                        upper=False,
+                        transpose=True,
+                        n=M,
+                        k=n,
+                    )
+            else:
+                self.KtK.addmm_(k_tile.T, k_tile)
+            self.KtY.addmm_(k_tile.T, Y_tile)
+            self.num_rows += n
+
+    def finalize(self, device: Optional[Union[str, torch.device]] = None) -> Tuple[torch.Tensor, torch.Tensor]:
+        """The statistics ``(KtK, KtY)``, moved to `device` (by default they are kept on their device)."""
+        if self.device.type == "cuda":
+            copy_triang(self.KtK, upper=False)
+        if device is None:
+            return self.KtK, self.KtY
+        return self.KtK.to(device), self.KtY.to(device)
@@ -4,6 +4,7 @@ from typing import List, Optional
 
 import torch
 
+from falkon.c_ext import parallel_lauum
 from falkon.options import FalkonOptions
 from falkon.utils import PropagatingThread, devices
 from falkon.utils.helpers import sizeof_dtype
@@ -16,6 +17,32 @@ from .parallel_lauum import BlockAlloc, par_lauum_c_lower, par_lauum_f_lower
 __all__ = ("gpu_lauum",)
 
 
+def _native_parallel_lauum(A, write_opposite: bool, block_sizes: List[int], gpu_info):
+    """Out-of-core LAUUM with the C++ multi-GPU runner. Block-rows are assigned round-robin to GPUs."""
+    num_gpus = len(gpu_info)
+    if num_gpus < 1:
+        raise ValueError("Parallel LAUUM can only run when a GPU is available.")
+    block_starts, block_ends = [], []
+    cur_n = 0
+    for bs in block_sizes:
+        block_starts.append(cur_n)
+        block_ends.append(cur_n + bs)
+        cur_n += bs
+    for g in gpu_info:
+        torch.cuda.current_stream(g.Id).synchronize()
+    parallel_lauum(
+        devices=[g.Id for g in gpu_info],
+        block_starts=block_starts,
+        block_ends=block_ends,
+        block_sizes=block_sizes,
+        block_devices=[gpu_info[i % num_gpus].Id for i in range(len(block_sizes))],
+        block_ids=list(range(len(block_sizes))),
+        write_opposite=write_opposite,
+        A=A,
+    )
+    return A
+
+
 def _parallel_lauum_runner(A, write_opposite: bool, gpu_info):
     # Choose target:
     if is_f_contig(A):
@@ -28,24 +55,7 @@ def _parallel_lauum_runner(A, write_opposite: bool, gpu_info):
     N = A.shape[0]
     dt = A.dtype
     dts = sizeof_dtype(dt)
-    if A.is_cuda:  # In-core
-        sync_current_stream(A.device)
-        gpu_info = [g for g in gpu_info if g.Id == A.device.index]
-        avail_ram = gpu_info[0].actual_free_mem / dts
-        if target.__name__ == "par_lauum_f_lower":
-            # Each GPU should hold in memory two additional blocks (2*B^2 <= M)
-            # and 1 full column.
-            max_block_size = int(math.floor((-N + math.sqrt(N**2 + 8 * avail_ram)) / 4))
-        else:
-            # Same RAM requirements as the out-of-core version
-            max_block_size = int(math.floor((-2 * N + math.sqrt(4 * N**2 + 8 * avail_ram)) / 4))
-        if max_block_size < 1:
-            raise RuntimeError(
-                "Cannot run parallel LAUUM with minimum available memory of %.2fMB" % (avail_ram * dts / 2**20)
-            )
-        # All computations on the same device (where data is stored). No multi-GPU support!
-        block_sizes = calc_block_sizes3(max_block_size, 1, N)
-    else:  # Out-of-core
+    if not A.is_cuda:  # Out-of-core
         avail_ram = min([g.actual_free_mem for g in gpu_info]) / dts
         # Each GPU should be able to hold in memory 2 block columns
         # Plus two blocks (=> quadratic equation 2B^2 + 2BN - M <= 0.
@@ -61,6 +71,24 @@ def _parallel_lauum_runner(A, write_opposite: bool, gpu_info):
             )
 
         block_sizes = calc_block_sizes3(max_block_size, len(gpu_info), N)
+        return _native_parallel_lauum(A, write_opposite, block_sizes, gpu_info)
+
+    # In-core: all computations on the device where the data is stored. No multi-GPU support!
+    sync_current_stream(A.device)
+    gpu_info = [g for g in gpu_info if g.Id == A.device.index]
+    avail_ram = gpu_info[0].actual_free_mem / dts
+    if target.__name__ == "par_lauum_f_lower":
+        # Each GPU should hold in memory two additional blocks (2*B^2 <= M)
+        # and 1 full column.
+        max_block_size = int(math.floor((-N + math.sqrt(N**2 + 8 * avail_ram)) / 4))
+    else:
+        # Same RAM requirements as the out-of-core version
+        max_block_size = int(math.floor((-2 * N + math.sqrt(4 * N**2 + 8 * avail_ram)) / 4))
+    if max_block_size < 1:
+        raise RuntimeError(
+            "Cannot run parallel LAUUM with minimum available memory of %.2fMB" % (avail_ram * dts / 2**20)
+        )
+    block_sizes = calc_block_sizes3(max_block_size, 1, N)
 
     # Create BlockAlloc objects describing the subdivision of input
     block_allocations: List[BlockAlloc] = []
@@ -69,26 +97,15 @@ def _parallel_lauum_runner(A, write_opposite: bool, gpu_info):
         block_allocations.append(BlockAlloc(start=cur_n, end=cur_n + bs, length=bs))
         cur_n += bs
 
-    num_gpus = len(gpu_info)
-    if num_gpus < 1:
-        raise ValueError("Parallel LAUUM can only run when a GPU is available.")
-    barrier = threading.Barrier(num_gpus, timeout=1000)
-    threads = []
-    for _gpu_idx, g in enumerate(gpu_info):
-        # Assign rows to GPUs round-robin. Use _gpu_idx instead of g.Id since the latter
-        # may not contain all integers from 0.
-        gid_allocs = [i for i in range(len(block_allocations)) if i % num_gpus == _gpu_idx]
-        t = PropagatingThread(
-            target=target,
-            name="GPU-%d" % (g.Id),
-            args=(A, block_allocations, gid_allocs, barrier, g.Id, write_opposite),
-        )
-        threads.append(t)
-
-    for t in threads:
-        t.start()
-    for t in threads:
-        t.join()
+    g = gpu_info[0]
+    barrier = threading.Barrier(1, timeout=1000)
+    t = PropagatingThread(
+        target=target,
+        name="GPU-%d" % (g.Id),
+        args=(A, block_allocations, list(range(len(block_allocations))), barrier, g.Id, write_opposite),
+    )
+    t.start()
+    t.join()
     return A
 
 
@@ -1,13 +1,16 @@
 import math
 import logging
 from collections import defaultdict
+from contextlib import ExitStack
+from typing import List, Tuple
 
 import torch
 
 from falkon import la_helpers
-from falkon.c_ext import cusolver_potrf, cusolver_potrf_buffer_size, parallel_potrf
-from falkon.options import CholeskyOptions, FalkonOptions
-from falkon.utils.device_copy import copy
+from falkon.c_ext import cusolver_potrf, cusolver_potrf_buffer_size, parallel_potrf, parallel_potrf_resident
+from falkon.options import FalkonOptions
+from falkon.utils import workspace
+from falkon.utils.device_copy import copy, copy_batch
 from falkon.utils.devices import DeviceInfo, get_device_info
 from falkon.utils.helpers import sizeof_dtype
 from falkon.utils.tensor_helpers import copy_same_stride, create_fortran, is_f_contig
@@ -77,7 +80,7 @@ def _ic_cholesky(A, upper, device):
     return A
 
 
-def _parallel_potrf_runner(A: torch.Tensor, opt: CholeskyOptions, gpu_info) -> torch.Tensor:
+def _parallel_potrf_runner(A: torch.Tensor, opt: FalkonOptions, gpu_info) -> torch.Tensor:
     num_gpus = len(gpu_info)
     N = A.shape[0]
     dt = A.dtype
@@ -106,20 +109,132 @@ def _parallel_potrf_runner(A: torch.Tensor, opt: CholeskyOptions, gpu_info) -> t
         block_allocations["id"].append(i)
         cur_n += bs
 
-    for g in range(num_gpus):
-        torch.cuda.current_stream(g).synchronize()
-    parallel_potrf(
-        devices=list(range(num_gpus)),
-        block_starts=block_allocations["start"],
-        block_ends=block_allocations["end"],
-        block_sizes=block_allocations["size"],
-        block_devices=block_allocations["device_id"],
-        block_ids=block_allocations["id"],
-        A=A,
-    )
+    with ExitStack() as stack:
+        # The tile buffers (2 columns and 1 tile on each GPU) are borrowed from the workspace arena.
+        # The native op runs on its own streams, which start after the synchronization below.
+        workspaces = []
+        if workspace.is_enabled():
+            max_bs = max(block_sizes)
+            ws_numel = max_bs**2 * (2 * len(block_sizes) + 1)
+            for g in range(num_gpus):
+                workspaces.append(stack.enter_context(workspace.borrow(ws_numel, dt, torch.device("cuda", g))))
+        for g in range(num_gpus):
+            torch.cuda.current_stream(g).synchronize()
+        parallel_potrf(
+            devices=list(range(num_gpus)),
+            block_starts=block_allocations["start"],
+            block_ends=block_allocations["end"],
+            block_sizes=block_allocations["size"],
+            block_devices=block_allocations["device_id"],
+            block_ids=block_allocations["id"],
+            A=A,
+            debug=opt.debug,
+            workspaces=workspaces,
+        )
     return A
 
 
+def _grid_rows(num_gpus: int) -> int:
+    # The most square grid of devices, so that the tiles of every block-row and block-column are
+    # spread over as many devices as possible.
+    rows = int(math.floor(math.sqrt(num_gpus)))
+    while num_gpus % rows != 0:
+        rows -= 1
+    return rows
+
+
+def _resident_tile_owners(num_blocks: int, grid_rows: int, grid_cols: int) -> List[Tuple[int, int, int]]:
+    """The (block-row, block-column, device index) of each tile of the lower triangle, in row-major order.
+
+    Must match the layout of the tiles in the native ``parallel_potrf_resident`` op.
+    """
+    return [
+        (b, y, (b % grid_rows) * grid_cols + (y % grid_cols)) for b in range(num_blocks) for y in range(b + 1)
+    ]
+
+
+def _parallel_potrf_resident_runner(A: torch.Tensor, opt: FalkonOptions, gpu_info) -> bool:
+    """Parallel POTRF with the lower triangle of `A` distributed over the GPUs.
+
+    The tiles of the lower triangle are copied once to the GPUs (in a 2D block-cyclic layout),
+    factorized there, and copied back into `A`. Returns False (without touching `A`) if the
+    tiles do not fit in the memory of the GPUs.
+    """
+    num_gpus = len(gpu_info)
+    N = A.shape[0]
+    dt = A.dtype
+    dts = sizeof_dtype(dt)
+    grid_rows = _grid_rows(num_gpus)
+    grid_cols = num_gpus // grid_rows
+    # Each GPU stores its share of the lower triangle (N^2 / (2 * num_gpus) floats, plus padding),
+    # and caches 2 whole columns of tiles owned by other GPUs: 2 * N * block-size floats.
+    avail_ram = min([g.actual_free_mem for g in gpu_info]) / dts
+    max_block_size = int(math.floor((avail_ram - N**2 / (2 * num_gpus)) / (2 * N)))
+    if max_block_size < 1:
+        return False
+    block_sizes = calc_block_sizes(max_block_size, num_gpus, N, opt.chol_par_blk_multiplier)
+    num_blocks = len(block_sizes)
+    max_bs = max(block_sizes)
+    owners = _resident_tile_owners(num_blocks, grid_rows, grid_cols)
+    num_tiles = [0] * num_gpus
+    for _, _, d in owners:
+        num_tiles[d] += 1
+    for d, g in enumerate(gpu_info):
+        if (num_tiles[d] + 2 * num_blocks) * max_bs**2 > g.actual_free_mem / dts:
+            return False
+    block_starts = [0]
+    for bs in block_sizes[:-1]:
+        block_starts.append(block_starts[-1] + bs)
+
+    devices = [torch.device("cuda", g.Id) for g in gpu_info]
+    with ExitStack() as stack:
+        tiles = [torch.empty(num_tiles[d] * max_bs**2, dtype=dt, device=dev) for d, dev in enumerate(devices)]
+        # The F-contiguous tile of each block of A, in its device's storage (with leading dimension max_bs).
+        tile_views = []
+        tile_idx = [0] * num_gpus
+        for b, y, d in owners:
+            flat = tiles[d][tile_idx[d] * max_bs**2 : (tile_idx[d] + 1) * max_bs**2]
+            tile_views.append(flat.view(max_bs, max_bs).T[: block_sizes[b], : block_sizes[y]])
+            tile_idx[d] += 1
+
+        def a_block(b, y):
+            rows = slice(block_starts[b], block_starts[b] + block_sizes[b])
+            return A[rows, block_starts[y] : block_starts[y] + block_sizes[y]]
+
+        # The caches of tiles read from other GPUs are borrowed from the workspace arena.
+        workspaces = []
+        if workspace.is_enabled():
+            for dev in devices:
+                workspaces.append(stack.enter_context(workspace.borrow(2 * num_blocks * max_bs**2, dt, dev)))
+        if A.is_cuda:  # The tiles are copied on the streams of their devices.
+            torch.cuda.current_stream(A.device).synchronize()
+        for d, dev in enumerate(devices):
+            with torch.cuda.device(dev):
+                idx = [t for t, (_, _, owner) in enumerate(owners) if owner == d]
+                copy_batch([a_block(*owners[t][:2]) for t in idx], [tile_views[t] for t in idx])
+        for dev in devices:
+            torch.cuda.current_stream(dev).synchronize()
+        parallel_potrf_resident(
+            devices=[g.Id for g in gpu_info],
+            block_starts=block_starts,
+            block_ends=[st + bs for st, bs in zip(block_starts, block_sizes)],
+            block_sizes=block_sizes,
+            block_devices=[i % num_gpus for i in range(num_blocks)],
+            block_ids=list(range(num_blocks)),
+            grid_rows=grid_rows,
+            tiles=tiles,
+            debug=opt.debug,
+            workspaces=workspaces,
+        )
+        for d, dev in enumerate(devices):
+            with torch.cuda.device(dev):
+                idx = [t for t, (_, _, owner) in enumerate(owners) if owner == d]
+                copy_batch([tile_views[t] for t in idx], [a_block(*owners[t][:2]) for t in idx])
+        for dev in devices:
+            torch.cuda.current_stream(dev).synchronize()
+    return True
+
+
 """
 GPU Cholesky, we implement use cuSOLVER as a backend for POTRF.
 
@@ -214,10 +329,11 @@ def gpu_cholesky(A: torch.Tensor, upper: bool, clean: bool, overwrite: bool, opt
                 "lower triangle for Fortran-ordered matrices (or on the upper "
                 "triangle for C-ordered matrices)"
             )
-    if not ic and A.is_cuda:
+    if not ic and A.is_cuda and not opt.chol_par_resident:
         _msg = "Cannot run out-of-core POTRF on CUDA matrix 'A'."
         if opt.chol_force_ooc:
             _msg += " Set the `chol_force_ooc` option to `False` in to allow in-core POTRF."
+        _msg += " Set the `chol_par_resident` option to `True` to distribute it over the GPUs."
         raise ValueError(_msg)
 
     # Handle different implementations for POTRF: in-core and out-of-core
@@ -225,6 +341,11 @@ def gpu_cholesky(A: torch.Tensor, upper: bool, clean: bool, overwrite: bool, opt
         if opt.debug:
             logger.info("Using in-core POTRF")
         _ic_cholesky(A, upper, device=device.Id)
+    elif opt.chol_par_resident and _parallel_potrf_resident_runner(A, opt, gpu_info):
+        if opt.debug:
+            logger.info("Used parallel POTRF with GPU-resident tiles")
+    elif A.is_cuda:
+        raise ValueError("Cannot run out-of-core POTRF on CUDA matrix 'A': its tiles do not fit on the GPUs.")
     else:
         if opt.debug:
             logger.info("Using parallel POTRF")
@@ -1,3 +1,5 @@
+import copy
+import dataclasses
 import functools
 import time
 import logging
@@ -7,9 +9,12 @@ from typing import Callable, List, Optional
 import torch
 
 import falkon
+from falkon.mmv_ops.data_cache import DeviceDataCache
+from falkon.mmv_ops.fmmv import fdmmv, fmmv
 from falkon.options import ConjugateGradientOptions, FalkonOptions
-from falkon.utils import TicToc
+from falkon.utils.distributed import all_reduce_sum_, check_distributed, global_num_rows
 from falkon.utils.tensor_helpers import copy_same_stride, create_same_stride
+from falkon.utils.tracing import trace_range
 
 # More readable 'pseudocode' for conjugate gradient.
 # function [x] = conjgrad(A, b, x)
@@ -95,6 +100,10 @@ class ConjugateGradient(Optimizer):
         -------
         The solution to the linear system `X`.
         """
+        if self.params.cg_cuda_graph and B.is_cuda:
+            return self._solve_graph(X0, B, mmv, max_iter, callback)
+        if self.params.cg_pipelined:
+            return self._solve_pipelined(X0, B, mmv, max_iter, callback)
         t_start = time.time()
 
         if X0 is None:
@@ -126,7 +135,7 @@ class ConjugateGradient(Optimizer):
             X_orig = X
 
         for self.num_iter in range(max_iter):
-            with TicToc("Chol Iter", debug=False):
+            with trace_range("cg.iter"):
                 t_start = time.time()
                 AP = mmv(P)
                 alpha = Rsold / (torch.sum(P * AP, dim=0).add_(m_eps))
@@ -167,7 +176,7 @@ class ConjugateGradient(Optimizer):
 
                 e_iter = time.time() - t_start
                 e_train += e_iter
-            with TicToc("Chol callback", debug=False):
+            with trace_range("cg.callback"):
                 if callback is not None:
                     try:
                         callback(self.num_iter + 1, X, e_train)
@@ -187,6 +196,226 @@ class ConjugateGradient(Optimizer):
             X = X_orig
         return X
 
+    def _solve_graph(
+        self,
+        X0: Optional[torch.Tensor],
+        B: torch.Tensor,
+        mmv: Callable[[torch.Tensor], torch.Tensor],
+        max_iter: int,
+        callback: Optional[Callable[[int, torch.Tensor, float], None]] = None,
+    ) -> torch.Tensor:
+        """Conjugate gradient on a CUDA device, with each iteration replayed from a CUDA graph.
+
+        `mmv` must only issue work on the current stream, and must not synchronize with the host
+        (as the in-core kernel-vector products). The state of the solver lives in static device
+        buffers. The first iteration runs eagerly (which also warms up `mmv`), the second one is
+        captured in a graph, and all others are replayed from it. The iterations which recompute
+        the full gradient are captured in a second graph, which shares the memory pool of the first.
+
+        Converged columns are frozen on the device (their step size is zero), so the iterations
+        launched before the convergence flag reaches the host do not modify the solution. Without
+        a callback, the flag of an iteration is only waited on after the next one has been launched.
+        """
+        t_start = time.time()
+        device = B.device
+
+        if X0 is None:
+            R = copy_same_stride(B)
+            X = create_same_stride(B.size(), B, B.dtype, B.device)
+            X.fill_(0.0)
+        else:
+            R = B - mmv(X0)
+            X = X0
+
+        m_eps = self.params.cg_epsilon(X.dtype)
+        full_grad_every = self.params.cg_full_gradient_every or max_iter * 2
+        tol = self.params.cg_tolerance**2
+
+        P = R.clone()
+        Rsold = R.square().sum(dim=0)
+        active = torch.greater_equal(Rsold, tol)  # Columns which have not converged
+        conv_flag = torch.zeros(1, dtype=torch.bool, device=device)
+        host_flags = torch.zeros(2, dtype=torch.bool, pin_memory=True)
+        flag_events = [torch.cuda.Event(), torch.cuda.Event()]
+
+        def iteration(full_grad: bool):
+            AP = mmv(P)
+            alpha = Rsold / (torch.sum(P * AP, dim=0).add_(m_eps))
+            alpha.mul_(active)
+            X.addcmul_(P, alpha.reshape(1, -1))
+            if full_grad:
+                R.copy_(B - mmv(X))
+            else:
+                R.addcmul_(AP, alpha.reshape(1, -1), value=-1.0)
+            Rsnew = R.square().sum(dim=0)
+            active.logical_and_(torch.greater_equal(Rsnew, tol))
+            conv_flag.copy_(torch.logical_not(torch.any(active)).reshape(1))
+            multiplier = (Rsnew / Rsold.add_(m_eps)).reshape(1, -1)
+            P.mul_(multiplier).add_(R)
+            Rsold.copy_(Rsnew)
+
+        # For each kind of iteration: None (never run), False (ran eagerly), or its captured graph.
+        graphs = {False: None, True: None}
+        pool = None
+        pending = None  # Iteration whose convergence flag has not been checked yet
+        e_train = time.time() - t_start
+        for self.num_iter in range(max_iter):
+            with trace_range("cg.iter"):
+                t_start = time.time()
+                full_grad = (self.num_iter + 1) % full_grad_every == 0
+                graph = graphs[full_grad]
+                if graph is None:
+                    iteration(full_grad)
+                    graphs[full_grad] = False
+                elif graph is False:
+                    graph = torch.cuda.CUDAGraph()
+                    with torch.cuda.graph(graph, pool=pool):
+                        iteration(full_grad)
+                    pool = graph.pool()
+                    graphs[full_grad] = graph
+                    graph.replay()
+                else:
+                    graph.replay()
+                slot = self.num_iter % 2
+                host_flags[slot : slot + 1].copy_(conv_flag, non_blocking=True)
+                flag_events[slot].record(torch.cuda.current_stream(device))
+                if callback is None:
+                    # Check the flag of the previous iteration, while the current one runs.
+                    check, pending = pending, self.num_iter
+                else:
+                    check = self.num_iter
+                converged = False
+                if check is not None:
+                    flag_events[check % 2].synchronize()
+                    converged = bool(host_flags[check % 2])
+                e_iter = time.time() - t_start
+                e_train += e_iter
+            if converged:
+                # Iterations launched after `check` did not modify `X`.
+                self.num_iter = check
+                break
+            if callback is not None:
+                with trace_range("cg.callback"):
+                    try:
+                        callback(self.num_iter + 1, X, e_train)
+                    except StopOptimizationException as e:
+                        logger.info(f"Optimization stopped from callback: {e.message}")
+                        break
+        return X
+
+    def _solve_pipelined(
+        self,
+        X0: Optional[torch.Tensor],
+        B: torch.Tensor,
+        mmv: Callable[[torch.Tensor], torch.Tensor],
+        max_iter: int,
+        callback: Optional[Callable[[int, torch.Tensor, float], None]] = None,
+    ) -> torch.Tensor:
+        """Pipelined conjugate gradient (Ghysels and Vanroose, 2014).
+
+        The recurrences are rearranged such that each iteration needs a single mmv (with `W = AR`)
+        which does not depend on the dot-products of the same iteration. On CUDA the dot-products
+        run on a side stream, concurrently with the mmv, and all scalars stay on the device. The
+        convergence flag is copied to the host asynchronously, and is only waited on after the
+        next mmv has been queued. Differential convergence is not supported: all columns are
+        updated until they have all converged.
+
+        Since the recurrences for `R` and `W` drift away from the true residual faster than in
+        the standard algorithm, the full gradient (which takes two mmvs) is used to restart
+        the recurrences every `cg_full_gradient_every` iterations.
+        """
+        t_start = time.time()
+
+        if X0 is None:
+            R = copy_same_stride(B)
+            X = create_same_stride(B.size(), B, B.dtype, B.device)
+            X.fill_(0.0)
+        else:
+            R = B - mmv(X0)
+            X = X0
+        W = mmv(R)
+
+        m_eps = self.params.cg_epsilon(X.dtype)
+        full_grad_every = self.params.cg_full_gradient_every or max_iter * 2
+        tol = self.params.cg_tolerance**2
+
+        cur_stream, red_stream, conv_flag, conv_event = None, None, None, None
+        if X.is_cuda:
+            cur_stream = torch.cuda.current_stream(X.device)
+            red_stream = torch.cuda.Stream(X.device)
+            conv_flag = torch.zeros(1, dtype=torch.bool, pin_memory=True)
+            conv_event = torch.cuda.Event()
+
+        P, S, Z = None, None, None
+        gamma_old, alpha_old = None, None
+        e_train = time.time() - t_start
+
+        for self.num_iter in range(max_iter):
+            with trace_range("cg.iter"):
+                t_start = time.time()
+                # 1. Dot-products, overlapped with the mmv.
+                if red_stream is not None:
+                    red_stream.wait_stream(cur_stream)
+                    with torch.cuda.stream(red_stream):
+                        gamma = R.square().sum(dim=0)
+                        delta = torch.sum(W * R, dim=0)
+                        conv_flag.copy_(torch.all(torch.less(gamma, tol)).reshape(1), non_blocking=True)
+                        conv_event.record(red_stream)
+                    gamma.record_stream(cur_stream)
+                    delta.record_stream(cur_stream)
+                    Q = mmv(W)
+                    cur_stream.wait_stream(red_stream)
+                else:
+                    gamma = R.square().sum(dim=0)
+                    delta = torch.sum(W * R, dim=0)
+                    Q = mmv(W)
+
+                # 2. Vector updates
+                if P is None:
+                    alpha = gamma / delta.add_(m_eps)
+                    P, S, Z = R.clone(), W.clone(), Q
+                else:
+                    beta = gamma / gamma_old.add_(m_eps)
+                    alpha = gamma / (delta - beta * gamma / alpha_old).add_(m_eps)
+                    beta = beta.reshape(1, -1)
+                    Z = Z.mul_(beta).add_(Q)
+                    S = S.mul_(beta).add_(W)
+                    P = P.mul_(beta).add_(R)
+                X.addcmul_(P, alpha.reshape(1, -1))
+                gamma_old, alpha_old = gamma, alpha
+
+                # 3. Convergence check (waits for the dot-products, not for the mmv).
+                if conv_event is not None:
+                    conv_event.synchronize()
+                    converged = bool(conv_flag.item())
+                else:
+                    converged = bool(torch.all(torch.less(gamma, tol)))
+                if converged:
+                    break
+
+                if (self.num_iter + 1) % full_grad_every == 0:
+                    # Restart from the true residual
+                    if X.is_cuda:
+                        # addcmul_ may not be finished yet causing mmv to get stale inputs.
+                        torch.cuda.synchronize()
+                    R = B - mmv(X)
+                    W = mmv(R)
+                    P = None
+                else:
+                    R.addcmul_(S, alpha.reshape(1, -1), value=-1.0)
+                    W.addcmul_(Z, alpha.reshape(1, -1), value=-1.0)
+
+                e_iter = time.time() - t_start
+                e_train += e_iter
+            with trace_range("cg.callback"):
+                if callback is not None:
+                    try:
+                        callback(self.num_iter + 1, X, e_train)
+                    except StopOptimizationException as e:
+                        logger.info(f"Optimization stopped from callback: {e.message}")
+                        break
+        return X
+
 
 class FalkonConjugateGradient(Optimizer):
     r"""Preconditioned conjugate gradient solver, optimized for the Falkon algorithm.
@@ -242,41 +471,86 @@ class FalkonConjugateGradient(Optimizer):
 
         self.weight_fn = weight_fn
 
-    def falkon_mmv(self, sol, penalty, X, M, n: int):
+    def falkon_mmv(self, sol, penalty, X, M, n: int, kernel=None):
         prec = self.preconditioner
+        kernel = self.kernel if kernel is None else kernel
 
-        with TicToc("MMV", False):
+        with trace_range("cg.mmv"):
             v = prec.invA(sol)
             v_t = prec.invT(v)
 
-            cc = self.kernel.dmmv(X, M, v_t, None, opt=self.params)
+            cc = kernel.dmmv(X, M, v_t, None, opt=self.params)
+            if self.params.distributed:
+                cc = all_reduce_sum_(cc)
 
-            # AT^-1 @ (TT^-1 @ (cc / n) + penalty * v)
+            # AT^-1 @ (TT^-1 @ (cc / n) + penalty * v), solved in the memory of cc
             cc_ = cc.div_(n)
             v_ = v.mul_(penalty)
-            cc_ = prec.invTt(cc_).add_(v_)
-            out = prec.invAt(cc_)
+            cc_ = prec.invTt(cc_, out=cc_).add_(v_)
+            out = prec.invAt(cc_, out=cc_)
             return out
 
-    def weighted_falkon_mmv(self, sol, penalty, X, M, y_weights, n: int):
+    def stats_falkon_mmv(self, sol, penalty, KtK, n: int):
         prec = self.preconditioner
 
-        with TicToc("MMV", False):
+        with trace_range("cg.mmv"):
             v = prec.invA(sol)
             v_t = prec.invT(v)
 
-            cc = self.kernel.mmv(X, M, v_t, None, opt=self.params).mul_(y_weights)
-            cc = self.kernel.mmv(M, X, cc, None, opt=self.params)
+            cc = KtK @ v_t
 
-            # AT^-1 @ (TT^-1 @ (cc / n) + penalty * v)
+            # AT^-1 @ (TT^-1 @ (cc / n) + penalty * v), solved in the memory of cc
             cc_ = cc.div_(n)
             v_ = v.mul_(penalty)
-            cc_ = prec.invTt(cc_).add_(v_)
-            out = prec.invAt(cc_)
+            cc_ = prec.invTt(cc_, out=cc_).add_(v_)
+            out = prec.invAt(cc_, out=cc_)
+            return out
+
+    def weighted_falkon_mmv(self, sol, penalty, X, M, y_weights, n: int, kernel=None):
+        prec = self.preconditioner
+        kernel = self.kernel if kernel is None else kernel
+
+        with trace_range("cg.mmv"):
+            v = prec.invA(sol)
+            v_t = prec.invT(v)
+
+            cc = kernel.mmv(X, M, v_t, None, opt=self.params).mul_(y_weights)
+            cc = kernel.mmv(M, X, cc, None, opt=self.params)
+            if self.params.distributed:
+                cc = all_reduce_sum_(cc)
+
+            # AT^-1 @ (TT^-1 @ (cc / n) + penalty * v), solved in the memory of cc
+            cc_ = cc.div_(n)
+            v_ = v.mul_(penalty)
+            cc_ = prec.invTt(cc_, out=cc_).add_(v_)
+            out = prec.invAt(cc_, out=cc_)
             return out
 
     def solve(self, X, M, Y, _lambda, initial_solution, max_iter, callback=None):
+        """Solve the preconditioned Falkon system for one or many penalties.
+
+        When `_lambda` is a list (or tuple) of `L` penalties, the preconditioner must be a
+        :class:`~falkon.preconditioner.MultiLambdaFalkonPreconditioner` initialized with the same
+        penalties. The `L` systems (each with all the `t` columns of `Y`) are then solved together:
+        the returned `beta` has `L * t` stacked columns, and each CG iteration needs a single kernel
+        evaluation for all of them. The solutions for each penalty can be recovered with
+        ``preconditioner.split(preconditioner.apply(beta))``.
+
+        With the ``distributed`` option, `X` and `Y` are the local shards of the data held by
+        this process, and the kernel-vector products are summed over all processes.
+        """
         n = Y.size(0)
+        if self.params.distributed:
+            # Y is the local shard of the targets: the problem is scaled by the total number of points.
+            check_distributed()
+            n = global_num_rows(n)
+        multi_lambda = isinstance(_lambda, (list, tuple))
+        optimizer = self.optimizer
+        if multi_lambda and optimizer.params.cg_differential_convergence:
+            # Columns are matched to their penalty by position, so converged columns cannot be dropped.
+            optimizer = ConjugateGradient(dataclasses.replace(optimizer.params, cg_differential_convergence=False))
+        if optimizer.params.cg_cuda_graph and not self._use_cuda_graph(X, M, Y):
+            optimizer = ConjugateGradient(dataclasses.replace(optimizer.params, cg_cuda_graph=False))
         cuda_inputs: bool = Y.is_cuda
         device = Y.device
 
@@ -285,7 +559,7 @@ class FalkonConjugateGradient(Optimizer):
             stream = torch.cuda.current_stream(device)
 
         # Note that if we don't have CUDA this still works with stream=None.
-        with ExitStack() as stack, TicToc("ConjGrad preparation", False):
+        with ExitStack() as stack, trace_range("cg.prepare"):
             if cuda_inputs:
                 stack.enter_context(torch.cuda.device(device))
                 stack.enter_context(torch.cuda.stream(stream))
@@ -297,22 +571,72 @@ class FalkonConjugateGradient(Optimizer):
 
             # Compute the right hand side
             B = self.kernel.mmv(M, X, y_over_n, opt=self.params)
-            B = self.preconditioner.apply_t(B)
+            if self.params.distributed:
+                B = all_reduce_sum_(B)
+            if multi_lambda:
+                _lambda, B = self._multi_lambda_rhs(_lambda, B)
+            else:
+                B = self.preconditioner.apply_t(B)
 
+            # The captured iterations cannot copy the kernel hyperparameters to the GPU.
+            kernel = self._device_kernel(X.device) if optimizer.params.cg_cuda_graph else self.kernel
             if self.is_weighted:
-                mmv = functools.partial(self.weighted_falkon_mmv, penalty=_lambda, X=X, M=M, y_weights=y_weights, n=n)
+                mmv = functools.partial(
+                    self.weighted_falkon_mmv, penalty=_lambda, X=X, M=M, y_weights=y_weights, n=n, kernel=kernel
+                )
             else:
-                mmv = functools.partial(self.falkon_mmv, penalty=_lambda, X=X, M=M, n=n)
+                mmv = functools.partial(self.falkon_mmv, penalty=_lambda, X=X, M=M, n=n, kernel=kernel)
+                if self._use_data_cache(X, M, B):
+                    stack.enter_context(DeviceDataCache(X, self.kernel, M.shape[0], B.shape[1], self.params))
             # Run the conjugate gradient solver
-            beta = self.optimizer.solve(initial_solution, B, mmv, max_iter, callback)
+            beta = optimizer.solve(initial_solution, B, mmv, max_iter, callback)
+            self.optimizer.num_iter = optimizer.num_iter
 
         return beta
 
+    def solve_stats(self, KtK, KtY, n: int, _lambda, initial_solution, max_iter, callback=None):
+        """Solve the preconditioned Falkon system from the sufficient statistics of the data.
+
+        Instead of the data, the system is specified by the (M x M) matrix :math:`K_{nm}^\top K_{nm}`
+        and the (M x t) matrix :math:`K_{nm}^\top Y`, accumulated over all `n` training points
+        (see :class:`falkon.models.streaming.KnmStatistics`). The iterations then only involve
+        (M x M) products, with no further pass over the data. `KtK` and `KtY` must be on the same
+        device as the preconditioner.
+        """
+        optimizer = self.optimizer
+        if optimizer.params.cg_cuda_graph and not (KtK.is_cuda and self._preconditioner_on(KtK.device)):
+            optimizer = ConjugateGradient(dataclasses.replace(optimizer.params, cg_cuda_graph=False))
+        with trace_range("cg.prepare"):
+            B = self.preconditioner.apply_t(KtY / n)
+            mmv = functools.partial(self.stats_falkon_mmv, penalty=_lambda, KtK=KtK, n=n)
+            beta = optimizer.solve(initial_solution, B, mmv, max_iter, callback)
+            self.optimizer.num_iter = optimizer.num_iter
+        return beta
+
+    def _multi_lambda_rhs(self, penalties, B):
+        prec = self.preconditioner
+        penalties = [float(p) for p in penalties]
+        if penalties != getattr(prec, "penalties", None):
+            raise ValueError(
+                "Solving for multiple penalties requires a MultiLambdaFalkonPreconditioner "
+                f"initialized with the same penalties ({penalties})."
+            )
+        # T^-T is shared by all penalties: apply it once, then stack one copy of the
+        # right-hand side per penalty (each copy is then solved against its own A).
+        B = prec.invTt(B)
+        B_stacked = create_same_stride((B.shape[0], B.shape[1] * len(penalties)), B, B.dtype, B.device)
+        for B_blk in prec.split(B_stacked):
+            B_blk.copy_(B)
+        B_stacked = prec.invAt(B_stacked)
+        # Row vector with the penalty of each stacked column, broadcast in `falkon_mmv`.
+        penalty = torch.tensor(penalties, dtype=B.dtype, device=B.device).repeat_interleave(B.shape[1])
+        return penalty.reshape(1, -1), B_stacked
+
     def solve_val_rhs(self, Xtr, Xval, M, Y, _lambda, initial_solution, max_iter, callback=None):
         n = Xtr.size(0)
         prec = self.preconditioner
 
-        with TicToc("ConjGrad preparation", False):
+        with trace_range("cg.prepare"):
             B = self.kernel.mmv(M, Xval, Y / n, opt=self.params)
             B = prec.apply_t(B)
 
@@ -322,6 +646,40 @@ class FalkonConjugateGradient(Optimizer):
         # Run the conjugate gradient solver
         return self.optimizer.solve(initial_solution, B, capture_mmv, max_iter, callback)
 
+    def _use_cuda_graph(self, X, M, Y) -> bool:
+        """Whether the CG iterations can be captured in a CUDA graph: all data (and the preconditioner)
+        must be on one GPU, and the kernel-vector products must run in-core (not through KeOps)."""
+        opt = self.params
+        if opt.use_cpu or opt.distributed or not isinstance(X, torch.Tensor):
+            return False
+        if not (X.is_cuda and M.is_cuda and Y.is_cuda) or not (X.device == M.device == Y.device):
+            return False
+        if not self._preconditioner_on(X.device):
+            return False
+        if self.is_weighted:
+            return self.kernel._decide_mmv_impl(X, M, Y, opt) is fmmv
+        return self.kernel._decide_dmmv_impl(X, M, Y, None, opt) is fdmmv
+
+    def _preconditioner_on(self, device) -> bool:
+        fC = getattr(self.preconditioner, "fC", None)
+        return fC is not None and fC.device == device
+
+    def _device_kernel(self, device):
+        """The kernel, or a copy of it with all its hyperparameters moved to `device`."""
+        tensors = list(self.kernel.parameters()) + list(self.kernel.buffers())
+        if all(t.device == device for t in tensors):
+            return self.kernel
+        return copy.deepcopy(self.kernel).to(device)
+
+    def _use_data_cache(self, X, M, B) -> bool:
+        opt = self.params
+        if not opt.cg_device_data_cache or opt.use_cpu or not torch.cuda.is_available():
+            return False
+        if not isinstance(X, torch.Tensor) or X.is_cuda or M.is_cuda:
+            return False
+        # The cache is only read by the non-KeOps implementation of the double kernel-vector product
+        return self.kernel._decide_dmmv_impl(X, M, B, None, opt) is fdmmv
+
     @property
     def is_weighted(self):
         return self.weight_fn is not None
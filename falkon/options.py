@@ -1,4 +1,5 @@
 from dataclasses import dataclass
+from typing import Optional
 
 import numpy as np
 import torch
@@ -85,14 +86,69 @@ store_kernel_d_threshold
     on whether the matrix is stored or not is based on the amount of memory available.
     Storing the Knm matrix may greatly reduce training and inference times, especially if `d` is
     large, or for kernels which are costly to compute.
+knm_cache
+    `default False` - Instead of deciding whether the whole Knm kernel matrix fits in RAM (see
+    ``store_kernel_d_threshold``), compute it once in row-tiles and store each tile in the first
+    tier with enough space: GPU memory (up to half of the free memory of the first GPU), host
+    memory, and a file in ``knm_cache_dir``. Tiles are only written to the file if reading them
+    back is estimated to be faster than recomputing them, and tiles which are not stored are
+    recomputed at every conjugate gradient iteration. Only used for dense data, and ignored if
+    ``never_store_kernel`` is set. See :class:`~falkon.kernels.TieredKnmKernel`.
+knm_cache_dir
+    `default None` - Directory (ideally on a fast local SSD) for the file tier of the tiered Knm
+    cache (see ``knm_cache``). If not set, tiles which do not fit in memory are recomputed.
+knm_cache_disk_bandwidth
+    `default 2e9` - The estimated read bandwidth of ``knm_cache_dir``, in bytes per second. It is
+    compared with the measured cost of computing kernel tiles to decide whether they are written
+    to the file.
 num_fmm_streams
     `default 2` - The number of CUDA streams to use for evaluating kernels when CUDA is available.
+    For out-of-core kernel-vector products this is the number of data tiles which are buffered
+    on the GPU, so that copies from the host overlap with kernel computations.
     This number should be increased from its default value when the number of Nystroem centers is
     higher than around 5000.
 memory_slack
     `default 0.9` - Controls the amount of slack in GPU memory when calculating the size of matrix
     splits for kernel-vector multiplications. This can be reduced if out-of-memory errors occur
     on the GPU.
+mmv_autotune
+    `default False` - Whether to choose the block sizes of out-of-core kernel-vector and kernel-matrix
+    products by benchmarking a few candidates on the GPU, instead of using the largest blocks
+    which fit in memory. The benchmark runs once for each device, data-type, kernel and data
+    dimension, and its results are cached on disk (in the directory given by the
+    ``FALKON_CACHE_DIR`` environment variable, or in ``~/.cache/falkon``).
+fused_mmv
+    `default False` - Whether to compute kernel-vector products on the GPU with a native fused
+    operation, which evaluates kernel tiles in on-chip memory and never writes them to GPU memory.
+    Memory usage then grows linearly with the block sizes, so much larger blocks are used.
+    This is only available for the Gaussian, Laplacian and Matern kernels with dense inputs. When
+    set, it has precedence over KeOps (see ``keops_active``) for kernel-vector products, but not
+    for double kernel-vector products.
+mmv_precision
+    `default "default"` - The precision of the kernel tiles of (double) kernel-vector products on
+    the GPU, for single precision data. With ``"bf16"`` or ``"fp16"``, the data tiles and the
+    kernel tiles are stored in ``torch.bfloat16`` or ``torch.float16``, and their products run on
+    the tensor cores with single precision accumulation. The squared norms of the data and
+    centers are kept in single precision, and so are the squared distances (the output of the
+    cross-term GEMM) and the outputs. Tiles take half the memory, so larger blocks are used. This
+    trades accuracy for speed: the kernel entries have only 8 (bf16) or 11 (fp16) bits of
+    precision, which is usually acceptable for large-scale regression. Only the Gaussian, Laplacian
+    and Matern kernels with dense inputs support it. It is not used by the KeOps or the fused (see
+    ``fused_mmv``) implementations, or for differentiable products.
+sparse_sliced_ell
+    `default False` - Whether out-of-core kernel-vector products with sparse data (see
+    :class:`~falkon.sparse.SparseTensor`) on the GPU should convert each tile of the data to the
+    sliced-ELL format (see :class:`~falkon.sparse.SlicedEllTensor`), and compute the sparse
+    dot-products directly into the kernel tile instead of using cuSPARSE. This is usually faster
+    on data where the number of non-zeros varies greatly between rows. All sparse matrices must
+    have sorted indices.
+distributed
+    `default False` - Fit :class:`~falkon.models.Falkon` models with the training data sharded over
+    the processes of the default ``torch.distributed`` process group, which must be initialized
+    before fitting. Each process passes its own shard of the data and targets to ``fit``. The
+    Nystrom centers and the preconditioner are computed on rank 0 and broadcast to the other
+    processes, while the kernel-vector products of each conjugate gradient iteration are summed
+    over all processes. Only dense data is supported.
     """,
     "keops": """
 keops_acc_dtype
@@ -111,6 +167,18 @@ keops_memory_slack
     `default 0.7` - Controls the amount of slack used when calculating the matrix splits for KeOps.
     Since memory usage estimation for KeOps is hard, you may need to reduce this value if running
     out-of-GPU-memory when using KeOps. Typically this only occurs for large datasets.
+    Only used when the memory of a KeOps formula was not measured (see :attr:`keops_measure_memory`).
+keops_measure_memory
+    `default False` - Measure the GPU memory used by each KeOps formula (once per formula, on small
+    inputs) and use the measurement to calculate the matrix splits for KeOps, instead of
+    :attr:`keops_memory_slack`. Measuring resets the peak memory statistics of the GPU.
+    Measurements are stored in :attr:`keops_cache_dir` if it is set, and formulas measured by
+    :func:`falkon.mmv_ops.keops_cache.warm_cache` are used even if this option is False.
+keops_cache_dir
+    `default None` - Directory into which KeOps compiles its formulas, and from which it loads
+    formulas which were already compiled. It can be filled ahead of time with
+    :func:`falkon.mmv_ops.keops_cache.warm_cache`, to avoid compiling formulas on new machines.
+    If None, the default KeOps build directory is used.
     """,
     "cg": """
 cg_epsilon_32
@@ -133,6 +201,28 @@ cg_differential_convergence
     If this flag is set, whenever the convergence criterion is met for single right-hand-sides,
     they are removed from the optimization procedure. If it is not set, all vectors must have
     converged for the optimization to stop. It is especially useful for hyperparameter optimization.
+cg_device_data_cache
+    `default False` - When the training data is in host memory, keep as much of it as fits (after
+    ``memory_slack``) resident in GPU memory for the whole conjugate gradient optimization. Each
+    GPU stores the leading rows of its share of the data, and only the remainder is copied from
+    the host at every iteration. This is only used for unweighted problems whose kernel-vector
+    products do not run through KeOps.
+cg_pipelined
+    `default False` - Use the pipelined variant of conjugate gradient (Ghysels and Vanroose). Each
+    iteration needs a single kernel-vector product which does not depend on the dot-products of the
+    same iteration: on the GPU the dot-products run concurrently with it, and the convergence check
+    does not block the device. The pipelined recurrences are slightly less stable, and are restarted
+    from the full gradient every ``cg_full_gradient_every`` iterations. ``cg_differential_convergence``
+    is ignored in this mode.
+cg_cuda_graph
+    `default False` - When the data, the Nystrom centers and the preconditioner are all on the same
+    GPU, capture one conjugate gradient iteration (kernel-vector products, preconditioner solves
+    and dot-products) in a CUDA graph, and replay it at every iteration. This removes the launch
+    and Python overheads, which dominate the iteration time for moderately sized problems.
+    Convergence is checked on the device, and polled without blocking the iterations when there is
+    no callback. Columns of the solution stop being updated once they have converged. Other
+    configurations (data in host memory, KeOps, distributed training) do not use the graph.
+    ``cg_pipelined`` and ``cg_differential_convergence`` are ignored in this mode.
     """,
     "pc": """
 pc_epsilon_32
@@ -144,6 +234,20 @@ pc_epsilon_64
 cpu_preconditioner
     `default False` - Whether the preconditioner should be computed on the CPU. This setting
     overrides the :attr:`FalkonOptions.use_cpu` option.
+pc_mixed_precision
+    `default False` - For double-precision data, compute the Cholesky decompositions and the
+    triangular product of the preconditioner in single precision. The factors are then stored
+    in double precision, so that triangular solves and the conjugate gradient remain in double
+    precision. The (slightly) less accurate preconditioner only affects the convergence speed of
+    conjugate gradient, not the accuracy of the solution. Single-precision jitter
+    (:attr:`pc_epsilon_32`) is used for the decompositions.
+pc_reuse_tol
+    `default 0.0` - Only used by :class:`falkon.preconditioner.LogisticPreconditioner`. Between two
+    Newton steps of :class:`falkon.models.LogisticFalkon`, the factorization of the weighted part
+    of the preconditioner is kept if the penalty has not changed, and the loss weights have
+    changed by at most `pc_reuse_tol` (relative to their norm). The factor of the kernel between
+    the centers is always reused. A stale preconditioner only slows down the convergence of
+    conjugate gradient. With the default value the weighted part is refactored at every step.
     """,
     "chol": """
 chol_force_in_core
@@ -154,6 +258,13 @@ chol_force_ooc
     even on matrices which fit in-GPU-core.
 chol_par_blk_multiplier
     `default 2` - Minimum number of tiles per-GPU in the out-of-core, GPU-parallel POTRF algorithm.
+chol_par_resident
+    `default False` - Whether the out-of-core, GPU-parallel POTRF algorithm should keep the lower
+    triangle of the matrix on the GPUs, when it fits in their combined memory. The tiles are then
+    distributed over the GPUs in a 2D block-cyclic layout, and the factorized tiles are copied
+    between GPUs point-to-point (directly over NVLink or PCIe, if the GPUs are connected) instead
+    of going through host memory. The matrix is only copied once to and from the GPUs. This also
+    allows the out-of-core factorization of matrices which are already on a GPU.
     """,
     "extra": """
     .. _KeOps documentation: https://www.kernel-operations.io/keops/python/api/pytorch/Genred_torch.html?highlight=genred#pykeops.torch.Genred
@@ -177,8 +288,16 @@ class BaseOptions:
     min_cuda_iter_size_64: int = 30_000 * 10 * 3_000
     never_store_kernel: bool = False
     store_kernel_d_threshold: int = 1200
+    knm_cache: bool = False
+    knm_cache_dir: Optional[str] = None
+    knm_cache_disk_bandwidth: float = 2e9
     num_fmm_streams: int = 2
     memory_slack: float = 0.9
+    mmv_autotune: bool = False
+    fused_mmv: bool = False
+    mmv_precision: str = "default"
+    sparse_sliced_ell: bool = False
+    distributed: bool = False
 
     def get_base_options(self):
         return BaseOptions(
@@ -194,7 +313,15 @@ class BaseOptions:
             min_cuda_iter_size_64=self.min_cuda_iter_size_64,
             never_store_kernel=self.never_store_kernel,
             store_kernel_d_threshold=self.store_kernel_d_threshold,
+            knm_cache=self.knm_cache,
+            knm_cache_dir=self.knm_cache_dir,
+            knm_cache_disk_bandwidth=self.knm_cache_disk_bandwidth,
             memory_slack=self.memory_slack,
+            mmv_autotune=self.mmv_autotune,
+            fused_mmv=self.fused_mmv,
+            mmv_precision=self.mmv_precision,
+            sparse_sliced_ell=self.sparse_sliced_ell,
+            distributed=self.distributed,
         )
 
 
@@ -206,6 +333,8 @@ class KeopsOptions:
     keops_sum_scheme: str = "auto"
     keops_active: str = "auto"
     keops_memory_slack: float = 0.7
+    keops_measure_memory: bool = False
+    keops_cache_dir: Optional[str] = None
 
     def get_keops_options(self):
         return KeopsOptions(
@@ -213,6 +342,8 @@ class KeopsOptions:
             keops_sum_scheme=self.keops_sum_scheme,
             keops_active=self.keops_active,
             keops_memory_slack=self.keops_memory_slack,
+            keops_measure_memory=self.keops_measure_memory,
+            keops_cache_dir=self.keops_cache_dir,
         )
 
 
@@ -225,6 +356,9 @@ class ConjugateGradientOptions:
     cg_tolerance: float = 1e-7
     cg_full_gradient_every: int = 10
     cg_differential_convergence: bool = False
+    cg_device_data_cache: bool = False
+    cg_pipelined: bool = False
+    cg_cuda_graph: bool = False
 
     def cg_epsilon(self, dtype):
         if dtype == torch.float32:
@@ -241,6 +375,9 @@ class ConjugateGradientOptions:
             cg_tolerance=self.cg_tolerance,
             cg_full_gradient_every=self.cg_full_gradient_every,
             cg_differential_convergence=self.cg_differential_convergence,
+            cg_device_data_cache=self.cg_device_data_cache,
+            cg_pipelined=self.cg_pipelined,
+            cg_cuda_graph=self.cg_cuda_graph,
         )
 
 
@@ -257,6 +394,8 @@ class PreconditionerOptions:
     pc_epsilon_32: float = 1e-5
     pc_epsilon_64: float = 1e-13
     cpu_preconditioner: bool = False
+    pc_mixed_precision: bool = False
+    pc_reuse_tol: float = 0.0
 
     def pc_epsilon(self, dtype):
         if dtype == torch.float32:
@@ -271,6 +410,8 @@ class PreconditionerOptions:
             pc_epsilon_32=self.pc_epsilon_32,
             pc_epsilon_64=self.pc_epsilon_64,
             cpu_preconditioner=self.cpu_preconditioner,
+            pc_mixed_precision=self.pc_mixed_precision,
+            pc_reuse_tol=self.pc_reuse_tol,
         )
 
 
@@ -281,12 +422,14 @@ class CholeskyOptions:
     chol_force_in_core: bool = False
     chol_force_ooc: bool = False
     chol_par_blk_multiplier: int = 2
+    chol_par_resident: bool = False
 
     def get_chol_options(self):
         return CholeskyOptions(
             chol_force_in_core=self.chol_force_in_core,
             chol_force_ooc=self.chol_force_ooc,
             chol_par_blk_multiplier=self.chol_par_blk_multiplier,
+            chol_par_resident=self.chol_par_resident,
         )
 
 
@@ -1,5 +1,5 @@
-from .flk_preconditioner import FalkonPreconditioner
+from .flk_preconditioner import FalkonPreconditioner, MultiLambdaFalkonPreconditioner
 from .logistic_preconditioner import LogisticPreconditioner
 from .preconditioner import Preconditioner
 
-__all__ = ("FalkonPreconditioner", "Preconditioner", "LogisticPreconditioner")
+__all__ = ("FalkonPreconditioner", "MultiLambdaFalkonPreconditioner", "Preconditioner", "LogisticPreconditioner")
@@ -1,8 +1,8 @@
-from typing import Optional, Union
+from typing import List, Optional, Sequence, Union
 
 import torch
 
-from falkon.la_helpers import copy_triang, mul_triang, trsm, vec_mul_triang
+from falkon.la_helpers import copy_triang, pc_apply, triang_affine, trsm, vec_mul_triang
 from falkon.options import FalkonOptions
 from falkon.sparse.sparse_tensor import SparseTensor
 from falkon.utils import TicToc, decide_cuda
@@ -51,6 +51,10 @@ class FalkonPreconditioner(Preconditioner):
             preconditioner on the CPU. If set to False, we fall back to
             the usual CPU/GPU settings (i.e. 'use_cpu' option and the
             availability of a GPU).
+        - pc_mixed_precision : for double-precision data, compute the
+            Cholesky decompositions and LAUUM in single precision. The
+            triangular solves still run in double precision on the
+            (upcast) factors.
 
     """
 
@@ -65,6 +69,7 @@ class FalkonPreconditioner(Preconditioner):
         self.fC: Optional[torch.Tensor] = None
         self.dT: Optional[torch.Tensor] = None
         self.dA: Optional[torch.Tensor] = None
+        self._weighted = False
 
     def check_inputs(self, X: Union[torch.Tensor, SparseTensor], weight_vec: Optional[torch.Tensor] = None):
         if X.is_cuda and not self._use_cuda:
@@ -107,6 +112,16 @@ class FalkonPreconditioner(Preconditioner):
         self.check_inputs(X, weight_vec)
         C = self.init_kernel_mat(X)
         M = C.shape[0]
+        # Mixed precision: the factorizations run on a single-precision copy of the kernel,
+        # and the factors are copied back into the double-precision buffer at the end.
+        C_out = None
+        if self.params.pc_mixed_precision and C.dtype == torch.float64:
+            with TicToc("Downcast", debug=self.params.debug):
+                C_out = C
+                C = create_same_stride(C.shape, C_out, torch.float32, C_out.device, pin_memory=self._use_cuda)
+                C.copy_(C_out)
+                if weight_vec is not None:
+                    weight_vec = weight_vec.to(dtype=C.dtype)
         eps = self.params.pc_epsilon(C.dtype)
 
         with TicToc("Cholesky 1", debug=self.params.debug):
@@ -120,6 +135,19 @@ class FalkonPreconditioner(Preconditioner):
             # Copy lower(fC) to upper(fC):  upper(fC) = T.
             copy_triang(C, upper=False)
 
+        C = self._factor_t_to_a(C, weight_vec)
+
+        if C_out is not None:
+            with TicToc("Upcast", debug=self.params.debug):
+                C = C_out.copy_(C)
+                self.dT = self.dT.to(dtype=C.dtype)
+                self.dA = self.dA.to(dtype=C.dtype)
+
+        self.fC = C
+        self._weighted = weight_vec is not None
+
+    def _factor_t_to_a(self, C: torch.Tensor, weight_vec: Optional[torch.Tensor]) -> torch.Tensor:
+        """Starting from T in both triangles of C, overwrite lower(C) with A.T and save its diagonal."""
         # Weighted least-squares needs to weight the A matrix. We can weigh once before LAUUM,
         # but since CUDA-LAUUM touches both sides of C, weighting before LAUUM will also modify
         # the matrix T. Therefore for CUDA inputs we weigh twice after LAUUM!
@@ -137,22 +165,138 @@ class FalkonPreconditioner(Preconditioner):
                 # Product lower(fC).T @ lower(fC), store in lower(fC) = T @ T.T
                 C = lauum_wrapper(C, upper=False, use_cuda=self._use_cuda, opt=self.params)
 
+        # For CUDA inputs the weighting is applied on both sides of the LAUUM output,
+        # fused with the scaling and diagonal shift.
+        cuda_weights = None
         if weight_vec is not None and self._use_cuda:
-            with TicToc("Weighting(CUDA)", debug=self.params.debug):
-                weight_vec.sqrt_()
-                vec_mul_triang(C, weight_vec, side=0, upper=False)
-                vec_mul_triang(C, weight_vec, side=1, upper=False)
+            weight_vec.sqrt_()
+            cuda_weights = weight_vec
 
         with TicToc("Cholesky 2", debug=self.params.debug):
-            # lower(fC) = 1/M * T@T.T
-            mul_triang(C, upper=False, preserve_diag=False, multiplier=1 / M)
-            # lower(fC) = 1/M * T@T.T + lambda * I
-            inplace_add_diag_th(C, self._lambda)
-            # Cholesky on lower(fC) : lower(fC) = A.T
-            C = potrf_wrapper(C, clean=False, upper=False, use_cuda=self._use_cuda, opt=self.params)
+            C = self._factor_a(C, self._lambda, cuda_weights)
             self.dA = C.diag()
+        return C
 
-        self.fC = C
+    def _factor_a(self, C: torch.Tensor, penalty: float, weights: Optional[torch.Tensor]) -> torch.Tensor:
+        """Overwrite lower(C), which holds T @ T.T, with the Cholesky factor A.T for `penalty`."""
+        # lower(C) = 1/M * T@T.T + lambda * I
+        triang_affine(
+            C,
+            upper=False,
+            multiplier=1 / C.shape[0],
+            diag_add=penalty,
+            row_multipliers=weights,
+            col_multipliers=weights,
+        )
+        # Cholesky on lower(C) : lower(C) = A.T
+        return potrf_wrapper(C, clean=False, upper=False, use_cuda=self._use_cuda, opt=self.params)
+
+    @check_init("fC", "dT", "dA")
+    def update(
+        self,
+        penalty: Optional[float] = None,
+        centers: Optional[Union[torch.Tensor, SparseTensor]] = None,
+        new_centers: Optional[Union[torch.Tensor, SparseTensor]] = None,
+        remove_idx: Optional[torch.Tensor] = None,
+    ):
+        r"""Update the preconditioner for a new penalty, or after adding or removing a few centers.
+
+        The factor `T` does not depend on the penalty, so changing it only requires recomputing
+        `A`. When centers are removed (those at indices `remove_idx`), their columns are dropped
+        from `T` and the trailing block of `T` which is no longer triangular is re-factorized with
+        a QR decomposition. When `k` centers are added (`new_centers`, appended after the existing
+        ones), `T` grows by `k` columns: with :math:`S = T^{-\top} K_{Mk}` the new factor is
+
+        .. math::
+
+            \begin{pmatrix} T & S \\ 0 & \mathrm{chol}(K_{kk} - S^\top S) \end{pmatrix}
+
+        which avoids recomputing the kernel between the existing centers and the first Cholesky
+        decomposition. `A` depends on the whole of `T`, so it is always recomputed.
+
+        The jitter added to the diagonal of the existing centers' kernel is not rescaled when the
+        number of centers changes, so the updated factor differs slightly from one computed from
+        scratch. Updates always run in the precision of the factors (``pc_mixed_precision`` is
+        ignored). Weighted preconditioners cannot be updated, and centers can only be removed
+        from dense (not sparse) centers.
+
+        Parameters
+        ----------
+        penalty
+            The new regularization parameter. If None, the current one is kept.
+        centers
+            The (M x D) centers the preconditioner was computed with. Required to add centers.
+        new_centers
+            The (k x D) centers which are added, after any removal.
+        remove_idx
+            The indices (into `centers`) of the centers which are removed.
+        """
+        if self._weighted:
+            raise NotImplementedError("Weighted preconditioners cannot be updated.")
+        if new_centers is not None and centers is None:
+            raise ValueError("The current centers must be specified in order to add new centers.")
+        if remove_idx is not None and isinstance(centers, SparseTensor):
+            raise NotImplementedError("Centers can only be removed from preconditioners with dense centers.")
+        if penalty is not None:
+            self._lambda = penalty
+        C = self.fC
+        if remove_idx is not None or new_centers is not None:
+            T = torch.triu(self.fC, diagonal=1)
+            inplace_set_diag_th(T, self.dT)
+            if remove_idx is not None:
+                with TicToc("Remove centers", debug=self.params.debug):
+                    T, keep_idx = self._remove_from_t(T, remove_idx)
+                if centers is not None:
+                    centers = centers[keep_idx]
+            if new_centers is not None:
+                with TicToc("Add centers", debug=self.params.debug):
+                    T = self._append_to_t(T, centers, new_centers)
+            C = create_fortran(T.shape, T.dtype, T.device, pin_memory=self._use_cuda)
+            C.copy_(T)
+            del T
+            self.dT = C.diag()
+        with TicToc("Copy triangular", debug=self.params.debug):
+            # Restore upper(fC) = T, and copy it to lower(fC)
+            inplace_set_diag_th(C, self.dT)
+            copy_triang(C, upper=True)
+        self.fC = self._factor_t_to_a(C, None)
+
+    def _remove_from_t(self, T: torch.Tensor, remove_idx: torch.Tensor):
+        M = T.shape[0]
+        keep = torch.ones(M, dtype=torch.bool)
+        keep[remove_idx.cpu()] = False
+        keep_idx = keep.nonzero().view(-1)
+        num_keep = keep_idx.shape[0]
+        if num_keep == 0:
+            raise ValueError("Cannot remove all centers from the preconditioner.")
+        if num_keep == M:
+            return T, keep_idx
+        # The first removed column is the first which breaks the triangular structure.
+        first = int((~keep).nonzero()[0])
+        T_keep = T[:, keep_idx.to(T.device)]
+        new_T = torch.zeros(num_keep, num_keep, dtype=T.dtype, device=T.device)
+        new_T[:first] = T_keep[:first]
+        if first < num_keep:
+            # T_keep[first:] is zero before column `first`, and B^T B = R^T R for B = QR.
+            R = torch.linalg.qr(T_keep[first:, first:], mode="r").R
+            signs = torch.sign(R.diagonal())
+            signs[signs == 0] = 1
+            new_T[first:, first:] = R * signs.reshape(-1, 1)
+        return new_T, keep_idx
+
+    def _append_to_t(self, T: torch.Tensor, centers, new_centers) -> torch.Tensor:
+        M, k = T.shape[0], new_centers.shape[0]
+        eps = self.params.pc_epsilon(T.dtype)
+        K_mk = self.kernel(centers, new_centers, opt=self.params).to(T)
+        K_kk = self.kernel(new_centers, new_centers, opt=self.params).to(T)
+        inplace_add_diag_th(K_kk, eps * (M + k))
+        # T.T @ S = K_mk
+        S = torch.linalg.solve_triangular(T.T, K_mk, upper=False)
+        new_T = torch.zeros(M + k, M + k, dtype=T.dtype, device=T.device)
+        new_T[:M, :M] = T
+        new_T[:M, M:] = S
+        new_T[M:, M:] = torch.linalg.cholesky(K_kk - S.T @ S).T
+        return new_T
 
     def to(self, device):
         if self.fC is not None:
@@ -164,7 +308,7 @@ class FalkonPreconditioner(Preconditioner):
         return self
 
     @check_init("fC", "dT", "dA")
-    def invA(self, v: torch.Tensor) -> torch.Tensor:
+    def invA(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
         r"""Solve the system of equations :math:`Ax = v` for unknown vector :math:`x`.
 
         Multiple right-hand sides are supported (by simply passing a 2D tensor for `v`)
@@ -173,6 +317,9 @@ class FalkonPreconditioner(Preconditioner):
         ----------
         v
             The right-hand side of the triangular system of equations
+        out
+            Optional tensor with the same shape as `v`, which will hold the solution. It may be
+            `v` itself, in which case no memory is allocated.
 
         Returns
         -------
@@ -184,10 +331,10 @@ class FalkonPreconditioner(Preconditioner):
         :func:`~falkon.preconditioner.pc_utils.trsm` : the function used to solve the system of equations
         """
         inplace_set_diag_th(self.fC, self.dA)
-        return trsm(v, self.fC, alpha=1.0, lower=1, transpose=1)
+        return trsm(v, self.fC, alpha=1.0, lower=1, transpose=1, out=out)
 
     @check_init("fC", "dT", "dA")
-    def invAt(self, v: torch.Tensor) -> torch.Tensor:
+    def invAt(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
         r"""Solve the system of equations :math:`A^\top x = v` for unknown vector :math:`x`.
 
         Multiple right-hand sides are supported (by simply passing a 2D tensor for `v`)
@@ -196,6 +343,9 @@ class FalkonPreconditioner(Preconditioner):
         ----------
         v
             The right-hand side of the triangular system of equations
+        out
+            Optional tensor with the same shape as `v`, which will hold the solution. It may be
+            `v` itself, in which case no memory is allocated.
 
         Returns
         -------
@@ -207,10 +357,10 @@ class FalkonPreconditioner(Preconditioner):
         :func:`falkon.preconditioner.pc_utils.trsm` : the function used to solve the system of equations
         """
         inplace_set_diag_th(self.fC, self.dA)
-        return trsm(v, self.fC, alpha=1.0, lower=1, transpose=0)
+        return trsm(v, self.fC, alpha=1.0, lower=1, transpose=0, out=out)
 
     @check_init("fC", "dT", "dA")
-    def invT(self, v: torch.Tensor) -> torch.Tensor:
+    def invT(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
         r"""Solve the system of equations :math:`Tx = v` for unknown vector :math:`x`.
 
         Multiple right-hand sides are supported (by simply passing a 2D tensor for `v`)
@@ -219,6 +369,9 @@ class FalkonPreconditioner(Preconditioner):
         ----------
         v
             The right-hand side of the triangular system of equations
+        out
+            Optional tensor with the same shape as `v`, which will hold the solution. It may be
+            `v` itself, in which case no memory is allocated.
 
         Returns
         -------
@@ -230,10 +383,10 @@ class FalkonPreconditioner(Preconditioner):
         :func:`falkon.preconditioner.pc_utils.trsm` : the function used to solve the system of equations
         """
         inplace_set_diag_th(self.fC, self.dT)
-        return trsm(v, self.fC, alpha=1.0, lower=0, transpose=0)
+        return trsm(v, self.fC, alpha=1.0, lower=0, transpose=0, out=out)
 
     @check_init("fC", "dT", "dA")
-    def invTt(self, v: torch.Tensor) -> torch.Tensor:
+    def invTt(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
         r"""Solve the system of equations :math:`T^\top x = v` for unknown vector :math:`x`.
 
         Multiple right-hand sides are supported (by simply passing a 2D tensor for `v`)
@@ -242,6 +395,9 @@ class FalkonPreconditioner(Preconditioner):
         ----------
         v
             The right-hand side of the triangular system of equations
+        out
+            Optional tensor with the same shape as `v`, which will hold the solution. It may be
+            `v` itself, in which case no memory is allocated.
 
         Returns
         -------
@@ -253,10 +409,10 @@ class FalkonPreconditioner(Preconditioner):
         :func:`falkon.preconditioner.pc_utils.trsm` : the function used to solve the system of equations
         """
         inplace_set_diag_th(self.fC, self.dT)
-        return trsm(v, self.fC, alpha=1.0, lower=0, transpose=1)
+        return trsm(v, self.fC, alpha=1.0, lower=0, transpose=1, out=out)
 
     @check_init("fC", "dT", "dA")
-    def apply(self, v: torch.Tensor) -> torch.Tensor:
+    def apply(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
         r"""Solve two systems of equations :math:`ATx = v` for unknown vector :math:`x`.
 
         Multiple right-hand sides are supported (by simply passing a 2D tensor for `v`)
@@ -265,20 +421,23 @@ class FalkonPreconditioner(Preconditioner):
         ----------
         v
             The right-hand side of the triangular system of equations
+        out
+            Optional tensor with the same shape as `v`, which will hold the solution. It may be
+            `v` itself, in which case no memory is allocated.
 
         Returns
         -------
         x
-            The solution, computed with the `trsm` function.
+            The solution, computed with the `pc_apply` function.
 
         See Also
         --------
-        :func:`falkon.preconditioner.pc_utils.trsm` : the function used to solve the system of equations
+        :func:`falkon.la_helpers.pc_apply` : the function used to solve both systems of equations in one call
         """
-        return self.invT(self.invA(v))
+        return pc_apply(self.fC, self.dT, self.dA, v, transpose=False, out=out)
 
     @check_init("fC", "dT", "dA")
-    def apply_t(self, v: torch.Tensor) -> torch.Tensor:
+    def apply_t(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
         r"""Solve two systems of equations :math:`A^\top T^\top x = v` for unknown vector :math:`x`.
 
         Multiple right-hand sides are supported (by simply passing a 2D tensor for `v`)
@@ -287,17 +446,154 @@ class FalkonPreconditioner(Preconditioner):
         ----------
         v
             The right-hand side of the triangular system of equations
+        out
+            Optional tensor with the same shape as `v`, which will hold the solution. It may be
+            `v` itself, in which case no memory is allocated.
 
         Returns
         -------
         x
-            The solution, computed with the `trsm` function.
+            The solution, computed with the `pc_apply` function.
 
         See Also
         --------
-        :func:`falkon.preconditioner.pc_utils.trsm` : the function used to solve the system of equations
+        :func:`falkon.la_helpers.pc_apply` : the function used to solve both systems of equations in one call
         """
-        return self.invAt(self.invTt(v))
+        return pc_apply(self.fC, self.dT, self.dA, v, transpose=True, out=out)
+
+    @check_init("fC", "dT", "dA")
+    def apply_inverse(self, v: torch.Tensor) -> torch.Tensor:
+        r"""Compute :math:`ATv`, the inverse of :meth:`apply`.
+
+        This maps coefficients from the parameter space back to the preconditioner space, for
+        example to warm-start the optimizer from a known solution.
+
+        Parameters
+        ----------
+        v
+            The (M x t) matrix to be multiplied.
+
+        Returns
+        -------
+        x
+            The product :math:`ATv`.
+        """
+        v = v.to(device=self.fC.device, dtype=self.fC.dtype)
+        Tv = torch.triu(self.fC, diagonal=1) @ v + self.dT.reshape(-1, 1) * v
+        # lower(fC) = A.T
+        return torch.tril(self.fC, diagonal=-1).T @ Tv + self.dA.reshape(-1, 1) * Tv
 
     def __str__(self):
         return f"FalkonPreconditioner(_lambda={self._lambda}, kernel={self.kernel})"
+
+
+class MultiLambdaFalkonPreconditioner(FalkonPreconditioner):
+    r"""Falkon preconditioner for many regularization parameters at once.
+
+    The factor :math:`T = \mathrm{chol}(K_{MM})` does not depend on the regularization, and is
+    computed only once. Then for each penalty :math:`\lambda_l` we obtain a separate factor
+    :math:`A_l = \mathrm{chol}(\frac{1}{M} T T^\top + \lambda_l)`. The factor for the first penalty
+    is stored in the lower triangle of `fC` (as in :class:`FalkonPreconditioner`), the others in
+    separate `M x M` matrices, so this preconditioner needs one extra `M x M` matrix per penalty.
+
+    All operations which involve `A` act on *stacked* inputs with `L * t` columns (`L` being the
+    number of penalties): the `l`-th block of `t` consecutive columns is associated with
+    penalty :math:`\lambda_l`. Operations with `T` act on all columns together.
+
+    Parameters
+    -----------
+    penalties : Sequence[float]
+        The regularization parameters. Must all be greater than 0.
+    kernel : falkon.kernels.kernel.Kernel
+        The kernel object, used to compute the M*M kernel between inducing points.
+    opt : FalkonOptions
+        Additional options to be used in computing the preconditioner. See
+        :class:`FalkonPreconditioner` for the relevant options.
+    """
+
+    def __init__(self, penalties: Sequence[float], kernel, opt: FalkonOptions):
+        penalties = [float(p) for p in penalties]
+        if len(penalties) == 0:
+            raise ValueError("At least one penalty must be specified.")
+        super().__init__(penalties[0], kernel, opt)
+        self.penalties = penalties
+        # The A factors for penalties[1:] (penalties[0] lives in fC).
+        self.fA: List[torch.Tensor] = []
+
+    @property
+    def num_penalties(self) -> int:
+        return len(self.penalties)
+
+    def init(self, X: Union[torch.Tensor, SparseTensor], weight_vec: Optional[torch.Tensor] = None):
+        self.fA = []
+        super().init(X, weight_vec)
+        # With mixed precision the extra factors must be upcast like fC.
+        self.fA = [fA.to(dtype=self.fC.dtype) for fA in self.fA]
+
+    def _factor_a(self, C: torch.Tensor, penalty: float, weights: Optional[torch.Tensor]) -> torch.Tensor:
+        # lower(C) = T @ T.T is shared by all penalties: factor copies of it first.
+        for extra_penalty in self.penalties[1:]:
+            fA = create_same_stride(C.shape, C, C.dtype, C.device, pin_memory=self._use_cuda)
+            fA.copy_(C)
+            self.fA.append(super()._factor_a(fA, extra_penalty, weights))
+        return super()._factor_a(C, penalty, weights)
+
+    def update(self, penalty: Optional[float] = None, **kwargs):
+        if penalty is not None:
+            raise ValueError("The penalties of a multi-lambda preconditioner cannot be updated.")
+        self.fA = []
+        super().update(**kwargs)
+
+    def to(self, device):
+        super().to(device)
+        self.fA = [fA.to(device) for fA in self.fA]
+        return self
+
+    def split(self, v: torch.Tensor) -> List[torch.Tensor]:
+        """Split a stacked tensor in its blocks of columns, one per penalty."""
+        if v.shape[1] % self.num_penalties != 0:
+            raise ValueError(
+                f"Stacked tensor has {v.shape[1]} columns, which is not a multiple of the "
+                f"number of penalties ({self.num_penalties})."
+            )
+        t = v.shape[1] // self.num_penalties
+        return [v[:, i * t : (i + 1) * t] for i in range(self.num_penalties)]
+
+    def _trsm_a(self, v: torch.Tensor, transpose: int, out: Optional[torch.Tensor] = None) -> torch.Tensor:
+        if out is None:
+            out = create_same_stride(v.shape, v, v.dtype, v.device)
+        for i, (v_blk, out_blk) in enumerate(zip(self.split(v), self.split(out))):
+            if i == 0:
+                inplace_set_diag_th(self.fC, self.dA)
+                fA = self.fC
+            else:
+                fA = self.fA[i - 1]
+            if not is_f_contig(v_blk, strict=False):
+                v_blk = v_blk.contiguous()
+            out_blk.copy_(trsm(v_blk, fA, alpha=1.0, lower=1, transpose=transpose))
+        return out
+
+    @check_init("fC", "dT", "dA")
+    def apply(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
+        r"""Solve :math:`A_l T x_l = v_l` for each block of columns :math:`v_l` of the stacked `v`."""
+        x = self.invT(self.invA(v))
+        return x if out is None else out.copy_(x)
+
+    @check_init("fC", "dT", "dA")
+    def apply_t(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
+        r"""Solve :math:`T^\top A_l^\top x_l = v_l` for each block of columns :math:`v_l` of the stacked `v`."""
+        x = self.invAt(self.invTt(v))
+        return x if out is None else out.copy_(x)
+
+    @check_init("fC", "dT", "dA")
+    def invA(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
+        r"""Solve :math:`A_l x_l = v_l` for each block of columns :math:`v_l` of the stacked `v`."""
+        return self._trsm_a(v, transpose=1, out=out)
+
+    @check_init("fC", "dT", "dA")
+    def invAt(self, v: torch.Tensor, out: Optional[torch.Tensor] = None) -> torch.Tensor:
+        r"""Solve :math:`A_l^\top x_l = v_l` for each block of columns :math:`v_l` of the stacked `v`."""
+        return self._trsm_a(v, transpose=0, out=out)
+
+    def __str__(self):
+        return f"MultiLambdaFalkonPreconditioner(penalties={self.penalties}, kernel={self.kernel})"
@@ -4,7 +4,7 @@ import numpy as np
 import scipy.linalg.blas as sclb
 import torch
 
-from falkon.la_helpers import copy_triang, mul_triang, trsm, vec_mul_triang
+from falkon.la_helpers import copy_triang, triang_affine, trsm, vec_mul_triang
 from falkon.options import FalkonOptions
 from falkon.sparse.sparse_tensor import SparseTensor
 from falkon.utils import TicToc, decide_cuda
@@ -59,6 +59,9 @@ class LogisticPreconditioner(Preconditioner):
             preconditioner on the CPU. If set to False, we fall back to
             the usual CPU/GPU settings (i.e. 'use_cpu' option and the
             availability of a GPU).
+        - pc_reuse_tol : relative change of the weights `W` (at the same penalty) below which
+            the factorization of `A` from the previous call to :meth:`init` is kept. `T` is
+            always computed only once.
 
     See Also
     --------
@@ -79,6 +82,10 @@ class LogisticPreconditioner(Preconditioner):
         self.fC: Optional[torch.Tensor] = None
         self.dT: Optional[torch.Tensor] = None
         self.dA: Optional[torch.Tensor] = None
+        # Weights, penalty and number of points with which A was last factorized
+        self._W: Optional[torch.Tensor] = None
+        self._penalty: Optional[float] = None
+        self._N: Optional[int] = None
 
     def _trmm(self, C: torch.Tensor, alpha: torch.Tensor) -> torch.Tensor:
         alpha_np = alpha.numpy()
@@ -90,6 +97,13 @@ class LogisticPreconditioner(Preconditioner):
         out = trmm(alpha=1.0, a=C.numpy(), b=alpha_np, side=0, lower=0, trans_a=1, diag=0, overwrite_b=1)
         return torch.from_numpy(out)
 
+    def _can_reuse_A(self, W: torch.Tensor, penalty: float, N: int) -> bool:
+        """Whether the current factor A can be kept for the new weights `W` (see `pc_reuse_tol`)."""
+        tol = self.params.pc_reuse_tol
+        if tol <= 0 or self._W is None or penalty != self._penalty or N != self._N:
+            return False
+        return torch.linalg.norm(W - self._W).item() <= tol * torch.linalg.norm(self._W).item()
+
     def check_inputs(self, X, Y):
         if X.is_cuda and not self._use_cuda:
             raise RuntimeError("use_cuda is set to False, but data is CUDA tensor. Check your options.")
@@ -157,11 +171,6 @@ class LogisticPreconditioner(Preconditioner):
                 copy_triang(C, upper=False)
         else:
             C = self.fC
-            if not self._use_cuda:
-                # Copy non-necessary for cuda since LAUUM will do the copying
-                with TicToc("Copy triangular", debug=self.params.debug):
-                    # Copy upper(fC) to lower(fC): lower(fC) = T.T
-                    copy_triang(C, upper=True)  # does not copy the diagonal
             # Setting diagonal necessary for trmm
             C.diagonal().copy_(self.dT)
 
@@ -171,6 +180,18 @@ class LogisticPreconditioner(Preconditioner):
             alpha = self._trmm(C, alpha.clone())
         with TicToc("W (ddf)", debug=self.params.debug):
             W = self.loss.ddf(Y, alpha)
+
+        if self._can_reuse_A(W, penalty, N):
+            # lower(fC) still contains A.T, computed from weights close to `W`.
+            C.diagonal().copy_(self.dA)
+            return
+        self._W, self._penalty, self._N = W.clone(), penalty, N
+
+        if self.fC is not None and not self._use_cuda:
+            # Copy non-necessary for cuda since LAUUM will do the copying
+            with TicToc("Copy triangular", debug=self.params.debug):
+                # Copy upper(fC) to lower(fC): lower(fC) = T.T
+                copy_triang(C, upper=True)  # does not copy the diagonal
         with TicToc("W-Multiply", debug=self.params.debug):
             W.sqrt_()
             vec_mul_triang(C, W.view(-1), side=0, upper=False)
@@ -187,12 +208,10 @@ class LogisticPreconditioner(Preconditioner):
                 # Product lower(fC).T @ lower(fC) : lower(fC) = T @ T.T
                 C = lauum_wrapper(C, upper=False, use_cuda=self._use_cuda, opt=self.params)
 
-        # NOTE: Here the multiplier is 1/N instead of the more common 1/M!
-        mul_triang(C, upper=False, preserve_diag=False, multiplier=1 / N)
-
         with TicToc("Add diag", debug=self.params.debug):
+            # NOTE: Here the multiplier is 1/N instead of the more common 1/M!
             # lower(fC) = 1/N * T@T.T + lambda * I
-            inplace_add_diag_th(C, penalty)
+            triang_affine(C, upper=False, multiplier=1 / N, diag_add=penalty)
 
         with TicToc("Cholesky 2", debug=self.params.debug):
             # Cholesky on lower(fC) : lower(fC) = A.T
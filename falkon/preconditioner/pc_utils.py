@@ -1,11 +1,11 @@
 import functools
 
 import torch
-from scipy.linalg import lapack as scll
 
+from falkon.c_ext import lauum
 from falkon.la_helpers import potrf
 from falkon.options import FalkonOptions
-from falkon.utils.helpers import choose_fn
+from falkon.utils.tensor_helpers import is_f_contig
 
 __all__ = ("check_init", "inplace_set_diag_th", "inplace_add_diag_th", "lauum_wrapper", "potrf_wrapper")
 
@@ -50,12 +50,10 @@ def lauum_wrapper(A: torch.Tensor, upper: bool, use_cuda: bool, opt: FalkonOptio
 
         return gpu_lauum(A, upper=upper, write_opposite=True, overwrite=True, opt=opt)
     else:
-        Anp = A.numpy()
-        lauum = choose_fn(Anp.dtype, scll.dlauum, scll.slauum, "LAUUM")
-        sol, info = lauum(Anp, lower=int(not upper), overwrite_c=1)
-        if info != 0:
-            raise RuntimeError(f"Lapack LAUUM failed with error code {info}.")
-        return torch.from_numpy(sol)
+        # Native multithreaded kernel, works in-place for both F and C-contiguous inputs.
+        ld = A.stride(1) if is_f_contig(A) else A.stride(0)
+        lauum(n=A.shape[0], A=A, lda=ld, B=A, ldb=ld, lower=not upper)
+        return A
 
 
 def potrf_wrapper(A: torch.Tensor, clean: bool, upper: bool, use_cuda: bool, opt: FalkonOptions) -> torch.Tensor:
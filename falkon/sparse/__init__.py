@@ -1,11 +1,14 @@
-from .sparse_ops import bdot, sparse_matmul, sparse_norm, sparse_square_norm
+from .sparse_ops import SpgemmPlan, bdot, sparse_matmul, sparse_norm, sparse_square_norm
+from .sliced_ell import SlicedEllTensor
 from .sparse_tensor import SparseTensor, SparseType
 
 __all__ = (
     "SparseTensor",
     "SparseType",
+    "SlicedEllTensor",
     "sparse_norm",
     "sparse_matmul",
     "sparse_square_norm",
     "bdot",
+    "SpgemmPlan",
 )
@@ -0,0 +1,157 @@
+from typing import Tuple
+
+import torch
+
+from falkon.sparse.sparse_tensor import SparseTensor
+
+
+class SlicedEllTensor:
+    """Sparse 2D matrix in the sliced-ELLPACK format, for the row-wise sparse kernels on the GPU.
+
+    The rows of the matrix are sorted by their number of non-zeros, and split in slices of
+    `slice_size` consecutive (sorted) rows. Each slice is padded to the length of its longest
+    row, and stored column-major: the `k`-th non-zero of the `l`-th row in slice `s` is at
+    position ``slice_ptr[s] + k * slice_size + l`` of the `index` and `data` arrays. Padding
+    entries have index -1 (and value 0), and always come after the actual non-zeros of a row.
+
+    Since all rows of a slice have similar lengths, threads which process the rows of a slice
+    in lockstep do similar amounts of work, and read the non-zeros with contiguous accesses.
+
+    Objects of this class should be created with :meth:`from_csr`.
+
+    Parameters
+    ----------
+    slice_ptr : torch.Tensor
+        Array of length ``num_slices + 1``, with the offset of each slice in `index` and `data`.
+    index : torch.Tensor
+        Column indices of the (padded) non-zero elements.
+    data : torch.Tensor
+        Values of the (padded) non-zero elements.
+    row_perm : torch.Tensor
+        Original row index of each sorted row.
+    size : Tuple[int, int]
+        Shape of the 2D tensor (rows, columns).
+    slice_size : int
+        Number of rows in each slice.
+    """
+
+    def __init__(
+        self,
+        slice_ptr: torch.Tensor,
+        index: torch.Tensor,
+        data: torch.Tensor,
+        row_perm: torch.Tensor,
+        size: Tuple[int, int],
+        slice_size: int,
+    ):
+        if slice_ptr.shape[0] - 1 != (size[0] + slice_size - 1) // slice_size:
+            raise ValueError("Data is not in correct sliced-ELL format. Incorrect slice_ptr size.")
+        if row_perm.shape[0] != size[0]:
+            raise ValueError("Data is not in correct sliced-ELL format. Incorrect row_perm size.")
+        if index.shape[0] != data.shape[0]:
+            raise ValueError("Data is not in correct format. Different sizes for index and values.")
+        dev = data.device
+        if index.device != dev or slice_ptr.device != dev or row_perm.device != dev:
+            raise ValueError("Cannot create SlicedEllTensor with components on different devices.")
+
+        self.slice_ptr = slice_ptr
+        self.index = index
+        self.data = data
+        self.row_perm = row_perm
+        self.slice_size = slice_size
+        self._size = size
+
+    @property
+    def shape(self):
+        return self._size
+
+    def size(self, dim=None):
+        if dim is None:
+            return self._size
+        return self._size[dim]
+
+    @property
+    def dtype(self) -> torch.dtype:
+        return self.data.dtype
+
+    @property
+    def device(self) -> torch.device:
+        return self.data.device
+
+    @property
+    def is_cuda(self) -> bool:
+        return self.data.is_cuda
+
+    @property
+    def is_csr(self):
+        return False
+
+    @property
+    def is_csc(self):
+        return False
+
+    def padded_nnz(self) -> int:
+        """Number of stored elements, including padding."""
+        return self.data.numel()
+
+    def to(self, dtype=None, device=None, non_blocking=False) -> "SlicedEllTensor":
+        if dtype is None:
+            dtype = self.dtype
+        if device is None:
+            device = self.device
+        new_data = self.data.to(dtype=dtype, device=device, non_blocking=non_blocking)
+        new_slice_ptr = self.slice_ptr.to(device=device, non_blocking=non_blocking)
+        new_index = self.index.to(device=device, non_blocking=non_blocking)
+        new_row_perm = self.row_perm.to(device=device, non_blocking=non_blocking)
+        return SlicedEllTensor(
+            slice_ptr=new_slice_ptr,
+            index=new_index,
+            data=new_data,
+            row_perm=new_row_perm,
+            size=self.shape,
+            slice_size=self.slice_size,
+        )
+
+    @staticmethod
+    def from_csr(mat: SparseTensor, slice_size: int = 32) -> "SlicedEllTensor":
+        """Convert a CSR matrix to the sliced-ELL format, on the same device as the input.
+
+        The index dtype of `mat` is preserved. For the GPU kernels `slice_size` must be left
+        to its default (the warp size), and the column indices of `mat` must be sorted within
+        each row.
+        """
+        if not mat.is_csr:
+            raise ValueError("Only CSR matrices can be converted to the sliced-ELL format.")
+        dev, index_dtype = mat.device, mat.index.dtype
+        n = mat.shape[0]
+        num_slices = (n + slice_size - 1) // slice_size
+
+        indexptr = mat.indexptr.to(dtype=torch.long)
+        row_len = indexptr[1:] - indexptr[:-1]
+        row_perm = torch.argsort(row_len, descending=True, stable=True)
+        # Rows are sorted by decreasing length: the width of a slice is the length of its first row.
+        width = row_len[row_perm[::slice_size]]
+        slice_ptr = torch.zeros(num_slices + 1, dtype=torch.long, device=dev)
+        slice_ptr[1:] = torch.cumsum(width * slice_size, dim=0)
+
+        total = int(slice_ptr[-1].item())
+        index = torch.full((total,), -1, dtype=index_dtype, device=dev)
+        data = torch.zeros(total, dtype=mat.dtype, device=dev)
+        if mat.nnz() > 0:
+            sorted_pos = torch.empty_like(row_perm)
+            sorted_pos[row_perm] = torch.arange(n, device=dev)
+            nz_row = torch.repeat_interleave(torch.arange(n, device=dev), row_len)
+            nz_pos = sorted_pos[nz_row]
+            nz_k = torch.arange(mat.nnz(), device=dev) - indexptr[nz_row]
+            dest = slice_ptr[nz_pos // slice_size] + nz_k * slice_size + nz_pos % slice_size
+            index[dest] = mat.index
+            data[dest] = mat.data
+
+        return SlicedEllTensor(
+            slice_ptr=slice_ptr.to(dtype=index_dtype),
+            index=index,
+            data=data,
+            row_perm=row_perm.to(dtype=index_dtype),
+            size=mat.shape,
+            slice_size=slice_size,
+        )
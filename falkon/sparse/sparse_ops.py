@@ -1,14 +1,71 @@
-import warnings
-from typing import Optional
+import threading
+from typing import List, Optional, Union
 
 import torch
 
-from falkon.c_ext import sparse_bdot, sparse_row_norm, sparse_row_norm_sq
+from falkon.c_ext import sell_csr_dot, sparse_bdot, sparse_row_norm, sparse_row_norm_sq
+from falkon.sparse.sliced_ell import SlicedEllTensor
 from falkon.sparse.sparse_tensor import SparseTensor
 from falkon.utils.helpers import check_same_dtype
 from falkon.utils.tensor_helpers import is_f_contig
 
-__all__ = ("sparse_matmul", "sparse_square_norm", "sparse_norm", "bdot")
+__all__ = ("sparse_matmul", "sparse_square_norm", "sparse_norm", "bdot", "SpgemmPlan")
+
+
+class SpgemmPlan:
+    """State shared between many sparse*sparse products on the same CUDA device.
+
+    The workspaces needed by cuSPARSE are kept across calls (and only grown when a larger
+    product needs them), instead of being allocated again at every call. A plan is used by
+    :func:`sparse_matmul` while it is active, which is as long as the ``with`` block entered
+    on the plan, in the current thread.
+
+    Parameters
+    ----------
+    device
+        The CUDA device on which the products will run.
+
+    Examples
+    --------
+    >>> with SpgemmPlan("cuda:0"):
+    ...     for A, B, out in tiles:
+    ...         sparse_matmul(A, B, out)
+    """
+
+    _active = threading.local()
+
+    def __init__(self, device: Union[str, torch.device]):
+        self.device = torch.device(device)
+        self.workspace1 = torch.empty(0, dtype=torch.uint8, device=self.device)
+        self.workspace2 = torch.empty(0, dtype=torch.uint8, device=self.device)
+
+    @staticmethod
+    def _stack() -> List["SpgemmPlan"]:
+        if not hasattr(SpgemmPlan._active, "stack"):
+            SpgemmPlan._active.stack = []
+        return SpgemmPlan._active.stack
+
+    @staticmethod
+    def current(device: torch.device) -> Optional["SpgemmPlan"]:
+        """The innermost active plan for `device` in the current thread, if there is one."""
+        for plan in reversed(SpgemmPlan._stack()):
+            if plan.device == device:
+                return plan
+        return None
+
+    def spspmm(self, A: SparseTensor, B: SparseTensor):
+        from falkon.c_ext import spspmm_ws
+
+        return spspmm_ws(
+            A.indexptr, A.index, A.data, B.indexptr, B.index, B.data, B.shape[1], self.workspace1, self.workspace2
+        )
+
+    def __enter__(self):
+        SpgemmPlan._stack().append(self)
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        SpgemmPlan._stack().remove(self)
 
 
 def _sparse_matmul_cpu(A: SparseTensor, B: SparseTensor, out: torch.Tensor):
@@ -45,11 +102,17 @@ def _sparse_matmul_cpu(A: SparseTensor, B: SparseTensor, out: torch.Tensor):
             except:  # noqa: E722
                 pass
     except ImportError:
-        warnings.warn("Failed to load MKL. Using Scipy sparse matrix multiplication instead.")
-        As = A.to_scipy(copy=False)
-        Bs = B.to_scipy(copy=False)
-        out_sp = As.dot(Bs)
-        out_sp.todense(out=out.numpy())
+        # Native kernels: spspmm needs both matrices in CSR format, csr2dense writes directly into
+        # `out` (either C or F-contiguous).
+        from falkon.c_ext import csr2dense, spspmm
+
+        Bs = B.to_scipy(copy=False).tocsr()
+        B_indexptr = torch.from_numpy(Bs.indptr).to(A.indexptr.dtype)
+        B_index = torch.from_numpy(Bs.indices).to(A.indexptr.dtype)
+        out_indexptr, out_index, out_data = spspmm(
+            A.indexptr, A.index, A.data, B_indexptr, B_index, torch.from_numpy(Bs.data), B.shape[1]
+        )
+        csr2dense(out_indexptr, out_index, out_data, out)
     return out
 
 
@@ -82,13 +145,35 @@ def _sparse_matmul_cuda(A: SparseTensor, B: SparseTensor, out: torch.Tensor):
         raise ValueError("out must be F-contiguous")
 
     # 1. MatMul
-    out_indexptr, out_index, out_data = spspmm(A.indexptr, A.index, A.data, B.indexptr, B.index, B.data, B.shape[1])
+    plan = SpgemmPlan.current(out.device)
+    if plan is not None:
+        out_indexptr, out_index, out_data = plan.spspmm(A, B)
+    else:
+        out_indexptr, out_index, out_data = spspmm(
+            A.indexptr, A.index, A.data, B.indexptr, B.index, B.data, B.shape[1]
+        )
     # 2. Convert to dense
     out = csr2dense(out_indexptr, out_index, out_data, out)
     return out
 
 
-def sparse_matmul(A: SparseTensor, B: SparseTensor, out: torch.Tensor) -> torch.Tensor:
+def _sparse_matmul_sell(A: SlicedEllTensor, B: SparseTensor, out: torch.Tensor):
+    """
+    Inputs:
+     - A : N x D, sliced-ELL matrix
+     - B : D x M, CSC matrix (whose arrays are the CSR representation of B^T)
+
+    Each entry of the output is the dot-product between a row of `A` and a column of `B`,
+    written directly into `out` (which may be C or F-contiguous).
+    """
+    if not B.is_csc:
+        raise ValueError("B must be CSC matrix")
+    if A.device != B.device or A.device != out.device:
+        raise ValueError("All inputs must be on the same device")
+    return sell_csr_dot(A.slice_ptr, A.index, A.data, A.row_perm, A.slice_size, B.indexptr, B.index, B.data, out)
+
+
+def sparse_matmul(A: Union[SparseTensor, SlicedEllTensor], B: SparseTensor, out: torch.Tensor) -> torch.Tensor:
     """Sparse*Sparse matrix multiplication. Output will be copied into dense `out` matrix.
 
     This function can be applied to CPU or CUDA tensors (but all tensors must
@@ -96,8 +181,9 @@ def sparse_matmul(A: SparseTensor, B: SparseTensor, out: torch.Tensor) -> torch.
 
     Parameters
     ----------
-    A : SparseTensor
-        N x D, sparse matrix.
+    A : SparseTensor or SlicedEllTensor
+        N x D, sparse matrix. If in the sliced-ELL format, `B` must be a CSC matrix with row
+        indices sorted within each column.
     B : SparseTensor
         D x M, sparse matrix
     out : torch.Tensor
@@ -109,6 +195,8 @@ def sparse_matmul(A: SparseTensor, B: SparseTensor, out: torch.Tensor) -> torch.
         The same tensor as the input `out` parameter.
 
     """
+    if isinstance(A, SlicedEllTensor):
+        return _sparse_matmul_sell(A, B, out)
     if A.nnz() == 0 or B.nnz() == 0:
         out.fill_(0.0)
         return out
@@ -137,10 +225,6 @@ def sparse_square_norm(A: SparseTensor, out: torch.Tensor) -> torch.Tensor:
     -------
     out : torch.Tensor
         The same tensor as the input `out` parameter.
-
-    Notes
-    -----
-    This function is currently limited to CPU input tensors.
     """
     if out is None:
         out = torch.empty(A.shape[0], 1, dtype=A.dtype, device=A.device)
@@ -170,10 +254,6 @@ def sparse_norm(A: SparseTensor, out: Optional[torch.Tensor]) -> torch.Tensor:
     -------
     out : torch.Tensor
         The same tensor as the input `out` parameter.
-
-    Notes
-    -----
-    This function is currently limited to CPU input tensors.
     """
     if out is None:
         out = torch.empty(A.shape[0], 1, dtype=A.dtype, device=A.device)
@@ -206,8 +286,8 @@ def bdot(A: SparseTensor, B: SparseTensor, out: Optional[torch.Tensor]) -> torch
         out = torch.empty(A.shape[0], 1, dtype=A.dtype, device=A.device)
     if not (A.is_csr and B.is_csr):
         raise RuntimeError("Batch dot can only be applied on CSR tensors.")
-    if A.is_cuda or B.is_cuda:
-        raise NotImplementedError("Batch dot has not been implemented for sparse CUDA tensors")
+    if A.device != B.device:
+        raise RuntimeError("Batch dot can only be applied on matrices on the same device.")
     if not check_same_dtype(A, B, out):
         raise ValueError("All data-types must match.")
     if A.shape[0] != out.shape[0]:
@@ -187,11 +187,26 @@ class SparseTensor:
             sparse_type=self.sparse_type,
         )
 
-    def index_to_int_(self):
+    def _check_int32_nnz(self):
+        if self.nnz() > torch.iinfo(torch.int32).max:
+            raise ValueError(f"Cannot use int32 indices for a sparse matrix with {self.nnz()} non-zeros.")
+
+    def index_to_int_(self) -> "SparseTensor":
+        """Convert the indices of this matrix to int32, in place.
+
+        The sparse matrix-multiplication kernels used on the GPU only work with int32 indices,
+        so calling this method once (e.g. on the training data) avoids converting the indices
+        of every tile of the matrix at every matrix-vector product.
+        """
+        self._check_int32_nnz()
         self.indexptr = self.indexptr.to(dtype=torch.int32)
         self.index = self.index.to(dtype=torch.int32)
+        return self
 
-    def index_to_int(self):
+    def index_to_int(self) -> "SparseTensor":
+        if self.index.dtype == torch.int32 and self.indexptr.dtype == torch.int32:
+            return self
+        self._check_int32_nnz()
         new_index = self.index.to(dtype=torch.int32)
         new_indexptr = self.indexptr.to(dtype=torch.int32)
         return SparseTensor(
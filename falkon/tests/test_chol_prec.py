@@ -116,6 +116,25 @@ class TestFalkonPreconditioner:
         assert_invariant_on_T(prec, gram, tol=rtol * 10)
         assert_invariant_on_prec(prec, N, gram, la, tol=rtol * 10)
 
+    def test_mixed_precision(self, mat, kernel, gram, cpu, rtol):
+        opt = dataclasses.replace(self.basic_opt, use_cpu=cpu, cpu_preconditioner=cpu, pc_mixed_precision=True)
+        rtol = rtol[np.float32]
+
+        mat = fix_mat(mat, dtype=np.float64, order="F", copy=True)
+        gram = fix_mat(gram, dtype=np.float64, order="F", copy=True)
+
+        la = 100
+        prec = FalkonPreconditioner(la, kernel, opt)
+        prec.init(mat)
+        # Factors are computed in single precision, but stored in double precision.
+        assert prec.fC.dtype == torch.float64
+        assert prec.dT.dtype == torch.float64
+        assert prec.dA.dtype == torch.float64
+        assert_invariant_on_TT(prec, gram, tol=rtol)
+        assert_invariant_on_AT(prec, gram, la, tol=rtol)
+        assert_invariant_on_T(prec, gram, tol=rtol * 10)
+        assert_invariant_on_prec(prec, N, gram, la, tol=rtol * 10)
+
     def test_zero_lambda(self, mat, kernel, gram, cpu, rtol):
         opt = dataclasses.replace(self.basic_opt, use_cpu=cpu, cpu_preconditioner=cpu)
         mat = fix_mat(mat, dtype=np.float64, order="K", copy=True)
@@ -129,6 +148,45 @@ class TestFalkonPreconditioner:
         assert_invariant_on_T(prec, gram, tol=1e-9)
         assert_invariant_on_prec(prec, N, gram, la, tol=1e-8)
 
+    def test_update(self, mat, kernel, gram, cpu, rtol):
+        opt = dataclasses.replace(self.basic_opt, use_cpu=cpu, cpu_preconditioner=cpu)
+        rtol = rtol[np.float64]
+        mat = fix_mat(mat, dtype=np.float64, order="F", copy=True)
+        gram = fix_mat(gram, dtype=np.float64, order="F", copy=True)
+
+        # New penalty: only A changes
+        prec = FalkonPreconditioner(100, kernel, opt)
+        prec.init(mat)
+        prec.update(penalty=10)
+        assert_invariant_on_TT(prec, gram, tol=rtol)
+        assert_invariant_on_AT(prec, gram, 10, tol=rtol)
+        assert_invariant_on_prec(prec, N, gram, 10, tol=rtol * 10)
+
+        # Add centers: from the first 90 to all centers
+        prec = FalkonPreconditioner(10, kernel, opt)
+        prec.init(mat[:90])
+        prec.update(centers=mat[:90], new_centers=mat[90:])
+        assert prec.fC.shape == (M, M)
+        assert_invariant_on_TT(prec, gram, tol=rtol)
+        assert_invariant_on_AT(prec, gram, 10, tol=rtol)
+        assert_invariant_on_prec(prec, N, gram, 10, tol=rtol * 10)
+
+        # Remove centers
+        remove_idx = torch.tensor([3, 50, 99])
+        keep = np.setdiff1d(np.arange(M), remove_idx.numpy())
+        sub_gram = fix_mat(gram.numpy()[np.ix_(keep, keep)], dtype=np.float64, order="F")
+        prec = FalkonPreconditioner(10, kernel, opt)
+        prec.init(mat)
+        prec.update(remove_idx=remove_idx)
+        assert prec.fC.shape == (M - 3, M - 3)
+        assert_invariant_on_TT(prec, sub_gram, tol=rtol)
+        assert_invariant_on_AT(prec, sub_gram, 10, tol=rtol)
+        assert_invariant_on_prec(prec, N, sub_gram, 10, tol=rtol * 10)
+
+        # apply_inverse inverts apply
+        v = torch.randn(M - 3, 2, dtype=torch.float64)
+        np.testing.assert_allclose(prec.apply(prec.apply_inverse(v)).cpu().numpy(), v.numpy(), rtol=1e-8, atol=1e-8)
+
 
 @pytest.mark.parametrize("order", ["C", "F"])
 @pytest.mark.parametrize("dtype", [np.float32, pytest.param(np.float64, marks=pytest.mark.full())])
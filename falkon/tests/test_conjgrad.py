@@ -7,9 +7,10 @@ import logging
 
 from falkon.center_selection import UniformSelector
 from falkon.kernels import GaussianKernel, PrecomputedKernel
+from falkon.mmv_ops.data_cache import find_data_cache
 from falkon.optim.conjgrad import ConjugateGradient, FalkonConjugateGradient
-from falkon.options import FalkonOptions
-from falkon.preconditioner import FalkonPreconditioner
+from falkon.options import ConjugateGradientOptions, FalkonOptions
+from falkon.preconditioner import FalkonPreconditioner, MultiLambdaFalkonPreconditioner
 from falkon.tests.gen_random import gen_random, gen_random_pd
 from falkon.utils import decide_cuda
 from falkon.utils.tensor_helpers import create_same_stride, move_tensor
@@ -69,6 +70,21 @@ class TestConjugateGradient:
         expected = np.linalg.solve(mat.cpu().numpy(), vec_rhs.cpu().numpy())
         np.testing.assert_allclose(expected, x.cpu().numpy(), rtol=1e-6)
 
+    def test_pipelined(self, mat, vec_rhs, order, device):
+        if order == "F":
+            mat = torch.from_numpy(np.asfortranarray(mat.numpy()))
+            vec_rhs = torch.from_numpy(np.asfortranarray(vec_rhs.numpy()))
+        mat = move_tensor(mat, device)
+        vec_rhs = move_tensor(vec_rhs, device)
+        conjgrad = ConjugateGradient(ConjugateGradientOptions(cg_pipelined=True, cg_tolerance=1e-10))
+
+        x = conjgrad.solve(X0=None, B=vec_rhs, mmv=lambda x_: mat @ x_, max_iter=50, callback=None)
+
+        assert str(x.device) == device, "Device has changed unexpectedly"
+        assert x.stride() == vec_rhs.stride(), "Stride has changed unexpectedly"
+        expected = np.linalg.solve(mat.cpu().numpy(), vec_rhs.cpu().numpy())
+        np.testing.assert_allclose(expected, x.cpu().numpy(), rtol=1e-6)
+
 
 @pytest.mark.parametrize(
     "device", ["cpu", pytest.param("cuda:0", marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found."))]
@@ -153,6 +169,45 @@ class TestFalkonConjugateGradient:
         alpha = preconditioner.apply(sol)
         np.testing.assert_allclose(expected, alpha.cpu().numpy(), rtol=1e-5)
 
+    def test_pipelined(self, data, centers, kernel, preconditioner, knm, kmm, vec_rhs, device):
+        preconditioner = preconditioner.to(device)
+        options = dataclasses.replace(self.basic_opt, use_cpu=device == "cpu", cg_pipelined=True)
+        opt = FalkonConjugateGradient(kernel, preconditioner, opt=options)
+
+        rhs = knm.T @ vec_rhs
+        lhs = knm.T @ knm + self.penalty * self.N * kmm
+        expected = np.linalg.solve(lhs.numpy(), rhs.numpy())
+
+        data = move_tensor(data, device)
+        centers = move_tensor(centers, device)
+        vec_rhs = move_tensor(vec_rhs, device)
+
+        beta = opt.solve(X=data, M=centers, Y=vec_rhs, _lambda=self.penalty, initial_solution=None, max_iter=100)
+        alpha = preconditioner.apply(beta)
+        np.testing.assert_allclose(expected, alpha.cpu().numpy(), rtol=1e-5)
+
+    def test_cuda_graph(self, data, centers, kernel, preconditioner, knm, kmm, vec_rhs, device):
+        preconditioner = preconditioner.to(device)
+        options = dataclasses.replace(
+            self.basic_opt, use_cpu=device == "cpu", cg_cuda_graph=True, cg_full_gradient_every=3
+        )
+        opt = FalkonConjugateGradient(kernel, preconditioner, opt=options)
+
+        rhs = knm.T @ vec_rhs
+        lhs = knm.T @ knm + self.penalty * self.N * kmm
+        expected = np.linalg.solve(lhs.numpy(), rhs.numpy())
+
+        data = move_tensor(data, device)
+        centers = move_tensor(centers, device)
+        vec_rhs = move_tensor(vec_rhs, device)
+
+        beta = opt.solve(X=data, M=centers, Y=vec_rhs, _lambda=self.penalty, initial_solution=None, max_iter=100)
+        alpha = preconditioner.apply(beta)
+        assert str(beta.device) == device, "Device has changed unexpectedly"
+        assert opt.optimizer.num_iter < 99, "Convergence was not detected"
+        assert kernel.sigma.device.type == "cpu", "The kernel was moved to the GPU"
+        np.testing.assert_allclose(expected, alpha.cpu().numpy(), rtol=1e-5)
+
     def test_precomputed_kernel(self, data, centers, kernel, preconditioner, knm, kmm, vec_rhs, device):
         preconditioner = preconditioner.to(device)
         options = dataclasses.replace(self.basic_opt, use_cpu=device == "cpu")
@@ -173,3 +228,54 @@ class TestFalkonConjugateGradient:
 
         assert str(beta.device) == device, "Device has changed unexpectedly"
         np.testing.assert_allclose(expected, alpha.cpu().numpy(), rtol=1e-5)
+
+    def test_device_data_cache(self, data, centers, kernel, preconditioner, knm, kmm, vec_rhs, device):
+        if device == "cpu":
+            pytest.skip("The data cache is only used with CUDA computations on host data.")
+        # Computations on the GPU, data stays on the host and is (partially) cached on the GPU.
+        options = dataclasses.replace(self.basic_opt, use_cpu=False, cg_device_data_cache=True)
+        opt = FalkonConjugateGradient(kernel, preconditioner, opt=options)
+
+        rhs = knm.T @ vec_rhs
+        lhs = knm.T @ knm + self.penalty * self.N * kmm
+        expected = np.linalg.solve(lhs.numpy(), rhs.numpy())
+
+        beta = opt.solve(X=data, M=centers, Y=vec_rhs, _lambda=self.penalty, initial_solution=None, max_iter=100)
+        alpha = preconditioner.apply(beta)
+        assert find_data_cache(data) is None, "Data cache was not released at the end of CG"
+        np.testing.assert_allclose(expected, alpha.cpu().numpy(), rtol=1e-5)
+
+    def test_multi_lambda(self, data, centers, kernel, knm, kmm, vec_rhs, device):
+        penalties = [self.penalty, 1.0, 0.1]
+        options = dataclasses.replace(self.basic_opt, use_cpu=device == "cpu", cg_differential_convergence=True)
+        preconditioner = MultiLambdaFalkonPreconditioner(penalties, kernel, self.basic_opt)
+        preconditioner.init(centers)
+        preconditioner = preconditioner.to(device)
+        opt = FalkonConjugateGradient(kernel, preconditioner, opt=options)
+
+        data = move_tensor(data, device)
+        centers = move_tensor(centers, device)
+        vec_rhs_dev = move_tensor(vec_rhs, device)
+
+        beta = opt.solve(X=data, M=centers, Y=vec_rhs_dev, _lambda=penalties, initial_solution=None, max_iter=100)
+        assert beta.shape == (self.M, vec_rhs.shape[1] * len(penalties))
+        alphas = preconditioner.split(preconditioner.apply(beta))
+
+        rhs = knm.T @ vec_rhs
+        for penalty, alpha in zip(penalties, alphas):
+            lhs = knm.T @ knm + penalty * self.N * kmm
+            expected = np.linalg.solve(lhs.numpy(), rhs.numpy())
+            np.testing.assert_allclose(expected, alpha.cpu().numpy(), rtol=1e-5)
+
+    def test_multi_lambda_wrong_penalties(self, data, centers, kernel, preconditioner, vec_rhs, device):
+        options = dataclasses.replace(self.basic_opt, use_cpu=device == "cpu")
+        opt = FalkonConjugateGradient(kernel, preconditioner.to(device), opt=options)
+        with pytest.raises(ValueError, match="MultiLambdaFalkonPreconditioner"):
+            opt.solve(
+                X=move_tensor(data, device),
+                M=move_tensor(centers, device),
+                Y=move_tensor(vec_rhs, device),
+                _lambda=[self.penalty, 1.0],
+                initial_solution=None,
+                max_iter=10,
+            )
@@ -6,7 +6,8 @@ from falkon import FalkonOptions
 from falkon.tests.conftest import fix_mat, memory_checker
 from falkon.tests.gen_random import gen_random
 from falkon.utils import decide_cuda
-from falkon.utils.device_copy import copy
+from falkon.utils.device_copy import copy, copy_batch
+from falkon.utils.staging import PinnedStager
 
 n = 10_000
 d = 1000
@@ -133,3 +134,54 @@ def test_wrong_stride(mat, order, in_dev):
     opt = FalkonOptions(max_gpu_mem=0.0)
     with memory_checker(opt), pytest.raises(ValueError):
         copy(in_mat, output)
+
+
+@pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")
+@pytest.mark.parametrize("order", ["F", "C"])
+@pytest.mark.parametrize("in_dev", ["cpu", "cuda"])
+def test_copy_batch(mat, order, in_dev):
+    in_mat: torch.Tensor = fix_mat(mat, np.float64, order, device=in_dev, copy=True, numpy=False)
+    if in_dev == "cpu":
+        in_mat = in_mat.pin_memory()
+    output = torch.empty_strided(in_mat.size(), in_mat.stride(), dtype=in_mat.dtype, device="cuda").fill_(0.0)
+    # Tiles of different shapes and alignments, more than fit in a single kernel launch.
+    tiles = [(slice(0, 1500), slice(0, d)), (slice(1500, 1501), slice(3, 700)), (slice(2000, 5000), slice(1, 2))]
+    tiles.extend((slice(i, i + 7), slice(5, 11)) for i in range(5000, 5350, 7))
+    tiles.append((slice(6000, n - 1), slice(17, 523)))
+
+    copy_batch([in_mat[r, c] for r, c in tiles], [output[r, c] for r, c in tiles])
+    torch.cuda.synchronize()
+    expected = torch.zeros_like(mat)
+    for r, c in tiles:
+        expected[r, c] = mat[r, c]
+    torch.testing.assert_close(expected, output.cpu(), rtol=0, atol=0)
+
+
+@pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")
+@pytest.mark.parametrize("order", ["F", "C"])
+def test_pinned_stager(mat, order):
+    in_mat: torch.Tensor = fix_mat(mat, np.float64, order, device="cpu", copy=True, numpy=False)
+    blocks = [(i, min(1500, n - i)) for i in range(0, n, 1500)]
+    dev = torch.device("cuda:0")
+    output = torch.empty_strided(in_mat.size(), in_mat.stride(), dtype=in_mat.dtype, device=dev)
+    stream = torch.cuda.current_stream(dev)
+
+    with PinnedStager(in_mat, blocks, dev, num_buffers=2) as stager:
+        assert stager.active
+        for i, leni in blocks:
+            tile = stager.get()
+            assert tile.is_pinned() and tile.stride() == in_mat[i : i + leni].stride()
+            copy(tile, output[i : i + leni], non_blocking=True)
+            stager.release(stream)
+    torch.cuda.synchronize(dev)
+    torch.testing.assert_close(in_mat, output.cpu(), rtol=0, atol=0)
+
+
+def test_pinned_stager_no_staging(mat):
+    blocks = [(0, 100), (100, 50)]
+    with PinnedStager(mat, blocks, torch.device("cpu")) as stager:
+        assert not stager.active
+        assert stager.get().data_ptr() == mat[:100].data_ptr()
+        assert stager.get().data_ptr() == mat[100:150].data_ptr()
+        with pytest.raises(IndexError):
+            stager.get()
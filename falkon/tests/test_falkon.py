@@ -13,8 +13,11 @@ from sklearn import datasets
 from falkon import Falkon, kernels
 from falkon.center_selection import FixedSelector
 from falkon.models.incore_falkon import InCoreFalkon
+from falkon.kernels.distance_kernel import FUSED_MAX_D
+from falkon.models.predictor import PredictionServer, Predictor
 from falkon.options import FalkonOptions
 from falkon.utils import decide_cuda
+from falkon.utils.memmap import is_file_backed, load_memmap, save_memmap
 
 logger = logging.getLogger(__name__)
 
@@ -189,6 +192,240 @@ class TestFalkon:
         assert tr_err < ts_err
         assert ts_err < 2.5
 
+    def test_partial_fit(self, reg_data):
+        Xtr, Ytr, Xts, Yts = reg_data
+        opt = FalkonOptions(use_cpu=True, keops_active="no", never_store_kernel=True)
+        kernel = kernels.GaussianKernel(20.0)
+
+        def make_model(centers, penalty, maxiter=50):
+            return Falkon(
+                kernel=kernel,
+                penalty=penalty,
+                M=centers.shape[0],
+                center_selection=FixedSelector(centers),
+                options=opt,
+                maxiter=maxiter,
+            )
+
+        def rel_diff(m1, m2):
+            p1, p2 = m1.predict(Xts), m2.predict(Xts)
+            return (torch.linalg.norm(p1 - p2) / torch.linalg.norm(p2)).item()
+
+        # More data and a new penalty: T is reused, A is recomputed.
+        flk = make_model(Xtr[:100], 1e-4).fit(Xtr[:600], Ytr[:600])
+        flk.penalty = 1e-5
+        flk.partial_fit(Xtr, Ytr)
+        assert rel_diff(flk, make_model(Xtr[:100], 1e-5).fit(Xtr, Ytr)) < 1e-3
+
+        # The optimizer starts from the previous solution.
+        flk.maxiter = 1
+        flk.partial_fit(Xtr, Ytr)
+        assert len(flk.fit_times_) == 1 and len(flk.val_errors_) == 0
+        assert rel_diff(flk, make_model(Xtr[:100], 1e-5).fit(Xtr, Ytr)) < 1e-3
+        assert rel_diff(make_model(Xtr[:100], 1e-5, maxiter=1).fit(Xtr, Ytr), flk) > 1e-2
+
+        # Remove the first two centers, and add twenty new ones.
+        flk.maxiter = 50
+        flk.partial_fit(Xtr, Ytr, add_centers=Xtr[100:120], remove_centers=torch.tensor([0, 1]))
+        assert flk.ny_points_.shape[0] == 118
+        np.testing.assert_allclose(flk.ny_points_.numpy(), Xtr[2:120].numpy())
+        assert rel_diff(flk, make_model(Xtr[2:120], 1e-5).fit(Xtr, Ytr)) < 1e-3
+
+    def test_fit_stream(self, reg_data):
+        Xtr, Ytr, Xts, Yts = reg_data
+        opt = FalkonOptions(use_cpu=True, keops_active="no", never_store_kernel=True)
+        kernel = kernels.GaussianKernel(20.0)
+        centers = FixedSelector(Xtr[:100])
+        flk = Falkon(kernel=kernel, penalty=1e-5, M=100, center_selection=centers, options=opt, maxiter=50)
+        flk.fit(Xtr, Ytr)
+
+        flk_stream = Falkon(kernel=kernel, penalty=1e-5, M=100, center_selection=centers, options=opt, maxiter=50)
+        chunks = ((Xtr[i : i + 150], Ytr[i : i + 150]) for i in range(0, Xtr.shape[0], 150))
+        flk_stream.fit_stream(chunks, tile_rows=64)
+        np.testing.assert_allclose(flk_stream.predict(Xts).numpy(), flk.predict(Xts).numpy(), rtol=1e-4, atol=1e-4)
+
+        with pytest.raises(ValueError):
+            flk_stream.fit_stream(iter([]))
+
+    @pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")
+    def test_cuda_fit_stream(self, reg_data):
+        Xtr, Ytr, Xts, Yts = reg_data
+        kernel = kernels.GaussianKernel(20.0)
+        centers = FixedSelector(Xtr[:100])
+        cpu_opt = FalkonOptions(use_cpu=True, keops_active="no", never_store_kernel=True)
+        flk = Falkon(kernel=kernel, penalty=1e-5, M=100, center_selection=centers, options=cpu_opt, maxiter=50)
+        flk.fit(Xtr, Ytr)
+
+        # The statistics are accumulated with SYRK on the GPU, with a CUDA preconditioner.
+        opt = FalkonOptions(use_cpu=False, keops_active="no", min_cuda_pc_size_64=1, min_cuda_iter_size_64=1)
+        flk_stream = Falkon(kernel=kernel, penalty=1e-5, M=100, center_selection=centers, options=opt, maxiter=50)
+        chunks = ((Xtr[i : i + 150], Ytr[i : i + 150]) for i in range(0, Xtr.shape[0], 150))
+        flk_stream.fit_stream(chunks, tile_rows=64)
+        assert flk_stream.alpha_.device == flk_stream.precond.fC.device
+        np.testing.assert_allclose(
+            flk_stream.predict(Xts).cpu().numpy(), flk.predict(Xts).numpy(), rtol=1e-4, atol=1e-4
+        )
+
+    def test_knm_cache(self, reg_data):
+        Xtr, Ytr, Xts, Yts = reg_data
+        opt = FalkonOptions(use_cpu=True, keops_active="no", never_store_kernel=True)
+        flk = Falkon(kernel=kernels.GaussianKernel(20.0), penalty=1e-6, M=200, seed=10, options=opt, maxiter=10)
+        flk.fit(Xtr, Ytr)
+
+        with tempfile.TemporaryDirectory() as folder:
+            opt_cache = FalkonOptions(use_cpu=True, keops_active="no", knm_cache=True, knm_cache_dir=folder)
+            flk_cache = Falkon(
+                kernel=kernels.GaussianKernel(20.0), penalty=1e-6, M=200, seed=10, options=opt_cache, maxiter=10
+            )
+            flk_cache.fit(Xtr, Ytr)
+            # With `use_cpu` no tile is stored on a GPU.
+            tiered = flk_cache._tiered_knm_kernel(Xtr, flk_cache.ny_points_, available_ram=2**30)
+            assert tiered.device.type == "cpu" and tiered.tier_counts()["gpu"] == 0
+        np.testing.assert_allclose(flk.alpha_.numpy(), flk_cache.alpha_.numpy(), rtol=1e-7, atol=1e-10)
+
+    @pytest.mark.parametrize(
+        "kernel", [kernels.GaussianKernel(20.0), kernels.PolynomialKernel(0.1, 1.0, 2.0)], ids=["fused", "generic"]
+    )
+    @pytest.mark.parametrize(
+        "device,cuda_graph",
+        [
+            ("cpu", False),
+            pytest.param("cuda:0", False, marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")),
+            pytest.param("cuda:0", True, marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")),
+        ],
+    )
+    def test_predictor(self, reg_data, kernel, device, cuda_graph):
+        Xtr, Ytr, Xts, Yts = reg_data
+        opt = FalkonOptions(use_cpu=True, keops_active="no")
+        flk = Falkon(kernel=kernel, penalty=1e-6, M=200, seed=10, options=opt, maxiter=10)
+        flk.fit(Xtr, Ytr)
+        expected = flk.predict(Xts)
+
+        predictor = flk.predictor(device=device, max_batch_size=16, cuda_graph=cuda_graph)
+        # Full batches, a partial batch and a single row
+        preds = predictor(Xts)
+        assert str(preds.device) == device
+        np.testing.assert_allclose(expected.numpy(), preds.cpu().numpy(), rtol=1e-8, atol=1e-8)
+        preds = predictor(Xts[:1])
+        np.testing.assert_allclose(expected[:1].numpy(), preds.cpu().numpy(), rtol=1e-8, atol=1e-8)
+        assert all(p.device.type == "cpu" for p in kernel.parameters()), "The kernel was moved to the device"
+
+    @pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")
+    def test_predictor_high_dim(self):
+        # Above FUSED_MAX_D dimensions the CUDA predictor uses the generic kernel path.
+        kernel = kernels.GaussianKernel(20.0)
+        X = torch.randn(40, FUSED_MAX_D + 1, dtype=torch.float64)
+        centers = torch.randn(30, FUSED_MAX_D + 1, dtype=torch.float64)
+        alpha = torch.randn(30, 2, dtype=torch.float64)
+        expected = kernel.mmv(X, centers, alpha, opt=FalkonOptions(use_cpu=True))
+
+        predictor = Predictor(kernel, centers, alpha, device="cuda:0", max_batch_size=16)
+        assert predictor.fused_type is None
+        np.testing.assert_allclose(expected.numpy(), predictor(X).cpu().numpy(), rtol=1e-8, atol=1e-8)
+
+    def test_prediction_server(self, reg_data):
+        Xtr, Ytr, Xts, Yts = reg_data
+        opt = FalkonOptions(use_cpu=True, keops_active="no")
+        flk = Falkon(kernel=kernels.GaussianKernel(20.0), penalty=1e-6, M=200, seed=10, options=opt, maxiter=10)
+        flk.fit(Xtr, Ytr)
+        expected = flk.predict(Xts)
+
+        num_threads = 4
+        futures = [None] * Xts.shape[0]
+        with PredictionServer(flk.predictor(device="cpu", max_batch_size=16), max_delay_ms=2.0) as server:
+
+            def submit_rows(tid):
+                # Single rows, and a request with several rows
+                for i in range(tid, Xts.shape[0] - 10, num_threads):
+                    futures[i] = server.submit(Xts[i])
+                if tid == 0:
+                    futures[-10] = server.submit(Xts[-10:])
+
+            threads = [threading.Thread(target=submit_rows, args=(tid,)) for tid in range(num_threads)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+            preds = torch.cat([f.result(timeout=10) for f in futures if f is not None], dim=0)
+        np.testing.assert_allclose(expected.numpy(), preds.numpy(), rtol=1e-8, atol=1e-8)
+        with pytest.raises(RuntimeError):
+            server.submit(Xts[0])
+
+    @pytest.mark.parametrize("order", ["C", "F"])
+    def test_memmap_data(self, reg_data, order):
+        Xtr, Ytr, Xts, Yts = reg_data
+        if order == "F":
+            Xtr, Xts = Xtr.T.contiguous().T, Xts.T.contiguous().T
+        opt = FalkonOptions(use_cpu=True, keops_active="no")
+        flk = Falkon(kernel=kernels.GaussianKernel(20.0), penalty=1e-6, M=200, seed=10, options=opt, maxiter=10)
+        flk.fit(Xtr, Ytr)
+        expected = flk.predict(Xts)
+
+        with tempfile.TemporaryDirectory() as folder:
+            save_memmap(os.path.join(folder, "xtr"), Xtr)
+            save_memmap(os.path.join(folder, "xts"), Xts)
+            Xtr_mm = load_memmap(os.path.join(folder, "xtr"))
+            Xts_mm = load_memmap(os.path.join(folder, "xts"))
+            assert is_file_backed(Xtr_mm) and not is_file_backed(Xtr)
+            assert Xtr_mm.stride() == Xtr.stride()
+            np.testing.assert_array_equal(Xtr.numpy(), Xtr_mm.numpy())
+
+            flk_mm = Falkon(kernel=kernels.GaussianKernel(20.0), penalty=1e-6, M=200, seed=10, options=opt, maxiter=10)
+            flk_mm.fit(Xtr_mm, Ytr)
+            np.testing.assert_allclose(expected.numpy(), flk_mm.predict(Xts_mm).numpy(), rtol=1e-8, atol=1e-8)
+
+
+def _distributed_fit_worker(rank, world_size, init_file, Xtr, Ytr, Xts, out_file):
+    import torch.distributed as dist
+
+    dist.init_process_group("gloo", init_method=f"file://{init_file}", rank=rank, world_size=world_size)
+    try:
+        shard = Xtr.shape[0] // world_size
+        X_shard, Y_shard = Xtr[rank * shard : (rank + 1) * shard], Ytr[rank * shard : (rank + 1) * shard]
+        opt = FalkonOptions(use_cpu=True, keops_active="no", distributed=True)
+        flk = Falkon(
+            kernel=kernels.GaussianKernel(20.0),
+            penalty=1e-6,
+            M=100,
+            center_selection=FixedSelector(Xtr[:100]),
+            options=opt,
+            maxiter=10,
+        )
+        flk.fit(X_shard, Y_shard)
+        with open(f"{out_file}.{rank}", "wb") as fh:
+            pickle.dump(flk.predict(Xts), fh)
+    finally:
+        dist.destroy_process_group()
+
+
+class TestDistributedFalkon:
+    def test_same_as_single_process(self, reg_data):
+        Xtr, Ytr, Xts, Yts = reg_data
+        world_size = 2
+        opt = FalkonOptions(use_cpu=True, keops_active="no")
+        flk = Falkon(
+            kernel=kernels.GaussianKernel(20.0),
+            penalty=1e-6,
+            M=100,
+            center_selection=FixedSelector(Xtr[:100]),
+            options=opt,
+            maxiter=10,
+        )
+        flk.fit(Xtr, Ytr)
+        expected = flk.predict(Xts)
+
+        with tempfile.TemporaryDirectory() as folder:
+            out_file = os.path.join(folder, "preds.pkl")
+            torch.multiprocessing.spawn(
+                _distributed_fit_worker,
+                args=(world_size, os.path.join(folder, "init"), Xtr, Ytr, Xts, out_file),
+                nprocs=world_size,
+            )
+            for rank in range(world_size):
+                with open(f"{out_file}.{rank}", "rb") as fh:
+                    preds = pickle.load(fh)
+                np.testing.assert_allclose(expected.numpy(), preds.numpy(), rtol=1e-6)
+
 
 class TestWeightedFalkon:
     @pytest.mark.parametrize(
@@ -6,7 +6,18 @@ import numpy as np
 import pytest
 import torch
 
-from falkon.kernels import GaussianKernel, LaplacianKernel, LinearKernel, MaternKernel, PolynomialKernel
+from falkon import c_ext
+from falkon.kernels import (
+    GaussianKernel,
+    LaplacianKernel,
+    LinearKernel,
+    MaternKernel,
+    PolynomialKernel,
+    TieredKnmKernel,
+)
+from falkon.kernels.distance_kernel import FUSED_GAUSSIAN, FUSED_LAPLACIAN, FUSED_MATERN32, FUSED_MATERN52
+from falkon.la_helpers import square_norm
+from falkon.mmv_ops.fmmv import _dmmv_blk_sizes, _mmv_blk_sizes, reduced_mmv_dtype
 from falkon.mmv_ops.utils import CUDA_EXTRA_MM_RAM
 from falkon.options import FalkonOptions
 from falkon.tests.conftest import fix_mats, memory_checker
@@ -338,6 +349,29 @@ class TestGaussianKernel:
             sigma=sigma,
         )
 
+    @pytest.mark.parametrize("grad_inputs", [(True, True, True, True), (False, True, False, True)])
+    def test_mmv_grad(self, A, B, v, w, sigma, rtol, atol, input_dev, comp_dev, grad_inputs):
+        A, B, v, w, sigma = fix_mats(A, B, v, w, sigma, order="F", device=input_dev, dtype=np.float64)
+        inputs = [t.clone().requires_grad_(rg) for t, rg in zip((A, B, v, sigma), grad_inputs)]
+        kernel = TestGaussianKernel.k_class(inputs[3], opt=basic_options)
+        inputs[3] = kernel.sigma
+
+        grads = kernel.compute_mmv_grad(inputs[0], inputs[1], inputs[2], w)
+        assert len(grads) == 4
+        expected = torch.autograd.grad(
+            kernel.compute_diff(inputs[0], inputs[1], diag=False) @ inputs[2],
+            [t for t in inputs if t.requires_grad],
+            grad_outputs=w,
+        )
+        expected = iter(expected)
+        for ipt, grad in zip(inputs, grads):
+            if not ipt.requires_grad:
+                assert grad is None
+                continue
+            exp_grad = next(expected)
+            assert grad.shape == ipt.shape
+            torch.testing.assert_close(grad, exp_grad, rtol=rtol[A.dtype], atol=atol[A.dtype])
+
     def test_wrong_sigma_dims(self, A, B, v, w, rtol, atol, input_dev, comp_dev):
         sigma = torch.tensor([2.0] * (d - 1), dtype=torch.float64)
         A, B, v, w, sigma = fix_mats(A, B, v, w, sigma, order="F", device=input_dev, dtype=np.float64)
@@ -575,6 +609,26 @@ class TestLargeComputations:
             grad_check=False,
         )
 
+    @pytest.mark.parametrize("num_streams", [1, 3])
+    def test_dense_kernel_pipelined(self, A, B, v, w, rtol, atol, input_dev, comp_dev, num_streams):
+        A, B, v, w, sigma = fix_mats(A, B, v, w, self.sigma, order="F", device=input_dev, dtype=np.float32)
+        opt = dataclasses.replace(
+            self.basic_options, use_cpu=comp_dev == "cpu", keops_active="no", num_fmm_streams=num_streams
+        )
+        run_dense_test(
+            TestGaussianKernel.k_class,
+            TestGaussianKernel.naive_fn,
+            m1=A,
+            m2=B,
+            v=v,
+            w=w,
+            rtol=rtol[A.dtype],
+            atol=atol[A.dtype],
+            opt=opt,
+            sigma=sigma,
+            grad_check=False,
+        )
+
     @keops_mark
     def test_keops_kernel(self, A, B, v, w, sigma, rtol, atol, input_dev, comp_dev):
         A, B, v, w, sigma = fix_mats(A, B, v, w, self.sigma, order="C", device=input_dev, dtype=np.float32)
@@ -694,5 +748,288 @@ class TestBenchmark:
         )
 
 
+@pytest.mark.parametrize("input_dev", ["cpu", pytest.param("cuda:0", marks=[cuda_mark])])
+@pytest.mark.parametrize("order", ["C", "F"])
+@pytest.mark.parametrize("dtype", [np.float32, np.float64])
+@pytest.mark.parametrize(
+    "kernel_type,naive_fn",
+    [
+        (FUSED_GAUSSIAN, lambda X1, X2: naive_diff_gaussian_kernel(X1, X2, torch.tensor([1.0], dtype=X1.dtype))),
+        (FUSED_LAPLACIAN, lambda X1, X2: naive_diff_laplacian_kernel(X1, X2, torch.tensor([1.0], dtype=X1.dtype))),
+        (FUSED_MATERN32, lambda X1, X2: naive_diff_matern_kernel(X1, X2, torch.tensor([1.0], dtype=X1.dtype), 1.5)),
+        (FUSED_MATERN52, lambda X1, X2: naive_diff_matern_kernel(X1, X2, torch.tensor([1.0], dtype=X1.dtype), 2.5)),
+    ],
+    ids=["gaussian", "laplacian", "matern1.5", "matern2.5"],
+)
+def test_fused_distance_kernel(input_dev, order, dtype, kernel_type, naive_fn):
+    # Sizes which are not multiples of the CUDA tile sizes
+    A = torch.from_numpy(gen_random(131, 37, dtype, F=order == "F", seed=12))
+    B = torch.from_numpy(gen_random(70, 37, dtype, F=order == "F", seed=13))
+    expected = naive_fn(A, B)
+    A, B = A.to(input_dev), B.to(input_dev)
+    if order == "F":
+        out = torch.empty(70, 131, dtype=A.dtype, device=input_dev).T
+    else:
+        out = torch.empty(131, 70, dtype=A.dtype, device=input_dev)
+    c_ext.fused_distance_kernel(A, B, square_norm(A, -1, False), square_norm(B, -1, False), kernel_type, out)
+    rtol = 1e-4 if dtype == np.float32 else 1e-10
+    np.testing.assert_allclose(out.cpu().numpy(), expected.numpy(), rtol=rtol, atol=rtol)
+
+
+@pytest.mark.parametrize("input_dev", ["cpu", pytest.param("cuda:0", marks=[cuda_mark])])
+@pytest.mark.parametrize("order", ["C", "F"])
+@pytest.mark.parametrize("dtype", [np.float32, np.float64])
+@pytest.mark.parametrize("kernel_type,nu", [(FUSED_GAUSSIAN, None), (FUSED_LAPLACIAN, None), (FUSED_MATERN52, 2.5)])
+def test_fused_distance_mmv(input_dev, order, dtype, kernel_type, nu):
+    sigma = torch.tensor([1.0], dtype=torch.float64)
+    A = torch.from_numpy(gen_random(131, 37, dtype, F=order == "F", seed=12))
+    B = torch.from_numpy(gen_random(70, 37, dtype, F=order == "F", seed=13))
+    v = torch.from_numpy(gen_random(70, 19, dtype, F=order == "F", seed=14))
+    out = torch.from_numpy(gen_random(131, 19, dtype, F=order == "F", seed=15))
+    if kernel_type == FUSED_GAUSSIAN:
+        ker = naive_diff_gaussian_kernel(A, B, sigma.to(A.dtype))
+    elif kernel_type == FUSED_LAPLACIAN:
+        ker = naive_diff_laplacian_kernel(A, B, sigma.to(A.dtype))
+    else:
+        ker = naive_diff_matern_kernel(A, B, sigma.to(A.dtype), nu)
+    expected = out + ker @ v  # The op accumulates into `out`
+    A, B, v, out = A.to(input_dev), B.to(input_dev), v.to(input_dev), out.to(input_dev)
+    c_ext.fused_distance_mmv(A, B, v, square_norm(A, -1, False), square_norm(B, -1, False), kernel_type, out)
+    rtol = 1e-4 if dtype == np.float32 else 1e-10
+    np.testing.assert_allclose(out.cpu().numpy(), expected.numpy(), rtol=rtol, atol=rtol)
+
+
+@cuda_mark
+@pytest.mark.parametrize("input_dev", ["cpu", "cuda:0"])
+@pytest.mark.parametrize(
+    "kernel",
+    [GaussianKernel(2.0), LaplacianKernel(2.0), MaternKernel(2.0, nu=1.5)],
+    ids=["gaussian", "laplacian", "matern"],
+)
+def test_fused_mmv_option(input_dev, kernel):
+    A = torch.from_numpy(gen_random(2000, 12, np.float64, F=False, seed=21))
+    B = torch.from_numpy(gen_random(300, 12, np.float64, F=False, seed=22))
+    v = torch.from_numpy(gen_random(300, 3, np.float64, F=False, seed=23))
+    expected = kernel.mmv(A, B, v, opt=FalkonOptions(use_cpu=True))
+    # Memory which is not enough to store a full kernel block
+    opt = FalkonOptions(
+        use_cpu=False, keops_active="no", fused_mmv=True, max_gpu_mem=CUDA_EXTRA_MM_RAM + 2000 * 100 * 8
+    )
+    A, B, v = A.to(input_dev), B.to(input_dev), v.to(input_dev)
+    out = kernel.mmv(A, B, v, opt=opt)
+    np.testing.assert_allclose(out.cpu().numpy(), expected.numpy(), rtol=1e-10)
+
+
+@cuda_mark
+@pytest.mark.parametrize("input_dev", ["cpu", "cuda:0"])
+@pytest.mark.parametrize("precision,tol", [("bf16", 2e-2), ("fp16", 5e-3)])
+@pytest.mark.parametrize(
+    "kernel",
+    [GaussianKernel(2.0), LaplacianKernel(2.0), MaternKernel(2.0, nu=1.5)],
+    ids=["gaussian", "laplacian", "matern"],
+)
+def test_reduced_precision_mmv(input_dev, precision, tol, kernel):
+    A = torch.from_numpy(gen_random(2000, 12, np.float32, F=False, seed=21))
+    B = torch.from_numpy(gen_random(300, 12, np.float32, F=False, seed=22))
+    v = torch.from_numpy(gen_random(300, 3, np.float32, F=False, seed=23))
+    cpu_opt = FalkonOptions(use_cpu=True)
+    expected_mmv = kernel.mmv(A, B, v, opt=cpu_opt)
+    expected_dmmv = kernel.dmmv(A, B, v, None, opt=cpu_opt)
+    opt = FalkonOptions(use_cpu=False, keops_active="no", mmv_precision=precision)
+    A, B, v = A.to(input_dev), B.to(input_dev), v.to(input_dev)
+    out_mmv = kernel.mmv(A, B, v, opt=opt)
+    out_dmmv = kernel.dmmv(A, B, v, None, opt=opt)
+    assert out_mmv.dtype == torch.float32 and out_dmmv.dtype == torch.float32
+
+    def rel_err(out, expected):
+        return float(torch.linalg.norm(out.cpu() - expected) / torch.linalg.norm(expected))
+
+    assert rel_err(out_mmv, expected_mmv) < tol
+    assert rel_err(out_dmmv, expected_dmmv) < tol
+
+
+@pytest.mark.parametrize("input_dev", ["cpu", pytest.param("cuda:0", marks=[cuda_mark])])
+@pytest.mark.parametrize("dtype", [torch.bfloat16, torch.float16])
+@pytest.mark.parametrize(
+    "kernel",
+    [GaussianKernel(2.0), LaplacianKernel(2.0), MaternKernel(2.0, nu=1.5)],
+    ids=["gaussian", "laplacian", "matern"],
+)
+def test_reduced_precision_large_norms(input_dev, dtype, kernel):
+    # Points far from the origin, but close to each other: the squared norms (~3e4) are much
+    # larger than the squared distances (~1), which must not be lost to cancellation.
+    A = 100 + torch.from_numpy(gen_random(200, 12, np.float32, F=False, seed=24)) * 0.5
+    B = 100 + torch.from_numpy(gen_random(150, 12, np.float32, F=False, seed=25)) * 0.5
+    A, B = A.to(dtype), B.to(dtype)
+    expected = kernel(A.double(), B.double(), opt=FalkonOptions(use_cpu=True))
+    A, B = A.to(input_dev), B.to(input_dev)
+    out = torch.empty(200, 150, dtype=dtype, device=input_dev)
+    out = kernel.compute(A, B, out, diag=False)
+    assert out.dtype == dtype
+    np.testing.assert_allclose(out.cpu().double().numpy(), expected.numpy(), rtol=2e-2, atol=1e-3)
+
+
+def test_reduced_precision_blk_sizes():
+    # The kernel tiles take half the memory, and the squared distances a fixed-size buffer.
+    kw = {
+        "n": 200_000,
+        "d": 10,
+        "m": 50_000,
+        "t": 1,
+        "avail_mem": 2**30 / 4,
+        "m1_ic": False,
+        "m2_ic": False,
+        "v_ic": False,
+        "out_ic": False,
+        "m1_sparsity": 1.0,
+        "m2_sparsity": 1.0,
+        "dtype": torch.float32,
+        "kernel": GaussianKernel(2.0),
+        "is_differentiable": False,
+        "is_sparse": False,
+    }
+    blk_n, blk_m, _ = _mmv_blk_sizes(**kw)
+    red_blk_n, red_blk_m, _ = _mmv_blk_sizes(**kw, comp_dt=torch.bfloat16)
+    assert red_blk_n * red_blk_m > 1.5 * blk_n * blk_m
+    kw["m"] = 10_000
+    blk_n = _dmmv_blk_sizes(**kw, w_ic=False)[0]
+    red_blk_n = _dmmv_blk_sizes(**kw, w_ic=False, comp_dt=torch.bfloat16)[0]
+    assert red_blk_n > 1.5 * blk_n
+
+
+def test_reduced_precision_wrong_option():
+    kernel = GaussianKernel(2.0)
+    A = torch.randn(10, 3)
+    with pytest.raises(ValueError, match="mmv_precision"):
+        reduced_mmv_dtype(kernel, A, FalkonOptions(mmv_precision="fp8"))
+
+
+@cuda_mark
+def test_workspace_arena_mmv():
+    from falkon.utils import workspace
+
+    kernel = GaussianKernel(2.0)
+    A = torch.from_numpy(gen_random(2000, 12, np.float64, F=False, seed=21))
+    B = torch.from_numpy(gen_random(300, 12, np.float64, F=False, seed=22))
+    v = torch.from_numpy(gen_random(300, 3, np.float64, F=False, seed=23))
+    cpu_opt = FalkonOptions(use_cpu=True)
+    expected_mmv = kernel.mmv(A, B, v, opt=cpu_opt)
+    expected_dmmv = kernel.dmmv(A, B, v, None, opt=cpu_opt)
+    opt = FalkonOptions(use_cpu=False, keops_active="no")
+    dev = torch.device("cuda:0")
+    workspace.enable()
+    try:
+        kernel.mmv(A, B, v, opt=opt)
+        idle = workspace.idle_bytes(dev)
+        assert idle > 0
+        # Repeated calls with the same shapes reuse the slab, instead of allocating new buffers.
+        out_dmmv = kernel.dmmv(A, B, v, None, opt=opt)
+        assert workspace.idle_bytes(dev) >= idle
+        out_mmv = kernel.mmv(A, B, v, opt=opt)
+        assert len(workspace._slabs[0]) == 1
+    finally:
+        workspace.disable()
+    assert workspace.idle_bytes(dev) == 0
+    np.testing.assert_allclose(out_mmv.numpy(), expected_mmv.numpy(), rtol=1e-10)
+    np.testing.assert_allclose(out_dmmv.numpy(), expected_dmmv.numpy(), rtol=1e-10)
+
+
+@pytest.mark.skipif(not decide_cuda() or torch.cuda.device_count() < 2, reason="Fewer than 2 GPUs found.")
+@pytest.mark.parametrize("order", ["F", "C"])
+@pytest.mark.parametrize("out_dev", ["cpu", "cuda:1"])
+def test_dmmv_multi_gpu_reduction(order, out_dev):
+    kernel = GaussianKernel(2.0)
+    A = torch.from_numpy(gen_random(3000, 12, np.float64, F=order == "F", seed=21))
+    B = torch.from_numpy(gen_random(300, 12, np.float64, F=order == "F", seed=22))
+    v = torch.from_numpy(gen_random(300, 4, np.float64, F=order == "F", seed=23))
+    expected = kernel.dmmv(A, B, v, None, opt=FalkonOptions(use_cpu=True))
+    # Data on the host, partial results are summed on the GPUs (directly into `out` if it is on a GPU).
+    opt = FalkonOptions(use_cpu=False, keops_active="no")
+    out = torch.zeros_like(expected).to(out_dev)
+    kernel.dmmv(A, B, v.to(out_dev), None, out=out, opt=opt)
+    assert str(out.device) == out_dev
+    np.testing.assert_allclose(out.cpu().numpy(), expected.numpy(), rtol=1e-10)
+
+
+@pytest.mark.parametrize("use_disk", [True, False], ids=["disk", "recompute"])
+def test_tiered_knm_kernel(tmp_path, use_disk):
+    kernel = GaussianKernel(2.0)
+    X = torch.from_numpy(gen_random(1000, 10, np.float64, F=True, seed=21))
+    C = torch.from_numpy(gen_random(100, 10, np.float64, F=False, seed=22))
+    v = torch.from_numpy(gen_random(100, 3, np.float64, F=False, seed=23))
+    w = torch.from_numpy(gen_random(1000, 3, np.float64, F=False, seed=24))
+    opt = FalkonOptions(use_cpu=True, keops_active="no")
+    # 5 tiles: 2 in RAM and 3 on disk (reading is always faster with infinite bandwidth), or recomputed
+    tiered = TieredKnmKernel(
+        kernel,
+        X,
+        C,
+        tile_rows=200,
+        device="cpu",
+        gpu_mem=0,
+        cpu_mem=2 * 200 * 100 * 8,
+        cache_dir=str(tmp_path) if use_disk else None,
+        disk_bandwidth=float("inf"),
+        opt=opt,
+    )
+    num_disk = 3 if use_disk else 0
+    assert tiered.tier_counts() == {"gpu": 0, "ram": 2, "disk": num_disk, "recompute": 3 - num_disk}
+    assert list(tmp_path.iterdir()) == []  # The cache file is only referenced by its mapping
+
+    np.testing.assert_allclose(tiered.mmv(X, C, v).numpy(), kernel.mmv(X, C, v, opt=opt).numpy(), rtol=1e-10)
+    np.testing.assert_allclose(tiered.mmv(C, X, w).numpy(), kernel.mmv(C, X, w, opt=opt).numpy(), rtol=1e-10)
+    np.testing.assert_allclose(
+        tiered.dmmv(X, C, v, w).numpy(), kernel.dmmv(X, C, v, w, opt=opt).numpy(), rtol=1e-10
+    )
+    np.testing.assert_allclose(
+        tiered.dmmv(X, C, v, None).numpy(), kernel.dmmv(X, C, v, None, opt=opt).numpy(), rtol=1e-10
+    )
+
+
+@keops_mark
+def test_keops_estimate_split_measured():
+    from falkon.mmv_ops.keops import _estimate_split
+
+    N, M, D, T, ds = 100_000, 50_000, 10, 1, 4
+    R = 2**20
+    n, m = _estimate_split(N, M, D, T, R, ds)
+    assert n * (D + T) * ds + m * (D + T) * ds <= R
+    # Measured intermediate memory is accounted for in the splits
+    mem_coef = (1024.0, 16.0, 4.0)
+    n, m = _estimate_split(N, M, D, T, R, ds, mem_coef)
+    assert 1024 + n * ((D + T) * ds + 16) + m * ((D + T) * ds + 4) <= R
+    # Small problems are not split
+    assert _estimate_split(100, 50, D, T, R, ds, mem_coef) == (100, 50)
+
+
+@keops_mark
+def test_keops_warm_cache(tmp_path, monkeypatch):
+    import pykeops
+
+    from falkon.mmv_ops import keops_cache
+
+    # The cache directory is global state: restore it (and the formula memory) after the test.
+    old_build_folder = pykeops.get_build_folder()
+    monkeypatch.setattr(keops_cache, "_cache_dir", None)
+    monkeypatch.setattr(keops_cache, "_memory", {})
+    try:
+        compiled = keops_cache.warm_cache(
+            str(tmp_path), dtypes=[torch.float64], dims=[3], outputs=[2], kernel_names=["gaussian", "linear"]
+        )
+        assert [(c[0], c[2], c[3]) for c in compiled] == [("gaussian", 3, 2), ("linear", 3, 2)]
+        # The fit path uses the cache directory, and gives the same results as the in-core path.
+        opt = dataclasses.replace(basic_options, keops_active="force", keops_cache_dir=str(tmp_path))
+        kernel = GaussianKernel(2.0)
+        A = torch.from_numpy(gen_random(n, d, np.float64, F=False, seed=2))
+        B = torch.from_numpy(gen_random(m, d, np.float64, F=False, seed=3))
+        v = torch.from_numpy(gen_random(m, t, np.float64, F=False, seed=4))
+        expected = kernel.mmv(A, B, v, opt=dataclasses.replace(opt, keops_active="no", use_cpu=True))
+        np.testing.assert_allclose(kernel.mmv(A, B, v, opt=opt).numpy(), expected.numpy(), rtol=1e-7)
+        if decide_cuda():
+            assert (tmp_path / keops_cache._MEMORY_FILE).is_file()
+    finally:
+        pykeops.set_build_folder(old_build_folder)
+
+
 if __name__ == "__main__":
     pytest.main()
@@ -239,6 +239,30 @@ class TestGaussianKernel:
         )
 
 
+@cuda_mark
+def test_sparse_sliced_ell_option(s_A, s_B, v, w, rtol, atol):
+    s_A, d_A = s_A
+    s_B, d_B = s_B
+    s_A, A, s_B, B, v, w, sigma = fix_mats(
+        s_A, d_A, s_B, d_B, v, w, torch.Tensor([3.0]), order="C", device="cpu", dtype=np.float32
+    )
+    opt = dataclasses.replace(basic_options, use_cpu=False, keops_active="no", sparse_sliced_ell=True)
+    run_sparse_test_wsigma(
+        GaussianKernel,
+        naive_diff_gaussian_kernel,
+        s_m1=s_A,
+        s_m2=s_B,
+        m1=A,
+        m2=B,
+        v=v,
+        w=w,
+        rtol=rtol[A.dtype],
+        atol=atol[A.dtype],
+        opt=opt,
+        sigma=sigma,
+    )
+
+
 @pytest.mark.parametrize("input_dev,comp_dev", device_marks)
 class TestMaternKernel:
     naive_fn = naive_diff_matern_kernel
@@ -7,6 +7,8 @@ from falkon import kernels
 from falkon.gsc_losses import LogisticLoss
 from falkon.models.logistic_falkon import LogisticFalkon
 from falkon.options import FalkonOptions
+from falkon.preconditioner import logistic_preconditioner
+from falkon.preconditioner.pc_utils import lauum_wrapper
 
 
 @pytest.fixture
@@ -43,3 +45,38 @@ class TestLogisticFalkon:
         preds = logflk.predict(X)
         err = error_fn(preds, Y)[0]
         assert err < 0.1
+
+    def test_reuse_preconditioner(self, data, monkeypatch):
+        X, Y = data
+        lauum_calls = []
+
+        def counting_lauum_wrapper(*args, **kwargs):
+            lauum_calls.append(1)
+            return lauum_wrapper(*args, **kwargs)
+
+        monkeypatch.setattr(logistic_preconditioner, "lauum_wrapper", counting_lauum_wrapper)
+        kernel = kernels.GaussianKernel(3.0)
+        loss = LogisticLoss(kernel=kernel)
+
+        def error_fn(t, p):
+            return float(100 * torch.sum(t * p <= 0)) / t.shape[0], "c-err"
+
+        opt = FalkonOptions(use_cpu=True, keops_active="no", pc_reuse_tol=0.5)
+
+        logflk = LogisticFalkon(
+            kernel=kernel,
+            loss=loss,
+            penalty_list=[1e-1, 1e-3, 1e-5, 1e-8, 1e-8, 1e-8, 1e-8, 1e-8],
+            iter_list=[3, 3, 3, 3, 8, 8, 8, 8],
+            M=500,
+            seed=10,
+            options=opt,
+            error_fn=error_fn,
+        )
+        logflk.fit(X, Y)
+        # A is factorized (one LAUUM) at least once per distinct penalty, but not at every
+        # one of the repeated-penalty Newton steps.
+        assert 4 <= len(lauum_calls) < 8
+        preds = logflk.predict(X)
+        err = error_fn(preds, Y)[0]
+        assert err < 0.1
@@ -8,7 +8,16 @@ import scipy
 import torch
 
 from falkon.c_ext import copy_transpose
-from falkon.la_helpers import copy_triang, mul_triang, potrf, square_norm, trsm, vec_mul_triang, zero_triang
+from falkon.la_helpers import (
+    copy_triang,
+    mul_triang,
+    potrf,
+    square_norm,
+    triang_affine,
+    trsm,
+    vec_mul_triang,
+    zero_triang,
+)
 from falkon.tests.conftest import fix_mat
 from falkon.tests.gen_random import gen_random, gen_random_pd
 from falkon.utils import decide_cuda
@@ -469,3 +478,59 @@ class TestVecMulTriang:
 
         logger.info("mat size %d - t_cpu: %.4fs -- t_cuda: %.4fs" % (t, np.min(cpu_times), np.min(gpu_times)))
         torch.testing.assert_close(out_cpu, out_cuda.cpu())
+
+
+class TestTriangAffine:
+    t = 120
+
+    @pytest.fixture(scope="class")
+    def mat(self):
+        return torch.from_numpy(gen_random(self.t, self.t, "float64", False, seed=92))
+
+    @pytest.fixture(scope="class")
+    def vecs(self):
+        return (
+            torch.from_numpy(gen_random(self.t, 1, "float64", False, seed=93)).reshape(-1),
+            torch.from_numpy(gen_random(self.t, 1, "float64", False, seed=94)).reshape(-1),
+        )
+
+    @staticmethod
+    def exp_triang_affine(mat, row_vec, col_vec, multiplier, diag_add, upper):
+        exp = mat.clone()
+        tri_mat = mat * multiplier
+        if row_vec is not None:
+            tri_mat *= row_vec.reshape(-1, 1)
+        if col_vec is not None:
+            tri_mat *= col_vec.reshape(1, -1)
+        tri_mat.diagonal().add_(diag_add)
+        if upper:
+            tri_idx = torch.triu_indices(mat.shape[0], mat.shape[1], offset=0)
+        else:
+            tri_idx = torch.tril_indices(mat.shape[0], mat.shape[1], offset=0)
+        exp[tri_idx[0], tri_idx[1]] = tri_mat[tri_idx[0], tri_idx[1]]
+        return exp
+
+    @pytest.mark.parametrize("order", ["F", "C"])
+    @pytest.mark.parametrize("upper", [True, False], ids=["upper", "lower"])
+    @pytest.mark.parametrize("weights", ["none", "row", "col", "both"])
+    @pytest.mark.parametrize(
+        "device", ["cpu", pytest.param("cuda:0", marks=[pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")])]
+    )
+    def test_all_combos(self, mat, vecs, order, device, upper, weights):
+        row_vec = vecs[0] if weights in {"row", "both"} else None
+        col_vec = vecs[1] if weights in {"col", "both"} else None
+        exp_output = self.exp_triang_affine(mat, row_vec, col_vec, 0.3, 2.5, upper)
+
+        mat2 = fix_mat(mat, order=order, dtype=np.float64, numpy=False, device=device, copy=True)
+        if row_vec is not None:
+            row_vec = row_vec.to(device)
+        if col_vec is not None:
+            col_vec = col_vec.to(device)
+        out = triang_affine(
+            mat2, upper=upper, multiplier=0.3, diag_add=2.5, row_multipliers=row_vec, col_multipliers=col_vec
+        ).cpu()
+        torch.testing.assert_close(exp_output, out)
+        if order == "F":
+            assert out.stride(0) == 1, f"Output is not F-contiguous. Found stride {out.stride()}"
+        else:
+            assert out.stride(1) == 1, f"Output is not C-contiguous. Found stride {out.stride()}"
@@ -0,0 +1,85 @@
+import json
+
+import numpy as np
+import pytest
+import torch
+
+import falkon.mmv_ops.autotune as autotune
+from falkon import FalkonOptions
+from falkon.kernels import GaussianKernel
+from falkon.utils import decide_cuda
+
+
+@pytest.fixture
+def cache_dir(tmp_path, monkeypatch):
+    monkeypatch.setenv("FALKON_CACHE_DIR", str(tmp_path))
+    monkeypatch.setattr(autotune, "_mem_cache", None)
+    yield tmp_path
+    autotune._mem_cache = None
+
+
+def test_cache_roundtrip(cache_dir):
+    autotune._cache_put("a", [10, 20])
+    autotune._cache_put("b", [5])
+    with open(cache_dir / autotune._CACHE_FILE_NAME) as fh:
+        assert json.load(fh) == {"a": [10, 20], "b": [5]}
+    # Reload from disk
+    autotune._mem_cache = None
+    assert autotune._cache_get("a") == [10, 20]
+    assert autotune._cache_get("c") is None
+    autotune.clear_cache()
+    assert not (cache_dir / autotune._CACHE_FILE_NAME).exists()
+    assert autotune._cache_get("a") is None
+
+
+def test_corrupt_cache(cache_dir):
+    with open(cache_dir / autotune._CACHE_FILE_NAME, "w") as fh:
+        fh.write("{not json")
+    assert autotune._cache_get("a") is None
+
+
+def test_candidates_fit():
+    def fits(bn, bm):
+        return bn * bm <= 1000 * 1000
+
+    cands = autotune._candidates_nm((1000, 1000), max_n=1500, max_m=800, fits=fits)
+    assert cands[0] == (1000, 800)
+    assert len(set(cands)) == len(cands)
+    for bn, bm in cands:
+        assert 1 <= bn <= 1500 and 1 <= bm <= 800
+        assert fits(bn, bm)
+
+
+@pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")
+def test_tune_uses_cache(cache_dir):
+    dev = torch.device("cuda:0")
+    kernel = GaussianKernel(sigma=1.0)
+
+    def fits(bn, bm):
+        return bn * bm <= 2000 * 2000
+
+    kw = dict(d=10, t=1, max_n=2000, max_m=2000, default=(2000, 2000), fits=fits, m1_ic=False, m2_ic=False, v_ic=False)
+    bn, bm = autotune.tune_mmv_blk_sizes(dev, torch.float32, kernel, **kw)
+    assert fits(bn, bm)
+    autotune._mem_cache = None  # Force reading from disk
+    assert autotune.tune_mmv_blk_sizes(dev, torch.float32, kernel, **kw) == (bn, bm)
+    # Cached value is clipped to the problem size
+    kw.update(max_n=100, max_m=100)
+    bn2, bm2 = autotune.tune_mmv_blk_sizes(dev, torch.float32, kernel, **kw)
+    assert bn2 <= 100 and bm2 <= 100
+
+
+@pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")
+def test_autotuned_mmv(cache_dir):
+    torch.manual_seed(3)
+    X1 = torch.randn(3000, 10, dtype=torch.float64)
+    X2 = torch.randn(500, 10, dtype=torch.float64)
+    v = torch.randn(500, 2, dtype=torch.float64)
+    kernel = GaussianKernel(sigma=2.0)
+    opt = FalkonOptions(use_cpu=False, keops_active="no", max_gpu_mem=2 * 2**20, mmv_autotune=True)
+    expected = kernel.mmv(X1, X2, v, opt=FalkonOptions(use_cpu=True))
+    np.testing.assert_allclose(kernel.mmv(X1, X2, v, opt=opt).numpy(), expected.numpy(), rtol=1e-10)
+    expected = kernel.dmmv(X1, X2, v, None, opt=FalkonOptions(use_cpu=True))
+    np.testing.assert_allclose(kernel.dmmv(X1, X2, v, None, opt=opt).numpy(), expected.numpy(), rtol=1e-10)
+    expected = kernel(X1, X2, opt=FalkonOptions(use_cpu=True))
+    np.testing.assert_allclose(kernel(X1, X2, opt=opt).numpy(), expected.numpy(), rtol=1e-10)
@@ -0,0 +1,28 @@
+import json
+
+import pytest
+
+from falkon import c_ext
+from falkon.utils import decide_cuda
+
+devices = ["cpu", pytest.param("cuda", marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found."))]
+
+
+@pytest.mark.parametrize("device", devices)
+def test_run_benchmarks(device):
+    ops = ["copy_triang", "sparse_norm"]
+    out = json.loads(c_ext.run_benchmarks(ops, [device], [64], 1, 2, 0.05))
+    assert {(p["device"], p["dtype"]) for p in out["peaks"]} == {(device, "float32"), (device, "float64")}
+    # 2 data-types: copy_triang in 2 layouts, sparse_norm in CSR.
+    assert len(out["results"]) == 6
+    for res in out["results"]:
+        assert res["op"] in ops
+        assert "error" not in res, res["error"]
+        assert res["median_ms"] >= res["min_ms"] > 0
+        assert res["gbps"] > 0
+
+
+def test_unknown_op():
+    with pytest.raises(RuntimeError, match="Unknown op"):
+        c_ext.run_benchmarks(["not_an_op"], ["cpu"], [64], 0, 1, 0.05)
+    assert "potrf" in c_ext.benchmark_ops()
@@ -3,7 +3,7 @@ import pytest
 import torch
 
 import falkon
-from falkon.center_selection import UniformSelector
+from falkon.center_selection import LeverageScoreSelector, UniformSelector
 from falkon.tests.gen_random import gen_random, gen_sparse_matrix
 from falkon.utils import decide_cuda
 
@@ -122,5 +122,31 @@ def test_with_y(uniform_sel, colmaj_arr):
     assert len(idx) == cY.shape[0]
 
 
+@pytest.mark.parametrize("order", ["C", "F"])
+def test_leverage_score_selector(rowmaj_arr, colmaj_arr, order):
+    X = rowmaj_arr if order == "C" else colmaj_arr
+    Y = torch.arange(M, dtype=X.dtype).reshape(-1, 1)
+    opt = falkon.FalkonOptions(use_cpu=True, keops_active="no")
+    sel = LeverageScoreSelector(0, num_centers, falkon.kernels.GaussianKernel(5.0), penalty=1e-4, opt=opt)
+    centers, cY, idx = sel.select_indices(X, Y)
+    assert centers.size() == (num_centers, D)
+    assert centers.stride() == ((D, 1) if order == "C" else (1, num_centers))
+    assert len(np.unique(idx.numpy())) == num_centers
+    np.testing.assert_array_equal(centers.numpy(), X[idx].numpy())
+    np.testing.assert_array_equal(cY.numpy(), Y[idx].numpy())
+
+
+def test_leverage_scores_favor_isolated_points():
+    # A tight cluster of 900 points, and 100 isolated points with much higher leverage scores.
+    rng = np.random.default_rng(3)
+    X = np.concatenate((rng.normal(scale=0.01, size=(900, 5)), rng.uniform(-20, 20, size=(100, 5))))
+    X = torch.from_numpy(X)
+    opt = falkon.FalkonOptions(use_cpu=True, keops_active="no")
+    sel = LeverageScoreSelector(0, 50, falkon.kernels.GaussianKernel(1.0), penalty=1e-3, opt=opt)
+    _, idx = sel.select_indices(X, None)
+    # Uniform sampling would select about 10% of isolated points.
+    assert (idx >= 900).float().mean() > 0.25
+
+
 if __name__ == "__main__":
     pytest.main(args=[__file__])
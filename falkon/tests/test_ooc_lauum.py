@@ -10,7 +10,9 @@ from falkon.options import FalkonOptions
 from falkon.tests.conftest import fix_mat, memory_checker
 from falkon.utils import decide_cuda
 from falkon.utils.helpers import sizeof_dtype
-from falkon.utils.tensor_helpers import move_tensor
+from falkon.utils.tensor_helpers import is_f_contig, move_tensor
+
+from falkon.c_ext import lauum
 
 if decide_cuda():
     from falkon.c_ext import lauum_cuda
@@ -239,5 +241,43 @@ class TestLauumKernel:
             np.testing.assert_allclose(np.triu(expected_upper), gpu_out_strided.cpu().numpy(), rtol=self.rtol[dtype])
 
 
+@pytest.mark.parametrize("dtype", [np.float32, pytest.param(np.float64, marks=pytest.mark.full())])
+@pytest.mark.parametrize("order", ["F", "C"])
+@pytest.mark.parametrize("lower", [True, False], ids=["lower", "upper"])
+class TestCpuLauumKernel:
+    rtol = {np.float64: 1e-12, np.float32: 1e-5}
+
+    @staticmethod
+    def _ld(mat):
+        return mat.stride(1) if is_f_contig(mat) else mat.stride(0)
+
+    def test_lauum(self, dtype, order, get_mat, expected_lower, expected_upper, lower):
+        mat = get_mat(order=order, dtype=dtype)
+        out = torch.zeros_like(mat)
+        omat = mat.clone()
+
+        lauum(n=mat.shape[0], A=mat, lda=self._ld(mat), B=out, ldb=self._ld(out), lower=lower)
+
+        np.testing.assert_allclose(omat.numpy(), mat.numpy())
+        if lower:
+            np.testing.assert_allclose(np.tril(expected_lower), out.numpy(), rtol=self.rtol[dtype])
+        else:
+            np.testing.assert_allclose(np.triu(expected_upper), out.numpy(), rtol=self.rtol[dtype])
+
+    def test_inplace(self, dtype, order, get_mat, expected_lower, expected_upper, lower):
+        mat = get_mat(order=order, dtype=dtype)
+        omat = mat.clone()
+
+        lauum(n=mat.shape[0], A=mat, lda=self._ld(mat), B=mat, ldb=self._ld(mat), lower=lower)
+
+        # The opposite triangle must be preserved
+        if lower:
+            np.testing.assert_allclose(np.tril(expected_lower), np.tril(mat.numpy()), rtol=self.rtol[dtype])
+            np.testing.assert_allclose(np.triu(omat.numpy(), k=1), np.triu(mat.numpy(), k=1))
+        else:
+            np.testing.assert_allclose(np.triu(expected_upper), np.triu(mat.numpy()), rtol=self.rtol[dtype])
+            np.testing.assert_allclose(np.tril(omat.numpy(), k=-1), np.tril(mat.numpy(), k=-1))
+
+
 if __name__ == "__main__":
     pytest.main()
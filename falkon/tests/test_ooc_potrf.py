@@ -191,6 +191,22 @@ class TestOutOfCorePyTest:
             opt=opt,
         )
 
+    @pytest.mark.parametrize("input_device", ["cpu", "cuda:0"])
+    @pytest.mark.parametrize("order,upper", [pytest.param("F", False), pytest.param("C", True)])
+    def test_ooc_resident(self, pd_data, dtype, order, upper, overwrite, input_device):
+        # The tiles are distributed over all GPUs (including for matrices which are on a GPU)
+        opt = dataclasses.replace(self.basic_options, chol_par_resident=True)
+        run_potrf_test(
+            pd_data,
+            dtype=dtype,
+            order=order,
+            upper=upper,
+            clean=True,
+            overwrite=overwrite,
+            input_device=input_device,
+            opt=opt,
+        )
+
 
 if __name__ == "__main__":
     pytest.main()
@@ -3,9 +3,10 @@ import pytest
 import scipy.sparse
 import torch
 
-from falkon.sparse import bdot, sparse_matmul, sparse_norm, sparse_square_norm
+from falkon.sparse import SlicedEllTensor, SpgemmPlan, bdot, sparse_matmul, sparse_norm, sparse_square_norm
 from falkon.sparse.sparse_tensor import SparseTensor
 from falkon.utils import decide_cuda
+from falkon.utils.memmap import is_file_backed, load_memmap_csr, save_memmap_csr
 from falkon.utils.tensor_helpers import create_fortran
 
 
@@ -128,6 +129,110 @@ class TestSparseBdot:
         torch.testing.assert_close(act, torch.from_numpy(exp_bdot).to(dtype=act.dtype))
 
 
+@pytest.mark.parametrize(
+    "device", ["cpu", pytest.param("cuda:0", marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found."))]
+)
+@pytest.mark.parametrize("index_dtype", [torch.int32, torch.int64])
+class TestLargeSparseVectorOps:
+    """Enough rows (with uneven numbers of non-zeros) to split the work between threads or warps."""
+
+    @pytest.fixture(scope="class")
+    def mats(self):
+        rng = np.random.default_rng(5)
+        mat1 = scipy.sparse.vstack(
+            [
+                scipy.sparse.random(19_980, 500, density=0.01, dtype=np.float64, random_state=rng),
+                scipy.sparse.random(20, 500, density=1.0, dtype=np.float64, random_state=rng),  # dense rows
+            ],
+            format="csr",
+        )
+        mat2 = scipy.sparse.random(20_000, 500, density=0.02, format="csr", dtype=np.float64, random_state=rng)
+        mat1.sort_indices()
+        mat2.sort_indices()
+        return mat1, mat2
+
+    def _to_sparse(self, mat, device, index_dtype):
+        return SparseTensor.from_scipy(mat).index_to(index_dtype).to(device=torch.device(device))
+
+    def test_norms(self, mats, device, index_dtype):
+        mat1 = self._to_sparse(mats[0], device, index_dtype)
+        exp = np.asarray(mats[0].multiply(mats[0]).sum(axis=1))
+        torch.testing.assert_close(sparse_square_norm(mat1, out=None).cpu(), torch.from_numpy(exp))
+        torch.testing.assert_close(sparse_norm(mat1, out=None).cpu(), torch.from_numpy(np.sqrt(exp)))
+
+    def test_bdot(self, mats, device, index_dtype):
+        mat1 = self._to_sparse(mats[0], device, index_dtype)
+        mat2 = self._to_sparse(mats[1], device, index_dtype)
+        exp = np.asarray(mats[0].multiply(mats[1]).sum(axis=1))
+        torch.testing.assert_close(bdot(mat1, mat2, out=None).cpu(), torch.from_numpy(exp))
+        torch.testing.assert_close(bdot(mat2, mat1, out=None).cpu(), torch.from_numpy(exp))
+
+
+@pytest.mark.parametrize("index_dtype", [torch.int32, torch.int64])
+class TestSlicedEll:
+    @pytest.fixture(scope="class")
+    def mats(self):
+        rng = np.random.default_rng(21)
+        # Rows with very different numbers of non-zeros
+        mat1 = scipy.sparse.vstack(
+            [
+                scipy.sparse.random(290, 300, density=0.01, dtype=np.float64, random_state=rng),
+                scipy.sparse.random(10, 300, density=0.8, dtype=np.float64, random_state=rng),
+                scipy.sparse.csr_matrix((5, 300), dtype=np.float64),  # empty rows
+            ],
+            format="csr",
+        )
+        mat2 = scipy.sparse.random(70, 300, density=0.1, format="csr", dtype=np.float64, random_state=rng)
+        mat1.sort_indices()
+        mat2.sort_indices()
+        return mat1, mat2
+
+    def test_from_csr(self, mats, index_dtype):
+        mat = SparseTensor.from_scipy(mats[0]).index_to(index_dtype)
+        sell = SlicedEllTensor.from_csr(mat, slice_size=32)
+        assert sell.shape == mat.shape
+        assert sell.index.dtype == index_dtype and sell.slice_ptr.dtype == index_dtype
+        assert sell.slice_ptr.shape[0] == (mat.shape[0] + 31) // 32 + 1
+        # Reconstruct the dense matrix from the sliced-ELL arrays
+        dense = np.zeros(mat.shape)
+        for s in range(sell.slice_ptr.shape[0] - 1):
+            start, end = int(sell.slice_ptr[s]), int(sell.slice_ptr[s + 1])
+            width = (end - start) // 32
+            for k in range(width):
+                for lane in range(32):
+                    r = s * 32 + lane
+                    col = int(sell.index[start + k * 32 + lane])
+                    if r < mat.shape[0] and col >= 0:
+                        dense[int(sell.row_perm[r]), col] = float(sell.data[start + k * 32 + lane])
+        np.testing.assert_array_equal(dense, mats[0].toarray())
+        # Padding is much smaller than with a single ELL block
+        assert sell.padded_nnz() < mat.shape[0] * int(np.diff(mats[0].indptr).max()) / 4
+
+    @pytest.mark.parametrize(
+        "device",
+        ["cpu", pytest.param("cuda:0", marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found."))],
+    )
+    @pytest.mark.parametrize("order", ["F", "C"])
+    def test_matmul(self, mats, index_dtype, device, order):
+        dev = torch.device(device)
+        sell = SlicedEllTensor.from_csr(SparseTensor.from_scipy(mats[0]).index_to(index_dtype).to(device=dev))
+        mat2_csc = SparseTensor.from_scipy(mats[1].T.tocsc()).index_to(index_dtype).to(device=dev)
+        shape = (mats[0].shape[0], mats[1].shape[0])
+        if order == "F":
+            out = create_fortran(shape, torch.float64, dev)
+        else:
+            out = torch.empty(shape, dtype=torch.float64, device=dev)
+        sparse_matmul(sell, mat2_csc, out)
+        torch.testing.assert_close(out.cpu(), torch.from_numpy((mats[0] @ mats[1].T).toarray()))
+
+    def test_matmul_wrong_format(self, mats, index_dtype):
+        sell = SlicedEllTensor.from_csr(SparseTensor.from_scipy(mats[0]).index_to(index_dtype))
+        mat2_csr = SparseTensor.from_scipy(mats[1]).index_to(index_dtype)
+        out = torch.empty(mats[0].shape[0], mats[1].shape[1], dtype=torch.float64)
+        with pytest.raises(ValueError, match="B must be CSC matrix"):
+            sparse_matmul(sell, mat2_csr, out)
+
+
 @pytest.mark.parametrize(
     "device", ["cpu", pytest.param("cuda:0", marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found."))]
 )
@@ -142,6 +247,58 @@ class TestMyTranspose:
         assert tr_mat.data.tolist() == [2, 1, 3, 4], f"expected data {[2, 1, 3, 4]}, but found {tr_mat.data.tolist()}"
 
 
+@pytest.mark.parametrize("index_dtype", [torch.int32, torch.int64])
+class TestCpuSpspmm:
+    @pytest.fixture(scope="class")
+    def mats(self):
+        rng = np.random.default_rng(11)
+        mat1 = scipy.sparse.random(3000, 400, density=0.02, format="csr", dtype=np.float64, random_state=rng)
+        mat2 = scipy.sparse.random(400, 700, density=0.05, format="csr", dtype=np.float64, random_state=rng)
+        return mat1, mat2
+
+    def test_spspmm(self, mats, index_dtype):
+        from falkon.c_ext import spspmm
+
+        mat1 = SparseTensor.from_scipy(mats[0]).index_to(index_dtype)
+        mat2 = SparseTensor.from_scipy(mats[1]).index_to(index_dtype)
+        indexptr, index, data = spspmm(
+            mat1.indexptr, mat1.index, mat1.data, mat2.indexptr, mat2.index, mat2.data, mat2.shape[1]
+        )
+        assert indexptr.dtype == index_dtype and index.dtype == index_dtype
+        exp = (mats[0] @ mats[1]).tocsr()
+        exp.sort_indices()
+        np.testing.assert_array_equal(indexptr.numpy(), exp.indptr)
+        np.testing.assert_array_equal(index.numpy(), exp.indices)
+        np.testing.assert_allclose(data.numpy(), exp.data)
+
+    @pytest.mark.parametrize("order", ["F", "C"])
+    def test_csr2dense(self, mats, index_dtype, order):
+        from falkon.c_ext import csr2dense
+
+        mat1 = SparseTensor.from_scipy(mats[0]).index_to(index_dtype)
+        if order == "F":
+            out = create_fortran(mat1.shape, mat1.dtype, "cpu")
+        else:
+            out = torch.empty(mat1.shape, dtype=mat1.dtype)
+        out.fill_(1.0)  # must be overwritten
+        csr2dense(mat1.indexptr, mat1.index, mat1.data, out)
+        torch.testing.assert_close(out, torch.from_numpy(mats[0].toarray()))
+
+
+def test_index_to_int(csr_mat):
+    arr = SparseTensor(
+        indexptr=csr_mat.indexptr.clone(), index=csr_mat.index.clone(), data=csr_mat.data, size=csr_mat.shape
+    )
+    int_arr = arr.index_to_int()
+    assert int_arr.index.dtype == torch.int32 and int_arr.indexptr.dtype == torch.int32
+    assert arr.index.dtype == torch.int64
+    # Already int32: no copies
+    assert int_arr.index_to_int() is int_arr
+    assert arr.index_to_int_() is arr
+    assert arr.index.dtype == torch.int32 and arr.indexptr.dtype == torch.int32
+    np.testing.assert_array_equal(arr.to_scipy().toarray(), csr_mat.to_scipy().toarray())
+
+
 @pytest.mark.parametrize(
     "device", ["cpu", pytest.param("cuda:0", marks=pytest.mark.skipif(not decide_cuda(), reason="No GPU found."))]
 )
@@ -268,6 +425,31 @@ class TestMatMul:
 
         torch.testing.assert_close(out.cpu(), expected)
 
+    @pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")
+    def test_cuda_matmul_plan(self, mat1, mat2, expected):
+        dev = torch.device("cuda:0")
+        mat1_csr = SparseTensor.from_scipy(scipy.sparse.csr_matrix(mat1)).index_to_int_().to(device=dev)
+        mat2_csr = SparseTensor.from_scipy(scipy.sparse.csr_matrix(mat2)).index_to_int_().to(device=dev)
+        with SpgemmPlan(dev) as plan:
+            assert SpgemmPlan.current(dev) is plan
+            for _ in range(3):
+                out = create_fortran(expected.shape, expected.dtype, dev)
+                sparse_matmul(mat1_csr, mat2_csr, out)
+                torch.testing.assert_close(out.cpu(), expected)
+            ws_ptr = plan.workspace1.data_ptr()
+            sparse_matmul(mat1_csr.narrow_rows(0, 50), mat2_csr, out[:50])
+            assert plan.workspace1.data_ptr() == ws_ptr  # smaller product reuses the workspace
+        assert SpgemmPlan.current(dev) is None
+
+
+def test_memmap_csr(csr_mat, tmp_path):
+    path = str(tmp_path / "mat")
+    save_memmap_csr(path, csr_mat)
+    loaded = load_memmap_csr(path)
+    assert is_file_backed(loaded)
+    assert loaded.shape == csr_mat.shape and loaded.is_csr
+    np.testing.assert_array_equal(loaded.to_scipy().toarray(), csr_mat.to_scipy().toarray())
+
 
 if __name__ == "__main__":
     pytest.main()
@@ -1,8 +1,9 @@
 import numpy as np
 import pytest
+import torch
 from scipy.linalg import blas as sclb
 
-from falkon.la_helpers import trsm
+from falkon.la_helpers import pc_apply, trsm
 from falkon.tests.conftest import fix_mat
 from falkon.tests.gen_random import gen_random
 from falkon.utils import decide_cuda
@@ -23,6 +24,7 @@ def arr():
 
 
 @pytest.mark.parametrize("order", ["C", "F"])
+@pytest.mark.parametrize("v_order", ["C", "F"])
 @pytest.mark.parametrize("dtype", [np.float32, pytest.param(np.float64, marks=pytest.mark.full())])
 @pytest.mark.parametrize("lower", [True, False], ids=["lower", "upper"])
 @pytest.mark.parametrize("transpose", [True, False], ids=["transpose", "no_transpose"])
@@ -33,20 +35,54 @@ def arr():
         pytest.param("cuda:0", marks=[pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")]),
     ],
 )
-def test_trsm_wrapper(mat, arr, dtype, order, device, lower, transpose):
+def test_trsm_wrapper(mat, arr, dtype, order, v_order, device, lower, transpose):
     rtol = 1e-2 if dtype == np.float32 else 1e-11
 
     n_mat = move_tensor(fix_mat(mat, dtype=dtype, order=order, copy=True), device=device)
-    n_arr = move_tensor(fix_mat(arr, dtype=dtype, order=order, copy=True), device=device)
+    n_arr = move_tensor(fix_mat(arr, dtype=dtype, order=v_order, copy=True), device=device)
+    orig_arr = n_arr.clone()
 
     expected = sclb.dtrsm(1e-2, mat, arr, side=0, lower=lower, trans_a=transpose, overwrite_b=0)
 
-    if device.startswith("cuda") and order == "C":
-        with pytest.raises(ValueError):
-            actual = trsm(n_arr, n_mat, alpha=1e-2, lower=lower, transpose=transpose)
+    actual = trsm(n_arr, n_mat, alpha=1e-2, lower=lower, transpose=transpose)
+    np.testing.assert_allclose(expected, actual.cpu().numpy(), rtol=rtol)
+    assert actual.stride() == n_arr.stride(), "Output layout differs from the input layout"
+    np.testing.assert_array_equal(orig_arr.cpu().numpy(), n_arr.cpu().numpy())
+    # In-place output
+    actual = trsm(n_arr, n_mat, alpha=1e-2, lower=lower, transpose=transpose, out=n_arr)
+    assert actual.data_ptr() == n_arr.data_ptr()
+    np.testing.assert_allclose(expected, n_arr.cpu().numpy(), rtol=rtol)
+
+
+@pytest.mark.parametrize("order", ["C", "F"])
+@pytest.mark.parametrize("transpose", [True, False], ids=["transpose", "no_transpose"])
+@pytest.mark.parametrize(
+    "device",
+    [
+        pytest.param("cpu"),
+        pytest.param("cuda:0", marks=[pytest.mark.skipif(not decide_cuda(), reason="No GPU found.")]),
+    ],
+)
+def test_pc_apply(mat, arr, order, transpose, device):
+    # Upper(fC) = T and lower(fC) = A.T, as in the Falkon preconditioner
+    fC = np.array(mat, order="F") + np.eye(M) * M
+    fT, At = np.triu(fC), np.tril(fC).T
+    dA = np.diag(fC).copy() * 2
+    At[np.diag_indices(M)] = dA
+    if transpose:
+        expected = np.linalg.solve(At.T, np.linalg.solve(fT.T, arr))
     else:
-        actual = trsm(n_arr, n_mat, alpha=1e-2, lower=lower, transpose=transpose)
-        np.testing.assert_allclose(expected, actual.cpu().numpy(), rtol=rtol)
+        expected = np.linalg.solve(fT, np.linalg.solve(At, arr))
+
+    t_fC = move_tensor(fix_mat(fC, dtype=np.float64, order="F", copy=True), device=device)
+    dT = t_fC.diagonal().clone()
+    t_dA = move_tensor(torch.from_numpy(dA), device=device)
+    v = move_tensor(fix_mat(arr, dtype=np.float64, order=order, copy=True), device=device)
+    actual = pc_apply(t_fC, dT, t_dA, v, transpose=transpose)
+    np.testing.assert_allclose(expected, actual.cpu().numpy(), rtol=1e-10)
+    # In-place output
+    pc_apply(t_fC, dT, t_dA, v, transpose=transpose, out=v)
+    np.testing.assert_allclose(expected, v.cpu().numpy(), rtol=1e-10)
 
 
 if __name__ == "__main__":
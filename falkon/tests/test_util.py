@@ -1,3 +1,5 @@
+import json
+
 import numpy as np
 import pytest
 import scipy.sparse
@@ -67,3 +69,34 @@ def test_check_sparse():
 
 if __name__ == "__main__":
     pytest.main()
+
+
+def test_tracing(tmp_path):
+    from falkon.utils import tracing
+
+    assert tracing.trace_range("off") is tracing.trace_range("off2")
+    tracing.enable()
+    try:
+        with tracing.trace_range("outer", flops=10):
+            with tracing.trace_range("inner", nbytes=8):
+                pass
+            with tracing.trace_range("inner", nbytes=8):
+                pass
+    finally:
+        tracing.disable()
+    events = [e for e in tracing.collect() if e["device"] == "host" and not e["track"].startswith("native")]
+    assert [e["name"] for e in events] == ["outer", "inner", "inner"]
+    assert all(e["end"] >= e["start"] for e in events)
+
+    summ = tracing.summary(events)
+    assert summ["ranges"]["inner"]["count"] == 2
+    assert summ["ranges"]["inner"]["bytes"] == 16
+    assert summ["ranges"]["outer"]["flops"] == 10
+
+    out_file = tmp_path / "trace.json"
+    tracing.export_chrome_trace(out_file, events)
+    with open(out_file) as fh:
+        trace = json.load(fh)
+    assert len([e for e in trace["traceEvents"] if e["ph"] == "X"]) == 3
+    # Collecting empties the buffers
+    assert all(e["track"].startswith("native") for e in tracing.collect())
@@ -13,6 +13,7 @@ if torch.cuda.is_available():
         cuda_1d_copy_async,
         cuda_2d_copy,
         cuda_2d_copy_async,
+        cuda_2d_copy_batch_async,
     )
 
 
@@ -53,6 +54,41 @@ def copy(origin, dest, non_blocking=False, allow_dtype_change=False):
     return dest
 
 
+def copy_batch(origins, dests):
+    """Asynchronously copy each tensor of `origins` into the corresponding tensor of `dests`.
+
+    The copies are submitted together, with a single call to the native batched copy op (which
+    runs all device-to-device copies in one kernel), instead of one call per copy. Pairs of tensors
+    with different data-types are copied one at a time with :func:`copy`. The destinations must
+    not overlap with each other or with any of the origins.
+    """
+    dest_t, dest_pitch, src_t, src_pitch, width, height = [], [], [], [], [], []
+    for origin, dest in zip(origins, dests):
+        if origin.dtype != dest.dtype or origin.device.type == dest.device.type == "cpu":
+            copy(origin, dest, non_blocking=True, allow_dtype_change=True)
+            continue
+        check_copy(origin, dest)
+        dts = sizeof_dtype(origin.dtype)
+        rows, cols = origin.shape[0], origin.shape[1] if origin.dim() > 1 else 1
+        if is_contig_vec(origin) and is_contig_vec(dest):
+            c_width, c_height, c_src_pitch, c_dest_pitch = rows * cols * dts, 1, rows * cols * dts, rows * cols * dts
+        elif is_f_contig(origin, strict=True):  # Columns are copied as rows
+            c_width, c_height = rows * dts, cols
+            c_src_pitch, c_dest_pitch = origin.stride(1) * dts, dest.stride(1) * dts
+        else:
+            c_width, c_height = cols * dts, rows
+            c_src_pitch, c_dest_pitch = origin.stride(0) * dts, dest.stride(0) * dts
+        dest_t.append(dest)
+        dest_pitch.append(c_dest_pitch)
+        src_t.append(origin)
+        src_pitch.append(c_src_pitch)
+        width.append(c_width)
+        height.append(c_height)
+    if len(dest_t) > 0:
+        cuda_2d_copy_batch_async(dest_t, dest_pitch, src_t, src_pitch, width, height)
+    return dests
+
+
 # noinspection PyProtectedMember
 def copy_to_host(rows, cols, D, Di, Dj, H, Hi, Hj, non_blocking=False):
     D_narrow = D.narrow(0, Di, rows).narrow(1, Dj, cols)
@@ -10,7 +10,7 @@ import torch.cuda as tcd
 from falkon.c_ext import mem_get_info
 from falkon.options import BaseOptions
 
-from . import TicToc
+from . import TicToc, workspace
 
 logger = logging.getLogger(__name__)
 __all__ = ("get_device_info", "DeviceInfo", "num_gpus")
@@ -87,6 +87,8 @@ def _get_gpu_device_info(opt: BaseOptions, g: int, data_dict: Dict[int, DeviceIn
         mem_used = mem_total - mem_free
         # noinspection PyUnresolvedReferences
         cached_free_mem = tcd.memory_reserved(g) - tcd.memory_allocated(g)
+        # The idle slabs of the workspace arena are available to the next operation.
+        cached_free_mem += workspace.idle_bytes(g)
 
         if g in data_dict:
             data_dict[g].update_memory(
@@ -0,0 +1,82 @@
+"""Helpers for fitting models with the data sharded over the processes of a torch.distributed group.
+
+All collectives run on the default process group. With the NCCL backend the tensors are moved
+to the current CUDA device for the duration of the collective.
+"""
+from typing import Optional, Sequence
+
+import torch
+import torch.distributed as dist
+
+from falkon.utils.tensor_helpers import create_C, create_fortran, is_f_contig
+
+__all__ = ("check_distributed", "get_rank", "all_reduce_sum_", "global_num_rows", "broadcast_tensor", "broadcast_attrs")
+
+
+def check_distributed():
+    if not dist.is_available() or not dist.is_initialized():
+        raise RuntimeError(
+            "The 'distributed' option requires the default torch.distributed process group to be initialized."
+        )
+
+
+def get_rank() -> int:
+    return dist.get_rank()
+
+
+def _comm_device(t: torch.Tensor) -> torch.device:
+    if dist.get_backend() == "nccl" and not t.is_cuda:
+        return torch.device("cuda", torch.cuda.current_device())
+    return t.device
+
+
+def all_reduce_sum_(t: torch.Tensor) -> torch.Tensor:
+    """Sum `t` over all processes, in-place."""
+    dev = _comm_device(t)
+    if dev == t.device and t.is_contiguous():
+        dist.all_reduce(t, op=dist.ReduceOp.SUM)
+        return t
+    t_comm = t.to(device=dev, memory_format=torch.contiguous_format)
+    dist.all_reduce(t_comm, op=dist.ReduceOp.SUM)
+    return t.copy_(t_comm)
+
+
+def global_num_rows(n: int) -> int:
+    """Total number of rows, given the number of rows `n` of the local shard."""
+    num = torch.tensor([n], dtype=torch.long)
+    return int(all_reduce_sum_(num).item())
+
+
+def broadcast_tensor(t: Optional[torch.Tensor], src: int = 0, pin_memory: bool = False) -> torch.Tensor:
+    """Broadcast a dense tensor from process `src`. On the other processes `t` may be None.
+
+    The tensor is received on the CPU of the other processes, with the same memory layout
+    (C or F-contiguous) as on `src`. On `src` itself `t` is returned unchanged.
+    """
+    is_src = get_rank() == src
+    meta = [None]
+    if is_src:
+        fortran = t.dim() == 2 and not t.is_contiguous() and is_f_contig(t, strict=True)
+        meta = [(tuple(t.shape), t.dtype, fortran)]
+    dist.broadcast_object_list(meta, src=src)
+    shape, dtype, fortran = meta[0]
+    if not is_src:
+        if fortran:
+            t = create_fortran(shape, dtype, "cpu", pin_memory=pin_memory)
+        else:
+            t = create_C(shape, dtype, "cpu", pin_memory=pin_memory)
+    # F-contiguous tensors are sent through their (C-contiguous) transpose.
+    t_view = t.T if fortran else t
+    t_comm = t_view.to(device=_comm_device(t_view), memory_format=torch.contiguous_format)
+    dist.broadcast(t_comm, src=src)
+    if not is_src:
+        t_view.copy_(t_comm)
+    return t
+
+
+def broadcast_attrs(obj, names: Sequence[str], src: int = 0):
+    """Replace the tensor attributes `names` of `obj` with the ones held by process `src`."""
+    for name in names:
+        value = getattr(obj, name) if get_rank() == src else None
+        setattr(obj, name, broadcast_tensor(value, src=src))
+    return obj
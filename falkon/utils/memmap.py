@@ -0,0 +1,116 @@
+"""On-disk formats for datasets which are memory-mapped instead of being loaded in RAM.
+
+A dense matrix is stored as a raw binary file of its elements (in C or F order), next to a
+small JSON header (``<path>.json``) with its shape, data-type and order. A CSR matrix is stored
+as three such arrays (``<path>.indexptr``, ``<path>.index``, ``<path>.data``) and a header.
+
+The loaded tensors are backed by private (copy-on-write) mappings of the files, so they can be
+used as any other CPU tensor while only the pages which are accessed get read from disk. The
+out-of-core operations read the data one block at a time, so fitting a model on a memory-mapped
+dataset needs host memory for the pipeline buffers rather than for the whole dataset.
+"""
+import json
+from typing import Union
+
+import numpy as np
+import torch
+
+from falkon.sparse import SparseTensor
+from falkon.utils.tensor_helpers import is_f_contig
+
+__all__ = ("save_memmap", "load_memmap", "save_memmap_csr", "load_memmap_csr", "is_file_backed")
+
+_DTYPES = {
+    "float32": torch.float32,
+    "float64": torch.float64,
+    "int32": torch.int32,
+    "int64": torch.int64,
+}
+
+
+def _dtype_name(dtype: torch.dtype) -> str:
+    for name, dt in _DTYPES.items():
+        if dt == dtype:
+            return name
+    raise TypeError(f"Data-type {dtype} cannot be stored in a memory-mapped file.")
+
+
+def _write_array(path: str, t: torch.Tensor) -> dict:
+    fortran = t.dim() == 2 and not t.is_contiguous() and is_f_contig(t, strict=True)
+    t_c = t.T if fortran else t.contiguous()
+    # Write in chunks of rows, such that memory-mapped inputs are not loaded in full.
+    with open(path, "wb") as fh:
+        if t_c.dim() == 0 or t_c.shape[0] == 0:
+            fh.write(t_c.cpu().numpy().tobytes())
+        else:
+            step = max(1, (1 << 26) // max(1, t_c[0].numel() * t_c.element_size()))
+            for i in range(0, t_c.shape[0], step):
+                fh.write(t_c[i : i + step].cpu().numpy().tobytes())
+    return {"shape": list(t.shape), "dtype": _dtype_name(t.dtype), "order": "F" if fortran else "C"}
+
+
+def _read_array(path: str, header: dict) -> torch.Tensor:
+    shape, dtype = tuple(header["shape"]), _DTYPES[header["dtype"]]
+    numel = int(np.prod(shape))
+    if numel == 0:
+        return torch.empty(shape, dtype=dtype)
+    # shared=False maps the file privately: writes to the tensor do not reach the file.
+    flat = torch.from_file(path, shared=False, size=numel, dtype=dtype)
+    if header["order"] == "F":
+        return flat.reshape(tuple(reversed(shape))).T
+    return flat.reshape(shape)
+
+
+def save_memmap(path: str, X: torch.Tensor):
+    """Store the dense tensor `X` at `path` (and its header at ``<path>.json``)."""
+    header = _write_array(path, X)
+    with open(f"{path}.json", "w") as fh:
+        json.dump({"format": "dense", **header}, fh)
+
+
+def load_memmap(path: str) -> torch.Tensor:
+    """Memory-map a dense tensor stored with :func:`save_memmap`."""
+    with open(f"{path}.json", "r") as fh:
+        header = json.load(fh)
+    if header.get("format") != "dense":
+        raise ValueError(f"File {path} does not contain a dense matrix.")
+    return _read_array(path, header)
+
+
+def save_memmap_csr(path: str, X: SparseTensor):
+    """Store the CSR sparse tensor `X` at ``<path>.indexptr``, ``<path>.index`` and ``<path>.data``."""
+    if not X.is_csr:
+        raise ValueError("Only CSR matrices can be stored in memory-mapped files.")
+    header = {
+        "format": "csr",
+        "shape": list(X.shape),
+        "indexptr": _write_array(f"{path}.indexptr", X.indexptr),
+        "index": _write_array(f"{path}.index", X.index),
+        "data": _write_array(f"{path}.data", X.data),
+    }
+    with open(f"{path}.json", "w") as fh:
+        json.dump(header, fh)
+
+
+def load_memmap_csr(path: str) -> SparseTensor:
+    """Memory-map a CSR sparse tensor stored with :func:`save_memmap_csr`."""
+    with open(f"{path}.json", "r") as fh:
+        header = json.load(fh)
+    if header.get("format") != "csr":
+        raise ValueError(f"File {path} does not contain a CSR matrix.")
+    return SparseTensor(
+        indexptr=_read_array(f"{path}.indexptr", header["indexptr"]),
+        index=_read_array(f"{path}.index", header["index"]),
+        data=_read_array(f"{path}.data", header["data"]),
+        size=tuple(header["shape"]),
+        sparse_type="csr",
+    )
+
+
+def is_file_backed(X: Union[torch.Tensor, SparseTensor]) -> bool:
+    """Whether the data of `X` is a memory-mapped file (e.g. loaded with :func:`load_memmap`)."""
+    if isinstance(X, SparseTensor):
+        X = X.data
+    if X.is_cuda:
+        return False
+    return getattr(X.untyped_storage(), "filename", None) is not None
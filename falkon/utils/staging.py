@@ -0,0 +1,133 @@
+"""Staging of pageable host tiles into pinned memory, for the out-of-core operations.
+
+Asynchronous host-to-device copies only overlap with computations when the host memory is
+page-locked: copies from pageable memory are synchronous, and go through a small driver buffer
+at reduced bandwidth. Instead of pinning whole datasets, the out-of-core operations read their
+inputs through a :class:`PinnedStager`, which copies the tiles that will be transferred next
+into a small pool of pinned buffers from a background thread.
+"""
+import queue
+import threading
+from typing import List, Optional, Sequence, Tuple
+
+import torch
+import torch.cuda as tcd
+
+from falkon.utils.tensor_helpers import create_C, extract_same_stride
+
+__all__ = ("PinnedStager", "needs_staging")
+
+
+def needs_staging(t: torch.Tensor, dev: torch.device) -> bool:
+    """Whether copies of the dense tensor `t` to device `dev` would be made from pageable memory."""
+    return dev.type == "cuda" and t.device.type == "cpu" and not t.is_pinned()
+
+
+class PinnedStager:
+    """Prefetch a sequence of host tiles into a bounded pool of pinned buffers.
+
+    A background thread copies the row-blocks `blocks` of `src` (a list of ``(start, length)``
+    tuples) in order, each into the first free buffer of the pool. The consumer receives the
+    pinned tiles in the same order with :meth:`get`, issues its asynchronous copy to the device,
+    and then calls :meth:`release` with the stream of the copy: the buffer is refilled only once
+    the copy has completed. With ``num_buffers >= 2`` the host copy of the next tile overlaps the
+    device transfer of the current one.
+
+    If `src` does not need staging (see :func:`needs_staging`) nor a data-type conversion on the
+    host, the tiles of `src` are returned directly and no thread is started. The stager must be
+    used as a context manager.
+
+    Parameters
+    ----------
+    src
+        The 2D dense tensor whose row-blocks are staged.
+    blocks
+        The ``(start, length)`` row-blocks of `src`, in the order they will be requested.
+    dev
+        The device the tiles are copied to.
+    dtype
+        The data-type of the staged tiles. Data-type conversions are performed by the
+        background thread. Defaults to the data-type of `src`.
+    num_buffers
+        The number of pinned buffers, which bounds the number of tiles staged ahead.
+    """
+
+    def __init__(
+        self,
+        src: torch.Tensor,
+        blocks: Sequence[Tuple[int, int]],
+        dev: torch.device,
+        dtype: Optional[torch.dtype] = None,
+        num_buffers: int = 2,
+    ):
+        self.tiles = [src[start : start + length] for start, length in blocks]
+        self.dtype = src.dtype if dtype is None else dtype
+        convert = self.dtype != src.dtype and src.device.type == "cpu" and dev.type == "cuda"
+        self.active = (needs_staging(src, dev) or convert) and len(self.tiles) > 0
+        self._next = 0
+        self._cur: Optional[int] = None
+        self._thread: Optional[threading.Thread] = None
+        if not self.active:
+            return
+        max_numel = max(t.numel() for t in self.tiles)
+        num_buffers = min(num_buffers, len(self.tiles))
+        self._buffers = [create_C((max_numel,), self.dtype, "cpu", pin_memory=True) for _ in range(num_buffers)]
+        self._events: List[Optional[tcd.Event]] = [None] * num_buffers
+        self._free: "queue.Queue[Optional[int]]" = queue.Queue()
+        self._ready: "queue.Queue" = queue.Queue()
+        for idx in range(num_buffers):
+            self._free.put(idx)
+
+    def _fill(self):
+        try:
+            for tile in self.tiles:
+                idx = self._free.get()
+                if idx is None:  # Stopped
+                    return
+                if self._events[idx] is not None:
+                    self._events[idx].synchronize()
+                buf = extract_same_stride(self._buffers[idx], size=tile.shape, other=tile)
+                buf.copy_(tile)
+                self._ready.put((idx, buf))
+        except BaseException as e:
+            self._ready.put((None, e))
+
+    def __enter__(self):
+        if self.active:
+            self._thread = threading.Thread(target=self._fill, name="PinnedStager", daemon=True)
+            self._thread.start()
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        if self._thread is not None:
+            self._free.put(None)
+            self._thread.join()
+            self._thread = None
+            # The pinned buffers must outlive the copies which read them.
+            for ev in self._events:
+                if ev is not None:
+                    ev.synchronize()
+
+    def get(self) -> torch.Tensor:
+        """The next tile, in pinned memory if staging is active."""
+        if self._next >= len(self.tiles):
+            raise IndexError(f"All {len(self.tiles)} tiles have already been requested.")
+        self._next += 1
+        if not self.active:
+            return self.tiles[self._next - 1]
+        idx, buf = self._ready.get()
+        if idx is None:
+            raise RuntimeError("Failed to stage a host tile in pinned memory.") from buf
+        self._cur = idx
+        return buf
+
+    def release(self, stream: Optional[tcd.Stream]):
+        """Return the buffer of the last tile to the pool, once the work queued on `stream` is done."""
+        if not self.active or self._cur is None:
+            return
+        if stream is not None:
+            ev = tcd.Event()
+            ev.record(stream)
+            self._events[self._cur] = ev
+        self._free.put(self._cur)
+        self._cur = None
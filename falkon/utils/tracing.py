@@ -0,0 +1,316 @@
+"""Tracing of the hot paths (tile stages of the kernel-vector products, CG iterations, POTRF tasks).
+
+Tracing is off by default, and can be switched on at runtime with :func:`enable` (or by setting
+the ``FALKON_TRACE=1`` environment variable). When it is off, :func:`trace_range` returns a shared
+no-op context manager, so instrumented code only pays for a function call.
+
+When it is on, each range:
+ - is pushed as an NVTX range (visible in Nsight Systems),
+ - records its host start and end times and, if it runs on a CUDA stream, a pair of CUDA events
+   which time it on the device,
+ - is appended to a buffer owned by the calling thread (the buffers only take a lock when a
+   thread records its first range),
+ - carries the number of bytes moved and of floating point operations of the stage.
+
+The native ops (``parallel_potrf``) record their own events, which are merged by :func:`collect`.
+The collected events can be exported as a Chrome / Perfetto trace with :func:`export_chrome_trace`,
+and reduced to summary counters (time, bytes and FLOPs per range name, busy time per device) with
+:func:`summary`.
+"""
+import json
+import os
+import threading
+import time
+from collections import defaultdict
+from typing import Any, Dict, List, Optional, Union
+
+import torch
+
+__all__ = ("enable", "disable", "is_enabled", "trace_range", "collect", "export_chrome_trace", "summary")
+
+_enabled = False
+_buffers: List[list] = []
+_registry_lock = threading.Lock()
+_local = threading.local()
+# Reference CUDA event and host time (ns) on each device, to place device events on the host clock.
+_cuda_refs: Dict[int, tuple] = {}
+
+
+def _set_native(enabled: bool):
+    try:
+        from falkon import c_ext
+
+        c_ext.trace_set_enabled(enabled)
+    except (ImportError, RuntimeError):
+        pass
+
+
+def enable():
+    """Start recording trace events."""
+    global _enabled
+    _enabled = True
+    _set_native(True)
+
+
+def disable():
+    """Stop recording trace events. Events which were already recorded are kept until :func:`collect`."""
+    global _enabled
+    _enabled = False
+    _set_native(False)
+
+
+def is_enabled() -> bool:
+    return _enabled
+
+
+class _NullRange:
+    __slots__ = ()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        return False
+
+
+_NULL_RANGE = _NullRange()
+
+
+def _thread_buffer() -> list:
+    try:
+        return _local.buffer
+    except AttributeError:
+        buf = []
+        with _registry_lock:
+            _buffers.append(buf)
+        _local.buffer = buf
+        return buf
+
+
+def _cuda_ref(device: int) -> tuple:
+    ref = _cuda_refs.get(device)
+    if ref is None:
+        with _registry_lock:
+            if device not in _cuda_refs:
+                ev = torch.cuda.Event(enable_timing=True)
+                ev.record(torch.cuda.current_stream(device))
+                ev.synchronize()
+                _cuda_refs[device] = (ev, time.monotonic_ns())
+            ref = _cuda_refs[device]
+    return ref
+
+
+class _Range:
+    __slots__ = ("name", "stream", "nbytes", "flops", "_t_start", "_ev_start")
+
+    def __init__(self, name: str, stream: Optional[torch.cuda.Stream], nbytes: float, flops: float):
+        self.name = name
+        self.stream = stream
+        self.nbytes = nbytes
+        self.flops = flops
+
+    def __enter__(self):
+        if torch.cuda.is_available():
+            torch.cuda.nvtx.range_push(self.name)
+        self._ev_start = None
+        if self.stream is not None:
+            _cuda_ref(self.stream.device.index)
+            self._ev_start = torch.cuda.Event(enable_timing=True)
+            self._ev_start.record(self.stream)
+        self._t_start = time.monotonic_ns()
+        return self
+
+    def __exit__(self, *args):
+        t_end = time.monotonic_ns()
+        ev_end = None
+        if self.stream is not None:
+            ev_end = torch.cuda.Event(enable_timing=True)
+            ev_end.record(self.stream)
+        if torch.cuda.is_available():
+            torch.cuda.nvtx.range_pop()
+        _thread_buffer().append(
+            (
+                self.name,
+                threading.current_thread().name,
+                self._t_start,
+                t_end,
+                self.stream,
+                self._ev_start,
+                ev_end,
+                self.nbytes,
+                self.flops,
+            )
+        )
+        return False
+
+
+def trace_range(
+    name: str,
+    stream: Optional[torch.cuda.Stream] = None,
+    device: Optional[torch.device] = None,
+    nbytes: float = 0,
+    flops: float = 0,
+):
+    """A context manager which traces the enclosed stage, if tracing is enabled.
+
+    Parameters
+    ----------
+    name
+        Name of the stage (e.g. ``"mmv.h2d"``).
+    stream
+        The CUDA stream on which the stage runs. If None and `device` is a CUDA device, the
+        current stream of `device` is used. Stages without a stream are only timed on the host.
+    device
+        The device on which the stage runs.
+    nbytes
+        Number of bytes moved by the stage.
+    flops
+        Number of floating point operations of the stage.
+    """
+    if not _enabled:
+        return _NULL_RANGE
+    if torch.cuda.is_available() and torch.cuda.is_current_stream_capturing():
+        # CUDA events cannot be recorded while capturing a CUDA graph, and host times are meaningless.
+        return _NULL_RANGE
+    if stream is None and device is not None and device.type == "cuda":
+        stream = torch.cuda.current_stream(device)
+    return _Range(name, stream, nbytes, flops)
+
+
+def collect() -> List[Dict[str, Any]]:
+    """Remove all recorded events from the buffers, and return them.
+
+    Should be called when no traced operation is running. Waits for the CUDA events of the ranges
+    to complete. Each event is a dictionary with its `name`, the `device` (``"host"`` or
+    ``"cuda:<i>"``) and `track` (thread or stream) where it ran, its `start` and `end` times
+    (in nanoseconds of the monotonic clock), and its `bytes` and `flops`.
+    """
+    with _registry_lock:
+        raw = []
+        for buf in _buffers:
+            raw.extend(buf)
+            buf.clear()
+    events = []
+    for name, thread, t_start, t_end, stream, ev_start, ev_end, nbytes, flops in raw:
+        if stream is None:
+            device, track, start, end = "host", thread, t_start, t_end
+        else:
+            ev_end.synchronize()
+            ref_ev, ref_ns = _cuda_refs[stream.device.index]
+            device, track = str(stream.device), "stream %d" % (stream.stream_id,)
+            start = ref_ns + int(ref_ev.elapsed_time(ev_start) * 1e6)
+            end = ref_ns + int(ref_ev.elapsed_time(ev_end) * 1e6)
+        events.append(
+            {
+                "name": name,
+                "device": device,
+                "track": track,
+                "start": start,
+                "end": end,
+                "bytes": nbytes,
+                "flops": flops,
+            }
+        )
+    events.extend(_collect_native())
+    events.sort(key=lambda e: e["start"])
+    return events
+
+
+def _collect_native() -> List[Dict[str, Any]]:
+    try:
+        from falkon import c_ext
+
+        names, tracks, times, work = c_ext.trace_collect()
+    except (ImportError, RuntimeError):
+        return []
+    events = []
+    for i, name in enumerate(names):
+        device, track = int(tracks[i, 0]), int(tracks[i, 1])
+        events.append(
+            {
+                "name": name,
+                "device": "host" if device < 0 else "cuda:%d" % (device,),
+                "track": "native %d" % (track,) if device < 0 else "stream %d" % (track,),
+                "start": int(times[i, 0]),
+                "end": int(times[i, 1]),
+                "bytes": float(work[i, 0]),
+                "flops": float(work[i, 1]),
+            }
+        )
+    return events
+
+
+def export_chrome_trace(path: Union[str, os.PathLike], events: Optional[List[Dict[str, Any]]] = None):
+    """Write the events (by default, the result of :func:`collect`) as a Chrome / Perfetto trace."""
+    if events is None:
+        events = collect()
+    pids: Dict[str, int] = {}
+    tids: Dict[tuple, int] = {}
+    trace = []
+    for ev in events:
+        pid = pids.setdefault(ev["device"], len(pids))
+        tid = tids.setdefault((ev["device"], ev["track"]), len(tids))
+        trace.append(
+            {
+                "name": ev["name"],
+                "ph": "X",
+                "pid": pid,
+                "tid": tid,
+                "ts": ev["start"] / 1e3,
+                "dur": (ev["end"] - ev["start"]) / 1e3,
+                "args": {"bytes": ev["bytes"], "flops": ev["flops"]},
+            }
+        )
+    for device, pid in pids.items():
+        trace.append({"name": "process_name", "ph": "M", "pid": pid, "args": {"name": device}})
+    for (device, track), tid in tids.items():
+        trace.append({"name": "thread_name", "ph": "M", "pid": pids[device], "tid": tid, "args": {"name": track}})
+    with open(path, "w") as fh:
+        json.dump({"traceEvents": trace, "displayTimeUnit": "ms"}, fh)
+
+
+def _union_length(intervals: List[tuple]) -> int:
+    total, cur_start, cur_end = 0, None, None
+    for start, end in sorted(intervals):
+        if cur_end is None or start > cur_end:
+            if cur_end is not None:
+                total += cur_end - cur_start
+            cur_start, cur_end = start, end
+        else:
+            cur_end = max(cur_end, end)
+    if cur_end is not None:
+        total += cur_end - cur_start
+    return total
+
+
+def summary(events: List[Dict[str, Any]]) -> Dict[str, Dict[str, Any]]:
+    """Summary counters of the trace `events` (see :func:`collect`).
+
+    Returns
+    -------
+    summary
+        ``summary["ranges"]`` maps each range name to its number of calls, total time (ms), bytes
+        and FLOPs. ``summary["devices"]`` maps each CUDA device to the time during which it ran
+        at least one traced range (``busy_ms``), the time between its first and last events
+        (``span_ms``), and their ratio in percent (``busy_pct``).
+    """
+    ranges = defaultdict(lambda: {"count": 0, "time_ms": 0.0, "bytes": 0.0, "flops": 0.0})
+    intervals = defaultdict(list)
+    for ev in events:
+        r = ranges[ev["name"]]
+        r["count"] += 1
+        r["time_ms"] += (ev["end"] - ev["start"]) / 1e6
+        r["bytes"] += ev["bytes"]
+        r["flops"] += ev["flops"]
+        if ev["device"] != "host":
+            intervals[ev["device"]].append((ev["start"], ev["end"]))
+    devices = {}
+    for device, ivs in intervals.items():
+        busy = _union_length(ivs) / 1e6
+        span = (max(e for _, e in ivs) - min(s for s, _ in ivs)) / 1e6
+        devices[device] = {"busy_ms": busy, "span_ms": span, "busy_pct": 100 * busy / span if span > 0 else 100.0}
+    return {"ranges": dict(ranges), "devices": devices}
+
+
+if os.environ.get("FALKON_TRACE", "0") == "1":
+    enable()
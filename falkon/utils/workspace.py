@@ -0,0 +1,149 @@
+"""Process-wide workspace arena for the GPU buffers of the blockwise operations.
+
+Each call to the blockwise kernel operations (``fmm``, ``fmmv``, ``fdmmv`` and their sparse
+variants) allocates one flat buffer on every GPU it runs on, and slices it into the blocks it
+needs. Conjugate gradient calls them at every iteration with the same shapes. With the arena
+switched on (with :func:`enable`, or by setting the ``FALKON_WORKSPACE=1`` environment variable)
+the buffers are borrowed from slabs owned by falkon instead: repeated calls reuse the same
+memory, and long-lived processes which mix fits and predictions do not fragment the PyTorch
+allocator. When the arena is off, :func:`borrow` simply allocates a new tensor.
+
+The slabs of a device are shared by all streams. A slab is lent to a single operation at a
+time. When it is returned, an event is recorded on the stream of the operation, and the next
+borrower makes its own stream wait on that event, so the two uses of the memory never overlap
+on the device. The slabs which are not lent are counted as free memory by
+:func:`falkon.utils.devices.get_device_info`, so that the block sizes are not reduced by the
+arena. The arena is filled by the first calls (e.g. the first iteration of a fit), which
+allocate the slabs that the following calls reuse, and :func:`clear` releases the idle slabs.
+"""
+import os
+import threading
+from collections import defaultdict
+from contextlib import contextmanager
+from typing import Dict, List, Optional, Union
+
+import torch
+
+__all__ = ("enable", "disable", "is_enabled", "borrow", "clear", "idle_bytes")
+
+_enabled = False
+_lock = threading.Lock()
+_slabs: Dict[int, List["_Slab"]] = defaultdict(list)
+
+
+class _Slab:
+    __slots__ = ("buf", "event", "busy")
+
+    def __init__(self, nbytes: int, device: torch.device):
+        # Slabs outlive the (inference mode) operation which allocated them.
+        with torch.inference_mode(False):
+            self.buf = torch.empty(nbytes, dtype=torch.uint8, device=device)
+        # Event recorded on the stream of the last borrower, when the slab was returned.
+        self.event: Optional[torch.cuda.Event] = None
+        self.busy = False
+
+    @property
+    def nbytes(self) -> int:
+        return self.buf.numel()
+
+    def drop(self):
+        # The allocator may reuse the memory right away on the stream it was allocated on,
+        # so the last use (possibly on another stream) must have completed.
+        if self.event is not None:
+            self.event.synchronize()
+        self.buf = None
+
+
+def enable():
+    """Borrow the buffers of the blockwise operations from the workspace arena."""
+    global _enabled
+    _enabled = True
+
+
+def disable():
+    """Allocate new buffers at each call, and release the idle slabs of the arena."""
+    global _enabled
+    _enabled = False
+    clear()
+
+
+def is_enabled() -> bool:
+    return _enabled
+
+
+def _device_index(device: Union[torch.device, int]) -> int:
+    if isinstance(device, int):
+        return device
+    return device.index if device.index is not None else torch.cuda.current_device()
+
+
+def _take(nbytes: int, dev_idx: int) -> _Slab:
+    with _lock:
+        slabs = _slabs[dev_idx]
+        idle = [s for s in slabs if not s.busy]
+        fits = [s for s in idle if s.nbytes >= nbytes]
+        if len(fits) > 0:
+            slab = min(fits, key=lambda s: s.nbytes)
+        else:
+            # Grow the arena by replacing its largest idle slab (if any) with one which fits.
+            if len(idle) > 0:
+                largest = max(idle, key=lambda s: s.nbytes)
+                slabs.remove(largest)
+                largest.drop()
+            slab = _Slab(nbytes, torch.device("cuda", dev_idx))
+            slabs.append(slab)
+        slab.busy = True
+    return slab
+
+
+@contextmanager
+def borrow(numel: int, dtype: torch.dtype, device: torch.device):
+    """A context manager which lends a flat buffer of `numel` elements of type `dtype`.
+
+    The buffer is uninitialized. It must be borrowed while the stream which first uses it is the
+    current stream of `device`, and the context must be exited while the current stream is the
+    one which (after joining any other streams) last uses the buffer. If the arena is switched off,
+    `device` is not a GPU, or a CUDA graph is being captured, a new tensor is allocated instead.
+    """
+    if not _enabled or device.type != "cuda" or torch.cuda.is_current_stream_capturing():
+        yield torch.empty(numel, dtype=dtype, device=device)
+        return
+    dev_idx = _device_index(device)
+    nbytes = numel * torch.empty(0, dtype=dtype).element_size()
+    slab = _take(nbytes, dev_idx)
+    stream = torch.cuda.current_stream(dev_idx)
+    if slab.event is not None:
+        stream.wait_event(slab.event)
+    try:
+        yield slab.buf[:nbytes].view(dtype)
+    finally:
+        event = torch.cuda.Event()
+        event.record(torch.cuda.current_stream(dev_idx))
+        with _lock:
+            slab.event = event
+            slab.busy = False
+
+
+def clear(device: Optional[Union[torch.device, int]] = None):
+    """Release the idle slabs of `device` (or of all devices) to the PyTorch allocator.
+
+    The slabs which are lent to running operations are kept.
+    """
+    with _lock:
+        devices = list(_slabs.keys()) if device is None else [_device_index(device)]
+        for dev_idx in devices:
+            slabs = _slabs[dev_idx]
+            for slab in [s for s in slabs if not s.busy]:
+                slabs.remove(slab)
+                slab.drop()
+
+
+def idle_bytes(device: Union[torch.device, int]) -> int:
+    """Number of bytes of the slabs of `device` which are not lent to any operation."""
+    dev_idx = _device_index(device)
+    with _lock:
+        return sum(s.nbytes for s in _slabs.get(dev_idx, []) if not s.busy)
+
+
+if os.environ.get("FALKON_WORKSPACE", "0") == "1":
+    enable()